@@ -109,6 +109,9 @@ class Platform(object):
         return self._platform in ('freebsd', 'linux', 'openbsd', 'bitrig',
                                   'dragonfly')
 
+    def supports_epoll(self):
+        return self._platform == 'linux'
+
     def supports_ninja_browse(self):
         return (not self.is_windows()
                 and not self.is_solaris()
@@ -221,7 +224,7 @@ parser.add_option('--with-python', metavar='EXE',
                   help='use EXE as the Python interpreter',
                   default=os.path.basename(sys.executable))
 parser.add_option('--force-pselect', action='store_true',
-                  help='ppoll() is used by default where available, '
+                  help='epoll or ppoll() is used by default where available, '
                        'but some platforms may need to use pselect instead',)
 (options, args) = parser.parse_args()
 if args:
@@ -358,6 +361,10 @@ else:
     if platform.is_mingw():
         cflags += ['-D_WIN32_WINNT=0x0601', '-D__USE_MINGW_ANSI_STDIO=1']
     ldflags = ['-L$builddir']
+    if not platform.is_windows():
+        # DiskInterface::StatMany() stats in parallel.
+        cflags.append('-pthread')
+        ldflags.append('-pthread')
     if platform.uses_usr_local():
         cflags.append('-I/usr/local/include')
         ldflags.append('-L/usr/local/lib')
@@ -388,6 +395,8 @@ else:
 
 if platform.supports_ppoll() and not options.force_pselect:
     cflags.append('-DUSE_PPOLL')
+if platform.supports_epoll() and not options.force_pselect:
+    cflags.append('-DUSE_EPOLL')
 if platform.supports_ninja_browse():
     cflags.append('-DNINJA_HAVE_BROWSE')
 
@@ -493,13 +502,17 @@ n.comment('Core source files all build into ninja library.')
 cxxvariables = []
 if platform.is_msvc():
     cxxvariables = [('pdb', 'ninja.pdb')]
-for name in ['build',
+for name in ['action_cache',
+             'arena',
+             'build',
              'build_log',
+             'cgroup',
              'clean',
              'clparser',
              'debug_flags',
              'depfile_parser',
              'deps_log',
+             'deps_reader',
              'disk_interface',
              'dyndep',
              'dyndep_parser',
@@ -507,13 +520,20 @@ for name in ['build',
              'eval_env',
              'graph',
              'graphviz',
+             'jobserver',
              'lexer',
              'line_printer',
+             'manifest_cache',
              'manifest_parser',
+             'mapped_file',
              'metrics',
              'parser',
+             'pressure',
+             'sha256',
              'state',
              'string_piece_util',
+             'string_pool',
+             'trace',
              'util',
              'version']:
     objs += cxx(name, variables=cxxvariables)
@@ -527,7 +547,10 @@ if platform.is_windows():
         objs += cxx('minidump-win32', variables=cxxvariables)
     objs += cc('getopt')
 else:
+    objs += cxx('http_cache')
     objs += cxx('subprocess-posix')
+if platform.is_linux():
+    objs += cxx('serve')
 if platform.is_aix():
     objs += cc('getopt')
 if platform.is_msvc():
@@ -565,28 +588,39 @@ objs = []
 if platform.is_msvc():
     cxxvariables = [('pdb', 'ninja_test.pdb')]
 
-for name in ['build_log_test',
+for name in ['action_cache_test',
+             'build_log_test',
              'build_test',
+             'cgroup_test',
              'clean_test',
              'clparser_test',
              'depfile_parser_test',
              'deps_log_test',
+             'deps_reader_test',
              'dyndep_parser_test',
              'disk_interface_test',
              'edit_distance_test',
              'graph_test',
+             'jobserver_test',
              'lexer_test',
+             'manifest_cache_test',
              'manifest_parser_test',
              'ninja_test',
+             'pressure_test',
+             'sha256_test',
              'state_test',
              'string_piece_util_test',
+             'string_pool_test',
              'subprocess_test',
+             'trace_test',
              'test',
              'util_test']:
     objs += cxx(name, variables=cxxvariables)
 if platform.is_windows():
     for name in ['includes_normalize_test', 'msvc_helper_test']:
         objs += cxx(name, variables=cxxvariables)
+if platform.is_linux():
+    objs += cxx('serve_test', variables=cxxvariables)
 
 ninja_test = n.build(binary('ninja_test'), 'link', objs, implicit=ninja_lib,
                      variables=[('libs', libs)])
@@ -597,8 +631,10 @@ all_targets += ninja_test
 n.comment('Ancillary executables.')
 
 for name in ['build_log_perftest',
+             'build_perftest',
              'canon_perftest',
              'depfile_parser_perftest',
+             'deps_log_perftest',
              'hash_collision_bench',
              'manifest_parser_perftest',
              'clparser_perftest']:
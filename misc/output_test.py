@@ -5,11 +5,14 @@
 In order to simulate a smart terminal it uses the 'script' command.
 """
 
+import http.server
 import os
 import platform
 import subprocess
 import sys
 import tempfile
+import threading
+import time
 import unittest
 
 default_env = dict(os.environ)
@@ -107,5 +110,106 @@ red
         self.assertEqual(run('', flags='-t recompact'), '')
         self.assertEqual(run('', flags='-t restat'), '')
 
+    def test_http_action_cache(self):
+        # A build in another directory restores the output from the server
+        # instead of running the command again.
+        entries = {}
+
+        class Handler(http.server.BaseHTTPRequestHandler):
+            protocol_version = 'HTTP/1.1'
+
+            def log_message(self, *args):
+                pass
+
+            def do_HEAD(self):
+                found = self.path in entries
+                self.send_response(200 if found else 404)
+                self.send_header('Content-Length',
+                                 len(entries[self.path]) if found else 0)
+                self.end_headers()
+
+            def do_GET(self):
+                data = entries.get(self.path)
+                self.send_response(404 if data is None else 200)
+                self.send_header('Content-Length', len(data or b''))
+                self.end_headers()
+                self.wfile.write(data or b'')
+
+            def do_PUT(self):
+                size = int(self.headers['Content-Length'])
+                entries[self.path] = self.rfile.read(size)
+                self.send_response(201)
+                self.send_header('Content-Length', 0)
+                self.end_headers()
+
+        server = http.server.ThreadingHTTPServer(('127.0.0.1', 0), Handler)
+        thread = threading.Thread(target=server.serve_forever)
+        thread.start()
+        try:
+            with tempfile.TemporaryDirectory() as d:
+                runs = os.path.join(d, 'runs')
+                build_ninja = '''
+rule copy
+  command = cp $in $out && echo ran >> {}
+build out: copy build.ninja
+'''.format(runs)
+                env = dict(default_env)
+                env['NINJA_ACTION_CACHE'] = 'http://127.0.0.1:{}/'.format(
+                    server.server_address[1])
+                run(build_ninja, pipe=True, env=env)
+                run(build_ninja, pipe=True, env=env)
+                with open(runs) as f:
+                    self.assertEqual(f.read(), 'ran\n')
+        finally:
+            server.shutdown()
+            server.server_close()
+            thread.join()
+
+    @unittest.skipUnless(platform.system() == 'Linux', 'needs inotify')
+    def test_serve(self):
+        # A client build is run by the server, which only reruns the edge
+        # of the source file touched between builds.
+        build_ninja = '''
+rule copy
+  command = cp $in $out && echo $out $$NINJA_SERVE_BUILD $$CLIENT >> runs
+build a.out: copy a.in
+build b.out: copy b.in
+'''
+        with tempfile.TemporaryDirectory() as d:
+            os.chdir(d)
+            for name, contents in [('build.ninja', build_ninja),
+                                   ('a.in', 'a'), ('b.in', 'b')]:
+                with open(name, 'w') as f:
+                    f.write(contents)
+            server = subprocess.Popen([NINJA_PATH, '-t', 'serve'],
+                                      stdout=subprocess.PIPE, env=default_env)
+            try:
+                self.assertEqual(server.stdout.readline(),
+                                 b"ninja: serving builds of 'build.ninja'\n")
+                # Commands run with the environment of the client.
+                client_env = dict(default_env, CLIENT='first')
+                subprocess.check_output([NINJA_PATH, '-j1'], env=client_env)
+                with open('runs') as f:
+                    self.assertEqual(sorted(f.read().splitlines()),
+                                     ['a.out 1 first', 'b.out 1 first'])
+
+                # Make a.in newer than a.out, even with coarse timestamps.
+                time.sleep(0.1)
+                os.utime('a.in')
+                client_env['CLIENT'] = 'second'
+                subprocess.check_output([NINJA_PATH, '-j1'], env=client_env)
+                with open('runs') as f:
+                    self.assertEqual(f.read().splitlines()[2:],
+                                     ['a.out 1 second'])
+
+                self.assertEqual(
+                    subprocess.check_output([NINJA_PATH], env=default_env),
+                    b'ninja: no work to do.\n')
+                self.assertIsNone(server.poll())
+            finally:
+                server.terminate()
+                server.wait()
+                server.stdout.close()
+
 if __name__ == '__main__':
     unittest.main()
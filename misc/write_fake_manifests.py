@@ -65,7 +65,7 @@ class GenRandom(object):
     def _n_unique_strings(self, n):
         seen = set([None])
         return [self._unique_string(seen, avg_options=3, p_suffix=0.4)
-                for _ in xrange(n)]
+                for _ in range(n)]
 
     def target_name(self):
         return self._unique_string(p_suffix=0, seen=self.seen_names)
@@ -73,7 +73,7 @@ class GenRandom(object):
     def path(self):
         return os.path.sep.join([
             self._unique_string(self.seen_names, avg_options=1, p_suffix=0)
-            for _ in xrange(1 + paretoint(0.6, alpha=4))])
+            for _ in range(1 + paretoint(0.6, alpha=4))])
 
     def src_obj_pairs(self, path, name):
         num_sources = paretoint(55, alpha=2) + 1
@@ -84,7 +84,7 @@ class GenRandom(object):
     def defines(self):
         return [
             '-DENABLE_' + self._unique_string(self.seen_defines).upper()
-            for _ in xrange(paretoint(20, alpha=3))]
+            for _ in range(paretoint(20, alpha=3))]
 
 
 LIB, EXE = 0, 1
@@ -105,7 +105,7 @@ class Target(object):
         self.has_compile_depends = random.random() < 0.4
 
 
-def write_target_ninja(ninja, target, src_dir):
+def write_target_ninja(ninja, target, src_dir, edge_variables):
     compile_depends = None
     if target.has_compile_depends:
       compile_depends = os.path.join(
@@ -113,13 +113,21 @@ def write_target_ninja(ninja, target, src_dir):
       ninja.build(compile_depends, 'stamp', target.src_obj_pairs[0][0])
       ninja.newline()
 
-    ninja.variable('defines', target.defines)
-    ninja.variable('includes', '-I' + src_dir)
-    ninja.variable('cflags', ['-Wall', '-fno-rtti', '-fno-exceptions'])
-    ninja.newline()
+    compile_variables = [
+        ('defines', target.defines),
+        ('includes', '-I' + src_dir),
+        ('cflags', ['-Wall', '-fno-rtti', '-fno-exceptions']),
+    ]
+    # Some generators repeat the same variables on every compile edge
+    # instead of setting them once for the file.
+    if not edge_variables:
+        for key, value in compile_variables:
+            ninja.variable(key, value)
+        ninja.newline()
 
     for src, obj in target.src_obj_pairs:
-        ninja.build(obj, 'cxx', src, implicit=compile_depends)
+        ninja.build(obj, 'cxx', src, implicit=compile_depends,
+                    variables=compile_variables if edge_variables else None)
     ninja.newline()
 
     deps = [dep.output for dep in target.deps]
@@ -227,7 +235,7 @@ def random_targets(num_targets, src_dir):
     gen = GenRandom(src_dir)
 
     # N-1 static libraries, and 1 executable depending on all of them.
-    targets = [Target(gen, LIB) for i in xrange(num_targets - 1)]
+    targets = [Target(gen, LIB) for i in range(num_targets - 1)]
     for i in range(len(targets)):
         targets[i].deps = [t for t in targets[0:i] if random.random() < 0.05]
 
@@ -246,6 +254,8 @@ def main():
                         help='number of targets (default: 1500)')
     parser.add_argument('-S', '--seed', type=int, help='random seed',
                         default=12345)
+    parser.add_argument('-e', '--edge-variables', action='store_true',
+                        help='set compile flags on each edge, not per file')
     parser.add_argument('outdir', help='output directory')
     args = parser.parse_args()
     root_dir = args.outdir
@@ -258,7 +268,7 @@ def main():
     targets = random_targets(args.targets, src_dir)
     for target in targets:
         with FileWriter(os.path.join(root_dir, target.ninja_file_path)) as n:
-            write_target_ninja(n, target, src_dir)
+            write_target_ninja(n, target, src_dir, args.edge_variables)
 
         if do_write_sources:
             write_sources(target, root_dir)
@@ -0,0 +1,577 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#include <algorithm>
+
+#include "graph.h"
+#include "metrics.h"
+#include "sha256.h"
+#include "trace.h"
+#ifndef _WIN32
+#include "http_cache.h"
+#endif
+
+// A record is a sequence of fields, each of which is its size in decimal,
+// a colon, its bytes and a newline.  The record of the sets of inputs of a
+// command has:
+//    its signature and the command
+//    the number of files the command writes, and their paths
+//    the number of sets of inputs, most recently used first, and for each
+//      the number of inputs, and their paths.
+// The record of a command run on one set of inputs has:
+//    its signature
+//    the command, the digest of its inputs and the text it printed
+//    the number of files it wrote
+//    for each file, its path, the digest and size of its contents, and "x"
+//      if it is executable or "-" if not.
+// Digests are SHA-256, in hex, so that nobody writing to a shared cache
+// can make other contents or other inputs have a digest they expect.
+
+namespace {
+
+const char kInputsSignature[] = "ninja inputs v1";
+const char kResultSignature[] = "ninja action v2";
+
+/// The most sets of inputs kept for a command.
+const size_t kMaxInputSets = 16;
+
+string Decimal(uint64_t value) {
+  char buf[21];
+  char* p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  do {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+  } while (value);
+  return p;
+}
+
+bool ParseNumber(const string& text, uint64_t* value) {
+  if (text.empty() || text.size() > 20)
+    return false;
+  *value = 0;
+  for (size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if (c < '0' || c > '9')
+      return false;
+    *value = *value * 10 + (c - '0');
+  }
+  return true;
+}
+
+bool IsHexDigest(const string& text) {
+  if (text.size() != 2 * Sha256::kDigestSize)
+    return false;
+  for (size_t i = 0; i < text.size(); ++i) {
+    char c = text[i];
+    if ((c < '0' || c > '9') && (c < 'a' || c > 'f'))
+      return false;
+  }
+  return true;
+}
+
+void AppendField(string* record, const string& field) {
+  record->append(Decimal(field.size()));
+  record->push_back(':');
+  record->append(field);
+  record->push_back('\n');
+}
+
+/// Read the field at |*pos| in |record| into |field|, and move |*pos| past
+/// it.
+bool ReadField(const string& record, size_t* pos, string* field) {
+  size_t colon = record.find(':', *pos);
+  uint64_t size;
+  if (colon == string::npos ||
+      !ParseNumber(record.substr(*pos, colon - *pos), &size) ||
+      record.size() - colon - 1 <= size || record[colon + 1 + size] != '\n')
+    return false;
+  field->assign(record, colon + 1, size);
+  *pos = colon + 2 + size;
+  return true;
+}
+
+void AppendFields(string* record, const vector<string>& fields) {
+  AppendField(record, Decimal(fields.size()));
+  for (vector<string>::const_iterator f = fields.begin(); f != fields.end();
+       ++f) {
+    AppendField(record, *f);
+  }
+}
+
+/// Read a number of fields at |*pos| in |record|, and then that many
+/// fields into |fields|.
+bool ReadFields(const string& record, size_t* pos, vector<string>* fields) {
+  string field;
+  uint64_t count;
+  if (!ReadField(record, pos, &field) || !ParseNumber(field, &count) ||
+      count > record.size())
+    return false;
+  fields->resize((size_t)count);
+  for (size_t i = 0; i < fields->size(); ++i) {
+    if (!ReadField(record, pos, &(*fields)[i]))
+      return false;
+  }
+  return true;
+}
+
+/// The files |edge| writes: its outputs, and its depfile if it has one.
+vector<string> FilesOf(const Edge* edge) {
+  vector<string> files;
+  for (vector<Node*>::const_iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    files.push_back((*o)->path());
+  }
+  string depfile = edge->GetUnescapedDepfile();
+  if (!depfile.empty())
+    files.push_back(depfile);
+  return files;
+}
+
+/// The hex SHA-256 digest of |data|.
+string HexDigest(const string& data) {
+  return Sha256::Hex(Sha256::Hash(data));
+}
+
+/// The key of an entry of |kind| named by the hex digest |digest|.  Entries
+/// are spread over 256 directories, named by the first two digits.
+string HashKey(const char* kind, const string& digest) {
+  return string(kind) + "/" + digest.substr(0, 2) + "/" + digest;
+}
+
+/// The key of the record of the sets of inputs of |edge| running |command|.
+string InputsKey(const Edge* edge, const string& command) {
+  string key = command;
+  vector<string> files = FilesOf(edge);
+  for (vector<string>::iterator f = files.begin(); f != files.end(); ++f) {
+    key.push_back('\0');
+    key.append(*f);
+  }
+  return HashKey("ac", HexDigest(key));
+}
+
+/// The key of the record of the command whose sets of inputs are at
+/// |inputs_key| running on inputs with the hex digest |input_digest|.
+string ResultKey(const string& inputs_key, const string& input_digest) {
+  return HashKey("ac", HexDigest(inputs_key + '\0' + input_digest));
+}
+
+/// The key of the contents with the hex digest |digest| and |size|.
+string ContentsKey(const string& digest, size_t size) {
+  return HashKey("cas", digest) + "-" + Decimal(size);
+}
+
+}  // anonymous namespace
+
+ActionCache::ActionCache(Backend* backend, DependencyScan* scan,
+                         DiskInterface* disk_interface, bool background)
+    : backend_(backend), scan_(scan), disk_interface_(disk_interface),
+      store_error_reported_(false)
+#if __cplusplus >= 201103L
+      , background_(background), storing_(false), done_(false)
+#endif
+      {}
+
+ActionCache::~ActionCache() {
+#if __cplusplus >= 201103L
+  {
+    lock_guard<mutex> lock(mutex_);
+    done_ = true;
+  }
+  work_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+#endif
+  delete backend_;
+}
+
+ActionCache::Backend* ActionCache::OpenBackend(const string& location,
+                                               DiskInterface* disk_interface,
+                                               string* err) {
+  if (location.compare(0, 7, "http://") == 0) {
+#ifndef _WIN32
+    return HttpBackend::Open(location, err);
+#else
+    *err = "http action caches are not supported on this platform";
+    return NULL;
+#endif
+  }
+  if (location.find("://") != string::npos) {
+    *err = "unsupported action cache '" + location + "'";
+    return NULL;
+  }
+  return new DirectoryBackend(location, disk_interface);
+}
+
+bool ActionCache::Restore(const Edge* edge, const string& command,
+                          string* output, string* err) {
+  METRIC_RECORD("action cache lookup");
+  TRACE_RECORD("action cache lookup");
+  string inputs_key = InputsKey(edge, command);
+  vector<vector<string> >& sets = input_sets_[inputs_key];
+  if (!ReadInputSets(edge, command, inputs_key, &sets, err))
+    return false;
+
+  // Any set of inputs the command ran with will do, provided that they all
+  // have the contents they had then.
+  for (vector<vector<string> >::iterator s = sets.begin(); s != sets.end();
+       ++s) {
+    string input_digest;
+    string hash_err;
+    if (!scan_->HashPaths(*s, &input_digest, NULL, &hash_err))
+      continue;
+    input_digest = Sha256::Hex(input_digest);
+    if (RestoreResult(edge, command, ResultKey(inputs_key, input_digest),
+                      input_digest, output, err)) {
+      input_sets_.erase(inputs_key);
+      return true;
+    }
+    if (!err->empty())
+      return false;
+  }
+  return false;
+}
+
+bool ActionCache::ReadInputSets(const Edge* edge, const string& command,
+                                const string& inputs_key,
+                                vector<vector<string> >* sets, string* err) {
+  sets->clear();
+  string record;
+  switch (backend_->Get(inputs_key, &record, err)) {
+  case FileReader::Okay:
+    break;
+  case FileReader::NotFound:
+    err->clear();
+    return false;
+  default:
+    return false;
+  }
+
+  size_t pos = 0;
+  string field;
+  vector<string> files;
+  uint64_t count;
+  if (!ReadField(record, &pos, &field) || field != kInputsSignature ||
+      !ReadField(record, &pos, &field) || field != command ||
+      !ReadFields(record, &pos, &files) || files != FilesOf(edge) ||
+      !ReadField(record, &pos, &field) || !ParseNumber(field, &count) ||
+      count > kMaxInputSets)
+    return false;
+  sets->resize((size_t)count);
+  for (size_t i = 0; i < sets->size(); ++i) {
+    if (!ReadFields(record, &pos, &(*sets)[i])) {
+      sets->clear();
+      return false;
+    }
+  }
+  if (pos != record.size()) {
+    sets->clear();
+    return false;
+  }
+  return true;
+}
+
+bool ActionCache::RestoreResult(const Edge* edge, const string& command,
+                                const string& result_key,
+                                const string& input_digest, string* output,
+                                string* err) {
+  string record;
+  switch (backend_->Get(result_key, &record, err)) {
+  case FileReader::Okay:
+    break;
+  case FileReader::NotFound:
+    err->clear();
+    return false;
+  default:
+    return false;
+  }
+
+  vector<string> paths = FilesOf(edge);
+  size_t pos = 0;
+  string field;
+  if (!ReadField(record, &pos, &field) || field != kResultSignature ||
+      !ReadField(record, &pos, &field) || field != command ||
+      !ReadField(record, &pos, &field) || field != input_digest ||
+      !ReadField(record, &pos, output) ||
+      !ReadField(record, &pos, &field) || field != Decimal(paths.size()))
+    return false;
+
+  vector<File> files(paths.size());
+  vector<string> contents(paths.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    File* file = &files[i];
+    string size, mode;
+    uint64_t size_value;
+    if (!ReadField(record, &pos, &file->path) || file->path != paths[i] ||
+        !ReadField(record, &pos, &file->digest) ||
+        !IsHexDigest(file->digest) ||
+        !ReadField(record, &pos, &size) ||
+        !ParseNumber(size, &size_value) ||
+        !ReadField(record, &pos, &mode))
+      return false;
+    file->size = (size_t)size_value;
+    file->executable = mode == "x";
+
+    string key = ContentsKey(file->digest, file->size);
+    string read_err;
+    FileReader::Status status = backend_->Get(key, &contents[i], &read_err);
+    if (status != FileReader::Okay || contents[i].size() != file->size ||
+        HexDigest(contents[i]) != file->digest) {
+      if (status == FileReader::Okay) {
+#if __cplusplus >= 201103L
+        lock_guard<mutex> lock(mutex_);
+#endif
+        damaged_.insert(key);
+      }
+      return false;
+    }
+  }
+  if (pos != record.size())
+    return false;
+
+  // Only restat rules can tell outputs that didn't change from stale ones.
+  return WriteFiles(files, contents, !edge->GetBindingBool("restat"), err);
+}
+
+bool ActionCache::WriteFiles(const vector<File>& files,
+                             const vector<string>& contents,
+                             bool touch_unchanged, string* err) {
+  METRIC_RECORD("action cache restore");
+  TRACE_RECORD("action cache restore");
+  for (size_t i = 0; i < files.size(); ++i) {
+    const string& path = files[i].path;
+    // Files that are already right are left alone, so that restat rules
+    // can tell that they didn't change.
+    string current;
+    string read_err;
+    if (disk_interface_->ReadFile(path, &current, &read_err) ==
+        DiskInterface::Okay) {
+      if (current == contents[i] &&
+          disk_interface_->IsExecutable(path) == files[i].executable) {
+        if (touch_unchanged && !disk_interface_->Touch(path)) {
+          *err = "can't restore " + path;
+          return false;
+        }
+        continue;
+      }
+      // Replace the file rather than truncating it, which some filesystems
+      // make wait for its old contents to be written out, and which would
+      // fail on executables that are running.
+      disk_interface_->RemoveFile(path);
+    }
+    if (!disk_interface_->MakeDirs(path) ||
+        !disk_interface_->WriteFile(path, contents[i]) ||
+        (files[i].executable && !disk_interface_->MakeExecutable(path))) {
+      *err = "can't restore " + path;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ActionCache::Store(const Edge* edge, const string& command,
+                        const vector<string>& inputs,
+                        const string& input_digest, const string& output,
+                        string* err) {
+  METRIC_RECORD("action cache store");
+  TRACE_RECORD("action cache store");
+  StoreRequest* request = new StoreRequest;
+  request->command = command;
+  request->paths = FilesOf(edge);
+  request->has_depfile = !edge->GetUnescapedDepfile().empty();
+  if (request->has_depfile) {
+    switch (disk_interface_->ReadFile(request->paths.back(),
+                                      &request->depfile, err)) {
+    case DiskInterface::Okay:
+      break;
+    case DiskInterface::NotFound:
+      err->clear();
+      delete request;
+      return true;
+    default:
+      delete request;
+      return false;
+    }
+  }
+  request->inputs = inputs;
+  request->input_digest = Sha256::Hex(input_digest);
+  request->output = output;
+  request->inputs_key = InputsKey(edge, command);
+  map<string, vector<vector<string> > >::iterator known =
+      input_sets_.find(request->inputs_key);
+  if (known != input_sets_.end()) {
+    request->sets.swap(known->second);
+    input_sets_.erase(known);
+  }
+
+#if __cplusplus >= 201103L
+  if (background_) {
+    lock_guard<mutex> lock(mutex_);
+    if (!store_error_.empty()) {
+      delete request;
+      return true;
+    }
+    pending_.push_back(request);
+    if (!thread_.joinable())
+      thread_ = thread(&ActionCache::Work, this);
+    work_.notify_one();
+    return true;
+  }
+#endif
+  bool stored = StoreFiles(request, err);
+  delete request;
+  return stored;
+}
+
+bool ActionCache::StoreFiles(StoreRequest* request, string* err) {
+  string record;
+  AppendField(&record, kResultSignature);
+  AppendField(&record, request->command);
+  AppendField(&record, request->input_digest);
+  AppendField(&record, request->output);
+  AppendField(&record, Decimal(request->paths.size()));
+  for (vector<string>::iterator p = request->paths.begin();
+       p != request->paths.end(); ++p) {
+    string contents;
+    if (request->has_depfile && p + 1 == request->paths.end()) {
+      contents.swap(request->depfile);
+    } else {
+      switch (disk_interface_->ReadFile(*p, &contents, err)) {
+      case DiskInterface::Okay:
+        break;
+      case DiskInterface::NotFound:
+        // The builder checked that it was there before storing.
+        *err = "can't store " + *p + ": it was removed";
+        return false;
+      default:
+        return false;
+      }
+    }
+
+    string digest = HexDigest(contents);
+    string key = ContentsKey(digest, contents.size());
+    bool damaged;
+    {
+#if __cplusplus >= 201103L
+      lock_guard<mutex> lock(mutex_);
+#endif
+      damaged = damaged_.erase(key) > 0;
+    }
+    if (!backend_->Put(key, contents, damaged, err))
+      return false;
+
+    AppendField(&record, *p);
+    AppendField(&record, digest);
+    AppendField(&record, Decimal(contents.size()));
+    AppendField(&record, disk_interface_->IsExecutable(*p) ? "x" : "-");
+  }
+  if (!backend_->Put(ResultKey(request->inputs_key, request->input_digest),
+                     record, true, err))
+    return false;
+
+  // The record of the sets of inputs is written last, so that the records
+  // and contents it leads to are there when it is read.  The latest set
+  // goes first, to be tried first.
+  vector<vector<string> >& sets = request->sets;
+  vector<vector<string> >::iterator same =
+      find(sets.begin(), sets.end(), request->inputs);
+  if (same != sets.end())
+    sets.erase(same);
+  sets.insert(sets.begin(), request->inputs);
+  if (sets.size() > kMaxInputSets)
+    sets.resize(kMaxInputSets);
+  record.clear();
+  AppendField(&record, kInputsSignature);
+  AppendField(&record, request->command);
+  AppendFields(&record, request->paths);
+  AppendField(&record, Decimal(sets.size()));
+  for (vector<vector<string> >::iterator s = sets.begin(); s != sets.end();
+       ++s) {
+    AppendFields(&record, *s);
+  }
+  return backend_->Put(request->inputs_key, record, true, err);
+}
+
+bool ActionCache::Flush(string* err) {
+#if __cplusplus >= 201103L
+  {
+    unique_lock<mutex> lock(mutex_);
+    while (!pending_.empty() || storing_)
+      stored_.wait(lock);
+  }
+#endif
+  if (!store_error_.empty() && !store_error_reported_) {
+    // Say so once.
+    store_error_reported_ = true;
+    *err = store_error_;
+    return false;
+  }
+  return backend_->Flush(err);
+}
+
+#if __cplusplus >= 201103L
+void ActionCache::Work() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    while (pending_.empty() && !done_)
+      work_.wait(lock);
+    if (pending_.empty())
+      return;
+    StoreRequest* request = pending_.front();
+    pending_.pop_front();
+    storing_ = true;
+    lock.unlock();
+    string err;
+    bool stored = StoreFiles(request, &err);
+    delete request;
+    lock.lock();
+    storing_ = false;
+    if (!stored && store_error_.empty()) {
+      // Give up on storing: the cache is likely not writable.
+      store_error_ = err;
+      for (deque<StoreRequest*>::iterator r = pending_.begin();
+           r != pending_.end(); ++r) {
+        delete *r;
+      }
+      pending_.clear();
+    }
+    stored_.notify_all();
+  }
+}
+#endif
+
+FileReader::Status DirectoryBackend::Get(const string& key, string* data,
+                                         string* err) {
+  return disk_interface_->ReadFile(dir_ + "/" + key, data, err);
+}
+
+bool DirectoryBackend::Put(const string& key, const string& data,
+                           bool replace, string* err) {
+  string path = dir_ + "/" + key;
+  if (!replace) {
+    TimeStamp mtime = disk_interface_->Stat(path, err);
+    if (mtime == -1)
+      return false;
+    if (mtime > 0)
+      return true;
+  }
+  if (!disk_interface_->MakeDirs(path) ||
+      !disk_interface_->WriteFile(path, data)) {
+    *err = "can't write " + path;
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,210 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ACTION_CACHE_H_
+#define NINJA_ACTION_CACHE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#if __cplusplus >= 201103L
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "disk_interface.h"
+#include "util.h"  // uint64_t
+
+struct DependencyScan;
+struct Edge;
+
+/// A cache of the files commands wrote, so that a command that ran before
+/// on inputs with the same contents needn't run again: its outputs, its
+/// depfile and the text it printed are restored from the cache.
+///
+/// The cache is a set of entries named by keys that look like paths, kept
+/// by a Backend.  "ac/" has two kinds of records.  The first, named by a
+/// digest of the command and its outputs, lists the sets of inputs it was
+/// run with, including those it discovered, so that it can be looked up
+/// before those are known.  The second, named by that and the digest of
+/// the contents of one set of inputs, lists the digest and size of each
+/// file the command wrote, and "cas/" has the contents, named by those, so
+/// that files several commands wrote are stored once.  Digests are SHA-256,
+/// as a cache may be shared with others.  Records repeat what
+/// they are named by, so that a clash of names is only a miss, and sizes
+/// and hashes are checked when reading, so that a damaged cache, or one
+/// that another ninja is writing to, only causes misses.
+struct ActionCache {
+  /// Where the entries of the cache are kept.
+  struct Backend {
+    virtual ~Backend() {}
+
+    /// Read the entry named |key| into |data|.
+    virtual FileReader::Status Get(const string& key, string* data,
+                                   string* err) = 0;
+
+    /// Set the entry named |key| to |data|, which may happen later.  If
+    /// |replace| is false, an entry that is already there is kept, as
+    /// contents named by their hash needn't be written again.
+    virtual bool Put(const string& key, const string& data, bool replace,
+                     string* err) = 0;
+
+    /// Wait for entries that are still being written.
+    virtual bool Flush(string* err) { return true; }
+  };
+
+  /// Open the cache at |location|, which is a directory or an http:// URL.
+  /// Returns NULL on error.
+  static Backend* OpenBackend(const string& location,
+                              DiskInterface* disk_interface, string* err);
+
+  /// Use |backend|, which is deleted with the cache, and |scan| to hash
+  /// inputs.  If |background|, what Store() stores is read, hashed and
+  /// written by another thread, which requires a |disk_interface| that can
+  /// be called from several threads.
+  ActionCache(Backend* backend, DependencyScan* scan,
+              DiskInterface* disk_interface, bool background = false);
+  ~ActionCache();
+
+  /// Restore the files |edge| wrote when it ran |command| on inputs with
+  /// the contents they have now, and set |*output| to the text it printed.
+  /// Returns false if that isn't cached, setting |err| if the cache can't
+  /// be read or the files can't be written.
+  bool Restore(const Edge* edge, const string& command, string* output,
+               string* err);
+
+  /// Store the files |edge| wrote when it ran |command| on the inputs at
+  /// |inputs|, sorted, whose digest, as set by DependencyScan::HashPaths(),
+  /// is |input_digest|, and the text it printed.  Nothing is stored if the
+  /// edge didn't write its depfile, which is read now, so that it may be
+  /// removed once this returns; an output that is missing when it is read
+  /// is an error.  When storing in the background, the outputs are read
+  /// later, and errors doing so are returned by Flush().
+  bool Store(const Edge* edge, const string& command,
+             const vector<string>& inputs, const string& input_digest,
+             const string& output, string* err);
+
+  /// Wait for what Store() stored to be written.
+  bool Flush(string* err);
+
+ private:
+  /// What Store() was asked to store.
+  struct StoreRequest {
+    string command;
+    /// The files the command wrote.
+    vector<string> paths;
+    /// Whether the last of |paths| is the depfile, whose contents were read
+    /// by Store() into |depfile|.
+    bool has_depfile;
+    string depfile;
+    vector<string> inputs;
+    string input_digest;
+    string output;
+    string inputs_key;
+    /// The sets of inputs known already, which |inputs| is added to.
+    vector<vector<string> > sets;
+  };
+
+  /// Read and hash the files of |request|, and write its contents and
+  /// records.
+  bool StoreFiles(StoreRequest* request, string* err);
+
+#if __cplusplus >= 201103L
+  /// Thread body: store requests until there are none left and the cache
+  /// is being destroyed.
+  void Work();
+#endif
+
+  /// A file a command wrote, as listed in its record.
+  struct File {
+    string path;
+    /// The digest of the contents, in hex.
+    string digest;
+    size_t size;
+    bool executable;
+  };
+
+  /// Read the record at |inputs_key| of the sets of inputs of |edge|
+  /// running |command| into |sets|.  Returns false on a miss.
+  bool ReadInputSets(const Edge* edge, const string& command,
+                     const string& inputs_key, vector<vector<string> >* sets,
+                     string* err);
+
+  /// Restore the record at |result_key| of |edge| running |command| on
+  /// inputs with the hex digest |input_digest|.  Returns false on a miss.
+  bool RestoreResult(const Edge* edge, const string& command,
+                     const string& result_key, const string& input_digest,
+                     string* output, string* err);
+
+  /// Write |files|, whose contents are in |contents|.  Files that already
+  /// have those are left alone, but for |touch_unchanged| made newer, as
+  /// running the command would.
+  bool WriteFiles(const vector<File>& files, const vector<string>& contents,
+                  bool touch_unchanged, string* err);
+
+  Backend* backend_;
+  DependencyScan* scan_;
+  DiskInterface* disk_interface_;
+
+  /// Keys of contents found to be damaged, to be written again.
+  set<string> damaged_;
+  /// The sets of inputs read by Restore(), by the key of their record, for
+  /// Store() to add to without reading them again.
+  map<string, vector<vector<string> > > input_sets_;
+
+  /// The first error storing, after which nothing is stored.
+  string store_error_;
+  /// Whether Flush() returned |store_error_| already.
+  bool store_error_reported_;
+#if __cplusplus >= 201103L
+  bool background_;
+  /// Guards |damaged_|, |store_error_| and what follows.
+  mutex mutex_;
+  /// Signalled when a request is queued, and when the thread should exit.
+  condition_variable work_;
+  /// Signalled when a request is stored.
+  condition_variable stored_;
+  deque<StoreRequest*> pending_;
+  /// Whether the thread is storing a request it took from |pending_|.
+  bool storing_;
+  bool done_;
+  thread thread_;
+#endif
+
+  // Not copyable.
+  ActionCache(const ActionCache&);
+  void operator=(const ActionCache&);
+};
+
+/// An ActionCache::Backend keeping each entry in a file in a directory.
+struct DirectoryBackend : public ActionCache::Backend {
+  DirectoryBackend(const string& dir, DiskInterface* disk_interface)
+      : dir_(dir), disk_interface_(disk_interface) {}
+
+  virtual FileReader::Status Get(const string& key, string* data,
+                                 string* err);
+  virtual bool Put(const string& key, const string& data, bool replace,
+                   string* err);
+
+ private:
+  string dir_;
+  DiskInterface* disk_interface_;
+};
+
+#endif  // NINJA_ACTION_CACHE_H_
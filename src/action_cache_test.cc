@@ -0,0 +1,297 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "action_cache.h"
+
+#include "build_log.h"
+#include "graph.h"
+#include "sha256.h"
+#include "state.h"
+#include "test.h"
+
+namespace {
+
+const char kCommand[] = "cc in.c -o out.o";
+
+struct ActionCacheTest : public StateTestWithBuiltinRules {
+  ActionCacheTest()
+      : scan_(&state_, &log_, NULL, &fs_, NULL),
+        cache_(new DirectoryBackend("cache", &fs_), &scan_, &fs_) {}
+
+  virtual void SetUp() {
+    ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = cc $in -o $out\n"
+"  depfile = $out.d\n"
+"build out.o: cc in.c\n"));
+    edge_ = GetNode("out.o")->in_edge();
+    fs_.Create("in.c", "#include \"in.h\"");
+    fs_.Create("in.h", "int x;");
+  }
+
+  /// Run the command of |edge_|, by writing its outputs.
+  void RunCommand() {
+    fs_.Create("out.o", "object");
+    fs_.Create("out.o.d", "out.o: in.c in.h");
+  }
+
+  /// Store the outputs of |edge_| as written with |inputs|, and remove
+  /// them.
+  void StoreAndRemove(const vector<string>& inputs) {
+    string digest;
+    string err;
+    ASSERT_TRUE(scan_.HashPaths(inputs, &digest, NULL, &err));
+    EXPECT_TRUE(cache_.Store(edge_, kCommand, inputs, digest, "warning",
+                             &err));
+    ASSERT_EQ("", err);
+    fs_.RemoveFile("out.o");
+    fs_.RemoveFile("out.o.d");
+  }
+
+  /// The inputs of |edge_|, including the header it discovered.
+  vector<string> Inputs() {
+    vector<string> inputs;
+    inputs.push_back("in.c");
+    inputs.push_back("in.h");
+    return inputs;
+  }
+
+  /// Change the contents of |path|.
+  void Change(const string& path, const string& contents) {
+    fs_.Tick();
+    fs_.Create(path, contents);
+  }
+
+  VirtualFileSystem fs_;
+  BuildLog log_;
+  DependencyScan scan_;
+  ActionCache cache_;
+  Edge* edge_;
+};
+
+TEST_F(ActionCacheTest, RoundTrip) {
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  string output, err;
+  EXPECT_TRUE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ("warning", output);
+  EXPECT_EQ("object", fs_.files_["out.o"].contents);
+  EXPECT_EQ("out.o: in.c in.h", fs_.files_["out.o.d"].contents);
+}
+
+TEST_F(ActionCacheTest, Misses) {
+  string output, err;
+  EXPECT_FALSE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  EXPECT_FALSE(cache_.Restore(edge_, "cc -O2 in.c -o out.o", &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(0u, fs_.files_.count("out.o"));
+}
+
+TEST_F(ActionCacheTest, DiscoveredInputs) {
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  // The header isn't an input of the edge, but it's found in the record of
+  // the inputs the command ran with, and its contents count.
+  Change("in.h", "int y;");
+  string output, err;
+  EXPECT_FALSE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(0u, fs_.files_.count("out.o"));
+
+  Change("in.h", "int x;");
+  EXPECT_TRUE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("object", fs_.files_["out.o"].contents);
+}
+
+TEST_F(ActionCacheTest, InputSets) {
+  // Each set of inputs the command ran with is tried.
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  Change("in.c", "#include \"other.h\"");
+  fs_.Create("other.h", "int z;");
+  string output, err;
+  EXPECT_FALSE(cache_.Restore(edge_, kCommand, &output, &err));
+  fs_.Create("out.o", "other object");
+  fs_.Create("out.o.d", "out.o: in.c other.h");
+  vector<string> inputs;
+  inputs.push_back("in.c");
+  inputs.push_back("other.h");
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(inputs));
+
+  EXPECT_TRUE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("other object", fs_.files_["out.o"].contents);
+
+  Change("in.c", "#include \"in.h\"");
+  EXPECT_TRUE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("object", fs_.files_["out.o"].contents);
+}
+
+TEST_F(ActionCacheTest, MissingOutput) {
+  // A command that didn't write all of its outputs isn't stored.
+  fs_.Create("out.o", "object");
+  string digest, err;
+  ASSERT_TRUE(scan_.HashPaths(Inputs(), &digest, NULL, &err));
+  EXPECT_TRUE(cache_.Store(edge_, kCommand, Inputs(), digest, "", &err));
+  EXPECT_EQ("", err);
+
+  string output;
+  EXPECT_FALSE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+}
+
+TEST_F(ActionCacheTest, Damaged) {
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  // Damage the stored contents of the object file.
+  for (VirtualFileSystem::FileMap::iterator i = fs_.files_.begin();
+       i != fs_.files_.end(); ++i) {
+    if (i->first.compare(0, 10, "cache/cas/") == 0 &&
+        i->second.contents == "object") {
+      i->second.contents = "objecT";
+    }
+  }
+
+  string output, err;
+  EXPECT_FALSE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(0u, fs_.files_.count("out.o"));
+
+  // Storing again repairs it.
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+  EXPECT_TRUE(cache_.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("object", fs_.files_["out.o"].contents);
+}
+
+TEST_F(ActionCacheTest, ContentsNamedByDigest) {
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  string digest = Sha256::Hex(Sha256::Hash("object"));
+  EXPECT_EQ(1u, fs_.files_.count("cache/cas/" + digest.substr(0, 2) + "/" +
+                                 digest + "-6"));
+}
+
+TEST_F(ActionCacheTest, Background) {
+  ActionCache cache(new DirectoryBackend("cache", &fs_), &scan_, &fs_, true);
+  RunCommand();
+  string digest, err;
+  ASSERT_TRUE(scan_.HashPaths(Inputs(), &digest, NULL, &err));
+  EXPECT_TRUE(cache.Store(edge_, kCommand, Inputs(), digest, "warning",
+                          &err));
+  EXPECT_TRUE(cache.Flush(&err));
+  EXPECT_EQ("", err);
+  fs_.RemoveFile("out.o");
+  fs_.RemoveFile("out.o.d");
+
+  string output;
+  EXPECT_TRUE(cache.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ("warning", output);
+  EXPECT_EQ("object", fs_.files_["out.o"].contents);
+}
+
+TEST_F(ActionCacheTest, BackgroundRemovedDepfile) {
+  // The depfile is read by Store(), so it may be removed before the other
+  // files are stored.
+  ActionCache cache(new DirectoryBackend("cache", &fs_), &scan_, &fs_, true);
+  RunCommand();
+  string digest, err;
+  ASSERT_TRUE(scan_.HashPaths(Inputs(), &digest, NULL, &err));
+  EXPECT_TRUE(cache.Store(edge_, kCommand, Inputs(), digest, "", &err));
+  fs_.RemoveFile("out.o.d");
+  EXPECT_TRUE(cache.Flush(&err));
+  EXPECT_EQ("", err);
+  fs_.RemoveFile("out.o");
+
+  string output;
+  EXPECT_TRUE(cache.Restore(edge_, kCommand, &output, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ("out.o: in.c in.h", fs_.files_["out.o.d"].contents);
+}
+
+TEST_F(ActionCacheTest, RemovedOutput) {
+  // An output that is gone by the time it's stored is an error.
+  RunCommand();
+  fs_.RemoveFile("out.o");
+  string digest, err;
+  ASSERT_TRUE(scan_.HashPaths(Inputs(), &digest, NULL, &err));
+  EXPECT_FALSE(cache_.Store(edge_, kCommand, Inputs(), digest, "", &err));
+  EXPECT_EQ("can't store out.o: it was removed", err);
+}
+
+#if __cplusplus >= 201103L
+/// A Backend that can't write anything.
+struct FailingBackend : public ActionCache::Backend {
+  virtual FileReader::Status Get(const string& key, string* data,
+                                 string* err) {
+    return FileReader::NotFound;
+  }
+  virtual bool Put(const string& key, const string& data, bool replace,
+                   string* err) {
+    *err = "can't write " + key;
+    return false;
+  }
+};
+
+TEST_F(ActionCacheTest, BackgroundError) {
+  // Errors storing in the background are reported once, by Flush().
+  ActionCache cache(new FailingBackend, &scan_, &fs_, true);
+  RunCommand();
+  string digest, err;
+  ASSERT_TRUE(scan_.HashPaths(Inputs(), &digest, NULL, &err));
+  EXPECT_TRUE(cache.Store(edge_, kCommand, Inputs(), digest, "", &err));
+  EXPECT_EQ("", err);
+  EXPECT_FALSE(cache.Flush(&err));
+  EXPECT_EQ(0u, err.find("can't write cas/"));
+
+  err.clear();
+  EXPECT_TRUE(cache.Store(edge_, kCommand, Inputs(), digest, "", &err));
+  EXPECT_TRUE(cache.Flush(&err));
+  EXPECT_EQ("", err);
+}
+#endif
+
+TEST_F(ActionCacheTest, SharedContents) {
+  // Files with the same contents are stored once.
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+  Change("in.h", "int y;");
+  RunCommand();
+  ASSERT_NO_FATAL_FAILURE(StoreAndRemove(Inputs()));
+
+  int records = 0, contents = 0;
+  for (VirtualFileSystem::FileMap::iterator i = fs_.files_.begin();
+       i != fs_.files_.end(); ++i) {
+    if (i->first.compare(0, 9, "cache/ac/") == 0)
+      ++records;
+    else if (i->first.compare(0, 10, "cache/cas/") == 0)
+      ++contents;
+  }
+  // One record of the inputs, and one of each run.
+  EXPECT_EQ(3, records);
+  EXPECT_EQ(2, contents);
+}
+
+}  // anonymous namespace
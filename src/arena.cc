@@ -0,0 +1,55 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "arena.h"
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "util.h"
+
+Arena::~Arena() {
+  for (vector<char*>::iterator i = blocks_.begin(); i != blocks_.end(); ++i)
+    free(*i);
+}
+
+void* Arena::AllocSlow(size_t size) {
+  // Large requests get a block of their own, so that the rest of the
+  // current block isn't wasted.
+  if (size > kBlockSize / 4) {
+    char* block = static_cast<char*>(malloc(size));
+    if (!block)
+      Fatal("out of memory allocating %lu bytes", (unsigned long)size);
+    blocks_.push_back(block);
+    bytes_allocated_ += size;
+    return block;
+  }
+
+  char* block = static_cast<char*>(malloc(kBlockSize));
+  if (!block)
+    Fatal("out of memory allocating %lu bytes", (unsigned long)kBlockSize);
+  blocks_.push_back(block);
+  bytes_allocated_ += kBlockSize;
+  ptr_ = block + size;
+  end_ = block + kBlockSize;
+  return block;
+}
+
+void Arena::Swap(Arena* other) {
+  std::swap(ptr_, other->ptr_);
+  std::swap(end_, other->end_);
+  std::swap(bytes_allocated_, other->bytes_allocated_);
+  blocks_.swap(other->blocks_);
+}
@@ -0,0 +1,69 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ARENA_H_
+#define NINJA_ARENA_H_
+
+#include <stddef.h>
+
+#include <vector>
+using namespace std;
+
+/// A bump allocator for objects that live as long as their owner.
+/// Memory is handed out from large blocks and only released, all at once,
+/// when the Arena is destroyed; destructors of objects placed in it are
+/// never run.
+struct Arena {
+  Arena() : ptr_(NULL), end_(NULL), bytes_allocated_(0) {}
+  ~Arena();
+
+  /// Allocate |size| bytes, aligned for any of the types ninja stores.
+  void* Alloc(size_t size) {
+    size = (size + kAlignment - 1) & ~(kAlignment - 1);
+    if (size > (size_t)(end_ - ptr_))
+      return AllocSlow(size);
+    void* result = ptr_;
+    ptr_ += size;
+    return result;
+  }
+
+  /// Allocate uninitialized storage for |count| objects of type T.
+  template<typename T>
+  T* AllocArray(size_t count) {
+    return static_cast<T*>(Alloc(sizeof(T) * count));
+  }
+
+  /// Exchange the contents of two arenas.
+  void Swap(Arena* other);
+
+  /// The number of bytes in all blocks allocated so far.
+  size_t bytes_allocated() const { return bytes_allocated_; }
+
+ private:
+  static const size_t kAlignment = 8;
+  static const size_t kBlockSize = 64 * 1024;
+
+  void* AllocSlow(size_t size);
+
+  char* ptr_;
+  char* end_;
+  size_t bytes_allocated_;
+  vector<char*> blocks_;
+
+  // Not copyable.
+  Arena(const Arena&);
+  void operator=(const Arena&);
+};
+
+#endif  // NINJA_ARENA_H_
@@ -18,6 +18,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
 #include <functional>
 
 #ifdef _WIN32
@@ -29,26 +30,32 @@
 #include <sys/termios.h>
 #endif
 
+#include "action_cache.h"
 #include "build_log.h"
-#include "clparser.h"
 #include "debug_flags.h"
 #include "depfile_parser.h"
 #include "deps_log.h"
 #include "disk_interface.h"
 #include "graph.h"
+#include "jobserver.h"
+#include "pressure.h"
 #include "state.h"
 #include "subprocess.h"
+#include "trace.h"
 #include "util.h"
 
 namespace {
 
+/// How long a sample of the available memory is used for.
+const int64_t kMemorySampleMillis = 100;
+
 /// A CommandRunner that doesn't actually run the commands.
 struct DryRunCommandRunner : public CommandRunner {
   virtual ~DryRunCommandRunner() {}
 
   // Overridden from CommandRunner:
   virtual bool CanRunMore() const;
-  virtual bool StartCommand(Edge* edge);
+  virtual bool StartCommand(Edge* edge, const string& command);
   virtual bool WaitForCommand(Result* result);
 
  private:
@@ -59,7 +66,7 @@ bool DryRunCommandRunner::CanRunMore() const {
   return true;
 }
 
-bool DryRunCommandRunner::StartCommand(Edge* edge) {
+bool DryRunCommandRunner::StartCommand(Edge* edge, const string& command) {
   finished_.push(edge);
   return true;
 }
@@ -101,6 +108,8 @@ void BuildStatus::BuildEdgeStarted(const Edge* edge) {
   int start_time = (int)(GetTimeMillis() - start_time_millis_);
   running_edges_.insert(make_pair(edge, start_time));
   ++started_edges_;
+  if (g_trace)
+    g_trace->JobStarted(edge);
 
   if (edge->use_console() || printer_.is_smart_terminal())
     PrintStatus(edge, kEdgeStarted);
@@ -122,6 +131,9 @@ void BuildStatus::BuildEdgeFinished(Edge* edge,
   *start_time = i->second;
   *end_time = (int)(now - start_time_millis_);
   running_edges_.erase(i);
+  if (g_trace)
+    g_trace->JobFinished(edge, edge->outputs_[0]->path(),
+                         edge->rule().name());
 
   if (edge->use_console())
     printer_.SetConsoleLocked(false);
@@ -308,6 +320,13 @@ void BuildStatus::PrintStatus(const Edge* edge, EdgeStatus status) {
 
 Plan::Plan(Builder* builder)
   : builder_(builder)
+  , memory_budget_(0)
+  , committed_memory_(0)
+  , logged_duration_(0)
+  , logged_edges_(0)
+  , memory_sample_(-1)
+  , memory_sample_time_(-1)
+  , memory_sample_committed_(0)
   , command_edges_(0)
   , wanted_edges_(0)
 {}
@@ -316,10 +335,22 @@ void Plan::Reset() {
   command_edges_ = 0;
   wanted_edges_ = 0;
   ready_.clear();
+  committed_memory_ = 0;
+  running_memory_.clear();
+  memory_deferred_.clear();
+  rule_memory_.clear();
+  logged_duration_ = 0;
+  logged_edges_ = 0;
+  memory_sample_time_ = -1;
   want_.clear();
+  pending_inputs_.clear();
+  planned_edges_.clear();
+  targets_.clear();
+  new_edges_.clear();
 }
 
 bool Plan::AddTarget(const Node* node, string* err) {
+  targets_.push_back(node);
   return AddSubTarget(node, NULL, err, NULL);
 }
 
@@ -340,28 +371,34 @@ bool Plan::AddSubTarget(const Node* node, const Node* dependent, string* err,
   if (edge->outputs_ready())
     return false;  // Don't need to do anything.
 
-  // If an entry in want_ does not already exist for edge, create an entry which
-  // maps to kWantNothing, indicating that we do not want to build this entry itself.
-  pair<map<Edge*, Want>::iterator, bool> want_ins =
-    want_.insert(make_pair(edge, kWantNothing));
-  Want& want = want_ins.first->second;
+  // If the edge is not in the plan yet, add it as kWantNothing, indicating
+  // that we do not want to build this edge itself.
+  bool newly_planned = GetWant(edge) == kNotInPlan;
+  if (newly_planned) {
+    SetWant(edge, kWantNothing);
+    CountPendingInputs(edge);
+    planned_edges_.push_back(edge);
+    edge->set_critical_path_weight(-1);
+  }
+  Want& want = want_[edge->id_];
 
   if (dyndep_walk && want == kWantToFinish)
     return false;  // Don't need to do anything with already-scheduled edge.
 
   // If we do need to build edge and we haven't already marked it as wanted,
-  // mark it now.
+  // mark it now.  Edges that are ready are scheduled by PrepareQueue(), once
+  // all targets are known and the edges can be prioritized.
   if (node->dirty() && want == kWantNothing) {
     want = kWantToStart;
     EdgeWanted(edge);
-    if (!dyndep_walk && edge->AllInputsReady())
-      ScheduleWork(want_ins.first);
+    if (!dyndep_walk)
+      new_edges_.push_back(edge);
   }
 
   if (dyndep_walk)
     dyndep_walk->insert(edge);
 
-  if (!want_ins.second)
+  if (!newly_planned)
     return true;  // We've already processed the inputs.
 
   for (vector<Node*>::iterator i = edge->inputs_.begin();
@@ -380,45 +417,270 @@ void Plan::EdgeWanted(const Edge* edge) {
 }
 
 Edge* Plan::FindWork() {
-  if (ready_.empty())
-    return NULL;
-  set<Edge*>::iterator e = ready_.begin();
-  Edge* edge = *e;
-  ready_.erase(e);
-  return edge;
+  if (!targets_.empty())
+    PrepareQueue();
+  while (!ready_.empty()) {
+    Edge* edge = ready_.top();
+    ready_.pop();
+    if (memory_budget_ <= 0)
+      return edge;
+    int64_t memory = EdgeMemory(edge);
+    if (!FitsInMemory(memory)) {
+      memory_deferred_.push_back(edge);
+      continue;
+    }
+    if (memory) {
+      committed_memory_ += memory;
+      running_memory_[edge] = memory;
+    }
+    return edge;
+  }
+  return NULL;
+}
+
+int64_t Plan::EdgeMemory(const Edge* edge) const {
+  if (edge->is_phony())
+    return 0;
+  BuildLog* build_log = builder_ ? builder_->build_log() : NULL;
+  if (build_log) {
+    BuildLog::LogEntry* entry =
+        build_log->LookupByOutput(edge->outputs_[0]->path());
+    if (entry && entry->usage.max_rss)
+      return entry->usage.max_rss;
+  }
+  map<const Rule*, pair<int64_t, int> >::const_iterator i =
+      rule_memory_.find(&edge->rule());
+  return i != rule_memory_.end() ? i->second.first / i->second.second : 0;
+}
+
+bool Plan::FitsInMemory(int64_t memory) {
+  // With nothing expected to use memory running, anything fits, so that
+  // the build always makes progress.
+  if (memory == 0 || committed_memory_ == 0)
+    return true;
+  if (committed_memory_ + memory > memory_budget_)
+    return false;
+  // Others may be using the memory the budget counted on.
+  int64_t available = AvailableMemory();
+  return available < 0 || memory <= available;
+}
+
+int64_t Plan::AvailableMemory() {
+  int64_t now = GetTimeMillis();
+  if (memory_sample_time_ < 0 ||
+      now - memory_sample_time_ >= kMemorySampleMillis) {
+    if (!cgroup_memory_.get())
+      cgroup_memory_.reset(new CgroupMemory);
+    memory_sample_ = GetAvailableMemory(cgroup_memory_.get());
+    memory_sample_time_ = now;
+    memory_sample_committed_ = committed_memory_;
+  }
+  if (memory_sample_ < 0)
+    return memory_sample_;
+  // The edges started since the sample may not have grown to their peak
+  // yet.  The memory of those that finished is counted back in only by the
+  // next sample, once it has been given back.
+  int64_t started = max(committed_memory_ - memory_sample_committed_,
+                        (int64_t)0);
+  return max(memory_sample_ - started, (int64_t)0);
+}
+
+void Plan::ReleaseMemory(const Edge* edge) {
+  map<const Edge*, int64_t>::iterator i = running_memory_.find(edge);
+  if (i == running_memory_.end())
+    return;
+  committed_memory_ -= i->second;
+  running_memory_.erase(i);
+  for (vector<Edge*>::iterator e = memory_deferred_.begin();
+       e != memory_deferred_.end(); ++e)
+    ready_.push(*e);
+  memory_deferred_.clear();
+}
+
+void Plan::PrepareQueue() {
+  AddLoggedUsage(new_edges_);
+  vector<Edge*> roots;
+  for (vector<const Node*>::const_iterator t = targets_.begin();
+       t != targets_.end(); ++t) {
+    if (Edge* edge = (*t)->in_edge())
+      roots.push_back(edge);
+  }
+  ComputeCriticalPath(roots);
+  ScheduleInitialEdges();
+  targets_.clear();
+  new_edges_.clear();
+}
+
+int64_t Plan::EdgeWeight(const Edge* edge) const {
+  // Edges we do not run cost nothing, but still propagate the weight of
+  // their dependents.
+  if (GetWant(edge) == kWantNothing || edge->is_phony())
+    return 0;
+  BuildLog* build_log = builder_ ? builder_->build_log() : NULL;
+  if (build_log) {
+    BuildLog::LogEntry* entry =
+        build_log->LookupByOutput(edge->outputs_[0]->path());
+    if (entry)
+      return max(entry->end_time - entry->start_time, 1);
+  }
+  // Edges that have never been run are assumed to take as long as the
+  // average edge that has.
+  return logged_edges_ ? logged_duration_ / logged_edges_ : 1;
+}
+
+void Plan::AddLoggedUsage(const vector<Edge*>& edges) {
+  BuildLog* build_log = builder_ ? builder_->build_log() : NULL;
+  if (!build_log)
+    return;
+  for (vector<Edge*>::const_iterator e = edges.begin(); e != edges.end();
+       ++e) {
+    if ((*e)->is_phony())
+      continue;
+    BuildLog::LogEntry* entry =
+        build_log->LookupByOutput((*e)->outputs_[0]->path());
+    if (!entry)
+      continue;
+    logged_duration_ += max(entry->end_time - entry->start_time, 1);
+    ++logged_edges_;
+    // Edges that have never been run are assumed to use as much memory as
+    // the average edge of their rule that has.
+    if (entry->usage.max_rss) {
+      pair<int64_t, int>& memory = rule_memory_[&(*e)->rule()];
+      memory.first += entry->usage.max_rss;
+      ++memory.second;
+    }
+  }
+}
+
+void Plan::ComputeCriticalPath(const vector<Edge*>& roots) {
+  METRIC_RECORD("critical path");
+  TRACE_RECORD("critical path");
+
+  // Sort the edges reachable from the roots so that every edge comes
+  // after all of its dependencies, then flow weights backwards from the
+  // roots in a single pass.  Edges that are already scheduled are sitting
+  // in ordered containers and keep their weight.
+  // Every edge we visit is in the plan, so |want_| bounds their ids; the
+  // edges of up-to-date inputs may not be, and have ids beyond it.
+  vector<bool> visited(want_.size(), false);
+  vector<Edge*> order;
+  for (vector<Edge*>::const_iterator r = roots.begin(); r != roots.end();
+       ++r) {
+    Edge* edge = *r;
+    CriticalPathVisit(edge, &visited, &order);
+    if (edge->id_ >= visited.size() || !visited[edge->id_])
+      continue;
+    int64_t weight = EdgeWeight(edge);
+    if (weight > edge->critical_path_weight())
+      edge->set_critical_path_weight(weight);
+  }
+
+  for (vector<Edge*>::reverse_iterator e = order.rbegin();
+       e != order.rend(); ++e) {
+    Edge* edge = *e;
+    for (vector<Node*>::const_iterator i = edge->inputs_.begin();
+         i != edge->inputs_.end(); ++i) {
+      Edge* in_edge = (*i)->in_edge();
+      if (!in_edge || in_edge->id_ >= visited.size() ||
+          !visited[in_edge->id_])
+        continue;
+      int64_t weight = edge->critical_path_weight() + EdgeWeight(in_edge);
+      if (weight > in_edge->critical_path_weight())
+        in_edge->set_critical_path_weight(weight);
+    }
+  }
+}
+
+void Plan::CriticalPathVisit(Edge* edge, vector<bool>* visited,
+                             vector<Edge*>* order) const {
+  Want want = GetWant(edge);
+  if (want == kNotInPlan || want == kWantToFinish)
+    return;
+  if ((*visited)[edge->id_])
+    return;
+  (*visited)[edge->id_] = true;
+
+  for (vector<Node*>::const_iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end(); ++i) {
+    if (Edge* in_edge = (*i)->in_edge())
+      CriticalPathVisit(in_edge, visited, order);
+  }
+  order->push_back(edge);
+}
+
+void Plan::ScheduleInitialEdges() {
+  // Delay all pooled edges before asking their pools for ready edges, so
+  // that pools hand out their most critical edges first rather than the
+  // ones that happened to be encountered first.
+  set<Pool*> pools;
+  for (vector<Edge*>::const_iterator e = new_edges_.begin();
+       e != new_edges_.end(); ++e) {
+    if (GetWant(*e) != kWantToStart || pending_inputs_[(*e)->id_] != 0)
+      continue;
+    Pool* pool = (*e)->pool();
+    if (pool->ShouldDelayEdge()) {
+      SetWant(*e, kWantToFinish);
+      pool->DelayEdge(*e);
+      pools.insert(pool);
+    } else {
+      ScheduleWork(*e);
+    }
+  }
+
+  for (set<Pool*>::iterator p = pools.begin(); p != pools.end(); ++p)
+    (*p)->RetrieveReadyEdges(&ready_);
 }
 
-void Plan::ScheduleWork(map<Edge*, Want>::iterator want_e) {
-  if (want_e->second == kWantToFinish) {
+void Plan::SetWant(const Edge* edge, Want want) {
+  if (edge->id_ >= want_.size())
+    want_.resize(edge->id_ + 1, kNotInPlan);
+  want_[edge->id_] = want;
+}
+
+void Plan::CountPendingInputs(const Edge* edge) {
+  if (edge->id_ >= pending_inputs_.size())
+    pending_inputs_.resize(edge->id_ + 1, 0);
+  int pending = 0;
+  for (vector<Node*>::const_iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end(); ++i) {
+    if ((*i)->in_edge() && !(*i)->in_edge()->outputs_ready())
+      ++pending;
+  }
+  pending_inputs_[edge->id_] = pending;
+}
+
+void Plan::ScheduleWork(Edge* edge) {
+  Want& want = want_[edge->id_];
+  if (want == kWantToFinish) {
     // This edge has already been scheduled.  We can get here again if an edge
     // and one of its dependencies share an order-only input, or if a node
     // duplicates an out edge (see https://github.com/ninja-build/ninja/pull/519).
     // Avoid scheduling the work again.
     return;
   }
-  assert(want_e->second == kWantToStart);
-  want_e->second = kWantToFinish;
+  assert(want == kWantToStart);
+  want = kWantToFinish;
 
-  Edge* edge = want_e->first;
   Pool* pool = edge->pool();
   if (pool->ShouldDelayEdge()) {
     pool->DelayEdge(edge);
     pool->RetrieveReadyEdges(&ready_);
   } else {
     pool->EdgeScheduled(*edge);
-    ready_.insert(edge);
+    ready_.push(edge);
   }
 }
 
 bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
-  map<Edge*, Want>::iterator e = want_.find(edge);
-  assert(e != want_.end());
-  bool directly_wanted = e->second != kWantNothing;
+  Want want = GetWant(edge);
+  assert(want != kNotInPlan);
+  bool directly_wanted = want != kWantNothing;
 
   // See if this job frees up any delayed jobs.
   if (directly_wanted)
     edge->pool()->EdgeFinished(*edge);
   edge->pool()->RetrieveReadyEdges(&ready_);
+  ReleaseMemory(edge);
 
   // The rest of this function only applies to successful commands.
   if (result != kEdgeSucceeded)
@@ -426,8 +688,22 @@ bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
 
   if (directly_wanted)
     --wanted_edges_;
-  want_.erase(e);
-  edge->outputs_ready_ = true;
+  SetWant(edge, kNotInPlan);
+
+  // The edges of the plan waiting for our outputs have one input fewer to
+  // wait for each time they list one.  Edges whose outputs were already
+  // found ready by a dyndep rescan were counted as ready to begin with.
+  if (!edge->outputs_ready_) {
+    edge->outputs_ready_ = true;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      for (vector<Edge*>::const_iterator oe = (*o)->out_edges().begin();
+           oe != (*o)->out_edges().end(); ++oe) {
+        if (GetWant(*oe) != kNotInPlan)
+          --pending_inputs_[(*oe)->id_];
+      }
+    }
+  }
 
   // Check off any nodes we were waiting for with this edge.
   for (vector<Node*>::iterator o = edge->outputs_.begin();
@@ -450,22 +726,20 @@ bool Plan::NodeFinished(Node* node, string* err) {
   // See if we we want any edges from this node.
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
+    if (GetWant(*oe) == kNotInPlan)
       continue;
 
     // See if the edge is now ready.
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*oe, err))
       return false;
   }
   return true;
 }
 
-bool Plan::EdgeMaybeReady(map<Edge*, Want>::iterator want_e, string* err) {
-  Edge* edge = want_e->first;
-  if (edge->AllInputsReady()) {
-    if (want_e->second != kWantNothing) {
-      ScheduleWork(want_e);
+bool Plan::EdgeMaybeReady(Edge* edge, string* err) {
+  if (pending_inputs_[edge->id_] == 0) {
+    if (GetWant(edge) != kWantNothing) {
+      ScheduleWork(edge);
     } else {
       // We do not need to build this edge, but we might need to build one of
       // its dependents.
@@ -482,8 +756,8 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
     // Don't process edges that we don't actually want.
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end() || want_e->second == kWantNothing)
+    Want want = GetWant(*oe);
+    if (want == kNotInPlan || want == kWantNothing)
       continue;
 
     // Don't attempt to clean an edge if it failed to load deps.
@@ -523,7 +797,7 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
             return false;
         }
 
-        want_e->second = kWantNothing;
+        SetWant(*oe, kWantNothing);
         --wanted_edges_;
         if (!(*oe)->is_phony())
           --command_edges_;
@@ -554,11 +828,9 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
     if (edge->outputs_ready())
       continue;
 
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-
     // If the edge has not been encountered before then nothing already in the
     // plan depends on it so we do not need to consider the edge yet either.
-    if (want_e == want_.end())
+    if (GetWant(edge) == kNotInPlan)
       continue;
 
     // This edge is already in the plan so queue it for the walk.
@@ -578,23 +850,35 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
     }
   }
 
+  // Weigh the edges the walk added to the plan by the edges that now
+  // depend on them, before any of them is scheduled.
+  vector<Edge*> walked, roots;
+  for (set<Edge*>::iterator wi = dyndep_walk.begin();
+       wi != dyndep_walk.end(); ++wi) {
+    if (GetWant(*wi) == kWantToStart && (*wi)->critical_path_weight() < 0)
+      walked.push_back(*wi);
+  }
+  AddLoggedUsage(walked);
+  for (vector<DyndepFile::const_iterator>::iterator
+       oei = dyndep_roots.begin(); oei != dyndep_roots.end(); ++oei)
+    roots.push_back((*oei)->first);
+  ComputeCriticalPath(roots);
+
   // Add out edges from this node that are in the plan (just as
   // Plan::NodeFinished would have without taking the dyndep code path).
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
+    if (GetWant(*oe) == kNotInPlan)
       continue;
-    dyndep_walk.insert(want_e->first);
+    dyndep_walk.insert(*oe);
   }
 
   // See if any encountered edges are now ready.
   for (set<Edge*>::iterator wi = dyndep_walk.begin();
        wi != dyndep_walk.end(); ++wi) {
-    map<Edge*, Want>::iterator want_e = want_.find(*wi);
-    if (want_e == want_.end())
+    if (GetWant(*wi) == kNotInPlan)
       continue;
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*wi, err))
       return false;
   }
 
@@ -625,13 +909,27 @@ bool Plan::RefreshDyndepDependents(DependencyScan* scan, const Node* node,
     // information an output is now known to be dirty, so we want the edge.
     Edge* edge = n->in_edge();
     assert(edge && !edge->outputs_ready());
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    assert(want_e != want_.end());
-    if (want_e->second == kWantNothing) {
-      want_e->second = kWantToStart;
+    Want want = GetWant(edge);
+    assert(want != kNotInPlan);
+    if (want == kWantNothing) {
+      SetWant(edge, kWantToStart);
       EdgeWanted(edge);
     }
   }
+
+  // The dyndep information may have added inputs to the edges of the plan
+  // that depend on the node, and rescanning may have found the outputs of
+  // some of them ready, so count what they wait for again.
+  vector<const Node*> nodes(dependents.begin(), dependents.end());
+  nodes.push_back(node);
+  for (vector<const Node*>::iterator i = nodes.begin(); i != nodes.end();
+       ++i) {
+    for (vector<Edge*>::const_iterator oe = (*i)->out_edges().begin();
+         oe != (*i)->out_edges().end(); ++oe) {
+      if (GetWant(*oe) != kNotInPlan)
+        CountPendingInputs(*oe);
+    }
+  }
   return true;
 }
 
@@ -640,8 +938,7 @@ void Plan::UnmarkDependents(const Node* node, set<Node*>* dependents) {
        oe != node->out_edges().end(); ++oe) {
     Edge* edge = *oe;
 
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    if (want_e == want_.end())
+    if (GetWant(edge) == kNotInPlan)
       continue;
 
     if (edge->mark_ != Edge::VisitNone) {
@@ -656,29 +953,74 @@ void Plan::UnmarkDependents(const Node* node, set<Node*>* dependents) {
 }
 
 void Plan::Dump() const {
-  printf("pending: %d\n", (int)want_.size());
-  for (map<Edge*, Want>::const_iterator e = want_.begin(); e != want_.end(); ++e) {
-    if (e->second != kWantNothing)
+  int pending = 0;
+  for (vector<Edge*>::const_iterator e = planned_edges_.begin();
+       e != planned_edges_.end(); ++e) {
+    if (GetWant(*e) != kNotInPlan)
+      ++pending;
+  }
+  printf("pending: %d\n", pending);
+  for (vector<Edge*>::const_iterator e = planned_edges_.begin();
+       e != planned_edges_.end(); ++e) {
+    Want want = GetWant(*e);
+    if (want == kNotInPlan)
+      continue;
+    if (want != kWantNothing)
       printf("want ");
-    e->first->Dump();
+    (*e)->Dump();
   }
   printf("ready: %d\n", (int)ready_.size());
+  if (!memory_deferred_.empty())
+    printf("held back for memory: %d\n", (int)memory_deferred_.size());
 }
 
 struct RealCommandRunner : public CommandRunner {
-  explicit RealCommandRunner(const BuildConfig& config) : config_(config) {}
-  virtual ~RealCommandRunner() {}
+  explicit RealCommandRunner(const BuildConfig& config);
+  virtual ~RealCommandRunner();
   virtual bool CanRunMore() const;
-  virtual bool StartCommand(Edge* edge);
+  virtual bool StartCommand(Edge* edge, const string& command);
   virtual bool WaitForCommand(Result* result);
   virtual vector<Edge*> GetActiveEdges();
   virtual void Abort();
 
+  /// Give back the jobserver tokens the running commands don't need.
+  void ReleaseTokens();
+
+  /// Have |subprocs_| wake up when a jobserver token may be free, or stop
+  /// that.
+  void WatchJobserver(bool watch);
+
   const BuildConfig& config_;
   SubprocessSet subprocs_;
   map<const Subprocess*, Edge*> subproc_to_edge_;
+  /// Lowers the parallelism under pressure, or NULL if there is no limit.
+  PressureThrottle* pressure_;
+  /// Whether CanRunMore() last said no for lack of a jobserver token.
+  mutable bool waiting_for_token_;
 };
 
+RealCommandRunner::RealCommandRunner(const BuildConfig& config)
+    : config_(config), pressure_(NULL), waiting_for_token_(false) {
+#ifndef _WIN32
+  if (config_.hangup_fd >= 0)
+    subprocs_.WatchHangup(config_.hangup_fd);
+#endif
+  if (config_.max_pressure > 0.0f) {
+    if (PressureMonitor* monitor = PressureMonitor::Open()) {
+      pressure_ = new PressureThrottle(monitor, config_.parallelism,
+                                       config_.max_pressure);
+    } else {
+      Warning("pressure stall information is not available; "
+              "ignoring --pressure");
+    }
+  }
+}
+
+RealCommandRunner::~RealCommandRunner() {
+  ReleaseTokens();
+  delete pressure_;
+}
+
 vector<Edge*> RealCommandRunner::GetActiveEdges() {
   vector<Edge*> edges;
   for (map<const Subprocess*, Edge*>::iterator e = subproc_to_edge_.begin();
@@ -689,18 +1031,51 @@ vector<Edge*> RealCommandRunner::GetActiveEdges() {
 
 void RealCommandRunner::Abort() {
   subprocs_.Clear();
+  ReleaseTokens();
+}
+
+void RealCommandRunner::ReleaseTokens() {
+  if (!config_.jobserver)
+    return;
+  // The first command runs in our own job slot.
+  size_t subproc_number =
+      subprocs_.running_.size() + subprocs_.finished_.size();
+  while (config_.jobserver->tokens() > 0 &&
+         config_.jobserver->tokens() + 1 > subproc_number)
+    config_.jobserver->Release();
+}
+
+void RealCommandRunner::WatchJobserver(bool watch) {
+#ifdef _WIN32
+  // The semaphore can't be waited on with the completion port, so look at
+  // it now and then.
+  subprocs_.SetTimeout(watch ? 50 : INFINITE);
+#else
+  subprocs_.WatchReadable(watch ? config_.jobserver->read_fd() : -1);
+#endif
 }
 
 bool RealCommandRunner::CanRunMore() const {
+  waiting_for_token_ = false;
   size_t subproc_number =
       subprocs_.running_.size() + subprocs_.finished_.size();
-  return (int)subproc_number < config_.parallelism
-    && ((subprocs_.running_.empty() || config_.max_load_average <= 0.0f)
-        || GetLoadAverage() < config_.max_load_average);
+  if (!((int)subproc_number < config_.parallelism
+        && ((subprocs_.running_.empty() || config_.max_load_average <= 0.0f)
+            || GetLoadAverage() < config_.max_load_average)))
+    return false;
+  if (pressure_ && !subprocs_.running_.empty() &&
+      (int)subproc_number >= pressure_->Limit(subproc_number))
+    return false;
+  // Each command beyond the first needs a token, which is taken now and
+  // kept until a command finishes.
+  if (!config_.jobserver || subproc_number == 0 ||
+      config_.jobserver->tokens() >= subproc_number)
+    return true;
+  waiting_for_token_ = !config_.jobserver->Acquire();
+  return !waiting_for_token_;
 }
 
-bool RealCommandRunner::StartCommand(Edge* edge) {
-  string command = edge->EvaluateCommand();
+bool RealCommandRunner::StartCommand(Edge* edge, const string& command) {
   Subprocess* subproc = subprocs_.Add(command, edge->use_console());
   if (!subproc)
     return false;
@@ -710,21 +1085,42 @@ bool RealCommandRunner::StartCommand(Edge* edge) {
 }
 
 bool RealCommandRunner::WaitForCommand(Result* result) {
-  Subprocess* subproc;
-  while ((subproc = subprocs_.NextFinished()) == NULL) {
-    bool interrupted = subprocs_.DoWork();
-    if (interrupted)
-      return false;
+  // Don't keep a token that no command was started with while waiting.
+  ReleaseTokens();
+  // A command that waits for a token starts once one is free, rather than
+  // once one of ours finishes.
+  if (waiting_for_token_)
+    WatchJobserver(true);
+  bool interrupted = false;
+  bool acquired = false;
+  Subprocess* subproc = NULL;
+  while (!interrupted && !acquired &&
+         (subproc = subprocs_.NextFinished()) == NULL) {
+    interrupted = subprocs_.DoWork();
+    acquired = !interrupted && waiting_for_token_ &&
+        config_.jobserver->Acquire();
+  }
+  if (waiting_for_token_) {
+    WatchJobserver(false);
+    waiting_for_token_ = false;
+  }
+  if (interrupted)
+    return false;
+  if (acquired) {
+    result->edge = NULL;
+    return true;
   }
 
   result->status = subproc->Finish();
   result->output = subproc->GetOutput();
+  result->usage = subproc->GetResourceUsage();
 
   map<const Subprocess*, Edge*>::iterator e = subproc_to_edge_.find(subproc);
   result->edge = e->second;
   subproc_to_edge_.erase(e);
 
   delete subproc;
+  ReleaseTokens();
   return true;
 }
 
@@ -747,6 +1143,16 @@ void Builder::Cleanup() {
     vector<Edge*> active_edges = command_runner_->GetActiveEdges();
     command_runner_->Abort();
 
+    // Commands whose dependencies are still being read aren't finished
+    // either.
+    for (deque<DepsRead*>::iterator r = deps_reads_.begin();
+         r != deps_reads_.end(); ++r) {
+      deps_reader_->Wait(&(*r)->request);
+      active_edges.push_back((*r)->result.edge);
+      delete *r;
+    }
+    deps_reads_.clear();
+
     for (vector<Edge*>::iterator e = active_edges.begin();
          e != active_edges.end(); ++e) {
       string depfile = (*e)->GetUnescapedDepfile();
@@ -784,6 +1190,7 @@ Node* Builder::AddTarget(const string& name, string* err) {
 }
 
 bool Builder::AddTarget(Node* node, string* err) {
+  TRACE_RECORD("dirty scan");
   if (!scan_.RecomputeDirty(node, err))
     return false;
 
@@ -803,6 +1210,7 @@ bool Builder::AlreadyUpToDate() const {
 }
 
 bool Builder::Build(string* err) {
+  TRACE_RECORD("build");
   assert(!AlreadyUpToDate());
 
   status_->PlanHasTotalEdges(plan_.command_edge_count());
@@ -816,6 +1224,29 @@ bool Builder::Build(string* err) {
     else
       command_runner_.reset(new RealCommandRunner(config_));
   }
+  if (!action_cache_.get() && !config_.action_cache.empty() &&
+      !config_.dry_run) {
+    ActionCache::Backend* backend =
+        ActionCache::OpenBackend(config_.action_cache, disk_interface_, err);
+    if (!backend) {
+      *err = "action cache: " + *err;
+      return false;
+    }
+    // Like the dependencies of commands, what they wrote can only be read
+    // on other threads if the DiskInterface allows it.
+    action_cache_.reset(new ActionCache(backend, &scan_, disk_interface_,
+                                        config_.deps_threads > 1));
+  }
+  if (!deps_reader_.get() && config_.deps_threads > 1 && !config_.dry_run) {
+    deps_reader_.reset(new DepsReader(disk_interface_,
+                                      config_.depfile_parser_options,
+                                      config_.deps_threads));
+  }
+
+  int64_t memory_budget = config_.dry_run ? 0 : config_.max_memory;
+  if (memory_budget < 0)
+    memory_budget = max(GetAvailableMemory(), (int64_t)0);
+  plan_.set_memory_budget(memory_budget);
 
   // We are about to start the build process.
   status_->BuildStarted();
@@ -826,8 +1257,10 @@ bool Builder::Build(string* err) {
   // command runner.
   // Second, we attempt to wait for / reap the next finished command.
   while (plan_.more_to_do()) {
-    // See if we can start any more commands.
-    if (failures_allowed && command_runner_->CanRunMore()) {
+    // See if we can start any more commands.  Edges restored from the
+    // action cache are finished first, so that they don't pile up.
+    if (failures_allowed && restored_.empty() &&
+        command_runner_->CanRunMore()) {
       if (Edge* edge = plan_.FindWork()) {
         if (!StartEdge(edge, err)) {
           Cleanup();
@@ -853,16 +1286,36 @@ bool Builder::Build(string* err) {
     // See if we can reap any finished commands.
     if (pending_commands) {
       CommandRunner::Result result;
-      if (!command_runner_->WaitForCommand(&result) ||
-          result.status == ExitInterrupted) {
+      DepsRead* deps_read = NULL;
+      if (!restored_.empty()) {
+        result = restored_.back();
+        restored_.pop_back();
+      } else if (!deps_reads_.empty()) {
+        // Another thread has usually read the dependencies of the command
+        // that finished first while more commands were started.
+        deps_read = deps_reads_.front();
+        deps_reads_.pop_front();
+        deps_reader_->Wait(&deps_read->request);
+        result = deps_read->result;
+      } else if (!command_runner_->WaitForCommand(&result) ||
+                 (result.edge && result.status == ExitInterrupted)) {
         Cleanup();
         status_->BuildFinished();
         *err = "interrupted by user";
         return false;
+      } else if (!result.edge) {
+        // Nothing finished, but another command can start.
+        continue;
+      } else if (ReadDepsLater(result)) {
+        // Refill the slot of the command while they are read.
+        continue;
       }
 
       --pending_commands;
-      if (!FinishCommand(&result, err)) {
+      bool finished = FinishCommand(&result, err,
+                                    deps_read ? &deps_read->request : NULL);
+      delete deps_read;
+      if (!finished) {
         Cleanup();
         status_->BuildFinished();
         return false;
@@ -893,11 +1346,17 @@ bool Builder::Build(string* err) {
   }
 
   status_->BuildFinished();
+
+  // Wait for what the action cache stored to be written.
+  string flush_err;
+  if (action_cache_.get() && !action_cache_->Flush(&flush_err))
+    Warning("action cache: %s", flush_err.c_str());
   return true;
 }
 
 bool Builder::StartEdge(Edge* edge, string* err) {
   METRIC_RECORD("StartEdge");
+  TRACE_RECORD("StartEdge");
   if (edge->is_phony())
     return true;
 
@@ -911,29 +1370,55 @@ bool Builder::StartEdge(Edge* edge, string* err) {
       return false;
   }
 
-  // Create response file, if needed
+  // Expand the command and the content of the response file once, for the
+  // response file, the build log, the action cache and the command runner
+  // alike.
+  string command;
+  size_t command_end;
+  size_t rspfile_content =
+      edge->EvaluateCommandAndRspfile(&command, &command_end);
+  edge->command_hash(command);
+
+  // Create response file, if needed.  One left by a failed run is usually
+  // still right, and for a large edge is not worth writing again.
   // XXX: this may also block; do we care?
   string rspfile = edge->GetUnescapedRspfile();
   if (!rspfile.empty()) {
-    string content = edge->GetBinding("rspfile_content");
-    if (!disk_interface_->WriteFile(rspfile, content))
+    StringPiece content(command.data() + rspfile_content,
+                        command.size() - rspfile_content);
+    if (!disk_interface_->WriteFileIfChanged(rspfile, content))
       return false;
   }
 
+  // The action cache may take |command|, so keep the command alone first.
+  string run_command(command, 0, command_end);
+  if (action_cache_.get() && RestoreFromActionCache(edge, &command))
+    return true;
+
   // start command computing and run it
-  if (!command_runner_->StartCommand(edge)) {
-    err->assign("command '" + edge->EvaluateCommand() + "' failed.");
+  if (!command_runner_->StartCommand(edge, run_command)) {
+    err->assign("command '" + run_command + "' failed.");
     return false;
   }
 
   return true;
 }
 
-bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
+bool Builder::FinishCommand(CommandRunner::Result* result, string* err,
+                            DepsReader::Request* deps) {
   METRIC_RECORD("FinishCommand");
+  TRACE_RECORD("FinishCommand");
 
   Edge* edge = result->edge;
 
+  // The action cache keeps what the command printed before dependencies are
+  // extracted from it, so that restoring it reproduces those.
+  map<const Edge*, ActionCacheMiss>::iterator cache_miss =
+      action_cache_misses_.find(edge);
+  string raw_output;
+  if (cache_miss != action_cache_misses_.end())
+    raw_output = result->output;
+
   // First try to extract dependencies from the result, if any.
   // This must happen first as it filters the command output (we want
   // to filter /showIncludes output, even on compile failure) and
@@ -942,11 +1427,13 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   vector<Node*> deps_nodes;
   string deps_type = edge->GetBinding("deps");
   const string deps_prefix = edge->GetBinding("msvc_deps_prefix");
+  bool deps_extracted = false;
   if (!deps_type.empty()) {
     string extract_err;
-    if (!ExtractDeps(result, deps_type, deps_prefix, &deps_nodes,
-                     &extract_err) &&
-        result->success()) {
+    deps_extracted = deps ?
+        AddDeps(deps, result, &deps_nodes, &extract_err) :
+        ExtractDeps(result, deps_type, deps_prefix, &deps_nodes, &extract_err);
+    if (!deps_extracted && result->success()) {
       if (!result->output.empty())
         result->output.append("\n");
       result->output.append(extract_err);
@@ -954,6 +1441,38 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
     }
   }
 
+  if (cache_miss != action_cache_misses_.end()) {
+    if (result->success()) {
+      // Dependencies in a depfile that isn't extracted are loaded by the
+      // next build, and must be known now too.
+      vector<Node*> depfile_deps;
+      string extract_err;
+      if (deps_type.empty() && !edge->GetUnescapedDepfile().empty() &&
+          !ExtractDeps(result, "gcc", "", &depfile_deps, &extract_err)) {
+        Warning("action cache: %s", extract_err.c_str());
+      } else {
+        StoreInActionCache(edge, cache_miss->second, raw_output,
+                           deps_type.empty() ? depfile_deps : deps_nodes);
+      }
+    }
+    action_cache_misses_.erase(cache_miss);
+  }
+
+  // The depfile is only removed now, so that the action cache could store
+  // it.
+  if (deps_extracted && deps_type == "gcc" && !g_keep_depfile) {
+    string depfile = edge->GetUnescapedDepfile();
+    if (!depfile.empty() && disk_interface_->RemoveFile(depfile) < 0 &&
+        result->success()) {
+      if (!result->output.empty())
+        result->output.append("\n");
+      result->output.append("deleting depfile: ");
+      result->output.append(strerror(errno));
+      result->output.append("\n");
+      result->status = ExitFailure;
+    }
+  }
+
   int start_time, end_time;
   status_->BuildEdgeFinished(edge, result->success(), result->output,
                              &start_time, &end_time);
@@ -966,8 +1485,11 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   // Restat the edge outputs
   TimeStamp output_mtime = 0;
   bool restat = edge->GetBindingBool("restat");
+  bool hash_inputs = edge->GetBindingBool("hash_inputs") && scan_.build_log();
+  uint64_t input_hash = 0;
   if (!config_.dry_run) {
     bool node_cleaned = false;
+    bool contents_cleaned = false;
 
     for (vector<Node*>::iterator o = edge->outputs_.begin();
          o != edge->outputs_.end(); ++o) {
@@ -983,6 +1505,24 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
         if (!plan_.CleanNode(&scan_, *o, err))
           return false;
         node_cleaned = true;
+      } else if (hash_inputs && new_mtime != 0) {
+        // If the command wrote the same contents as before, the edges using
+        // the output may still be clean, provided they hash their inputs.
+        BuildLog::ContentHash* old_hash =
+            scan_.build_log()->LookupContentHash((*o)->path());
+        bool had_hash = old_hash && old_hash->mtime == (*o)->mtime();
+        string previous = had_hash ? old_hash->digest : string();
+        string digest;
+        string hash_err;
+        if (scan_.build_log()->HashContent((*o)->path(), new_mtime,
+                                           disk_interface_, &digest,
+                                           &hash_err) &&
+            had_hash && digest == previous) {
+          (*o)->UpdateMtime(new_mtime);
+          if (!plan_.CleanNode(&scan_, *o, err))
+            return false;
+          contents_cleaned = true;
+        }
       }
     }
 
@@ -1008,11 +1548,24 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
           restat_mtime = depfile_mtime;
       }
 
+      output_mtime = restat_mtime;
+    }
+
+    if (node_cleaned || contents_cleaned) {
       // The total number of edges in the plan may have changed as a result
       // of a restat.
       status_->PlanHasTotalEdges(plan_.command_edge_count());
+    }
 
-      output_mtime = restat_mtime;
+    // An input newer than the outputs may have changed while the command
+    // ran.  Without a hash, the next build goes by mtimes alone.
+    TimeStamp newest_input;
+    string hash_err;
+    if (hash_inputs &&
+        (!scan_.HashInputs(edge, deps_nodes, &input_hash, &newest_input,
+                           &hash_err) ||
+         newest_input > output_mtime)) {
+      input_hash = 0;
     }
   }
 
@@ -1026,7 +1579,8 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
 
   if (scan_.build_log()) {
     if (!scan_.build_log()->RecordCommand(edge, start_time, end_time,
-                                          output_mtime)) {
+                                          output_mtime, input_hash,
+                                          result->usage)) {
       *err = string("Error writing to build log: ") + strerror(errno);
       return false;
     }
@@ -1048,72 +1602,131 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   return true;
 }
 
+bool Builder::RestoreFromActionCache(Edge* edge, string* command) {
+  // Inputs are hashed with the build log.
+  if (!scan_.build_log() || edge->GetBindingBool("generator") ||
+      edge->GetBindingBool("no_cache") || edge->use_console())
+    return false;
+
+  CommandRunner::Result result;
+  string err;
+  if (action_cache_->Restore(edge, *command, &result.output, &err)) {
+    result.edge = edge;
+    result.status = ExitSuccess;
+    restored_.push_back(result);
+    return true;
+  }
+  if (!err.empty())
+    Warning("action cache: %s", err.c_str());
+
+  uint64_t start_hash;
+  TimeStamp newest_input;
+  if (!scan_.HashInputs(edge, vector<Node*>(), &start_hash, &newest_input,
+                        &err)) {
+    Warning("action cache: %s", err.c_str());
+    return false;
+  }
+  ActionCacheMiss& miss = action_cache_misses_[edge];
+  miss.start_hash = start_hash;
+  miss.command.swap(*command);
+  return false;
+}
+
+void Builder::StoreInActionCache(Edge* edge, const ActionCacheMiss& miss,
+                                 const string& output,
+                                 const vector<Node*>& deps) {
+  // Outputs of inputs that changed while the command ran may not match
+  // either version of them, and so may those of inputs that were only
+  // discovered and are newer than the outputs.
+  uint64_t hash;
+  TimeStamp newest_input;
+  vector<string> inputs;
+  string err;
+  if (!scan_.HashInputs(edge, vector<Node*>(), &hash, &newest_input, &err) ||
+      hash != miss.start_hash) {
+    if (!err.empty())
+      Warning("action cache: %s", err.c_str());
+    return;
+  }
+  scan_.InputPaths(edge, deps, &inputs);
+  string input_digest;
+  if (!scan_.HashPaths(inputs, &input_digest, &newest_input, &err)) {
+    Warning("action cache: %s", err.c_str());
+    return;
+  }
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    TimeStamp mtime = disk_interface_->Stat((*o)->path(), &err);
+    if (mtime <= 0 || mtime < newest_input)
+      return;
+  }
+
+  if (!action_cache_->Store(edge, miss.command, inputs, input_digest, output,
+                            &err)) {
+    Warning("action cache: %s", err.c_str());
+  }
+}
+
 bool Builder::ExtractDeps(CommandRunner::Result* result,
                           const string& deps_type,
                           const string& deps_prefix,
                           vector<Node*>* deps_nodes,
                           string* err) {
-  if (deps_type == "msvc") {
-    CLParser parser;
-    string output;
-    if (!parser.Parse(result->output, deps_prefix, &output, err))
-      return false;
-    result->output = output;
-    for (set<string>::iterator i = parser.includes_.begin();
-         i != parser.includes_.end(); ++i) {
-      // ~0 is assuming that with MSVC-parsed headers, it's ok to always make
-      // all backslashes (as some of the slashes will certainly be backslashes
-      // anyway). This could be fixed if necessary with some additional
-      // complexity in IncludesNormalize::Relativize.
-      deps_nodes->push_back(state_->GetNode(*i, ~0u));
-    }
-  } else
-  if (deps_type == "gcc") {
-    string depfile = result->edge->GetUnescapedDepfile();
-    if (depfile.empty()) {
-      *err = string("edge with deps=gcc but no depfile makes no sense");
-      return false;
-    }
-
-    // Read depfile content.  Treat a missing depfile as empty.
-    string content;
-    switch (disk_interface_->ReadFile(depfile, &content, err)) {
-    case DiskInterface::Okay:
-      break;
-    case DiskInterface::NotFound:
-      err->clear();
-      break;
-    case DiskInterface::OtherError:
-      return false;
-    }
-    if (content.empty())
-      return true;
+  TRACE_RECORD("extract deps");
+  DepsReader::Request request;
+  request.deps_type = deps_type;
+  request.deps_prefix = deps_prefix;
+  if (deps_type == "msvc")
+    request.output.swap(result->output);
+  else
+    request.depfile = result->edge->GetUnescapedDepfile();
+  DepsReader reader(disk_interface_, config_.depfile_parser_options, 1);
+  reader.Read(&request);
+  return AddDeps(&request, result, deps_nodes, err);
+}
 
-    DepfileParser deps(config_.depfile_parser_options);
-    if (!deps.Parse(&content, err))
-      return false;
+bool Builder::AddDeps(DepsReader::Request* request,
+                      CommandRunner::Result* result,
+                      vector<Node*>* deps_nodes, string* err) {
+  if (request->deps_type == "msvc")
+    result->output.swap(request->output);
+  if (!request->success) {
+    if (request->deps_type != "msvc" && request->deps_type != "gcc")
+      Fatal("%s", request->err.c_str());
+    *err = request->err;
+    return false;
+  }
+  deps_nodes->reserve(request->deps.size());
+  for (vector<pair<StringPiece, uint64_t> >::iterator i =
+           request->deps.begin(); i != request->deps.end(); ++i) {
+    deps_nodes->push_back(state_->GetNode(i->first, i->second));
+  }
+  return true;
+}
 
-    // XXX check depfile matches expected output.
-    deps_nodes->reserve(deps.ins_.size());
-    for (vector<StringPiece>::iterator i = deps.ins_.begin();
-         i != deps.ins_.end(); ++i) {
-      uint64_t slash_bits;
-      if (!CanonicalizePath(const_cast<char*>(i->str_), &i->len_, &slash_bits,
-                            err))
-        return false;
-      deps_nodes->push_back(state_->GetNode(*i, slash_bits));
-    }
+bool Builder::ReadDepsLater(const CommandRunner::Result& result) {
+  // A failure is finished at once, so that no more commands are started
+  // than the failures allowed.
+  if (!deps_reader_.get() || !result.success())
+    return false;
+  Edge* edge = result.edge;
+  string deps_type = edge->GetBinding("deps");
+  if (deps_type.empty())
+    return false;
 
-    if (!g_keep_depfile) {
-      if (disk_interface_->RemoveFile(depfile) < 0) {
-        *err = string("deleting depfile: ") + strerror(errno) + string("\n");
-        return false;
-      }
-    }
+  DepsRead* read = new DepsRead;
+  read->result = result;
+  DepsReader::Request* request = &read->request;
+  request->deps_type = deps_type;
+  if (deps_type == "msvc") {
+    request->deps_prefix = edge->GetBinding("msvc_deps_prefix");
+    // What the command printed is kept as it is for the action cache.
+    request->output = result.output;
   } else {
-    Fatal("unknown deps type '%s'", deps_type.c_str());
+    request->depfile = edge->GetUnescapedDepfile();
   }
-
+  deps_reads_.push_back(read);
+  deps_reader_->Push(request);
   return true;
 }
 
@@ -16,6 +16,7 @@
 #define NINJA_BUILD_H_
 
 #include <cstdio>
+#include <deque>
 #include <map>
 #include <memory>
 #include <queue>
@@ -23,18 +24,23 @@
 #include <string>
 #include <vector>
 
+#include "cgroup.h"
 #include "depfile_parser.h"
+#include "deps_reader.h"
 #include "graph.h"  // XXX needed for DependencyScan; should rearrange.
 #include "exit_status.h"
 #include "line_printer.h"
 #include "metrics.h"
+#include "resource_usage.h"
 #include "util.h"  // int64_t
 
+struct ActionCache;
 struct BuildLog;
 struct BuildStatus;
 struct Builder;
 struct DiskInterface;
 struct Edge;
+struct Jobserver;
 struct Node;
 struct State;
 
@@ -48,10 +54,21 @@ struct Plan {
   /// fill in |err| with an error message if there's a problem.
   bool AddTarget(const Node* node, string* err);
 
-  // Pop a ready edge off the queue of edges to build.
+  // Pop a ready edge off the queue of edges to build.  Edges on the longest
+  // remaining path to the targets are handed out first, except that edges
+  // that would not fit in the memory budget are held back.
   // Returns NULL if there's no work to do.
   Edge* FindWork();
 
+  /// Keep the memory that the edges handed out by FindWork() and not yet
+  /// finished are expected to use at their peak within |budget| kilobytes,
+  /// and each edge within the memory available when it would start.  An
+  /// edge is expected to use what the last run of its command did, or what
+  /// the edges of its rule did on average.  Edges that would not fit are
+  /// held back until an edge expected to use memory finishes, while edges
+  /// that fit keep being handed out.  0 means there is no budget.
+  void set_memory_budget(int64_t budget) { memory_budget_ = budget; }
+
   /// Returns true if there's more work to be done.
   bool more_to_do() const { return wanted_edges_ > 0 && command_edges_ > 0; }
 
@@ -79,6 +96,11 @@ struct Plan {
   /// Reset state.  Clears want and ready sets.
   void Reset();
 
+  /// Compute the critical path weights of the edges added since the last
+  /// call and queue those that are ready to run.  Called implicitly by
+  /// FindWork().
+  void PrepareQueue();
+
   /// Update the build plan to account for modifications made to the graph
   /// by information loaded from a dyndep file.
   bool DyndepsLoaded(DependencyScan* scan, const Node* node,
@@ -98,6 +120,9 @@ private:
   /// Enumerate possible steps we want for an edge.
   enum Want
   {
+    /// The edge is not part of the plan: we want neither it nor any of its
+    /// dependents.
+    kNotInPlan,
     /// We do not want to build the edge, but we might want to build one of
     /// its dependents.
     kWantNothing,
@@ -109,23 +134,115 @@ private:
   };
 
   void EdgeWanted(const Edge* edge);
-  bool EdgeMaybeReady(map<Edge*, Want>::iterator want_e, string* err);
+
+  Want GetWant(const Edge* edge) const {
+    return edge->id_ < want_.size() ? want_[edge->id_] : kNotInPlan;
+  }
+  void SetWant(const Edge* edge, Want want);
+
+  /// Count the inputs of |edge| whose producing edges are not done yet,
+  /// into |pending_inputs_|.
+  void CountPendingInputs(const Edge* edge);
+
+  /// Add the durations and peak memory that the build log records for the
+  /// newly wanted |edges| to the estimates for edges it has none for.
+  void AddLoggedUsage(const vector<Edge*>& edges);
+
+  /// Assign every wanted edge reachable from |roots| the length of the
+  /// longest path from it to a target, using durations recorded in the
+  /// build log as edge costs.  The weight the roots already have counts
+  /// as the length of the path from them.
+  void ComputeCriticalPath(const vector<Edge*>& roots);
+
+  /// Append the wanted, not yet scheduled edges that |edge| depends on, and
+  /// then |edge| itself, to |order|, skipping edges already |visited|.
+  void CriticalPathVisit(Edge* edge, vector<bool>* visited,
+                         vector<Edge*>* order) const;
+
+  /// Estimated cost of running |edge|: its last recorded duration, or the
+  /// average of those of the logged edges if it has none.
+  int64_t EdgeWeight(const Edge* edge) const;
+
+  /// Estimated peak memory of |edge| in kilobytes, or 0 if it is unknown.
+  int64_t EdgeMemory(const Edge* edge) const;
+
+  /// Whether an edge expected to use |memory| fits in the memory budget.
+  bool FitsInMemory(int64_t memory);
+
+  /// The memory available, in kilobytes, or a negative value if it is not
+  /// known.  Since reading it takes several files, it is sampled at most
+  /// every kMemorySampleMillis, less what the edges handed out since then
+  /// are expected to use.
+  int64_t AvailableMemory();
+
+  /// Account for |edge| no longer running, and give the edges held back
+  /// for lack of memory another chance if it used some.
+  void ReleaseMemory(const Edge* edge);
+
+  /// Schedule the edges in |new_edges_| whose inputs are already ready.
+  void ScheduleInitialEdges();
+  bool EdgeMaybeReady(Edge* edge, string* err);
 
   /// Submits a ready edge as a candidate for execution.
   /// The edge may be delayed from running, for example if it's a member of a
   /// currently-full pool.
-  void ScheduleWork(map<Edge*, Want>::iterator want_e);
+  void ScheduleWork(Edge* edge);
+
+  /// Keep track of which edges we want to build in this plan, indexed by
+  /// Edge::id_.  Edges beyond the end of the vector are kNotInPlan.
+  vector<Want> want_;
 
-  /// Keep track of which edges we want to build in this plan.  If this map does
-  /// not contain an entry for an edge, we do not want to build the entry or its
-  /// dependents.  If it does contain an entry, the enumeration indicates what
-  /// we want for the edge.
-  map<Edge*, Want> want_;
+  /// The number of inputs each edge in the plan waits for, indexed by
+  /// Edge::id_ like |want_|: the inputs made by edges whose outputs are not
+  /// ready.  An edge listing an input twice waits for it twice.  Counted
+  /// when the edge is added to the plan and decremented as the edges making
+  /// its inputs finish, so that an edge with many inputs is not rescanned
+  /// each time one of them is done.
+  vector<int> pending_inputs_;
 
-  set<Edge*> ready_;
+  /// All edges that have been added to |want_|, in the order they were
+  /// added.  Used for debugging output.
+  vector<Edge*> planned_edges_;
+
+  EdgePriorityQueue ready_;
 
   Builder* builder_;
 
+  /// See set_memory_budget().
+  int64_t memory_budget_;
+  /// The sum of |running_memory_|.
+  int64_t committed_memory_;
+  /// The expected peak memory of the edges handed out by FindWork() that
+  /// are expected to use any.
+  map<const Edge*, int64_t> running_memory_;
+  /// Ready edges held back for lack of memory.
+  vector<Edge*> memory_deferred_;
+  /// The total peak memory of the wanted edges of each rule that have
+  /// any logged, and their number, for edges that have none logged.
+  map<const Rule*, pair<int64_t, int> > rule_memory_;
+  /// The total duration of the wanted edges that have any logged, and
+  /// their number, for the weight of edges that have none logged.
+  int64_t logged_duration_;
+  int logged_edges_;
+  /// The cgroup memory of the process, found when memory is first sampled.
+#if __cplusplus < 201703L
+  auto_ptr<CgroupMemory> cgroup_memory_;
+#else
+  unique_ptr<CgroupMemory> cgroup_memory_;
+#endif
+  /// The memory available when it was last sampled, the time of that in
+  /// milliseconds, or -1 if it is yet to be sampled, and |committed_memory_|
+  /// then.
+  int64_t memory_sample_;
+  int64_t memory_sample_time_;
+  int64_t memory_sample_committed_;
+
+  /// Targets added since the queue was last prepared.
+  vector<const Node*> targets_;
+
+  /// Edges that became wanted since the queue was last prepared.
+  vector<Edge*> new_edges_;
+
   /// Total number of edges that have commands (not phony).
   int command_edges_;
 
@@ -139,7 +256,8 @@ private:
 struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual bool CanRunMore() const = 0;
-  virtual bool StartCommand(Edge* edge) = 0;
+  /// Start running |command|, the expanded command of |edge|.
+  virtual bool StartCommand(Edge* edge, const string& command) = 0;
 
   /// The result of waiting for a command.
   struct Result {
@@ -147,9 +265,12 @@ struct CommandRunner {
     Edge* edge;
     ExitStatus status;
     string output;
+    ResourceUsage usage;
     bool success() const { return status == ExitSuccess; }
   };
   /// Wait for a command to complete, or return false if interrupted.
+  /// Returns with |result->edge| NULL instead if more commands can run
+  /// though none completed, as when a jobserver token came free.
   virtual bool WaitForCommand(Result* result) = 0;
 
   virtual vector<Edge*> GetActiveEdges() { return vector<Edge*>(); }
@@ -159,7 +280,9 @@ struct CommandRunner {
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
   BuildConfig() : verbosity(NORMAL), dry_run(false), parallelism(1),
-                  failures_allowed(1), max_load_average(-0.0f) {}
+                  failures_allowed(1), max_load_average(-0.0f),
+                  max_pressure(-0.0f), max_memory(-1), deps_threads(1),
+                  jobserver(NULL), hangup_fd(-1) {}
 
   enum Verbosity {
     NORMAL,
@@ -173,7 +296,31 @@ struct BuildConfig {
   /// The maximum load average we must not exceed. A negative value
   /// means that we do not have any limit.
   double max_load_average;
+  /// The percentage of the time that tasks may stall waiting for CPU,
+  /// memory or I/O before fewer commands are run; see PressureThrottle.
+  /// A negative value means that we do not have any limit.
+  double max_pressure;
+  /// The memory, in kilobytes, that the commands running may be expected
+  /// to use at their peak, going by what they used before; see
+  /// Plan::set_memory_budget().  0 means no limit, and a negative value the
+  /// memory available when the build starts.
+  int64_t max_memory;
   DepfileParserOptions depfile_parser_options;
+  /// How many threads may read the dependencies of commands that finished
+  /// at once, counting the one running the build.  More than one lets
+  /// commands be started while they are read, and the action cache read
+  /// what commands wrote on another thread.  It requires a DiskInterface
+  /// that can be called from several threads.
+  int deps_threads;
+  /// The directory or http:// URL of the action cache, or empty if there
+  /// is none.
+  string action_cache;
+  /// The jobserver to take a token from for each command run beyond the
+  /// first, or NULL if there is none.  Not owned.
+  Jobserver* jobserver;
+  /// A descriptor whose becoming readable interrupts the build as SIGHUP
+  /// would, or -1 if there is none; see SubprocessSet::WatchHangup().
+  int hangup_fd;
 };
 
 /// Builder wraps the build process: starting commands, updating status.
@@ -201,15 +348,21 @@ struct Builder {
 
   bool StartEdge(Edge* edge, string* err);
 
-  /// Update status ninja logs following a command termination.
+  /// Update status ninja logs following a command termination.  |deps| are
+  /// the dependencies of the command if they were read already.
   /// @return false if the build can not proceed further due to a fatal error.
-  bool FinishCommand(CommandRunner::Result* result, string* err);
+  bool FinishCommand(CommandRunner::Result* result, string* err,
+                     DepsReader::Request* deps = NULL);
 
   /// Used for tests.
   void SetBuildLog(BuildLog* log) {
     scan_.set_build_log(log);
   }
 
+  BuildLog* build_log() const {
+    return scan_.build_log();
+  }
+
   /// Load the dyndep information provided by the given node.
   bool LoadDyndeps(Node* node, string* err);
 
@@ -227,10 +380,63 @@ struct Builder {
    bool ExtractDeps(CommandRunner::Result* result, const string& deps_type,
                     const string& deps_prefix, vector<Node*>* deps_nodes,
                     string* err);
+  /// Look up the nodes of the dependencies |request| read for the command
+  /// of |result|, and give it what the command printed less what was read.
+  bool AddDeps(DepsReader::Request* request, CommandRunner::Result* result,
+               vector<Node*>* deps_nodes, string* err);
+  /// Have the dependencies of the command of |result| read on another
+  /// thread, if they can be.  Returns true if they are, in which case the
+  /// command is finished once they have been read.
+  bool ReadDepsLater(const CommandRunner::Result& result);
+
+  /// A running edge that wasn't in the action cache.
+  struct ActionCacheMiss {
+    /// The hash of its known inputs when it started, to tell whether they
+    /// changed while it ran.
+    uint64_t start_hash;
+    /// Its EvaluateCommand(true), kept from when it started rather than
+    /// expanded again.
+    string command;
+  };
+
+  /// Restore the outputs of |edge| from the action cache, if it is cached
+  /// there, given its |command| as EvaluateCommand(true) returns it.
+  /// Returns true if it was, in which case its result is queued in
+  /// |restored_| instead of running its command.  Otherwise |command| may
+  /// be taken, to store the outputs later.
+  bool RestoreFromActionCache(Edge* edge, string* command);
+  /// Store the outputs of |edge| from when it was a |miss|, and which
+  /// printed |output| and discovered |deps|.
+  void StoreInActionCache(Edge* edge, const ActionCacheMiss& miss,
+                          const string& output, const vector<Node*>& deps);
 
   DiskInterface* disk_interface_;
   DependencyScan scan_;
 
+#if __cplusplus < 201703L
+  auto_ptr<ActionCache> action_cache_;
+#else
+  unique_ptr<ActionCache> action_cache_;
+#endif
+  /// Each running edge that wasn't in the action cache.
+  map<const Edge*, ActionCacheMiss> action_cache_misses_;
+  /// Results of edges restored from the action cache, yet to be finished.
+  vector<CommandRunner::Result> restored_;
+
+  /// A command that finished, whose dependencies are being read.
+  struct DepsRead {
+    CommandRunner::Result result;
+    DepsReader::Request request;
+  };
+  /// Commands whose dependencies are being read on other threads, in the
+  /// order they finished.
+  deque<DepsRead*> deps_reads_;
+#if __cplusplus < 201703L
+  auto_ptr<DepsReader> deps_reader_;
+#else
+  unique_ptr<DepsReader> deps_reader_;
+#endif
+
   // Unimplemented copy ctor and operator= ensure we don't copy the auto_ptr.
   Builder(const Builder &other);        // DO NOT IMPLEMENT
   void operator=(const Builder &other); // DO NOT IMPLEMENT
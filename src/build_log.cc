@@ -23,10 +23,13 @@
 #include "build_log.h"
 #include "disk_interface.h"
 
+#include <assert.h>
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <algorithm>
+
 #ifndef _WIN32
 #include <inttypes.h>
 #include <unistd.h>
@@ -35,6 +38,8 @@
 #include "build.h"
 #include "graph.h"
 #include "metrics.h"
+#include "sha256.h"
+#include "trace.h"
 #include "util.h"
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 #define strtoll _strtoi64
@@ -46,12 +51,71 @@
 // older runs.
 // Once the number of redundant entries exceeds a threshold, we write
 // out a new file and replace the existing one with it.
+//
+// Since version 6, the file is binary, in the native byte order (as with
+// the deps log, the version doubles as a byte order mark):
+//    a 24-byte header: the signature, padded with NULs to 16 bytes, the
+//      offset of the index or 0, and 4 reserved bytes
+//    records, each starting with a 4-byte word whose two high bits tell
+//      entry records and hash records from path records:
+//      path records hold the size of the rest of the record, then the path
+//        padded with up to 3 NULs to a multiple of 4 bytes
+//      entry records are an EntryRecord, referring to the path record of
+//        their output by its offset in the file
+//      hash records are a HashRecord, likewise referring to the path record
+//        of the file whose contents were hashed
+//    when the log was written by recompaction, the index: a 4-byte bucket
+//      count and entry count, and then an open addressing hash table of
+//      IndexBuckets referring to the path record of each entry, every one
+//      of which is directly followed by its entry record
+//    records appended since the last recompaction, just like the above;
+//      recompaction writes the hash records here too, as they aren't
+//      indexed.
+// Offsets are 32 bits, which limits the log to 4GB.
 
 namespace {
 
 const char kFileSignature[] = "# ninja log v%d\n";
 const int kOldestSupportedVersion = 4;
-const int kCurrentVersion = 5;
+const int kCurrentVersion = 6;
+/// Logs of older versions are text.
+const int kFirstBinaryVersion = 6;
+
+const size_t kSignatureSize = 16;
+const size_t kHeaderSize = kSignatureSize + 8;
+
+/// Entry records have the high bit of their first word set, hash records
+/// the next one.
+const unsigned kEntryRecordBit = 0x80000000;
+const unsigned kHashRecordBit = 0x40000000;
+/// Paths are capped like deps log records, so that a corrupt size is
+/// noticed early.
+const unsigned kMaxPathRecordSize = (1 << 19) - 1;
+
+struct EntryRecord {
+  uint32_t path_offset;
+  int32_t start_time;
+  int32_t end_time;
+  uint32_t mtime[2];  // Low and high 32 bits.
+  uint32_t command_hash[2];
+  uint32_t input_hash[2];
+  uint32_t user_time;
+  uint32_t system_time;
+  uint32_t max_rss;
+  uint32_t blocks_in;
+  uint32_t blocks_out;
+};
+
+struct HashRecord {
+  uint32_t path_offset;
+  uint32_t mtime[2];
+  unsigned char digest[Sha256::kDigestSize];
+};
+
+struct IndexBucket {
+  uint32_t hash;  // The high 32 bits of the hash of the path.
+  uint32_t path_offset;  // 0 if the bucket is empty.
+};
 
 // 64bit MurmurHash2, by Austin Appleby
 #if defined(_MSC_VER)
@@ -101,6 +165,145 @@ uint64_t MurmurHash64A(const void* key, size_t len) {
 }
 #undef BIG_CONSTANT
 
+uint64_t HashPath(StringPiece path) {
+  return MurmurHash64A(path.str_, path.len_);
+}
+
+/// Return the path of the path record at |offset| in the |size| bytes at
+/// |data|, or an empty StringPiece if there is no valid one.  If |end| is
+/// given, it is set to the end of the record.
+StringPiece PathRecordAt(const char* data, size_t size, size_t offset,
+                         size_t* end = NULL) {
+  if (offset < kHeaderSize || offset % 4 != 0 || offset > size ||
+      size - offset < 4)
+    return StringPiece();
+  uint32_t record_size;
+  memcpy(&record_size, data + offset, 4);
+  if (record_size == 0 || record_size > kMaxPathRecordSize ||
+      record_size % 4 != 0 || size - offset - 4 < record_size)
+    return StringPiece();
+  const char* path = data + offset + 4;
+  size_t path_size = record_size;
+  // There can be up to 3 bytes of padding.
+  if (path[path_size - 1] == '\0') --path_size;
+  if (path[path_size - 1] == '\0') --path_size;
+  if (path[path_size - 1] == '\0') --path_size;
+  if (path[path_size - 1] == '\0')
+    return StringPiece();
+  if (end)
+    *end = offset + 4 + record_size;
+  return StringPiece(path, path_size);
+}
+
+/// Read the entry record at |offset| in the |size| bytes at |data| into
+/// |record|.  Returns false if there is no valid one.  If |end| is given,
+/// it is set to the end of the record.
+bool EntryRecordAt(const char* data, size_t size, size_t offset,
+                   EntryRecord* record, size_t* end = NULL) {
+  if (offset > size || size - offset < 4)
+    return false;
+  uint32_t word;
+  memcpy(&word, data + offset, 4);
+  size_t record_size = word & ~kEntryRecordBit;
+  if (!(word & kEntryRecordBit) || record_size != sizeof(*record) ||
+      size - offset - 4 < record_size)
+    return false;
+  memcpy(record, data + offset + 4, record_size);
+  if (end)
+    *end = offset + 4 + record_size;
+  return true;
+}
+
+/// Read the hash record at |offset| in the |size| bytes at |data| into
+/// |record|.  Returns false if there is no valid one.
+bool HashRecordAt(const char* data, size_t size, size_t offset,
+                  HashRecord* record) {
+  if (offset > size || size - offset < 4 + sizeof(*record))
+    return false;
+  uint32_t word;
+  memcpy(&word, data + offset, 4);
+  if (word != (kHashRecordBit | sizeof(*record)))
+    return false;
+  memcpy(record, data + offset + 4, sizeof(*record));
+  return true;
+}
+
+uint64_t Join(const uint32_t (&halves)[2]) {
+  return ((uint64_t)halves[1] << 32) | halves[0];
+}
+
+void Split(uint64_t value, uint32_t (*halves)[2]) {
+  (*halves)[0] = (uint32_t)(value & 0xffffffff);
+  (*halves)[1] = (uint32_t)(value >> 32);
+}
+
+void FillEntry(BuildLog::LogEntry* entry, const EntryRecord& record) {
+  entry->start_time = record.start_time;
+  entry->end_time = record.end_time;
+  entry->mtime = (TimeStamp)Join(record.mtime);
+  entry->command_hash = Join(record.command_hash);
+  entry->input_hash = Join(record.input_hash);
+  entry->usage.user_time = record.user_time;
+  entry->usage.system_time = record.system_time;
+  entry->usage.max_rss = record.max_rss;
+  entry->usage.blocks_in = record.blocks_in;
+  entry->usage.blocks_out = record.blocks_out;
+}
+
+/// Return the size of the path record of |path|.
+size_t PathRecordSize(const string& path) {
+  return 4 + path.size() + (4 - path.size() % 4) % 4;
+}
+
+/// Write a path record of |path| to |f|.
+bool WritePathRecord(FILE* f, const string& path) {
+  uint32_t path_size = path.size();
+  uint32_t padding = (4 - path_size % 4) % 4;
+  uint32_t record_size = path_size + padding;
+  if (record_size > kMaxPathRecordSize) {
+    errno = ERANGE;
+    return false;
+  }
+  return fwrite(&record_size, 4, 1, f) == 1 &&
+      fwrite(path.data(), path_size, 1, f) == 1 &&
+      (!padding || fwrite("\0\0", padding, 1, f) == 1);
+}
+
+/// Write the records for |entry|, whose path record is at |path_offset| or
+/// is to be written first if |write_path|, to |f|.
+bool WriteRecords(FILE* f, const BuildLog::LogEntry& entry,
+                  uint32_t path_offset, bool write_path) {
+  if (write_path && !WritePathRecord(f, entry.output))
+    return false;
+
+  EntryRecord record;
+  record.path_offset = path_offset;
+  record.start_time = entry.start_time;
+  record.end_time = entry.end_time;
+  Split((uint64_t)entry.mtime, &record.mtime);
+  Split(entry.command_hash, &record.command_hash);
+  Split(entry.input_hash, &record.input_hash);
+  record.user_time = entry.usage.user_time;
+  record.system_time = entry.usage.system_time;
+  record.max_rss = entry.usage.max_rss;
+  record.blocks_in = entry.usage.blocks_in;
+  record.blocks_out = entry.usage.blocks_out;
+  uint32_t word = kEntryRecordBit | sizeof(record);
+  return fwrite(&word, 4, 1, f) == 1 && fwrite(&record, sizeof(record), 1, f) == 1;
+}
+
+/// Write a hash record of |content_hash|, whose path record is at
+/// |path_offset|, to |f|.
+bool WriteHashRecord(FILE* f, const BuildLog::ContentHash& content_hash,
+                     uint32_t path_offset) {
+  HashRecord record;
+  record.path_offset = path_offset;
+  Split((uint64_t)content_hash.mtime, &record.mtime);
+  assert(content_hash.digest.size() == sizeof(record.digest));
+  memcpy(record.digest, content_hash.digest.data(), sizeof(record.digest));
+  uint32_t word = kHashRecordBit | sizeof(record);
+  return fwrite(&word, 4, 1, f) == 1 && fwrite(&record, sizeof(record), 1, f) == 1;
+}
 
 }  // namespace
 
@@ -110,19 +313,22 @@ uint64_t BuildLog::LogEntry::HashCommand(StringPiece command) {
 }
 
 BuildLog::LogEntry::LogEntry(const string& output)
-  : output(output) {}
+  : output(output), input_hash(0) {}
 
 BuildLog::LogEntry::LogEntry(const string& output, uint64_t command_hash,
   int start_time, int end_time, TimeStamp restat_mtime)
   : output(output), command_hash(command_hash),
-    start_time(start_time), end_time(end_time), mtime(restat_mtime)
+    start_time(start_time), end_time(end_time), mtime(restat_mtime),
+    input_hash(0)
 {}
 
 BuildLog::BuildLog()
-  : log_file_(NULL), needs_recompaction_(false) {}
+  : log_file_(NULL), needs_recompaction_(false), index_offset_(0),
+    index_buckets_(0) {}
 
 BuildLog::~BuildLog() {
   Close();
+  Clear();
 }
 
 bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
@@ -137,7 +343,8 @@ bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
     *err = strerror(errno);
     return false;
   }
-  setvbuf(log_file_, NULL, _IOLBF, BUFSIZ);
+  // Records are flushed one by one, so that they aren't written partially.
+  setvbuf(log_file_, NULL, _IOFBF, BUFSIZ);
   SetCloseOnExec(fileno(log_file_));
 
   // Opening a file in append mode doesn't set the file pointer to the file's
@@ -145,7 +352,10 @@ bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
   fseek(log_file_, 0, SEEK_END);
 
   if (ftell(log_file_) == 0) {
-    if (fprintf(log_file_, kFileSignature, kCurrentVersion) < 0) {
+    char header[kHeaderSize] = {};
+    snprintf(header, kSignatureSize, kFileSignature, kCurrentVersion);
+    if (fwrite(header, sizeof(header), 1, log_file_) < 1 ||
+        fflush(log_file_) != 0) {
       *err = strerror(errno);
       return false;
     }
@@ -155,17 +365,14 @@ bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
 }
 
 bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
-                             TimeStamp mtime) {
-  string command = edge->EvaluateCommand(true);
-  uint64_t command_hash = LogEntry::HashCommand(command);
+                             TimeStamp mtime, uint64_t input_hash,
+                             const ResourceUsage& usage) {
+  uint64_t command_hash = edge->command_hash();
   for (vector<Node*>::iterator out = edge->outputs_.begin();
        out != edge->outputs_.end(); ++out) {
     const string& path = (*out)->path();
-    Entries::iterator i = entries_.find(path);
-    LogEntry* log_entry;
-    if (i != entries_.end()) {
-      log_entry = i->second;
-    } else {
+    LogEntry* log_entry = LookupByOutput(path);
+    if (!log_entry) {
       log_entry = new LogEntry(path);
       entries_.insert(Entries::value_type(log_entry->output, log_entry));
     }
@@ -173,9 +380,11 @@ bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->mtime = mtime;
+    log_entry->input_hash = input_hash;
+    log_entry->usage = usage;
 
     if (log_file_) {
-      if (!WriteEntry(log_file_, *log_entry))
+      if (!WriteRecord(*log_entry))
         return false;
       if (fflush(log_file_) != 0) {
           return false;
@@ -185,6 +394,91 @@ bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
   return true;
 }
 
+bool BuildLog::WriteRecord(const LogEntry& entry) {
+  if (unsigned path_offset = PathOffset(entry.output))
+    return WriteRecords(log_file_, entry, path_offset, false);
+
+  long offset = ftell(log_file_);
+  if (offset < 0)
+    return false;
+  if ((unsigned long)offset > 0xffffffffUL) {
+    errno = EFBIG;
+    return false;
+  }
+  if (!WriteRecords(log_file_, entry, offset, true))
+    return false;
+  path_offsets_[entry.output] = offset;
+  return true;
+}
+
+bool BuildLog::WriteRecord(const ContentHash& content_hash) {
+  unsigned path_offset;
+  return EnsurePathRecord(content_hash.path, &path_offset) &&
+      WriteHashRecord(log_file_, content_hash, path_offset);
+}
+
+bool BuildLog::EnsurePathRecord(const string& path, unsigned* offset) {
+  if ((*offset = PathOffset(path)))
+    return true;
+  long end = ftell(log_file_);
+  if (end < 0)
+    return false;
+  if ((unsigned long)end > 0xffffffffUL) {
+    errno = EFBIG;
+    return false;
+  }
+  if (!WritePathRecord(log_file_, path))
+    return false;
+  *offset = end;
+  // Key the offset with a string that lives as long as the log does.
+  ContentHashes::iterator i = content_hashes_.find(path);
+  Entries::iterator e = entries_.find(path);
+  if (e != entries_.end())
+    path_offsets_[e->second->output] = *offset;
+  else if (i != content_hashes_.end())
+    path_offsets_[i->second->path] = *offset;
+  return true;
+}
+
+BuildLog::ContentHash* BuildLog::LookupContentHash(const string& path) {
+  ContentHashes::iterator i = content_hashes_.find(path);
+  return i != content_hashes_.end() ? i->second : NULL;
+}
+
+bool BuildLog::HashContent(const string& path, TimeStamp mtime,
+                           DiskInterface* disk_interface, string* digest,
+                           string* err) {
+  if (mtime == 0) {
+    digest->clear();
+    return true;
+  }
+  ContentHash* content_hash = LookupContentHash(path);
+  if (content_hash && content_hash->mtime == mtime) {
+    *digest = content_hash->digest;
+    return true;
+  }
+
+  METRIC_RECORD("hash file contents");
+  string contents;
+  if (disk_interface->ReadFile(path, &contents, err) != DiskInterface::Okay)
+    return false;
+  if (!content_hash) {
+    content_hash = new ContentHash(path);
+    content_hashes_.insert(ContentHashes::value_type(content_hash->path,
+                                                     content_hash));
+  }
+  content_hash->mtime = mtime;
+  content_hash->digest = *digest = Sha256::Hash(contents);
+
+  if (log_file_) {
+    if (!WriteRecord(*content_hash) || fflush(log_file_) != 0) {
+      *err = string("Error writing to build log: ") + strerror(errno);
+      return false;
+    }
+  }
+  return true;
+}
+
 void BuildLog::Close() {
   if (log_file_)
     fclose(log_file_);
@@ -244,6 +538,173 @@ struct LineReader {
 
 LoadStatus BuildLog::Load(const string& path, string* err) {
   METRIC_RECORD(".ninja_log load");
+  TRACE_RECORD(".ninja_log load");
+  Clear();
+  needs_recompaction_ = false;
+
+  int ret = file_.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+
+  char signature[kSignatureSize + 1] = {};
+  if (file_.size())
+    memcpy(signature, file_.data(), min(file_.size(), kSignatureSize));
+  int log_version = 0;
+  sscanf(signature, kFileSignature, &log_version);
+  if (log_version >= kFirstBinaryVersion)
+    return LoadBinary(path, err);
+  file_.Close();
+  return LoadText(path, err);
+}
+
+LoadStatus BuildLog::LoadBinary(const string& path, string* err) {
+  const char* data = file_.data();
+  size_t size = file_.size();
+
+  char expected[kSignatureSize] = {};
+  snprintf(expected, sizeof(expected), kFileSignature, kCurrentVersion);
+  bool valid_header = size >= kHeaderSize &&
+      memcmp(data, expected, kSignatureSize) == 0 && size <= 0xffffffffUL;
+  uint32_t index_offset = 0;
+  uint32_t index_buckets = 0;
+  uint32_t index_entries = 0;
+  size_t offset = kHeaderSize;
+  if (valid_header) {
+    memcpy(&index_offset, data + kSignatureSize, 4);
+    if (index_offset) {
+      if (index_offset < kHeaderSize || index_offset % 4 != 0 ||
+          size - 8 < index_offset) {
+        valid_header = false;
+      } else {
+        memcpy(&index_buckets, data + index_offset, 4);
+        memcpy(&index_entries, data + index_offset + 4, 4);
+        offset = index_offset + 8 + (size_t)index_buckets * sizeof(IndexBucket);
+        if (index_buckets == 0 || (index_buckets & (index_buckets - 1)) ||
+            index_buckets > (size - index_offset) / sizeof(IndexBucket) ||
+            offset > size) {
+          valid_header = false;
+        }
+      }
+    }
+  }
+  if (!valid_header) {
+    *err = "bad build log signature, version or index; starting over";
+    file_.Close();
+    unlink(path.c_str());
+    // Don't report this as a failure.  An empty build log will cause
+    // us to rebuild the outputs anyway.
+    return LOAD_SUCCESS;
+  }
+  index_offset_ = index_offset;
+  index_buckets_ = index_buckets;
+  indexed_entries_.resize(index_buckets);
+
+  // Entries in the index are read when they are looked up; the records
+  // after it are newer, and are read right away.
+  int total_entry_count = 0;
+  bool read_failed = false;
+  while (offset < size) {
+    uint32_t word;
+    if (size - offset < 4) {
+      read_failed = true;
+      break;
+    }
+    memcpy(&word, data + offset, 4);
+    if (word & kHashRecordBit) {
+      HashRecord record;
+      StringPiece path;
+      if (!HashRecordAt(data, size, offset, &record) ||
+          record.path_offset >= offset ||
+          (path = PathRecordAt(data, size, record.path_offset)).size() == 0) {
+        read_failed = true;
+        break;
+      }
+      offset += 4 + sizeof(record);
+
+      ContentHash* content_hash;
+      ContentHashes::iterator i = content_hashes_.find(path);
+      if (i != content_hashes_.end()) {
+        content_hash = i->second;
+      } else {
+        content_hash = new ContentHash(path.AsString());
+        content_hashes_.insert(ContentHashes::value_type(content_hash->path,
+                                                         content_hash));
+        path_offsets_.insert(PathOffsets::value_type(content_hash->path,
+                                                     record.path_offset));
+      }
+      content_hash->mtime = (TimeStamp)Join(record.mtime);
+      content_hash->digest.assign((const char*)record.digest,
+                                  sizeof(record.digest));
+      continue;
+    }
+    if (!(word & kEntryRecordBit)) {
+      size_t end;
+      if (PathRecordAt(data, size, offset, &end).size() == 0) {
+        read_failed = true;
+        break;
+      }
+      offset = end;
+      continue;
+    }
+
+    EntryRecord record;
+    StringPiece output;
+    size_t end;
+    if (!EntryRecordAt(data, size, offset, &record, &end) ||
+        record.path_offset >= offset ||
+        (output = PathRecordAt(data, size, record.path_offset)).size() == 0) {
+      read_failed = true;
+      break;
+    }
+    offset = end;
+
+    LogEntry* entry;
+    Entries::iterator i = entries_.find(output);
+    if (i != entries_.end()) {
+      entry = i->second;
+    } else {
+      entry = new LogEntry(output.AsString());
+      entries_.insert(Entries::value_type(entry->output, entry));
+      path_offsets_[entry->output] = record.path_offset;
+    }
+    FillEntry(entry, record);
+    ++total_entry_count;
+  }
+
+  if (read_failed) {
+    // An error occurred while loading; try to recover by truncating the
+    // file to the last fully-read record, so that new records don't end up
+    // behind a partial one.  The index, before that, stays usable.
+    *err = "premature end of file";
+    if (!Truncate(path, offset, err))
+      return LOAD_ERROR;
+
+    // The truncate succeeded; we'll just report the load error as a
+    // warning because the build can proceed.
+    *err += "; recovering";
+    return LOAD_SUCCESS;
+  }
+
+  if (!index_buckets_)
+    file_.Close();
+
+  // The records after the index are read on every load, so fold them into
+  // the index once there are enough of them.
+  int kMinCompactionEntryCount = 100;
+  int kCompactionRatio = 3;
+  if (total_entry_count > kMinCompactionEntryCount &&
+      total_entry_count * kCompactionRatio > (int)index_entries) {
+    needs_recompaction_ = true;
+  }
+
+  return LOAD_SUCCESS;
+}
+
+LoadStatus BuildLog::LoadText(const string& path, string* err) {
   FILE* file = fopen(path.c_str(), "r");
   if (!file) {
     if (errno == ENOENT)
@@ -362,20 +823,130 @@ BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
   Entries::iterator i = entries_.find(path);
   if (i != entries_.end())
     return i->second;
+  int bucket = FindInIndex(path);
+  if (bucket >= 0)
+    return LoadIndexedEntry(bucket);
   return NULL;
 }
 
+int BuildLog::FindInIndex(StringPiece path) const {
+  if (!index_buckets_)
+    return -1;
+  uint64_t hash = HashPath(path);
+  uint32_t hash_high = (uint32_t)(hash >> 32);
+  const char* buckets = file_.data() + index_offset_ + 8;
+  for (uint32_t b = (uint32_t)hash & (index_buckets_ - 1), probes = 0;
+       probes < index_buckets_; b = (b + 1) & (index_buckets_ - 1), ++probes) {
+    IndexBucket bucket;
+    memcpy(&bucket, buckets + b * sizeof(bucket), sizeof(bucket));
+    if (!bucket.path_offset)
+      return -1;
+    if (bucket.hash == hash_high &&
+        PathRecordAt(file_.data(), file_.size(), bucket.path_offset) == path)
+      return b;
+  }
+  return -1;
+}
+
+BuildLog::LogEntry* BuildLog::LoadIndexedEntry(int bucket) {
+  if (indexed_entries_[bucket])
+    return indexed_entries_[bucket];
+  // Empty buckets have no path record, and are rejected below.
+
+  IndexBucket index_bucket;
+  memcpy(&index_bucket,
+         file_.data() + index_offset_ + 8 + bucket * sizeof(index_bucket),
+         sizeof(index_bucket));
+  size_t record_offset;
+  StringPiece output = PathRecordAt(file_.data(), file_.size(),
+                                    index_bucket.path_offset, &record_offset);
+  EntryRecord record;
+  if (output.size() == 0 ||
+      !EntryRecordAt(file_.data(), file_.size(), record_offset, &record))
+    return NULL;
+  LogEntry* entry = new LogEntry(output.AsString());
+  FillEntry(entry, record);
+  indexed_entries_[bucket] = entry;
+  return entry;
+}
+
+unsigned BuildLog::PathOffset(StringPiece path) const {
+  PathOffsets::const_iterator i = path_offsets_.find(path);
+  if (i != path_offsets_.end())
+    return i->second;
+  int bucket = FindInIndex(path);
+  if (bucket < 0)
+    return 0;
+  IndexBucket index_bucket;
+  memcpy(&index_bucket,
+         file_.data() + index_offset_ + 8 + bucket * sizeof(index_bucket),
+         sizeof(index_bucket));
+  return index_bucket.path_offset;
+}
+
+void BuildLog::LoadAllEntries() {
+  const char* buckets = file_.data() + index_offset_ + 8;
+  for (uint32_t b = 0; b < index_buckets_; ++b) {
+    LogEntry* entry = LoadIndexedEntry(b);
+    if (!entry)
+      continue;
+    if (!entries_.insert(Entries::value_type(entry->output, entry)).second) {
+      // Superseded by a newer entry.
+      delete entry;
+      continue;
+    }
+    IndexBucket bucket;
+    memcpy(&bucket, buckets + b * sizeof(bucket), sizeof(bucket));
+    path_offsets_[entry->output] = bucket.path_offset;
+  }
+  indexed_entries_.clear();
+  file_.Close();
+  index_offset_ = index_buckets_ = 0;
+}
+
+const BuildLog::Entries& BuildLog::entries() {
+  LoadAllEntries();
+  return entries_;
+}
+
+void BuildLog::Clear() {
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i)
+    delete i->second;
+  entries_.clear();
+  for (vector<LogEntry*>::iterator i = indexed_entries_.begin();
+       i != indexed_entries_.end(); ++i)
+    delete *i;
+  indexed_entries_.clear();
+  for (ContentHashes::iterator i = content_hashes_.begin();
+       i != content_hashes_.end(); ++i)
+    delete i->second;
+  content_hashes_.clear();
+  path_offsets_.clear();
+  file_.Close();
+  index_offset_ = index_buckets_ = 0;
+}
+
+// static
 bool BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
   return fprintf(f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\n",
           entry.start_time, entry.end_time, entry.mtime,
           entry.output.c_str(), entry.command_hash) > 0;
 }
 
-bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
-                         string* err) {
-  METRIC_RECORD(".ninja_log recompact");
+bool BuildLog::WriteText(FILE* f) {
+  if (fprintf(f, kFileSignature, 5) < 0)
+    return false;
+  const Entries& all = entries();
+  for (Entries::const_iterator i = all.begin(); i != all.end(); ++i) {
+    if (!WriteEntry(f, *i->second))
+      return false;
+  }
+  return true;
+}
+
+bool BuildLog::WriteCompacted(const string& path, string* err) {
+  LoadAllEntries();
 
-  Close();
   string temp_path = path + ".recompact";
   FILE* f = fopen(temp_path.c_str(), "wb");
   if (!f) {
@@ -383,30 +954,92 @@ bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
     return false;
   }
 
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
+  char header[kHeaderSize] = {};
+  snprintf(header, kSignatureSize, kFileSignature, kCurrentVersion);
+  if (fwrite(header, sizeof(header), 1, f) < 1) {
     *err = strerror(errno);
     fclose(f);
     return false;
   }
 
-  vector<StringPiece> dead_outputs;
+  // Build the index as the entries are written, each right after its path.
+  uint32_t bucket_count = 1;
+  while (bucket_count < 2 * entries_.size())
+    bucket_count *= 2;
+  vector<IndexBucket> buckets(bucket_count);
+  PathOffsets path_offsets;
+  uint64_t offset = kHeaderSize;
   for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
-    if (user.IsPathDead(i->first)) {
-      dead_outputs.push_back(i->first);
-      continue;
+    const LogEntry& entry = *i->second;
+    if (offset > 0xffffffffUL) {
+      *err = strerror(EFBIG);
+      fclose(f);
+      return false;
     }
-
-    if (!WriteEntry(f, *i->second)) {
+    if (!WriteRecords(f, entry, (uint32_t)offset, true)) {
       *err = strerror(errno);
       fclose(f);
       return false;
     }
+    path_offsets[entry.output] = (uint32_t)offset;
+
+    uint64_t hash = HashPath(entry.output);
+    uint32_t b = (uint32_t)hash & (bucket_count - 1);
+    while (buckets[b].path_offset)
+      b = (b + 1) & (bucket_count - 1);
+    buckets[b].hash = (uint32_t)(hash >> 32);
+    buckets[b].path_offset = (uint32_t)offset;
+
+    offset += PathRecordSize(entry.output) + 4 + sizeof(EntryRecord);
+  }
+
+  uint32_t index_offset = (uint32_t)offset;
+  uint32_t entry_count = entries_.size();
+  offset += 8 + buckets.size() * sizeof(IndexBucket);
+  if (offset > 0xffffffffUL ||
+      fwrite(&bucket_count, 4, 1, f) < 1 || fwrite(&entry_count, 4, 1, f) < 1 ||
+      fwrite(&buckets[0], sizeof(IndexBucket), buckets.size(), f) <
+          buckets.size()) {
+    *err = offset > 0xffffffffUL ? strerror(EFBIG) : strerror(errno);
+    fclose(f);
+    return false;
+  }
+
+  // Hash records aren't indexed, so they follow the index, reusing the path
+  // records of entries.
+  for (ContentHashes::iterator i = content_hashes_.begin();
+       i != content_hashes_.end(); ++i) {
+    const ContentHash& content_hash = *i->second;
+    PathOffsets::iterator path = path_offsets.find(content_hash.path);
+    uint32_t path_offset = (uint32_t)offset;
+    if (path != path_offsets.end()) {
+      path_offset = path->second;
+    } else {
+      offset += PathRecordSize(content_hash.path);
+      path_offsets[content_hash.path] = path_offset;
+    }
+    offset += 4 + sizeof(HashRecord);
+    if (offset > 0xffffffffUL ||
+        (path == path_offsets.end() &&
+         !WritePathRecord(f, content_hash.path)) ||
+        !WriteHashRecord(f, content_hash, path_offset)) {
+      *err = offset > 0xffffffffUL ? strerror(EFBIG) : strerror(errno);
+      fclose(f);
+      return false;
+    }
   }
 
-  for (size_t i = 0; i < dead_outputs.size(); ++i)
-    entries_.erase(dead_outputs[i]);
+  if (fseek(f, kSignatureSize, SEEK_SET) != 0 ||
+      fwrite(&index_offset, 4, 1, f) < 1) {
+    *err = strerror(errno);
+    fclose(f);
+    return false;
+  }
 
-  fclose(f);
+  if (fclose(f) != 0) {
+    *err = strerror(errno);
+    return false;
+  }
   if (unlink(path.c_str()) < 0) {
     *err = strerror(errno);
     return false;
@@ -417,28 +1050,55 @@ bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
     return false;
   }
 
+  path_offsets_.swap(path_offsets);
   return true;
 }
 
+bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
+                         string* err) {
+  METRIC_RECORD(".ninja_log recompact");
+  TRACE_RECORD(".ninja_log recompact");
+
+  Close();
+  LoadAllEntries();
+
+  vector<StringPiece> dead_outputs;
+  for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
+    if (user.IsPathDead(i->first))
+      dead_outputs.push_back(i->first);
+  }
+  for (size_t i = 0; i < dead_outputs.size(); ++i) {
+    Entries::iterator entry = entries_.find(dead_outputs[i]);
+    LogEntry* dead = entry->second;
+    entries_.erase(entry);
+    path_offsets_.erase(dead->output);
+    delete dead;
+  }
+
+  vector<ContentHash*> dead_hashes;
+  for (ContentHashes::iterator i = content_hashes_.begin();
+       i != content_hashes_.end(); ++i) {
+    if (user.IsPathDead(i->first))
+      dead_hashes.push_back(i->second);
+  }
+  for (size_t i = 0; i < dead_hashes.size(); ++i) {
+    content_hashes_.erase(dead_hashes[i]->path);
+    path_offsets_.erase(dead_hashes[i]->path);
+    delete dead_hashes[i];
+  }
+
+  return WriteCompacted(path, err);
+}
+
 bool BuildLog::Restat(const StringPiece path,
                       const DiskInterface& disk_interface,
                       const int output_count, char** outputs,
                       std::string* const err) {
   METRIC_RECORD(".ninja_log restat");
+  TRACE_RECORD(".ninja_log restat");
 
   Close();
-  std::string temp_path = path.AsString() + ".restat";
-  FILE* f = fopen(temp_path.c_str(), "wb");
-  if (!f) {
-    *err = strerror(errno);
-    return false;
-  }
-
-  if (fprintf(f, kFileSignature, kCurrentVersion) < 0) {
-    *err = strerror(errno);
-    fclose(f);
-    return false;
-  }
+  LoadAllEntries();
   for (Entries::iterator i = entries_.begin(); i != entries_.end(); ++i) {
     bool skip = output_count > 0;
     for (int j = 0; j < output_count; ++j) {
@@ -449,30 +1109,11 @@ bool BuildLog::Restat(const StringPiece path,
     }
     if (!skip) {
       const TimeStamp mtime = disk_interface.Stat(i->second->output, err);
-      if (mtime == -1) {
-        fclose(f);
+      if (mtime == -1)
         return false;
-      }
       i->second->mtime = mtime;
     }
-
-    if (!WriteEntry(f, *i->second)) {
-      *err = strerror(errno);
-      fclose(f);
-      return false;
-    }
   }
 
-  fclose(f);
-  if (unlink(path.str_) < 0) {
-    *err = strerror(errno);
-    return false;
-  }
-
-  if (rename(temp_path.c_str(), path.str_) < 0) {
-    *err = strerror(errno);
-    return false;
-  }
-
-  return true;
+  return WriteCompacted(path.AsString(), err);
 }
@@ -16,11 +16,14 @@
 #define NINJA_BUILD_LOG_H_
 
 #include <string>
+#include <vector>
 #include <stdio.h>
 using namespace std;
 
 #include "hash_map.h"
 #include "load_status.h"
+#include "mapped_file.h"
+#include "resource_usage.h"
 #include "timestamp.h"
 #include "util.h"  // uint64_t
 
@@ -41,16 +44,30 @@ struct BuildLogUser {
 ///    when we need to rebuild due to the command changing
 /// 2) timing information, perhaps for generating reports
 /// 3) restat information
+/// 4) for rules with "hash_inputs" set, hashes of the contents of the
+///    inputs each command ran on, and digests of the files hashed so far,
+///    so that those are only read again once their mtime changes
+/// 5) the CPU time, memory and I/O each command used, for "-t costs"
+///
+/// Since version 6 the log is a binary file, made to be used in place
+/// rather than read in full on every run.  Each output path is stored once,
+/// and each run of a command appends a fixed-size record that refers to
+/// the paths it wrote by offset.  Recompaction writes every live entry
+/// once, followed by a hash index from path to entry, so that loading the
+/// log only has to read the records appended after the index.  Logs in the
+/// older text format are still read, and converted on recompaction.
 struct BuildLog {
   BuildLog();
   ~BuildLog();
 
   bool OpenForWrite(const string& path, const BuildLogUser& user, string* err);
   bool RecordCommand(Edge* edge, int start_time, int end_time,
-                     TimeStamp mtime = 0);
+                     TimeStamp mtime = 0, uint64_t input_hash = 0,
+                     const ResourceUsage& usage = ResourceUsage());
   void Close();
 
-  /// Load the on-disk log.
+  /// Load the on-disk log, replacing anything loaded before.  Entries that
+  /// are in the index of the file are only read when they are looked up.
   LoadStatus Load(const string& path, string* err);
 
   struct LogEntry {
@@ -59,6 +76,11 @@ struct BuildLog {
     int start_time;
     int end_time;
     TimeStamp mtime;
+    /// The hash of the contents of the inputs the command ran on, or 0 if
+    /// they weren't hashed.
+    uint64_t input_hash;
+    /// The resources the command used.
+    ResourceUsage usage;
 
     static uint64_t HashCommand(StringPiece command);
 
@@ -66,7 +88,12 @@ struct BuildLog {
     bool operator==(const LogEntry& o) {
       return output == o.output && command_hash == o.command_hash &&
           start_time == o.start_time && end_time == o.end_time &&
-          mtime == o.mtime;
+          mtime == o.mtime && input_hash == o.input_hash &&
+          usage.user_time == o.usage.user_time &&
+          usage.system_time == o.usage.system_time &&
+          usage.max_rss == o.usage.max_rss &&
+          usage.blocks_in == o.usage.blocks_in &&
+          usage.blocks_out == o.usage.blocks_out;
     }
 
     explicit LogEntry(const string& output);
@@ -77,8 +104,30 @@ struct BuildLog {
   /// Lookup a previously-run command by its output path.
   LogEntry* LookupByOutput(const string& path);
 
-  /// Serialize an entry into a log file.
-  bool WriteEntry(FILE* f, const LogEntry& entry);
+  /// The digest of the contents of a file, as of a given mtime.
+  struct ContentHash {
+    explicit ContentHash(const string& path) : path(path), mtime(0) {}
+    string path;
+    TimeStamp mtime;
+    /// The SHA-256 digest of the contents, as raw bytes.
+    string digest;
+  };
+
+  /// Lookup the last recorded hash of the contents of |path|.
+  ContentHash* LookupContentHash(const string& path);
+
+  /// Set |*digest| to the SHA-256 digest of the contents of |path|, whose
+  /// mtime is |mtime|.  The file is only read if the digest recorded for it
+  /// is for another mtime, and the new digest is then recorded.  Missing
+  /// files (|mtime| 0) have an empty digest.
+  bool HashContent(const string& path, TimeStamp mtime,
+                   DiskInterface* disk_interface, string* digest, string* err);
+
+  /// Serialize an entry into a log file in the text format of version 5.
+  static bool WriteEntry(FILE* f, const LogEntry& entry);
+
+  /// Write all entries to |f| as a log in the text format of version 5.
+  bool WriteText(FILE* f);
 
   /// Rewrite the known log entries, throwing away old data.
   bool Recompact(const string& path, const BuildLogUser& user, string* err);
@@ -88,12 +137,63 @@ struct BuildLog {
               int output_count, char** outputs, std::string* err);
 
   typedef ExternalStringHashMap<LogEntry*>::Type Entries;
-  const Entries& entries() const { return entries_; }
+  /// All entries of the log.  This reads every entry of a loaded index,
+  /// so it is slow for large logs.
+  const Entries& entries();
 
  private:
+  typedef ExternalStringHashMap<unsigned>::Type PathOffsets;
+
+  LoadStatus LoadText(const string& path, string* err);
+  LoadStatus LoadBinary(const string& path, string* err);
+
+  /// Find |path| in the index of the loaded file.  Returns the bucket it
+  /// is in, or -1 if it is not there.
+  int FindInIndex(StringPiece path) const;
+
+  /// Read the entry in |bucket| of the index of the loaded file.
+  LogEntry* LoadIndexedEntry(int bucket);
+
+  /// Return the offset of the path record of |path| in the log file, or 0
+  /// if it has none yet.
+  unsigned PathOffset(StringPiece path) const;
+
+  /// Add all indexed entries to |entries_| and release the loaded file.
+  void LoadAllEntries();
+
+  /// Forget all entries and release the loaded file.
+  void Clear();
+
+  /// Append a record of |entry| to |log_file_|, preceded by a record of
+  /// its path if the file has none yet.
+  bool WriteRecord(const LogEntry& entry);
+  bool WriteRecord(const ContentHash& content_hash);
+
+  /// Set |*offset| to that of the path record of |path| in |log_file_|,
+  /// appending one if the file has none yet.
+  bool EnsurePathRecord(const string& path, unsigned* offset);
+
+  /// Write all entries to a new log at |path|, with an index, and refer to
+  /// that log from now on.
+  bool WriteCompacted(const string& path, string* err);
+
   Entries entries_;
+  typedef ExternalStringHashMap<ContentHash*>::Type ContentHashes;
+  ContentHashes content_hashes_;
   FILE* log_file_;
   bool needs_recompaction_;
+
+  /// The loaded file, while its index is used.
+  MappedFile file_;
+  /// Where the index of |file_| starts, or 0 if there is none.
+  unsigned index_offset_;
+  /// The number of buckets in the index, a power of two.
+  unsigned index_buckets_;
+  /// Entries read from the index so far, by bucket.  Those in |entries_|,
+  /// which are newer, take precedence.
+  vector<LogEntry*> indexed_entries_;
+  /// Offsets of the path records in the log file that are not in the index.
+  PathOffsets path_offsets_;
 };
 
 #endif // NINJA_BUILD_LOG_H_
@@ -14,6 +14,7 @@
 
 #include "build_log.h"
 
+#include "sha256.h"
 #include "util.h"
 #include "test.h"
 
@@ -70,9 +71,46 @@ TEST_F(BuildLogTest, WriteRead) {
   ASSERT_EQ("out", e1->output);
 }
 
+TEST_F(BuildLogTest, ResourceUsage) {
+  AssertParse(&state_,
+"build out: cat in\n");
+
+  ResourceUsage usage;
+  usage.user_time = 1500;
+  usage.system_time = 250;
+  usage.max_rss = 4 << 20;
+  usage.blocks_in = 8;
+  usage.blocks_out = 16;
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.RecordCommand(state_.edges_[0], 15, 18, 0, 0, usage));
+    log.Close();
+  }
+
+  // Recompaction keeps the usage too.
+  for (int i = 0; i < 2; ++i) {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    BuildLog::LogEntry* e = log.LookupByOutput("out");
+    ASSERT_TRUE(e);
+    EXPECT_EQ(1500u, e->usage.user_time);
+    EXPECT_EQ(250u, e->usage.system_time);
+    EXPECT_EQ(4u << 20, e->usage.max_rss);
+    EXPECT_EQ(8u, e->usage.blocks_in);
+    EXPECT_EQ(16u, e->usage.blocks_out);
+    EXPECT_TRUE(log.Recompact(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+  }
+}
+
 TEST_F(BuildLogTest, FirstWriteAddsSignature) {
-  const char kExpectedVersion[] = "# ninja log vX\n";
-  const size_t kVersionPos = strlen(kExpectedVersion) - 2;  // Points at 'X'.
+  // The signature, padded to 16 bytes, and an empty index offset.
+  const string kExpectedVersion("# ninja log vX\n\0\0\0\0\0\0\0\0\0", 24);
+  const size_t kVersionPos = 13;  // Points at 'X'.
 
   BuildLog log;
   string contents, err;
@@ -155,6 +193,153 @@ TEST_F(BuildLogTest, Truncate) {
   }
 }
 
+TEST_F(BuildLogTest, IndexedLookup) {
+  AssertParse(&state_,
+"build out: cat mid\n"
+"build mid: cat in\n"
+"build out2: cat in\n");
+
+  {
+    BuildLog log1;
+    string err;
+    EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log1.RecordCommand(state_.edges_[0], 15, 18);
+    log1.RecordCommand(state_.edges_[1], 20, 25, 30);
+    log1.Close();
+    EXPECT_TRUE(log1.Recompact(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+  }
+
+  // Add a newer entry for "mid" after the index.
+  {
+    BuildLog log2;
+    string err;
+    EXPECT_TRUE(log2.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log2.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log2.RecordCommand(state_.edges_[1], 40, 45, 50);
+    log2.RecordCommand(state_.edges_[2], 60, 65);
+    log2.Close();
+  }
+
+  BuildLog log3;
+  string err;
+  EXPECT_TRUE(log3.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log3.LookupByOutput("out");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(15, e->start_time);
+  EXPECT_EQ(18, e->end_time);
+  ASSERT_NO_FATAL_FAILURE(AssertHash("cat mid > out", e->command_hash));
+  e = log3.LookupByOutput("mid");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(40, e->start_time);
+  EXPECT_EQ(50, e->mtime);
+  e = log3.LookupByOutput("out2");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(60, e->start_time);
+  EXPECT_FALSE(log3.LookupByOutput("in"));
+  EXPECT_FALSE(log3.LookupByOutput("ou"));
+  EXPECT_EQ(3u, log3.entries().size());
+}
+
+TEST_F(BuildLogTest, ConvertText) {
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v5\n");
+  fprintf(f, "123\t456\t789\tout\t1234abcd\n");
+  fprintf(f, "1\t2\t3\tout2\tffffffffffffffff\n");
+  fclose(f);
+
+  string err;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.Load(kTestFilename, &err));
+    ASSERT_EQ("", err);
+    // Opening for writing converts the log to the current version.
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    log.Close();
+  }
+
+  string contents;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  EXPECT_EQ(0u, contents.find("# ninja log v6\n"));
+
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log.LookupByOutput("out2");
+  ASSERT_TRUE(e);
+  EXPECT_EQ(0xffffffffffffffffull, e->command_hash);
+
+  // And back to text.  The loaded log must stay untouched while in use.
+  const char kTextFilename[] = "BuildLogTest-tempfile.txt";
+  f = fopen(kTextFilename, "wb");
+  EXPECT_TRUE(log.WriteText(f));
+  fclose(f);
+  contents.clear();
+  ASSERT_EQ(0, ReadFile(kTextFilename, &contents, &err));
+  unlink(kTextFilename);
+  EXPECT_EQ(0u, contents.find("# ninja log v5\n"));
+  EXPECT_NE(string::npos, contents.find("123\t456\t789\tout\t1234abcd\n"));
+  EXPECT_NE(string::npos, contents.find("1\t2\t3\tout2\tffffffffffffffff\n"));
+}
+
+TEST_F(BuildLogTest, ContentHashes) {
+  AssertParse(&state_,
+"build out: cat in\n");
+  VirtualFileSystem fs;
+  fs.Create("in", "contents");
+
+  string err;
+  string digest, digest2;
+  {
+    BuildLog log;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, *this, &err));
+    ASSERT_EQ("", err);
+    EXPECT_TRUE(log.HashContent("in", 1, &fs, &digest, &err));
+    ASSERT_EQ("", err);
+    EXPECT_EQ(Sha256::Hash("contents"), digest);
+    EXPECT_TRUE(log.HashContent("in", 1, &fs, &digest2, &err));
+    EXPECT_EQ(digest, digest2);
+    log.RecordCommand(state_.edges_[0], 15, 18, 2, 0x123456789ull);
+    log.Close();
+  }
+  EXPECT_EQ(1u, fs.files_read_.size());
+
+  // A later run doesn't read the file again until its mtime changes.
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(log.HashContent("in", 1, &fs, &digest2, &err));
+  EXPECT_EQ(digest, digest2);
+  EXPECT_EQ(1u, fs.files_read_.size());
+  fs.Create("in", "other contents");
+  EXPECT_TRUE(log.HashContent("in", 2, &fs, &digest2, &err));
+  EXPECT_NE(digest, digest2);
+  EXPECT_EQ(2u, fs.files_read_.size());
+
+  // Missing files have no digest, and aren't read.
+  EXPECT_TRUE(log.HashContent("missing", 0, &fs, &digest, &err));
+  EXPECT_EQ("", digest);
+  EXPECT_EQ(2u, fs.files_read_.size());
+
+  // Digests and input hashes survive recompaction.
+  EXPECT_TRUE(log.Recompact(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::ContentHash* content_hash = log2.LookupContentHash("in");
+  ASSERT_TRUE(content_hash);
+  EXPECT_EQ(2, content_hash->mtime);
+  EXPECT_EQ(digest2, content_hash->digest);
+  ASSERT_TRUE(log2.LookupByOutput("out"));
+  EXPECT_EQ(0x123456789ull, log2.LookupByOutput("out")->input_hash);
+}
+
 TEST_F(BuildLogTest, ObsoleteOldVersion) {
   FILE* f = fopen(kTestFilename, "wb");
   fprintf(f, "# ninja log v3\n");
@@ -0,0 +1,162 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Tests Plan performance: adding every target of a large manifest to a plan
+// and then walking it to completion, as a full build would, and then doing
+// the same for an edge with a very large number of inputs.  Expects to be
+// run in ninja's root directory.
+
+#include <algorithm>
+#include <numeric>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "build.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+
+bool WriteFakeManifests(const string& dir, string* err) {
+  RealDiskInterface disk_interface;
+  TimeStamp mtime = disk_interface.Stat(dir + "/build.ninja", err);
+  if (mtime != 0)  // 0 means that the file doesn't exist yet.
+    return mtime != -1;
+
+  string command = "python misc/write_fake_manifests.py " + dir;
+  printf("Creating manifest data..."); fflush(stdout);
+  int exit_code = system(command.c_str());
+  printf("done.\n");
+  if (exit_code != 0)
+    *err = "Failed to run " + command;
+  return exit_code == 0;
+}
+
+/// Mark everything as needing a rebuild, as on a clean checkout.
+void MarkAllDirty(State* state) {
+  for (vector<Edge*>::iterator e = state->edges_.begin();
+       e != state->edges_.end(); ++e) {
+    (*e)->outputs_ready_ = false;
+    for (vector<Node*>::iterator o = (*e)->outputs_.begin();
+         o != (*e)->outputs_.end(); ++o) {
+      (*o)->set_dirty(true);
+    }
+  }
+}
+
+/// Build a plan for |targets| and run it to completion, finishing each edge
+/// as soon as it is handed out.  Returns the number of edges run.
+int RunPlan(const vector<Node*>& targets) {
+  string err;
+  Plan plan;
+  for (vector<Node*>::const_iterator t = targets.begin();
+       t != targets.end(); ++t) {
+    if (!plan.AddTarget(*t, &err) && !err.empty()) {
+      fprintf(stderr, "%s\n", err.c_str());
+      exit(1);
+    }
+  }
+
+  int edges_run = 0;
+  while (Edge* edge = plan.FindWork()) {
+    if (!plan.EdgeFinished(edge, Plan::kEdgeSucceeded, &err)) {
+      fprintf(stderr, "%s\n", err.c_str());
+      exit(1);
+    }
+    ++edges_run;
+  }
+  if (plan.more_to_do()) {
+    fprintf(stderr, "plan did not run to completion\n");
+    exit(1);
+  }
+  return edges_run;
+}
+
+/// Time a plan for one edge with |inputs| inputs, each made by an edge of
+/// its own, as a link of many objects is.
+void RunFanIn(int inputs) {
+  State state;
+  Rule rule("cat");
+  Edge* link = state.AddEdge(&rule);
+  state.AddOut(link, "out", 0);
+  for (int i = 0; i < inputs; ++i) {
+    char path[32];
+    snprintf(path, sizeof(path), "in%d", i);
+    Edge* edge = state.AddEdge(&rule);
+    state.AddOut(edge, path, 0);
+    state.AddIn(link, path, 0);
+  }
+
+  vector<Node*> targets(1, state.LookupNode("out"));
+  MarkAllDirty(&state);
+  int64_t start = GetTimeMillis();
+  int edges_run = RunPlan(targets);
+  int delta = (int)(GetTimeMillis() - start);
+  printf("%d inputs: %dms (%d edges)\n", inputs, delta, edges_run);
+}
+
+int main(int argc, char* argv[]) {
+  const char kManifestDir[] = "build/manifest_perftest";
+
+  string err;
+  if (!WriteFakeManifests(kManifestDir, &err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  if (chdir(kManifestDir) < 0)
+    Fatal("chdir: %s", strerror(errno));
+
+  RealDiskInterface disk_interface;
+  State state;
+  ManifestParser parser(&state, &disk_interface);
+  if (!parser.Load("build.ninja", &err)) {
+    fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+    return 1;
+  }
+  vector<Node*> targets = state.DefaultNodes(&err);
+  if (!err.empty()) {
+    fprintf(stderr, "%s\n", err.c_str());
+    return 1;
+  }
+
+  const int kNumRepetitions = 5;
+  vector<int> times;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    MarkAllDirty(&state);
+    int64_t start = GetTimeMillis();
+    int edges_run = RunPlan(targets);
+    int delta = (int)(GetTimeMillis() - start);
+    printf("%dms (%d edges)\n", delta, edges_run);
+    times.push_back(delta);
+  }
+
+  int min = *min_element(times.begin(), times.end());
+  int max = *max_element(times.begin(), times.end());
+  float total = accumulate(times.begin(), times.end(), 0.0f);
+  printf("min %dms  max %dms  avg %.1fms\n", min, max, total / times.size());
+
+  RunFanIn(50000);
+}
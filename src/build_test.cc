@@ -420,6 +420,111 @@ TEST_F(PlanTest, PoolWithRedundantEdges) {
   ASSERT_FALSE(plan_.more_to_do());
 }
 
+TEST_F(PlanTest, PoolWeights) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool heavy\n"
+"  depth = 4\n"
+"rule link\n"
+"  command = link\n"
+"  pool = heavy\n"
+"  pool_weight = 3\n"
+"rule cc\n"
+"  command = cc\n"
+"  pool = heavy\n"
+"build link1: link in\n"
+"build link2: link in\n"
+"build cc1: cc in\n"
+"build cc2: cc in\n"
+"build cc3: cc in\n"
+"build out: cat link1 link2 cc1 cc2 cc3\n"));
+  const char* outs[] = { "link1", "link2", "cc1", "cc2", "cc3", "out" };
+  for (size_t i = 0; i < sizeof(outs) / sizeof(outs[0]); ++i)
+    GetNode(outs[i])->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // link2 doesn't fit next to link1, and the edges behind it wait for it.
+  Edge* link1 = plan_.FindWork();
+  ASSERT_TRUE(link1);
+  EXPECT_EQ("link1", link1->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  // cc1 fits next to link2, but cc2 doesn't.
+  plan_.EdgeFinished(link1, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 2);
+  EXPECT_EQ("cc1", edges[0]->outputs_[0]->path());
+  EXPECT_EQ("link2", edges[1]->outputs_[0]->path());
+
+  plan_.EdgeFinished(edges[0], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("cc2", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(edges[1], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("cc3", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, PoolHeavyEdgeNotStarved) {
+  // A link that takes the whole pool, among compiles that take one slot.
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"pool heavy\n"
+"  depth = 8\n"
+"rule lto\n"
+"  command = lto\n"
+"  pool = heavy\n"
+"  pool_weight = 8\n"
+"rule cc\n"
+"  command = cc\n"
+"  pool = heavy\n"
+"build cc1: cc in\n"
+"build cc2: cc in\n"
+"build link: lto in\n"
+"build cc3: cc in\n"
+"build cc4: cc in\n"
+"build cc5: cc in\n"
+"build out: cat cc1 cc2 link cc3 cc4 cc5\n"));
+  const char* outs[] = { "cc1", "cc2", "link", "cc3", "cc4", "cc5", "out" };
+  for (size_t i = 0; i < sizeof(outs) / sizeof(outs[0]); ++i)
+    GetNode(outs[i])->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 2);
+  EXPECT_EQ("cc1", edges[0]->outputs_[0]->path());
+  EXPECT_EQ("cc2", edges[1]->outputs_[0]->path());
+
+  // The slot cc1 leaves is kept for the link, rather than given to cc3.
+  plan_.EdgeFinished(edges[0], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(edges[1], Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* link = plan_.FindWork();
+  ASSERT_TRUE(link);
+  EXPECT_EQ("link", link->outputs_[0]->path());
+  ASSERT_FALSE(plan_.FindWork());
+
+  plan_.EdgeFinished(link, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  edges.clear();
+  FindWorkSorted(&edges, 3);
+  EXPECT_EQ("cc3", edges[0]->outputs_[0]->path());
+  EXPECT_EQ("cc4", edges[1]->outputs_[0]->path());
+  EXPECT_EQ("cc5", edges[2]->outputs_[0]->path());
+}
+
 TEST_F(PlanTest, PoolWithFailingEdge) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
     "pool foobar\n"
@@ -464,6 +569,192 @@ TEST_F(PlanTest, PoolWithFailingEdge) {
   ASSERT_EQ(0, edge);
 }
 
+TEST_F(PlanTest, PriorityLongestChainFirst) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat a0 b0\n"
+"build a0: cat a1\n"
+"build a1: cat a2\n"
+"build a2: cat in\n"
+"build b0: cat in\n"));
+  GetNode("a0")->MarkDirty();
+  GetNode("a1")->MarkDirty();
+  GetNode("a2")->MarkDirty();
+  GetNode("b0")->MarkDirty();
+  GetNode("out")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // a2 starts a chain of four edges, b0 one of two.
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("a2", edge->outputs_[0]->path());
+  EXPECT_EQ(4, edge->critical_path_weight());
+  edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("b0", edge->outputs_[0]->path());
+  EXPECT_EQ(2, edge->critical_path_weight());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, PriorityWithInputEdgeNotInPlan) {
+  // The edge of the up-to-date input has an id far beyond those of the
+  // edges in the plan.
+  string manifest = "build out: cat gen\n";
+  for (int i = 0; i < 2000; ++i) {
+    char line[64];
+    snprintf(line, sizeof(line), "build filler%d: cat in\n", i);
+    manifest += line;
+  }
+  manifest += "build gen: cat src\n";
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_, manifest.c_str()));
+  GetNode("gen")->in_edge()->outputs_ready_ = true;
+  GetNode("out")->MarkDirty();
+  string err;
+  EXPECT_TRUE(plan_.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("out", edge->outputs_[0]->path());
+  EXPECT_EQ(1, edge->critical_path_weight());
+  ASSERT_FALSE(plan_.FindWork());
+}
+
+TEST_F(PlanTest, PriorityFromBuildLog) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat fast slow new\n"
+"build fast: cat in\n"
+"build slow: cat in\n"
+"build new: cat in\n"));
+  GetNode("fast")->MarkDirty();
+  GetNode("slow")->MarkDirty();
+  GetNode("new")->MarkDirty();
+  GetNode("out")->MarkDirty();
+
+  BuildLog log;
+  log.RecordCommand(GetNode("fast")->in_edge(), 0, 10);
+  log.RecordCommand(GetNode("slow")->in_edge(), 0, 1000);
+  log.RecordCommand(GetNode("out")->in_edge(), 1000, 1100);
+
+  BuildConfig config;
+  VirtualFileSystem fs;
+  Builder builder(&state_, config, &log, NULL, &fs);
+  Plan& plan = builder.plan_;
+  string err;
+  EXPECT_TRUE(plan.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // Edges missing from the log are assumed to take the average duration.
+  Edge* edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("slow", edge->outputs_[0]->path());
+  EXPECT_EQ(1100, edge->critical_path_weight());
+  edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("new", edge->outputs_[0]->path());
+  EXPECT_EQ(100 + (10 + 1000 + 100) / 3, edge->critical_path_weight());
+  edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("fast", edge->outputs_[0]->path());
+  EXPECT_EQ(110, edge->critical_path_weight());
+  ASSERT_FALSE(plan.FindWork());
+}
+
+TEST_F(PlanTest, MemoryBudget) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule link\n"
+"  command = link\n"
+"build out: cat big1 big2 new small\n"
+"build big1: link in\n"
+"build big2: link in\n"
+"build new: link in\n"
+"build small: cat in\n"));
+  GetNode("big1")->MarkDirty();
+  GetNode("big2")->MarkDirty();
+  GetNode("new")->MarkDirty();
+  GetNode("small")->MarkDirty();
+  GetNode("out")->MarkDirty();
+
+  BuildLog log;
+  ResourceUsage usage;
+  usage.max_rss = 600;
+  log.RecordCommand(GetNode("big1")->in_edge(), 0, 1000, 0, 0, usage);
+  usage.max_rss = 500;
+  log.RecordCommand(GetNode("big2")->in_edge(), 0, 900, 0, 0, usage);
+  usage.max_rss = 100;
+  log.RecordCommand(GetNode("small")->in_edge(), 0, 10, 0, 0, usage);
+
+  BuildConfig config;
+  VirtualFileSystem fs;
+  Builder builder(&state_, config, &log, NULL, &fs);
+  Plan& plan = builder.plan_;
+  plan.set_memory_budget(1000);
+  string err;
+  EXPECT_TRUE(plan.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  Edge* big1 = plan.FindWork();
+  ASSERT_TRUE(big1);
+  EXPECT_EQ("big1", big1->outputs_[0]->path());
+  // big2 and new, which is expected to use the 550 of an average link,
+  // don't fit next to big1, but small does.
+  Edge* small = plan.FindWork();
+  ASSERT_TRUE(small);
+  EXPECT_EQ("small", small->outputs_[0]->path());
+  ASSERT_FALSE(plan.FindWork());
+
+  // small didn't free enough memory, big1 did.
+  plan.EdgeFinished(small, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  ASSERT_FALSE(plan.FindWork());
+  plan.EdgeFinished(big1, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  Edge* big2 = plan.FindWork();
+  ASSERT_TRUE(big2);
+  EXPECT_EQ("big2", big2->outputs_[0]->path());
+  ASSERT_FALSE(plan.FindWork());
+
+  plan.EdgeFinished(big2, Plan::kEdgeFailed, &err);
+  ASSERT_EQ("", err);
+  Edge* edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("new", edge->outputs_[0]->path());
+  ASSERT_FALSE(plan.FindWork());
+}
+
+TEST_F(PlanTest, MemoryBudgetExceededAlone) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat huge\n"
+"build huge: cat in\n"));
+  GetNode("huge")->MarkDirty();
+  GetNode("out")->MarkDirty();
+
+  BuildLog log;
+  ResourceUsage usage;
+  usage.max_rss = 5000;
+  log.RecordCommand(GetNode("huge")->in_edge(), 0, 10, 0, 0, usage);
+
+  BuildConfig config;
+  VirtualFileSystem fs;
+  Builder builder(&state_, config, &log, NULL, &fs);
+  Plan& plan = builder.plan_;
+  plan.set_memory_budget(1000);
+  string err;
+  EXPECT_TRUE(plan.AddTarget(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  // An edge over budget still runs when nothing else does.
+  Edge* edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("huge", edge->outputs_[0]->path());
+  plan.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  edge = plan.FindWork();
+  ASSERT_TRUE(edge);
+  EXPECT_EQ("out", edge->outputs_[0]->path());
+}
+
 /// Fake implementation of CommandRunner, useful for tests.
 struct FakeCommandRunner : public CommandRunner {
   explicit FakeCommandRunner(VirtualFileSystem* fs) :
@@ -471,7 +762,7 @@ struct FakeCommandRunner : public CommandRunner {
 
   // CommandRunner impl
   virtual bool CanRunMore() const;
-  virtual bool StartCommand(Edge* edge);
+  virtual bool StartCommand(Edge* edge, const string& command);
   virtual bool WaitForCommand(Result* result);
   virtual vector<Edge*> GetActiveEdges();
   virtual void Abort();
@@ -578,11 +869,11 @@ bool FakeCommandRunner::CanRunMore() const {
   return active_edges_.size() < max_active_edges_;
 }
 
-bool FakeCommandRunner::StartCommand(Edge* edge) {
+bool FakeCommandRunner::StartCommand(Edge* edge, const string& command) {
   assert(active_edges_.size() < max_active_edges_);
   assert(find(active_edges_.begin(), active_edges_.end(), edge)
          == active_edges_.end());
-  commands_ran_.push_back(edge->EvaluateCommand());
+  commands_ran_.push_back(command);
   if (edge->rule().name() == "cat"  ||
       edge->rule().name() == "cat_rsp" ||
       edge->rule().name() == "cat_rsp_out" ||
@@ -1331,6 +1622,7 @@ TEST_F(BuildWithLogTest, RebuildAfterFailure) {
   builder_.plan_.Reset();
 
   fs_.Tick();
+  err.clear();
 
   // Run again, should rerun even though the output file is up to date on disk
   EXPECT_TRUE(builder_.AddTarget("out1", &err));
@@ -1436,6 +1728,152 @@ TEST_F(BuildWithLogTest, RestatTest) {
   ASSERT_EQ(2u, command_runner_.commands_ran_.size());
 }
 
+TEST_F(BuildWithLogTest, HashInputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp\n"
+"  command = cp $in $out\n"
+"  hash_inputs = 1\n"
+"build mid: cp in | extra\n"
+"build out: cp mid\n"));
+
+  fs_.Create("in", "1");
+  fs_.Create("extra", "");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+
+  // Newer inputs with the same contents don't make anything dirty.
+  fs_.Tick();
+  fs_.Create("in", "1");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // Rebuilding "mid" with the same contents leaves "out" clean.
+  fs_.Tick();
+  fs_.Create("extra", "changed");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cp in mid", command_runner_.commands_ran_[0]);
+
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // Other contents rebuild everything downstream.
+  fs_.Tick();
+  fs_.Create("in", "2");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+  string contents;
+  EXPECT_EQ(DiskInterface::Okay, fs_.ReadFile("out", &contents, &err));
+  EXPECT_EQ("2", contents);
+}
+
+TEST_F(BuildWithLogTest, ActionCache) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp\n"
+"  command = cp $in $out\n"
+"build out: cp in\n"
+"build out2: cp in\n"
+"  no_cache = 1\n"));
+  config_.action_cache = "cache";
+
+  fs_.Create("in", "1");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(2u, command_runner_.commands_ran_.size());
+
+  fs_.Tick();
+  fs_.Create("in", "2");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+
+  // Going back to the first contents restores the output from the cache,
+  // except for edges that opted out.
+  fs_.Tick();
+  fs_.Create("in", "1");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  EXPECT_TRUE(builder_.AddTarget("out2", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cp in out2", command_runner_.commands_ran_[0]);
+  string contents;
+  EXPECT_EQ(DiskInterface::Okay, fs_.ReadFile("out", &contents, &err));
+  EXPECT_EQ("1", contents);
+
+  // The restored output is up to date.
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+}
+
+TEST_F(BuildWithLogTest, ActionCacheTouchedInput) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp\n"
+"  command = cp $in $out\n"
+"build out: cp in\n"));
+  config_.action_cache = "cache";
+
+  fs_.Create("in", "1");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+
+  // Touching the input restores the output, which already has the right
+  // contents but must become newer than the input.
+  fs_.Tick();
+  fs_.Create("in", "1");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(0u, command_runner_.commands_ran_.size());
+  EXPECT_EQ(fs_.now_, fs_.files_["out"].mtime);
+
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+}
+
 TEST_F(BuildWithLogTest, RestatMissingFile) {
   // If a restat rule doesn't create its output, and the output didn't
   // exist before the rule was run, consider that behavior equivalent
@@ -1695,6 +2133,19 @@ TEST_F(BuildTest, RspFileFailure) {
 
   // The RSP file contains what it should
   ASSERT_EQ("Another very long command", fs_.files_["out.rsp"].contents);
+
+  // The RSP file is still right the next time, so isn't written again.
+  fs_.files_created_.clear();
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  builder_.Cleanup();
+  builder_.plan_.Reset();
+  err.clear();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ(0u, fs_.files_created_.count("out.rsp"));
 }
 
 // Test that contents of the RSP file behaves like a regular part of
@@ -1921,6 +2372,83 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileMSVC) {
   EXPECT_EQ("in1", out2_deps->nodes[0]->path());
 }
 
+/// Test that dependencies read on other threads reach the deps log.
+TEST_F(BuildWithQueryDepsLogTest, DepsReadOnOtherThreads) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp_multi_msvc\n"
+"    command = cp $in $out\n"
+"    deps = msvc\n"
+"    msvc_deps_prefix = using \n"
+"build a: cp_multi_msvc in1\n"
+"build b: cp_multi_msvc in2\n"
+"build c: cp_multi_msvc a b\n"));
+
+  config_.deps_threads = 2;
+  command_runner_.max_active_edges_ = 2;
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("c", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(3u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cp a b c", command_runner_.commands_ran_[2]);
+
+  DepsLog::Deps* deps = log_.GetDeps(state_.LookupNode("a"));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(1, deps->node_count);
+  EXPECT_EQ("in1", deps->nodes[0]->path());
+  deps = log_.GetDeps(state_.LookupNode("c"));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(2, deps->node_count);
+  EXPECT_EQ("a", deps->nodes[0]->path());
+  EXPECT_EQ("b", deps->nodes[1]->path());
+}
+
+/// Test that the action cache stores the depfile of an edge whose
+/// dependencies are read on other threads, though it's removed once they
+/// are.
+TEST_F(BuildWithQueryDepsLogTest, ActionCacheStoresRemovedDepfile) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp_multi_gcc\n"
+"    command = echo '$out: $in' > in.d && for file in $out; do cp in1 $$file; done\n"
+"    deps = gcc\n"
+"    depfile = in.d\n"
+"build out1 out2: cp_multi_gcc in1 in2\n"));
+  // Inputs are hashed with the build log.
+  BuildLog build_log;
+  builder_.SetBuildLog(&build_log);
+  config_.deps_threads = 2;
+  config_.action_cache = "cache";
+
+  std::string err;
+  EXPECT_TRUE(builder_.AddTarget("out1", &err));
+  ASSERT_EQ("", err);
+  fs_.Create("in.d", "out1 out2: in1 in2");
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ(0u, fs_.files_.count("in.d"));
+
+  // Touching an input restores the outputs and the depfile, which is read
+  // and removed again.
+  fs_.Tick();
+  fs_.Create("in1", "");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out1", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(0u, command_runner_.commands_ran_.size());
+  EXPECT_EQ(0u, fs_.files_.count("in.d"));
+
+  DepsLog::Deps* deps = log_.GetDeps(state_.LookupNode("out1"));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(2, deps->node_count);
+  EXPECT_EQ("in1", deps->nodes[0]->path());
+  EXPECT_EQ("in2", deps->nodes[1]->path());
+}
+
 /// Test a GCC-style deps log with multiple outputs.
 TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCOneLine) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
@@ -2899,6 +3427,37 @@ TEST_F(BuildTest, DyndepBuildDiscoverNewInput) {
   EXPECT_EQ("touch out", command_runner_.commands_ran_[2]);
 }
 
+TEST_F(BuildTest, DyndepBuildDiscoverNewInputWeighed) {
+  // Verify that the edges a dyndep file adds to the plan are given the
+  // critical path weight of the edges that depend on them.
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule touch\n"
+"  command = touch $out\n"
+"rule cp\n"
+"  command = cp $in $out\n"
+"build dd: cp dd-in\n"
+"build in: touch\n"
+"build out: touch || dd\n"
+"  dyndep = dd\n"
+"build final: touch out\n"
+  ));
+  fs_.Create("dd-in",
+"ninja_dyndep_version = 1\n"
+"build out: dyndep | in\n"
+);
+
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("final", &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(-1, GetNode("in")->in_edge()->critical_path_weight());
+
+  EXPECT_TRUE(builder_.Build(&err));
+  EXPECT_EQ("", err);
+  ASSERT_EQ(4u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("touch in", command_runner_.commands_ran_[1]);
+  EXPECT_EQ(3, GetNode("in")->in_edge()->critical_path_weight());
+}
+
 TEST_F(BuildTest, DyndepBuildDiscoverImplicitConnection) {
   // Verify that a dyndep file can be built and loaded to discover
   // that one edge has an implicit output that is also an implicit
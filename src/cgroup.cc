@@ -0,0 +1,322 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cgroup.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace {
+
+/// Memory limits from here on mean there is none: cgroup v1 reports no
+/// limit as the largest multiple of the page size that fits in an int64_t.
+const int64_t kNoMemoryLimit = (int64_t)1 << 62;
+
+/// Split |str| at each |sep|.
+vector<string> Split(const string& str, char sep) {
+  vector<string> parts;
+  size_t start = 0;
+  for (;;) {
+    size_t end = str.find(sep, start);
+    parts.push_back(str.substr(start, end - start));
+    if (end == string::npos)
+      return parts;
+    start = end + 1;
+  }
+}
+
+/// Read the lines of |path|.  Returns false if it can't be read.
+bool ReadLines(const string& path, vector<string>* lines) {
+  string contents, err;
+  if (ReadFile(path, &contents, &err) < 0)
+    return false;
+  if (!contents.empty() && contents[contents.size() - 1] == '\n')
+    contents.resize(contents.size() - 1);
+  *lines = Split(contents, '\n');
+  return true;
+}
+
+/// Read the first line of |path|.  Returns false if it can't be read.
+bool ReadValue(const string& path, string* value) {
+  vector<string> lines;
+  if (!ReadLines(path, &lines))
+    return false;
+  *value = lines[0];
+  return true;
+}
+
+/// Read the number in |path|.  Returns false if there is none, as when
+/// it says "max".
+bool ReadNumber(const string& path, int64_t* number) {
+  string value;
+  if (!ReadValue(path, &value))
+    return false;
+  char* end;
+  *number = strtoll(value.c_str(), &end, 10);
+  return end != value.c_str();
+}
+
+/// Read the value of |key| in a file of "key value" lines, such as
+/// memory.stat.  Returns false if it isn't there.
+bool ReadKey(const string& path, const string& key, int64_t* number) {
+  vector<string> lines;
+  if (!ReadLines(path, &lines))
+    return false;
+  for (vector<string>::iterator i = lines.begin(); i != lines.end(); ++i) {
+    if (i->size() > key.size() && i->compare(0, key.size(), key) == 0 &&
+        (*i)[key.size()] == ' ') {
+      *number = strtoll(i->c_str() + key.size() + 1, NULL, 10);
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Count the CPUs in a cpuset list such as "0-3,8".  Returns -1 if it
+/// can't be parsed.
+int CountCpus(const string& list) {
+  if (list.empty())
+    return -1;
+  int count = 0;
+  vector<string> ranges = Split(list, ',');
+  for (vector<string>::iterator i = ranges.begin(); i != ranges.end(); ++i) {
+    char* end;
+    long first = strtol(i->c_str(), &end, 10);
+    if (end == i->c_str())
+      return -1;
+    long last = first;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    if (*end != 0 || last < first)
+      return -1;
+    count += last - first + 1;
+  }
+  return count;
+}
+
+/// A cgroup file system, from a line of /proc/self/mountinfo.
+struct Mount {
+  /// The directory of the file system that is mounted.
+  string root;
+  string mount_point;
+  string type;
+  /// The options of the file system, which for cgroup v1 name the
+  /// controllers of the hierarchy.
+  vector<string> options;
+};
+
+/// Read the cgroup file systems mounted, under |root|.
+vector<Mount> ReadMounts(const string& root) {
+  // "36 35 98:0 /root /mount/point rw,noatime shared:1 - cgroup2 src rw"
+  vector<Mount> mounts;
+  vector<string> lines;
+  if (!ReadLines(root + "/proc/self/mountinfo", &lines))
+    return mounts;
+  for (vector<string>::iterator i = lines.begin(); i != lines.end(); ++i) {
+    vector<string> fields = Split(*i, ' ');
+    vector<string>::iterator dash = find(fields.begin(), fields.end(), "-");
+    if (fields.size() < 5 || fields.end() - dash < 4)
+      continue;
+    Mount mount;
+    mount.type = dash[1];
+    if (mount.type != "cgroup" && mount.type != "cgroup2")
+      continue;
+    mount.root = fields[3];
+    mount.mount_point = fields[4];
+    mount.options = Split(dash[3], ',');
+    mounts.push_back(mount);
+  }
+  return mounts;
+}
+
+/// The directory, under |root|, of the group at |path| of the hierarchy
+/// mounted by |mount|, or an empty string if the mount doesn't show it.
+/// Sets |*top| to the directory of the top group that is mounted.
+string GroupDir(const string& root, const Mount& mount, string path,
+                string* top) {
+  // In a container the file system is usually mounted from the group of
+  // the container rather than from the root of the hierarchy.
+  if (mount.root != "/") {
+    if (path.compare(0, mount.root.size(), mount.root) != 0 ||
+        (path.size() > mount.root.size() && path[mount.root.size()] != '/'))
+      return string();
+    path = path.substr(mount.root.size());
+  }
+  if (!path.empty() && path[path.size() - 1] == '/')
+    path.resize(path.size() - 1);
+  *top = root + mount.mount_point;
+  return *top + path;
+}
+
+/// The group directories of the cgroup v1 hierarchy with |controller|, or
+/// of the cgroup v2 hierarchy if it is empty, from the group of the
+/// current process up to the top one that is mounted.
+vector<string> GroupDirs(const string& root, const vector<Mount>& mounts,
+                         const string& controller) {
+  vector<string> dirs;
+  // "4:memory:/path", or "0::/path" for cgroup v2.
+  vector<string> lines;
+  if (!ReadLines(root + "/proc/self/cgroup", &lines))
+    return dirs;
+  for (vector<string>::iterator i = lines.begin(); i != lines.end(); ++i) {
+    size_t first = i->find(':');
+    size_t second = first == string::npos ? first : i->find(':', first + 1);
+    if (second == string::npos)
+      continue;
+    vector<string> controllers =
+        Split(i->substr(first + 1, second - first - 1), ',');
+    bool v2 = i->compare(0, first, "0") == 0 && controllers[0].empty();
+    if (controller.empty() ? !v2 :
+        find(controllers.begin(), controllers.end(), controller) ==
+            controllers.end())
+      continue;
+
+    for (vector<Mount>::const_iterator m = mounts.begin(); m != mounts.end();
+         ++m) {
+      if (controller.empty() ? m->type != "cgroup2" :
+          m->type != "cgroup" ||
+          find(m->options.begin(), m->options.end(), controller) ==
+              m->options.end())
+        continue;
+      string top;
+      string dir = GroupDir(root, *m, i->substr(second + 1), &top);
+      if (dir.empty())
+        continue;
+      for (;;) {
+        dirs.push_back(dir);
+        if (dir.size() <= top.size())
+          return dirs;
+        dir.resize(dir.rfind('/'));
+      }
+    }
+  }
+  return dirs;
+}
+
+/// Lower |*limit| to |value|, where -1 means no limit.
+template<typename T>
+void Lower(T* limit, T value) {
+  if (value >= 0 && (*limit < 0 || value < *limit))
+    *limit = value;
+}
+
+}  // anonymous namespace
+
+// static
+CgroupLimits CgroupLimits::Read(const string& root) {
+  CgroupLimits limits;
+  vector<Mount> mounts = ReadMounts(root);
+  if (mounts.empty())
+    return limits;
+
+  // cgroup v2, where "max" means there is no limit.
+  vector<string> dirs = GroupDirs(root, mounts, "");
+  for (vector<string>::iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    string value;
+    if (ReadValue(*d + "/cpu.max", &value)) {
+      vector<string> quota = Split(value, ' ');
+      char* end;
+      double max = strtod(quota[0].c_str(), &end);
+      if (end != quota[0].c_str() && quota.size() == 2) {
+        double period = strtod(quota[1].c_str(), NULL);
+        if (period > 0)
+          Lower(&limits.cpu_quota, max / period);
+      }
+    }
+  }
+  if (!dirs.empty()) {
+    string cpus;
+    if (ReadValue(dirs[0] + "/cpuset.cpus.effective", &cpus))
+      limits.cpuset_cpus = CountCpus(cpus);
+  }
+
+  // cgroup v1, where a quota of -1 means there is none.
+  dirs = GroupDirs(root, mounts, "cpu");
+  for (vector<string>::iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    int64_t quota, period;
+    if (ReadNumber(*d + "/cpu.cfs_quota_us", &quota) && quota > 0 &&
+        ReadNumber(*d + "/cpu.cfs_period_us", &period) && period > 0)
+      Lower(&limits.cpu_quota, (double)quota / period);
+  }
+  dirs = GroupDirs(root, mounts, "cpuset");
+  if (!dirs.empty()) {
+    string cpus;
+    if (ReadValue(dirs[0] + "/cpuset.effective_cpus", &cpus) ||
+        ReadValue(dirs[0] + "/cpuset.cpus", &cpus))
+      Lower(&limits.cpuset_cpus, CountCpus(cpus));
+  }
+
+  CgroupMemory memory(root);
+  limits.memory_limit = memory.limit();
+  limits.memory_usage = memory.ReadUsage();
+  return limits;
+}
+
+int CgroupLimits::cpus() const {
+  int cpus = cpuset_cpus;
+  if (cpu_quota > 0)
+    Lower(&cpus, max(1, (int)ceil(cpu_quota)));
+  return cpus;
+}
+
+CgroupMemory::CgroupMemory(const string& root) : limit_(-1) {
+  vector<Mount> mounts = ReadMounts(root);
+  if (mounts.empty())
+    return;
+
+  // cgroup v2, where "max" means there is no limit.
+  vector<string> dirs = GroupDirs(root, mounts, "");
+  for (vector<string>::iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    int64_t memory;
+    if (ReadNumber(*d + "/memory.max", &memory) && memory < kNoMemoryLimit)
+      Lower(&limit_, memory / 1024);
+  }
+  int64_t usage;
+  if (!dirs.empty() && ReadNumber(dirs[0] + "/memory.current", &usage)) {
+    usage_path_ = dirs[0] + "/memory.current";
+    stat_path_ = dirs[0] + "/memory.stat";
+    inactive_key_ = "inactive_file";
+  }
+
+  // cgroup v1, which is what counts when both have the memory controller.
+  dirs = GroupDirs(root, mounts, "memory");
+  for (vector<string>::iterator d = dirs.begin(); d != dirs.end(); ++d) {
+    int64_t memory;
+    if (ReadNumber(*d + "/memory.limit_in_bytes", &memory) &&
+        memory < kNoMemoryLimit)
+      Lower(&limit_, memory / 1024);
+  }
+  if (!dirs.empty() && ReadNumber(dirs[0] + "/memory.usage_in_bytes", &usage)) {
+    usage_path_ = dirs[0] + "/memory.usage_in_bytes";
+    stat_path_ = dirs[0] + "/memory.stat";
+    inactive_key_ = "total_inactive_file";
+  }
+}
+
+int64_t CgroupMemory::ReadUsage() const {
+  int64_t usage, inactive;
+  if (usage_path_.empty() || !ReadNumber(usage_path_, &usage))
+    return 0;
+  if (ReadKey(stat_path_, inactive_key_, &inactive))
+    usage -= min(inactive, usage);
+  return usage / 1024;
+}
+
+string CgroupV2Dir(const string& root) {
+  vector<string> dirs = GroupDirs(root, ReadMounts(root), "");
+  return dirs.empty() ? string() : dirs[0];
+}
@@ -0,0 +1,76 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_CGROUP_H_
+#define NINJA_CGROUP_H_
+
+#include <string>
+using namespace std;
+
+#include "util.h"  // For int64_t.
+
+/// The limits that the Linux cgroups of the current process put on it, as
+/// the cgroups of a container such as a Kubernetes pod do.  Both cgroup v1
+/// and v2 hierarchies are read, and the limits of the groups above ours up
+/// to the root of a hierarchy count too.  The files are looked up under
+/// |root|, which is empty except in tests.
+struct CgroupLimits {
+  CgroupLimits()
+      : cpu_quota(-1), cpuset_cpus(-1), memory_limit(-1), memory_usage(0) {}
+
+  static CgroupLimits Read(const string& root = "");
+
+  /// The number of CPUs the limits leave, rounded up, or -1 if they don't
+  /// limit the CPUs.
+  int cpus() const;
+
+  /// The CPU time the quota allows per unit of time, which may be a
+  /// fraction, or -1 if there is no quota.
+  double cpu_quota;
+  /// The number of CPUs in the cpuset, or -1 if that is unknown.
+  int cpuset_cpus;
+  /// The memory limit, in kilobytes, or -1 if there is none.
+  int64_t memory_limit;
+  /// The memory in use, in kilobytes, not counting file pages that are
+  /// inactive and so reclaimed first.
+  int64_t memory_usage;
+};
+
+/// The memory limit and usage of the cgroups of the current process, for
+/// sampling the usage often: the files to read are found once, when this
+/// is constructed, and only the usage is read again after that.
+struct CgroupMemory {
+  explicit CgroupMemory(const string& root = "");
+
+  /// The memory limit, in kilobytes, or -1 if there is none.
+  int64_t limit() const { return limit_; }
+
+  /// The memory in use now, like CgroupLimits::memory_usage, or 0 if it
+  /// can't be read.
+  int64_t ReadUsage() const;
+
+ private:
+  int64_t limit_;
+  /// The file with the memory in use, or an empty string if there is none.
+  string usage_path_;
+  /// The memory.stat file, and the key in it of the inactive file pages.
+  string stat_path_;
+  string inactive_key_;
+};
+
+/// The directory of the cgroup v2 group of the current process, under
+/// |root|, or an empty string if there is no cgroup v2 hierarchy.
+string CgroupV2Dir(const string& root = "");
+
+#endif  // NINJA_CGROUP_H_
@@ -0,0 +1,141 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "cgroup.h"
+
+#include "disk_interface.h"
+#include "test.h"
+
+namespace {
+
+/// Fake cgroup files under a temporary directory.
+struct CgroupTest : public testing::Test {
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("Ninja-CgroupTest");
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  void Write(const string& path, const string& contents) {
+    ASSERT_TRUE(disk_interface_.MakeDirs(path));
+    ASSERT_TRUE(disk_interface_.WriteFile(path, contents));
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_interface_;
+};
+
+TEST_F(CgroupTest, None) {
+  CgroupLimits limits = CgroupLimits::Read(".");
+  EXPECT_EQ(-1, limits.cpu_quota);
+  EXPECT_EQ(-1, limits.cpuset_cpus);
+  EXPECT_EQ(-1, limits.memory_limit);
+  EXPECT_EQ(-1, limits.cpus());
+  EXPECT_EQ("", CgroupV2Dir("."));
+}
+
+TEST_F(CgroupTest, V2) {
+  Write("proc/self/mountinfo",
+"22 1 0:21 / / rw,relatime - ext4 /dev/sda1 rw\n"
+"29 22 0:26 / /sys/fs/cgroup rw,nosuid - cgroup2 cgroup2 rw,nsdelegate\n");
+  Write("proc/self/cgroup", "0::/pod/ninja\n");
+  Write("sys/fs/cgroup/pod/cpu.max", "250000 100000\n");
+  Write("sys/fs/cgroup/pod/memory.max", "4294967296\n");
+  Write("sys/fs/cgroup/pod/ninja/cpu.max", "max 100000\n");
+  Write("sys/fs/cgroup/pod/ninja/memory.max", "max\n");
+  Write("sys/fs/cgroup/pod/ninja/memory.current", "1073741824\n");
+  Write("sys/fs/cgroup/pod/ninja/memory.stat",
+        "anon 536870912\nactive_file 0\ninactive_file 536870912\n");
+  Write("sys/fs/cgroup/pod/ninja/cpuset.cpus.effective", "0-3,8\n");
+
+  CgroupLimits limits = CgroupLimits::Read(".");
+  EXPECT_EQ(2.5, limits.cpu_quota);
+  EXPECT_EQ(5, limits.cpuset_cpus);
+  EXPECT_EQ(3, limits.cpus());
+  EXPECT_EQ(4 * 1024 * 1024, limits.memory_limit);
+  EXPECT_EQ(512 * 1024, limits.memory_usage);
+  EXPECT_EQ("./sys/fs/cgroup/pod/ninja", CgroupV2Dir("."));
+}
+
+TEST_F(CgroupTest, V2MountedFromGroup) {
+  // A container mounts the file system from its own group.
+  Write("proc/self/mountinfo",
+"29 22 0:26 /pod /sys/fs/cgroup rw,nosuid - cgroup2 cgroup2 rw\n");
+  Write("proc/self/cgroup", "0::/pod/ninja\n");
+  Write("sys/fs/cgroup/cpu.max", "50000 100000\n");
+  Write("sys/fs/cgroup/ninja/cpuset.cpus.effective", "0-7\n");
+
+  CgroupLimits limits = CgroupLimits::Read(".");
+  EXPECT_EQ(0.5, limits.cpu_quota);
+  EXPECT_EQ(8, limits.cpuset_cpus);
+  // A fraction of a CPU still runs one command.
+  EXPECT_EQ(1, limits.cpus());
+  EXPECT_EQ("./sys/fs/cgroup/ninja", CgroupV2Dir("."));
+}
+
+TEST_F(CgroupTest, V1) {
+  Write("proc/self/mountinfo",
+"30 25 0:26 / /sys/fs/cgroup/cpu,cpuacct rw - cgroup cgroup rw,cpu,cpuacct\n"
+"31 25 0:27 / /sys/fs/cgroup/cpuset rw - cgroup cgroup rw,cpuset\n"
+"32 25 0:28 / /sys/fs/cgroup/memory rw - cgroup cgroup rw,memory\n"
+"33 25 0:29 / /sys/fs/cgroup/unified rw - cgroup2 cgroup2 rw\n");
+  Write("proc/self/cgroup",
+        "4:memory:/docker/abc\n"
+        "3:cpuset:/docker/abc\n"
+        "2:cpu,cpuacct:/docker/abc\n"
+        "0::/\n");
+  Write("sys/fs/cgroup/cpu,cpuacct/docker/abc/cpu.cfs_quota_us", "-1\n");
+  Write("sys/fs/cgroup/cpu,cpuacct/docker/abc/cpu.cfs_period_us", "100000\n");
+  Write("sys/fs/cgroup/cpu,cpuacct/docker/cpu.cfs_quota_us", "400000\n");
+  Write("sys/fs/cgroup/cpu,cpuacct/docker/cpu.cfs_period_us", "100000\n");
+  Write("sys/fs/cgroup/cpuset/docker/abc/cpuset.cpus", "2,4-5\n");
+  Write("sys/fs/cgroup/memory/memory.limit_in_bytes",
+        "9223372036854771712\n");
+  Write("sys/fs/cgroup/memory/docker/abc/memory.limit_in_bytes",
+        "2147483648\n");
+  Write("sys/fs/cgroup/memory/docker/abc/memory.usage_in_bytes",
+        "1073741824\n");
+  Write("sys/fs/cgroup/memory/docker/abc/memory.stat",
+        "cache 0\ninactive_file 1\ntotal_inactive_file 268435456\n");
+
+  CgroupLimits limits = CgroupLimits::Read(".");
+  EXPECT_EQ(4.0, limits.cpu_quota);
+  EXPECT_EQ(3, limits.cpuset_cpus);
+  EXPECT_EQ(3, limits.cpus());
+  EXPECT_EQ(2 * 1024 * 1024, limits.memory_limit);
+  EXPECT_EQ(768 * 1024, limits.memory_usage);
+}
+
+TEST_F(CgroupTest, MemoryUsageSampled) {
+  Write("proc/self/mountinfo",
+"29 22 0:26 / /sys/fs/cgroup rw,nosuid - cgroup2 cgroup2 rw,nsdelegate\n");
+  Write("proc/self/cgroup", "0::/ninja\n");
+  Write("sys/fs/cgroup/ninja/memory.max", "2147483648\n");
+  Write("sys/fs/cgroup/ninja/memory.current", "1073741824\n");
+
+  CgroupMemory memory(".");
+  EXPECT_EQ(2 * 1024 * 1024, memory.limit());
+  EXPECT_EQ(1024 * 1024, memory.ReadUsage());
+
+  // The files are found once, and only the usage is read again.
+  ASSERT_EQ(0, disk_interface_.RemoveFile("proc/self/mountinfo"));
+  ASSERT_EQ(0, disk_interface_.RemoveFile("proc/self/cgroup"));
+  Write("sys/fs/cgroup/ninja/memory.current", "536870912\n");
+  Write("sys/fs/cgroup/ninja/memory.stat", "inactive_file 268435456\n");
+  EXPECT_EQ(256 * 1024, memory.ReadUsage());
+}
+
+}  // anonymous namespace
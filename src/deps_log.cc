@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <new>
 #ifndef _WIN32
 #include <unistd.h>
 #elif defined(_MSC_VER) && (_MSC_VER < 1900)
@@ -26,8 +27,10 @@ typedef unsigned __int32 uint32_t;
 #endif
 
 #include "graph.h"
+#include "mapped_file.h"
 #include "metrics.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 
 // The version is stored as 4 bytes after the signature and also serves as a
@@ -39,6 +42,16 @@ const int kCurrentVersion = 4;
 // internal buffers having to have this size.
 const unsigned kMaxRecordSize = (1 << 19) - 1;
 
+namespace {
+
+/// The number of input ids in the deps record whose data, following the
+/// size word, starts at |deps_data|.
+int DepsRecordNodeCount(const unsigned* deps_data) {
+  return ((deps_data[-1] & 0x7FFFFFFF) / 4) - 3;
+}
+
+}  // anonymous namespace
+
 DepsLog::~DepsLog() {
   Close();
 }
@@ -153,7 +166,7 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
     return false;
 
   // Update in-memory representation.
-  Deps* deps = new Deps(mtime, node_count);
+  Deps* deps = NewDeps(mtime, node_count);
   for (int i = 0; i < node_count; ++i)
     deps->nodes[i] = nodes[i];
   UpdateDeps(node->id(), deps);
@@ -169,85 +182,100 @@ void DepsLog::Close() {
 
 LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
   METRIC_RECORD(".ninja_deps load");
-  char buf[kMaxRecordSize + 1];
-  FILE* f = fopen(path.c_str(), "rb");
-  if (!f) {
-    if (errno == ENOENT)
-      return LOAD_NOT_FOUND;
-    *err = strerror(errno);
-    return LOAD_ERROR;
+  TRACE_RECORD(".ninja_deps load");
+  MappedFile file;
+  int ret = file.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
   }
+  if (ret < 0)
+    return LOAD_ERROR;
 
-  bool valid_header = true;
+  const char* const data = file.data();
+  const char* const end = data + file.size();
+  const size_t kSignatureSize = sizeof(kFileSignature) - 1;
+  const size_t kHeaderSize = kSignatureSize + 4;
+
+  bool valid_header = file.size() >= kHeaderSize &&
+      memcmp(data, kFileSignature, kSignatureSize) == 0;
   int version = 0;
-  if (!fgets(buf, sizeof(buf), f) || fread(&version, 4, 1, f) < 1)
-    valid_header = false;
+  if (file.size() >= kHeaderSize)
+    memcpy(&version, data + kSignatureSize, 4);
   // Note: For version differences, this should migrate to the new format.
   // But the v1 format could sometimes (rarely) end up with invalid data, so
   // don't migrate v1 to v3 to force a rebuild. (v2 only existed for a few days,
   // and there was no release with it, so pretend that it never happened.)
-  if (!valid_header || strcmp(buf, kFileSignature) != 0 ||
-      version != kCurrentVersion) {
+  if (!valid_header || version != kCurrentVersion) {
     if (version == 1)
       *err = "deps log version change; rebuilding";
     else
       *err = "bad deps log signature or version; starting over";
-    fclose(f);
+    file.Close();
     unlink(path.c_str());
     // Don't report this as a failure.  An empty deps log will cause
     // us to rebuild the outputs anyway.
     return LOAD_SUCCESS;
   }
 
-  long offset;
+  // First pass: assign ids to the paths, and find the latest deps record of
+  // each output.  Records stay in the mapped file; replaced ones are never
+  // copied anywhere.
+  vector<const unsigned*> latest_deps;
+  size_t latest_node_count = 0;
+  const char* p = data + kHeaderSize;
+  size_t offset;
   bool read_failed = false;
   int unique_dep_record_count = 0;
   int total_dep_record_count = 0;
   for (;;) {
-    offset = ftell(f);
+    offset = p - data;
+    if (p == end)
+      break;
 
     unsigned size;
-    if (fread(&size, 4, 1, f) < 1) {
-      if (!feof(f))
-        read_failed = true;
+    if (end - p < 4) {
+      read_failed = true;
       break;
     }
+    memcpy(&size, p, 4);
     bool is_deps = (size >> 31) != 0;
     size = size & 0x7FFFFFFF;
 
-    if (size > kMaxRecordSize || fread(buf, size, 1, f) < 1) {
+    // All records are made of 4-byte words: deps records hold at least an
+    // output id and an mtime, path records at least one byte of path and
+    // a checksum.
+    if (size > kMaxRecordSize || size % 4 != 0 ||
+        size < (is_deps ? 12u : 8u) || (size_t)(end - p) - 4 < size) {
       read_failed = true;
       break;
     }
+    const char* record = p + 4;
+    p = record + size;
 
     if (is_deps) {
-      assert(size % 4 == 0);
-      int* deps_data = reinterpret_cast<int*>(buf);
+      const unsigned* deps_data = reinterpret_cast<const unsigned*>(record);
       int out_id = deps_data[0];
-      TimeStamp mtime;
-      mtime = (TimeStamp)(((uint64_t)(unsigned int)deps_data[2] << 32) |
-                          (uint64_t)(unsigned int)deps_data[1]);
-      deps_data += 3;
-      int deps_count = (size / 4) - 3;
-
-      Deps* deps = new Deps(mtime, deps_count);
-      for (int i = 0; i < deps_count; ++i) {
-        assert(deps_data[i] < (int)nodes_.size());
-        assert(nodes_[deps_data[i]]);
-        deps->nodes[i] = nodes_[deps_data[i]];
+      if (out_id < 0) {
+        read_failed = true;
+        break;
       }
-
-      total_dep_record_count++;
-      if (!UpdateDeps(out_id, deps))
+      if (out_id >= (int)latest_deps.size())
+        latest_deps.resize(out_id + 1);
+      if (latest_deps[out_id])
+        latest_node_count -= DepsRecordNodeCount(latest_deps[out_id]);
+      else
         ++unique_dep_record_count;
+      latest_deps[out_id] = deps_data;
+      latest_node_count += DepsRecordNodeCount(deps_data);
+      total_dep_record_count++;
     } else {
       int path_size = size - 4;
-      assert(path_size > 0);  // CanonicalizePath() rejects empty paths.
       // There can be up to 3 bytes of padding.
-      if (buf[path_size - 1] == '\0') --path_size;
-      if (buf[path_size - 1] == '\0') --path_size;
-      if (buf[path_size - 1] == '\0') --path_size;
-      StringPiece subpath(buf, path_size);
+      if (record[path_size - 1] == '\0') --path_size;
+      if (record[path_size - 1] == '\0') --path_size;
+      if (record[path_size - 1] == '\0') --path_size;
+      StringPiece subpath(record, path_size);
       // It is not necessary to pass in a correct slash_bits here. It will
       // either be a Node that's in the manifest (in which case it will already
       // have a correct slash_bits that GetNode will look up), or it is an
@@ -259,7 +287,8 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
       // happen if two ninja processes write to the same deps log concurrently.
       // (This uses unary complement to make the checksum look less like a
       // dependency record entry.)
-      unsigned checksum = *reinterpret_cast<unsigned*>(buf + size - 4);
+      unsigned checksum;
+      memcpy(&checksum, record + size - 4, 4);
       int expected_id = ~checksum;
       int id = nodes_.size();
       if (id != expected_id) {
@@ -273,16 +302,33 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
     }
   }
 
+  // Second pass: resolve the latest deps of each output to nodes, all into
+  // a single array.
+  Node** nodes = arena_.AllocArray<Node*>(latest_node_count);
+  Deps* deps = arena_.AllocArray<Deps>(unique_dep_record_count);
+  for (int out_id = 0; out_id < (int)latest_deps.size(); ++out_id) {
+    const unsigned* deps_data = latest_deps[out_id];
+    if (!deps_data)
+      continue;
+    TimeStamp mtime;
+    mtime = (TimeStamp)(((uint64_t)deps_data[2] << 32) |
+                        (uint64_t)deps_data[1]);
+    int deps_count = DepsRecordNodeCount(deps_data);
+    for (int i = 0; i < deps_count; ++i) {
+      int id = deps_data[3 + i];
+      assert(id < (int)nodes_.size());
+      assert(nodes_[id]);
+      nodes[i] = nodes_[id];
+    }
+    UpdateDeps(out_id, new (deps++) Deps(mtime, deps_count, nodes));
+    nodes += deps_count;
+  }
+  file.Close();
+
   if (read_failed) {
     // An error occurred while loading; try to recover by truncating the
     // file to the last fully-read record.
-    if (ferror(f)) {
-      *err = strerror(ferror(f));
-    } else {
-      *err = "premature end of file";
-    }
-    fclose(f);
-
+    *err = "premature end of file";
     if (!Truncate(path, offset, err))
       return LOAD_ERROR;
 
@@ -292,8 +338,6 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
     return LOAD_SUCCESS;
   }
 
-  fclose(f);
-
   // Rebuild the log if there are too many dead records.
   int kMinCompactionEntryCount = 1000;
   int kCompactionRatio = 3;
@@ -315,6 +359,7 @@ DepsLog::Deps* DepsLog::GetDeps(Node* node) {
 
 bool DepsLog::Recompact(const string& path, string* err) {
   METRIC_RECORD(".ninja_deps recompact");
+  TRACE_RECORD(".ninja_deps recompact");
 
   Close();
   string temp_path = path + ".recompact";
@@ -352,6 +397,7 @@ bool DepsLog::Recompact(const string& path, string* err) {
   // All nodes now have ids that refer to new_log, so steal its data.
   deps_.swap(new_log.deps_);
   nodes_.swap(new_log.nodes_);
+  arena_.Swap(&new_log.arena_);
 
   if (unlink(path.c_str()) < 0) {
     *err = strerror(errno);
@@ -380,11 +426,15 @@ bool DepsLog::UpdateDeps(int out_id, Deps* deps) {
   if (out_id >= (int)deps_.size())
     deps_.resize(out_id + 1);
 
-  bool delete_old = deps_[out_id] != NULL;
-  if (delete_old)
-    delete deps_[out_id];
+  // The replaced record stays in the arena until the log is recompacted.
+  bool replaced = deps_[out_id] != NULL;
   deps_[out_id] = deps;
-  return delete_old;
+  return replaced;
+}
+
+DepsLog::Deps* DepsLog::NewDeps(TimeStamp mtime, int node_count) {
+  Node** nodes = arena_.AllocArray<Node*>(node_count);
+  return new (arena_.AllocArray<Deps>(1)) Deps(mtime, node_count, nodes);
 }
 
 bool DepsLog::RecordId(Node* node) {
@@ -21,6 +21,7 @@ using namespace std;
 
 #include <stdio.h>
 
+#include "arena.h"
 #include "load_status.h"
 #include "timestamp.h"
 
@@ -77,14 +78,19 @@ struct DepsLog {
   void Close();
 
   // Reading (startup-time) interface.
+
+  /// The recorded deps of one output.  The node list is owned by the
+  /// DepsLog, and lives as long as it does.
   struct Deps {
-    Deps(int64_t mtime, int node_count)
-        : mtime(mtime), node_count(node_count), nodes(new Node*[node_count]) {}
-    ~Deps() { delete [] nodes; }
+    Deps(int64_t mtime, int node_count, Node** nodes)
+        : mtime(mtime), node_count(node_count), nodes(nodes) {}
     TimeStamp mtime;
     int node_count;
     Node** nodes;
   };
+  /// Load the log at |path|.  The file is mapped into memory and parsed in
+  /// place; only the latest record for each output is kept, with all their
+  /// node lists in a single allocation.
   LoadStatus Load(const string& path, State* state, string* err);
   Deps* GetDeps(Node* node);
 
@@ -104,9 +110,11 @@ struct DepsLog {
   const vector<Deps*>& deps() const { return deps_; }
 
  private:
-  // Updates the in-memory representation.  Takes ownership of |deps|.
-  // Returns true if a prior deps record was deleted.
+  // Updates the in-memory representation.  |deps| must be allocated from
+  // |arena_|.  Returns true if a prior deps record was replaced.
   bool UpdateDeps(int out_id, Deps* deps);
+  // Allocates a Deps, and room for its nodes, from |arena_|.
+  Deps* NewDeps(TimeStamp mtime, int node_count);
   // Write a node name record, assigning it an id.
   bool RecordId(Node* node);
 
@@ -117,6 +125,8 @@ struct DepsLog {
   vector<Node*> nodes_;
   /// Maps id -> deps of that id.
   vector<Deps*> deps_;
+  /// Holds all Deps and their node lists.
+  Arena arena_;
 
   friend struct DepsLogTest;
 };
@@ -0,0 +1,122 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "deps_log.h"
+#include "graph.h"
+#include "state.h"
+#include "util.h"
+#include "metrics.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+const char kTestFilename[] = "DepsLogPerfTest-tempfile";
+
+bool WriteTestData(string* err) {
+  DepsLog log;
+  if (!log.OpenForWrite(kTestFilename, err))
+    return false;
+
+  /*
+  A large C++ project: a million object files, each depending on 30 out of
+  20000 headers, with 10% of the objects rebuilt (and so recorded again)
+  since the log was last recompacted.  This makes for a log of about 2.1
+  million records and 200 MB.
+  */
+  const int kNumHeaders = 20000;
+  const int kNumObjects = 1000000;
+  const int kNumDeps = 30;
+
+  State state;
+  vector<Node*> headers;
+  for (int i = 0; i < kNumHeaders; ++i) {
+    char buf[80];
+    sprintf(buf, "../../third_party/some/library/include/header%d.h", i);
+    headers.push_back(state.GetNode(buf, 0));
+  }
+
+  srand(0);
+  vector<Node*> deps(kNumDeps);
+  for (int i = 0; i < kNumObjects + kNumObjects / 10; ++i) {
+    char buf[80];
+    sprintf(buf, "obj/src/module%d/source%d.o", (i % kNumObjects) / 100,
+            i % kNumObjects);
+    for (int j = 0; j < kNumDeps; ++j)
+      deps[j] = headers[rand() % kNumHeaders];
+    if (!log.RecordDeps(state.GetNode(buf, 0), i, deps)) {
+      *err = "failed to record deps";
+      return false;
+    }
+  }
+  log.Close();
+
+  return true;
+}
+
+int main() {
+  vector<int> times;
+  string err;
+
+  printf("Creating test data..."); fflush(stdout);
+  if (!WriteTestData(&err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+  printf("done.\n");
+
+  {
+    // Read once to warm up disk cache.
+    State state;
+    DepsLog log;
+    if (log.Load(kTestFilename, &state, &err) != LOAD_SUCCESS) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+  }
+  const int kNumRepetitions = 5;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    State state;
+    DepsLog log;
+    int64_t start = GetTimeMillis();
+    if (log.Load(kTestFilename, &state, &err) != LOAD_SUCCESS) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+    int delta = (int)(GetTimeMillis() - start);
+    printf("%dms (%d nodes)\n", delta, (int)log.nodes().size());
+    times.push_back(delta);
+  }
+
+  int min = times[0];
+  int max = times[0];
+  float total = 0;
+  for (size_t i = 0; i < times.size(); ++i) {
+    total += times[i];
+    if (times[i] < min)
+      min = times[i];
+    else if (times[i] > max)
+      max = times[i];
+  }
+
+  printf("min %dms  max %dms  avg %.1fms\n",
+         min, max, total / times.size());
+
+  unlink(kTestFilename);
+
+  return 0;
+}
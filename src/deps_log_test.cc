@@ -120,6 +120,46 @@ TEST_F(DepsLogTest, LotsOfDeps) {
   ASSERT_EQ(kNumDeps, log_deps->node_count);
 }
 
+// Verify that only the latest of several records for an output is loaded.
+TEST_F(DepsLogTest, ReadLatestEntry) {
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+
+  vector<Node*> deps;
+  deps.push_back(state1.GetNode("foo.h", 0));
+  deps.push_back(state1.GetNode("bar.h", 0));
+  deps.push_back(state1.GetNode("baz.h", 0));
+  log1.RecordDeps(state1.GetNode("out.o", 0), 1, deps);
+  log1.RecordDeps(state1.GetNode("out2.o", 0), 2, deps);
+  deps.pop_back();
+  log1.RecordDeps(state1.GetNode("out.o", 0), 3, deps);
+  deps.push_back(state1.GetNode("qux.h", 0));
+  log1.RecordDeps(state1.GetNode("out.o", 0), 4, deps);
+  log1.Close();
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+
+  DepsLog::Deps* log_deps = log2.GetDeps(state2.GetNode("out.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(4, log_deps->mtime);
+  ASSERT_EQ(3, log_deps->node_count);
+  ASSERT_EQ("foo.h", log_deps->nodes[0]->path());
+  ASSERT_EQ("bar.h", log_deps->nodes[1]->path());
+  ASSERT_EQ("qux.h", log_deps->nodes[2]->path());
+
+  log_deps = log2.GetDeps(state2.GetNode("out2.o", 0));
+  ASSERT_TRUE(log_deps);
+  ASSERT_EQ(2, log_deps->mtime);
+  ASSERT_EQ(3, log_deps->node_count);
+  ASSERT_EQ("baz.h", log_deps->nodes[2]->path());
+}
+
 // Verify that adding the same deps twice doesn't grow the file.
 TEST_F(DepsLogTest, DoubleEntry) {
   // Write some deps to the file and grab its size.
@@ -407,6 +447,55 @@ TEST_F(DepsLogTest, Truncated) {
   }
 }
 
+// Verify that a record whose size can't be right is treated like a
+// truncated file.
+TEST_F(DepsLogTest, BadRecordSize) {
+  int file_size;
+  {
+    State state;
+    DepsLog log;
+    string err;
+    EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
+    ASSERT_EQ("", err);
+
+    vector<Node*> deps;
+    deps.push_back(state.GetNode("foo.h", 0));
+    log.RecordDeps(state.GetNode("out.o", 0), 1, deps);
+    log.Close();
+
+    struct stat st;
+    ASSERT_EQ(0, stat(kTestFilename, &st));
+    file_size = (int)st.st_size;
+  }
+
+  const unsigned kBadSizes[] = {
+    0x80000000 | 6,  // Not a multiple of 4.
+    0x80000000 | 8,  // Deps record without room for the mtime.
+    4,               // Path record without a path.
+    64,              // Past the end of the file.
+  };
+  for (size_t i = 0; i < sizeof(kBadSizes) / sizeof(kBadSizes[0]); ++i) {
+    FILE* f = fopen(kTestFilename, "ab");
+    ASSERT_TRUE(f);
+    fwrite(&kBadSizes[i], 4, 1, f);
+    fwrite("\0\0\0\0\0\0\0\0\0\0\0\0", 12, 1, f);
+    fclose(f);
+
+    State state;
+    DepsLog log;
+    string err;
+    EXPECT_TRUE(log.Load(kTestFilename, &state, &err));
+    EXPECT_EQ("premature end of file; recovering", err);
+    DepsLog::Deps* log_deps = log.GetDeps(state.GetNode("out.o", 0));
+    ASSERT_TRUE(log_deps);
+    ASSERT_EQ(1, log_deps->node_count);
+
+    struct stat st;
+    ASSERT_EQ(0, stat(kTestFilename, &st));
+    ASSERT_EQ(file_size, (int)st.st_size);
+  }
+}
+
 // Run the truncation-recovery logic.
 TEST_F(DepsLogTest, TruncatedRecovery) {
   // Create a file with some entries.
@@ -0,0 +1,167 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "deps_reader.h"
+
+#include <algorithm>
+
+#include "clparser.h"
+
+DepsReader::DepsReader(FileReader* file_reader,
+                       const DepfileParserOptions& options, int threads)
+    : file_reader_(file_reader), options_(options), max_threads_(threads)
+#if __cplusplus >= 201103L
+      , idle_(0), done_(false)
+#endif
+      {}
+
+DepsReader::~DepsReader() {
+#if __cplusplus >= 201103L
+  vector<thread> threads;
+  {
+    lock_guard<mutex> lock(mutex_);
+    done_ = true;
+    threads.swap(threads_);
+  }
+  work_.notify_all();
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+#endif
+}
+
+void DepsReader::Read(Request* request) const {
+  request->success = false;
+  request->deps.clear();
+
+  if (request->deps_type == "msvc") {
+    CLParser parser;
+    string output;
+    if (!parser.Parse(request->output, request->deps_prefix, &output,
+                      &request->err))
+      return;
+    request->output.swap(output);
+    request->includes_.swap(parser.includes_);
+    for (set<string>::iterator i = request->includes_.begin();
+         i != request->includes_.end(); ++i) {
+      // ~0 is assuming that with MSVC-parsed headers, it's ok to always make
+      // all backslashes (as some of the slashes will certainly be backslashes
+      // anyway). This could be fixed if necessary with some additional
+      // complexity in IncludesNormalize::Relativize.
+      request->deps.push_back(make_pair(StringPiece(*i), (uint64_t)~0u));
+    }
+  } else
+  if (request->deps_type == "gcc") {
+    if (request->depfile.empty()) {
+      request->err = "edge with deps=gcc but no depfile makes no sense";
+      return;
+    }
+
+    // Read depfile content.  Treat a missing depfile as empty.
+    switch (file_reader_->ReadFile(request->depfile, &request->content_,
+                                   &request->err)) {
+    case FileReader::Okay:
+      break;
+    case FileReader::NotFound:
+      request->err.clear();
+      break;
+    case FileReader::OtherError:
+      return;
+    }
+
+    if (!request->content_.empty()) {
+      DepfileParser deps(options_);
+      if (!deps.Parse(&request->content_, &request->err))
+        return;
+
+      // XXX check depfile matches expected output.
+      request->deps.reserve(deps.ins_.size());
+      for (vector<StringPiece>::iterator i = deps.ins_.begin();
+           i != deps.ins_.end(); ++i) {
+        uint64_t slash_bits;
+        if (!CanonicalizePath(const_cast<char*>(i->str_), &i->len_,
+                              &slash_bits, &request->err))
+          return;
+        request->deps.push_back(make_pair(*i, slash_bits));
+      }
+    }
+  } else {
+    // Fatal() would exit while the main thread runs, so leave it to that.
+    request->err = "unknown deps type '" + request->deps_type + "'";
+    return;
+  }
+
+  request->success = true;
+}
+
+void DepsReader::Push(Request* request) {
+#if __cplusplus >= 201103L
+  // Without helpers, Wait() reads every request when it gets to it.
+  if (max_threads_ <= 1)
+    return;
+  lock_guard<mutex> lock(mutex_);
+  if (done_)
+    return;
+  pending_.push_back(request);
+  // The thread waiting reads requests too, when it has to wait for one
+  // that nobody has started on.
+  if ((int)pending_.size() > idle_ &&
+      (int)threads_.size() < max_threads_ - 1)
+    threads_.push_back(thread(&DepsReader::Work, this));
+  work_.notify_one();
+#endif
+}
+
+void DepsReader::Wait(Request* request) {
+#if __cplusplus >= 201103L
+  unique_lock<mutex> lock(mutex_);
+  if (request->status_ == Request::kQueued) {
+    deque<Request*>::iterator i =
+        find(pending_.begin(), pending_.end(), request);
+    if (i != pending_.end())
+      pending_.erase(i);
+    request->status_ = Request::kReading;
+    lock.unlock();
+    Read(request);
+    lock.lock();
+    request->status_ = Request::kRead;
+    return;
+  }
+  while (request->status_ != Request::kRead)
+    read_.wait(lock);
+#else
+  Read(request);
+#endif
+}
+
+#if __cplusplus >= 201103L
+void DepsReader::Work() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    ++idle_;
+    while (pending_.empty() && !done_)
+      work_.wait(lock);
+    --idle_;
+    if (done_)
+      return;
+    Request* request = pending_.front();
+    pending_.pop_front();
+    request->status_ = Request::kReading;
+    lock.unlock();
+    Read(request);
+    lock.lock();
+    request->status_ = Request::kRead;
+    read_.notify_all();
+  }
+}
+#endif
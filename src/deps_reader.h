@@ -0,0 +1,124 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_DEPS_READER_H_
+#define NINJA_DEPS_READER_H_
+
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+#if __cplusplus >= 201103L
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "depfile_parser.h"
+#include "disk_interface.h"
+#include "string_piece.h"
+#include "util.h"  // For uint64_t.
+
+/// Reads the dependencies a command discovered, from its depfile or from
+/// what it printed, into canonical paths that are yet to be looked up in
+/// the State.  Since that doesn't touch the State, it can be done on other
+/// threads while the build starts more commands.
+struct DepsReader {
+  /// The dependencies of one command, and what to read them from.
+  struct Request {
+    Request() : success(false), status_(kQueued) {}
+
+    /// The deps binding of the edge, "gcc" or "msvc".
+    string deps_type;
+    /// The msvc_deps_prefix binding of the edge, for "msvc".
+    string deps_prefix;
+    /// The depfile of the edge, for "gcc".
+    string depfile;
+    /// What the command printed, for "msvc", from which the lines naming
+    /// includes are removed.
+    string output;
+
+    /// Whether the dependencies were read; if not, |err| says why.  An
+    /// unknown |deps_type| is an error too, which callers should treat as
+    /// fatal.
+    bool success;
+    string err;
+    /// The paths of the dependencies, which point into the request, and
+    /// their slash bits.
+    vector<pair<StringPiece, uint64_t> > deps;
+
+   private:
+    friend struct DepsReader;
+
+    enum Status { kQueued, kReading, kRead };
+    Status status_;
+    /// The contents of the depfile, which |deps| point into for "gcc".
+    string content_;
+    /// The includes printed, which |deps| point into for "msvc".
+    set<string> includes_;
+
+    // Not copyable, since |deps| point into it.
+    Request(const Request&);
+    void operator=(const Request&);
+  };
+
+  /// |threads| is how many threads may read at once, counting the one
+  /// calling Wait().  More than one requires a |file_reader| that can be
+  /// called from several threads.
+  DepsReader(FileReader* file_reader, const DepfileParserOptions& options,
+             int threads);
+  ~DepsReader();
+
+  /// Read |request| on this thread.
+  void Read(Request* request) const;
+
+  /// Make |request| available to other threads for reading.  It must be
+  /// passed to Wait() before it is deleted.
+  void Push(Request* request);
+
+  /// Return once |request| is read, reading it on this thread if no other
+  /// thread has started on it.
+  void Wait(Request* request);
+
+ private:
+#if __cplusplus >= 201103L
+  /// Thread body: read queued requests until the reader is destroyed.
+  void Work();
+#endif
+
+  FileReader* file_reader_;
+  DepfileParserOptions options_;
+  int max_threads_;
+#if __cplusplus >= 201103L
+  mutex mutex_;
+  /// Signalled when a request is queued, and when the threads should exit.
+  condition_variable work_;
+  /// Signalled when a request has been read.
+  condition_variable read_;
+  deque<Request*> pending_;
+  vector<thread> threads_;
+  /// The number of threads waiting for a request.
+  int idle_;
+  bool done_;
+#endif
+
+  // Not copyable.
+  DepsReader(const DepsReader&);
+  void operator=(const DepsReader&);
+};
+
+#endif  // NINJA_DEPS_READER_H_
@@ -0,0 +1,138 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "deps_reader.h"
+
+#include "test.h"
+
+namespace {
+
+struct DepsReaderTest : public testing::Test {
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("Ninja-DepsReaderTest");
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_interface_;
+};
+
+TEST_F(DepsReaderTest, Gcc) {
+  ASSERT_TRUE(disk_interface_.WriteFile("out.d",
+                                        "out: ./in.c dir/../in.h \\\n"
+                                        "  other\\dir/in.h\n"));
+  DepsReader reader(&disk_interface_, DepfileParserOptions(), 1);
+  DepsReader::Request request;
+  request.deps_type = "gcc";
+  request.depfile = "out.d";
+  reader.Read(&request);
+  ASSERT_TRUE(request.success);
+  EXPECT_EQ("", request.err);
+  ASSERT_EQ(3u, request.deps.size());
+  EXPECT_EQ("in.c", request.deps[0].first.AsString());
+  EXPECT_EQ(0u, request.deps[0].second);
+  EXPECT_EQ("in.h", request.deps[1].first.AsString());
+#ifdef _WIN32
+  EXPECT_EQ("other/dir/in.h", request.deps[2].first.AsString());
+  EXPECT_EQ(1u, request.deps[2].second);
+#else
+  EXPECT_EQ("other\\dir/in.h", request.deps[2].first.AsString());
+  EXPECT_EQ(0u, request.deps[2].second);
+#endif
+}
+
+TEST_F(DepsReaderTest, Gcc_MissingDepfile) {
+  DepsReader reader(&disk_interface_, DepfileParserOptions(), 1);
+  DepsReader::Request request;
+  request.deps_type = "gcc";
+  request.depfile = "out.d";
+  reader.Read(&request);
+  EXPECT_TRUE(request.success);
+  EXPECT_EQ("", request.err);
+  EXPECT_EQ(0u, request.deps.size());
+
+  DepsReader::Request no_depfile;
+  no_depfile.deps_type = "gcc";
+  reader.Read(&no_depfile);
+  EXPECT_FALSE(no_depfile.success);
+  EXPECT_EQ("edge with deps=gcc but no depfile makes no sense",
+            no_depfile.err);
+}
+
+TEST_F(DepsReaderTest, Msvc) {
+  DepsReader reader(&disk_interface_, DepfileParserOptions(), 1);
+  DepsReader::Request request;
+  request.deps_type = "msvc";
+  request.deps_prefix = "using ";
+  request.output = "using in.h\ncompiling\nusing in.h\nusing other.h\n";
+  reader.Read(&request);
+  ASSERT_TRUE(request.success);
+  EXPECT_EQ("compiling\n", request.output);
+  ASSERT_EQ(2u, request.deps.size());
+  EXPECT_EQ("in.h", request.deps[0].first.AsString());
+  EXPECT_EQ("other.h", request.deps[1].first.AsString());
+}
+
+TEST_F(DepsReaderTest, UnknownType) {
+  // Reading is done on other threads, so this is left to the caller.
+  DepsReader reader(&disk_interface_, DepfileParserOptions(), 2);
+  DepsReader::Request request;
+  request.deps_type = "foo";
+  reader.Push(&request);
+  reader.Wait(&request);
+  EXPECT_FALSE(request.success);
+  EXPECT_EQ("unknown deps type 'foo'", request.err);
+}
+
+TEST_F(DepsReaderTest, Threads) {
+  const int kRequests = 100;
+  for (int i = 0; i < kRequests; ++i) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    string name = buf;
+    ASSERT_TRUE(disk_interface_.WriteFile(name + ".d",
+                                          name + ".o: " + name + ".c\n"));
+  }
+
+  // Some requests are waited for before threads could start on them, and
+  // get read by the thread waiting.
+  DepsReader reader(&disk_interface_, DepfileParserOptions(), 4);
+  vector<DepsReader::Request*> requests;
+  for (int i = 0; i < kRequests; ++i) {
+    DepsReader::Request* request = new DepsReader::Request;
+    requests.push_back(request);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    request->deps_type = "gcc";
+    request->depfile = string(buf) + ".d";
+    reader.Push(request);
+    if (i % 10 == 0)
+      reader.Wait(request);
+  }
+  for (int i = 0; i < kRequests; ++i) {
+    DepsReader::Request* request = requests[i];
+    reader.Wait(request);
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%d", i);
+    EXPECT_TRUE(request->success);
+    ASSERT_EQ(1u, request->deps.size());
+    EXPECT_EQ(string(buf) + ".c", request->deps[0].first.AsString());
+    delete request;
+  }
+}
+
+}  // anonymous namespace
@@ -21,6 +21,15 @@
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#if !defined(_WIN32) && __cplusplus >= 201103L
+#include <thread>
+#endif
 
 #ifdef _WIN32
 #include <sstream>
@@ -125,6 +134,41 @@ bool StatAllFilesInDir(const string& dir, map<string, TimeStamp>* stamps,
   FindClose(find_handle);
   return true;
 }
+#else
+TimeStamp StatSingleFile(const string& path, string* err) {
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0) {
+    if (errno == ENOENT || errno == ENOTDIR)
+      return 0;
+    *err = "stat(" + path + "): " + strerror(errno);
+    return -1;
+  }
+  // Some users (Flatpak) set mtime to 0, this should be harmless
+  // and avoids conflicting with our return value of 0 meaning
+  // that it doesn't exist.
+  if (st.st_mtime == 0)
+    return 1;
+#if defined(_AIX)
+  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtime_n;
+#elif defined(__APPLE__)
+  return ((int64_t)st.st_mtimespec.tv_sec * 1000000000LL +
+          st.st_mtimespec.tv_nsec);
+#elif defined(st_mtime) // A macro, so we're likely on modern POSIX.
+  return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#else
+  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtimensec;
+#endif
+}
+
+#if __cplusplus >= 201103L
+/// Thread body for RealDiskInterface::StatMany().
+void StatRange(const vector<string>* paths, vector<TimeStamp>* mtimes,
+               size_t begin, size_t end) {
+  string err;
+  for (size_t i = begin; i < end; ++i)
+    (*mtimes)[i] = StatSingleFile((*paths)[i], &err);
+}
+#endif
 #endif  // _WIN32
 
 }  // namespace
@@ -151,6 +195,23 @@ bool DiskInterface::MakeDirs(const string& path) {
   return MakeDir(dir);
 }
 
+bool DiskInterface::WriteFileIfChanged(const string& path,
+                                       StringPiece contents) {
+  string old_contents, err;
+  if (ReadFile(path, &old_contents, &err) == Okay &&
+      StringPiece(old_contents) == contents)
+    return true;
+  return WriteFile(path, contents.AsString());
+}
+
+void DiskInterface::StatMany(const vector<string>& paths,
+                             vector<TimeStamp>* mtimes) const {
+  mtimes->resize(paths.size());
+  string err;
+  for (size_t i = 0; i < paths.size(); ++i)
+    (*mtimes)[i] = Stat(paths[i], &err);
+}
+
 // RealDiskInterface -----------------------------------------------------------
 
 TimeStamp RealDiskInterface::Stat(const string& path, string* err) const {
@@ -190,32 +251,45 @@ TimeStamp RealDiskInterface::Stat(const string& path, string* err) const {
   DirCache::iterator di = ci->second.find(base);
   return di != ci->second.end() ? di->second : 0;
 #else
-  struct stat st;
-  if (stat(path.c_str(), &st) < 0) {
-    if (errno == ENOENT || errno == ENOTDIR)
-      return 0;
-    *err = "stat(" + path + "): " + strerror(errno);
-    return -1;
-  }
-  // Some users (Flatpak) set mtime to 0, this should be harmless
-  // and avoids conflicting with our return value of 0 meaning
-  // that it doesn't exist.
-  if (st.st_mtime == 0)
-    return 1;
-#if defined(_AIX)
-  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtime_n;
-#elif defined(__APPLE__)
-  return ((int64_t)st.st_mtimespec.tv_sec * 1000000000LL +
-          st.st_mtimespec.tv_nsec);
-#elif defined(st_mtime) // A macro, so we're likely on modern POSIX.
-  return (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
-#else
-  return (int64_t)st.st_mtime * 1000000000LL + st.st_mtimensec;
+  return StatSingleFile(path, err);
 #endif
+}
+
+void RealDiskInterface::StatMany(const vector<string>& paths,
+                                 vector<TimeStamp>* mtimes) const {
+#if !defined(_WIN32) && __cplusplus >= 201103L
+  // stat() mostly waits on the file system rather than the CPU, so use
+  // more threads than there are processors; on network file systems each
+  // call is a round trip to the server.
+  const size_t kMaxThreads = 32;
+  const size_t kMinPathsPerThread = 256;
+  size_t num_threads = min(kMaxThreads, paths.size() / kMinPathsPerThread);
+  if (num_threads > 1) {
+    METRIC_RECORD("node stat batch");
+    mtimes->resize(paths.size());
+    vector<thread> threads;
+    size_t begin = 0;
+    for (size_t i = 0; i < num_threads; ++i) {
+      size_t end = paths.size() * (i + 1) / num_threads;
+      threads.push_back(thread(StatRange, &paths, mtimes, begin, end));
+      begin = end;
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+      threads[i].join();
+    return;
+  }
 #endif
+  // The Windows stat cache is not thread-safe.
+  DiskInterface::StatMany(paths, mtimes);
 }
 
 bool RealDiskInterface::WriteFile(const string& path, const string& contents) {
+  return WriteContents(path, contents);
+}
+
+// static
+bool RealDiskInterface::WriteContents(const string& path,
+                                      StringPiece contents) {
   FILE* fp = fopen(path.c_str(), "w");
   if (fp == NULL) {
     Error("WriteFile(%s): Unable to create file. %s",
@@ -223,7 +297,7 @@ bool RealDiskInterface::WriteFile(const string& path, const string& contents) {
     return false;
   }
 
-  if (fwrite(contents.data(), 1, contents.length(), fp) < contents.length())  {
+  if (fwrite(contents.str_, 1, contents.len_, fp) < contents.len_)  {
     Error("WriteFile(%s): Unable to write to the file. %s",
           path.c_str(), strerror(errno));
     fclose(fp);
@@ -239,6 +313,80 @@ bool RealDiskInterface::WriteFile(const string& path, const string& contents) {
   return true;
 }
 
+bool RealDiskInterface::WriteFileIfChanged(const string& path,
+                                           StringPiece contents) {
+  // Compare a piece at a time so a large file isn't read into memory.
+  FILE* fp = fopen(path.c_str(), "r");
+  if (fp != NULL) {
+    char buf[64 << 10];
+    size_t offset = 0, len;
+    bool same = true;
+    while (same && (len = fread(buf, 1, sizeof(buf), fp)) > 0) {
+      same = len <= contents.len_ - offset &&
+          memcmp(buf, contents.str_ + offset, len) == 0;
+      offset += len;
+    }
+    same = same && !ferror(fp) && offset == contents.len_;
+    fclose(fp);
+    if (same)
+      return true;
+  }
+  return WriteContents(path, contents);
+}
+
+bool RealDiskInterface::Touch(const string& path) {
+#ifdef _WIN32
+  if (_utime(path.c_str(), NULL) < 0) {
+#else
+  if (utime(path.c_str(), NULL) < 0) {
+#endif
+    Error("utime(%s): %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+}
+
+bool DiskInterface::Touch(const string& path) {
+  string contents, err;
+  if (ReadFile(path, &contents, &err) != Okay) {
+    Error("%s", err.c_str());
+    return false;
+  }
+  return WriteFile(path, contents);
+}
+
+bool DiskInterface::IsExecutable(const string& path) const {
+  return false;
+}
+
+bool DiskInterface::MakeExecutable(const string& path) {
+  return true;
+}
+
+bool RealDiskInterface::IsExecutable(const string& path) const {
+#ifdef _WIN32
+  return false;
+#else
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && (st.st_mode & S_IXUSR);
+#endif
+}
+
+bool RealDiskInterface::MakeExecutable(const string& path) {
+#ifdef _WIN32
+  return true;
+#else
+  struct stat st;
+  if (stat(path.c_str(), &st) < 0 ||
+      // Whoever can read the file may execute it.
+      chmod(path.c_str(), st.st_mode | ((st.st_mode & 0444) >> 2)) < 0) {
+    Error("chmod(%s): %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+#endif
+}
+
 bool RealDiskInterface::MakeDir(const string& path) {
   if (::MakeDir(path) < 0) {
     if (errno == EEXIST) {
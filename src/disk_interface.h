@@ -17,8 +17,10 @@
 
 #include <map>
 #include <string>
+#include <vector>
 using namespace std;
 
+#include "string_piece.h"
 #include "timestamp.h"
 
 /// Interface for reading files from disk.  See DiskInterface for details.
@@ -48,6 +50,13 @@ struct DiskInterface: public FileReader {
   /// other errors.
   virtual TimeStamp Stat(const string& path, string* err) const = 0;
 
+  /// stat() each of |paths|, storing the results in |mtimes| as Stat()
+  /// would.  Paths that could not be stat()ed get an mtime of -1; callers
+  /// are expected to Stat() those again to report the error.  The default
+  /// implementation stats the paths one at a time.
+  virtual void StatMany(const vector<string>& paths,
+                        vector<TimeStamp>* mtimes) const;
+
   /// Create a directory, returning false on failure.
   virtual bool MakeDir(const string& path) = 0;
 
@@ -55,6 +64,21 @@ struct DiskInterface: public FileReader {
   /// Returns true on success, false on failure
   virtual bool WriteFile(const string& path, const string& contents) = 0;
 
+  /// Like WriteFile, but leave the file alone if it already has |contents|,
+  /// so that its mtime is kept and a large file isn't rewritten.  The
+  /// default implementation reads the file to compare it.
+  virtual bool WriteFileIfChanged(const string& path, StringPiece contents);
+
+  /// Make the mtime of the existing file at |path| now, returning false on
+  /// failure.  The default implementation writes the file again.
+  virtual bool Touch(const string& path);
+
+  /// Whether the file at |path| can be executed, and make it so, so that
+  /// copies of files keep that.  Files have no such permission on Windows,
+  /// which is what the default implementation mimics.
+  virtual bool IsExecutable(const string& path) const;
+  virtual bool MakeExecutable(const string& path);
+
   /// Remove the file named @a path. It behaves like 'rm -f path' so no errors
   /// are reported if it does not exists.
   /// @returns 0 if the file has been removed,
@@ -76,8 +100,14 @@ struct RealDiskInterface : public DiskInterface {
                       {}
   virtual ~RealDiskInterface() {}
   virtual TimeStamp Stat(const string& path, string* err) const;
+  virtual void StatMany(const vector<string>& paths,
+                        vector<TimeStamp>* mtimes) const;
   virtual bool MakeDir(const string& path);
   virtual bool WriteFile(const string& path, const string& contents);
+  virtual bool WriteFileIfChanged(const string& path, StringPiece contents);
+  virtual bool Touch(const string& path);
+  virtual bool IsExecutable(const string& path) const;
+  virtual bool MakeExecutable(const string& path);
   virtual Status ReadFile(const string& path, string* contents, string* err);
   virtual int RemoveFile(const string& path);
 
@@ -85,6 +115,9 @@ struct RealDiskInterface : public DiskInterface {
   void AllowStatCache(bool allow);
 
  private:
+  /// WriteFile(), for contents that may not be in a string of their own.
+  static bool WriteContents(const string& path, StringPiece contents);
+
 #ifdef _WIN32
   /// Whether stat information can be cached.
   bool use_cache_;
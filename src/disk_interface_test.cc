@@ -17,6 +17,8 @@
 #ifdef _WIN32
 #include <io.h>
 #include <windows.h>
+#else
+#include <utime.h>
 #endif
 
 #include "disk_interface.h"
@@ -104,6 +106,33 @@ TEST_F(DiskInterfaceTest, StatExistingDir) {
             disk_.Stat("subdir/subsubdir/.", &err));
 }
 
+TEST_F(DiskInterfaceTest, StatMany) {
+  // Enough paths for the stats to be spread over several threads, where
+  // that is supported.
+  vector<string> paths;
+  for (int i = 0; i < 1000; ++i) {
+    char buf[32];
+    sprintf(buf, "file%d", i);
+    paths.push_back(buf);
+    if (i % 3 != 0)
+      ASSERT_TRUE(Touch(buf));
+  }
+  paths.push_back(string(512, 'x'));
+
+  vector<TimeStamp> mtimes;
+  disk_.StatMany(paths, &mtimes);
+  ASSERT_EQ(paths.size(), mtimes.size());
+  for (size_t i = 0; i < paths.size(); ++i) {
+    string err;
+    EXPECT_EQ(disk_.Stat(paths[i], &err), mtimes[i]);
+  }
+  EXPECT_EQ(0, mtimes[0]);
+  EXPECT_GT(mtimes[1], 1);
+#ifndef _WIN32
+  EXPECT_EQ(-1, mtimes.back());
+#endif
+}
+
 #ifdef _WIN32
 TEST_F(DiskInterfaceTest, StatCache) {
   string err;
@@ -188,6 +217,48 @@ TEST_F(DiskInterfaceTest, ReadFile) {
   EXPECT_EQ("", err);
 }
 
+TEST_F(DiskInterfaceTest, WriteFileIfChanged) {
+  const char* kTestFile = "testfile";
+  string err, content;
+  ASSERT_TRUE(disk_.WriteFileIfChanged(kTestFile, "test content\n"));
+  ASSERT_EQ(DiskInterface::Okay, disk_.ReadFile(kTestFile, &content, &err));
+  EXPECT_EQ("test content\n", content);
+
+  // Neither a prefix nor a longer file passes for the same contents.
+  ASSERT_TRUE(disk_.WriteFileIfChanged(kTestFile, "test content\nmore"));
+  content.clear();
+  ASSERT_EQ(DiskInterface::Okay, disk_.ReadFile(kTestFile, &content, &err));
+  EXPECT_EQ("test content\nmore", content);
+  ASSERT_TRUE(disk_.WriteFileIfChanged(kTestFile, "test"));
+  content.clear();
+  ASSERT_EQ(DiskInterface::Okay, disk_.ReadFile(kTestFile, &content, &err));
+  EXPECT_EQ("test", content);
+
+  // A file that is already right is left alone.
+  TimeStamp mtime = disk_.Stat(kTestFile, &err);
+  ASSERT_GT(mtime, 0);
+  ASSERT_TRUE(disk_.WriteFileIfChanged(kTestFile, "test"));
+  EXPECT_EQ(mtime, disk_.Stat(kTestFile, &err));
+}
+
+TEST_F(DiskInterfaceTest, Touch) {
+  const char* kTestFile = "testfile";
+  string err;
+  ASSERT_TRUE(disk_.WriteFile(kTestFile, "test"));
+#ifndef _WIN32
+  struct utimbuf times = { 1000000, 1000000 };
+  ASSERT_EQ(0, utime(kTestFile, &times));
+  TimeStamp mtime = disk_.Stat(kTestFile, &err);
+  EXPECT_TRUE(disk_.Touch(kTestFile));
+  EXPECT_LT(mtime, disk_.Stat(kTestFile, &err));
+#else
+  EXPECT_TRUE(disk_.Touch(kTestFile));
+#endif
+  string content;
+  ASSERT_EQ(DiskInterface::Okay, disk_.ReadFile(kTestFile, &content, &err));
+  EXPECT_EQ("test", content);
+}
+
 TEST_F(DiskInterfaceTest, MakeDirs) {
   string path = "path/with/double//slash/";
   EXPECT_TRUE(disk_.MakeDirs(path.c_str()));
@@ -13,20 +13,107 @@
 // limitations under the License.
 
 #include <assert.h>
+#include <string.h>
+
+#include <algorithm>
 
 #include "eval_env.h"
+#include "string_pool.h"
+
+namespace {
+
+/// Orders bindings by name.
+bool NameLess(const pair<StringPiece, StringPiece>& binding,
+              StringPiece name) {
+  size_t len = min(binding.first.len_, name.len_);
+  int cmp = len ? memcmp(binding.first.str_, name.str_, len) : 0;
+  return cmp < 0 || (cmp == 0 && binding.first.len_ < name.len_);
+}
+
+}  // anonymous namespace
+
+bool BindingEnv::Find(const string& var, StringPiece* value) const {
+  if (!bindings_.empty()) {
+    Bindings::const_iterator i =
+        lower_bound(bindings_.begin(), bindings_.end(), var, NameLess);
+    if (i == bindings_.end() || i->first != var)
+      return false;
+    *value = i->second;
+    return true;
+  }
+  Values::const_iterator i = values_.find(var);
+  if (i == values_.end())
+    return false;
+  *value = i->second;
+  return true;
+}
 
 string BindingEnv::LookupVariable(const string& var) {
-  map<string, string>::iterator i = bindings_.find(var);
-  if (i != bindings_.end())
-    return i->second;
-  if (parent_)
-    return parent_->LookupVariable(var);
+  StringPiece value;
+  for (BindingEnv* env = this; env; env = env->parent_) {
+    if (env->Find(var, &value))
+      return value.AsString();
+  }
   return "";
 }
 
-void BindingEnv::AddBinding(const string& key, const string& val) {
-  bindings_[key] = val;
+void BindingEnv::AppendVariable(const string& var, string* result) {
+  StringPiece value;
+  for (BindingEnv* env = this; env; env = env->parent_) {
+    if (env->Find(var, &value)) {
+      result->append(value.str_, value.len_);
+      return;
+    }
+  }
+}
+
+void BindingEnv::AddBinding(StringPiece key, StringPiece val) {
+  if (bindings_.empty()) {
+    values_[key.AsString()].assign(val.str_, val.len_);
+    return;
+  }
+  // A frozen scope rarely gets more, as when dyndep information sets
+  // "restat" on an edge.
+  Bindings::iterator i =
+      lower_bound(bindings_.begin(), bindings_.end(), key, NameLess);
+  if (i != bindings_.end() && i->first == key)
+    i->second = strings_->Intern(val);
+  else
+    bindings_.insert(i,
+                     make_pair(strings_->Intern(key), strings_->Intern(val)));
+}
+
+void BindingEnv::Freeze() {
+  if (!strings_ || values_.empty())
+    return;
+  // |values_| is sorted by name already.
+  bindings_.reserve(values_.size());
+  for (Values::const_iterator v = values_.begin(); v != values_.end(); ++v)
+    bindings_.push_back(make_pair(strings_->Intern(v->first),
+                                  strings_->Intern(v->second)));
+  Values().swap(values_);
+}
+
+void BindingEnv::set_parent(BindingEnv* parent) {
+  parent_ = parent;
+  if (!strings_ && parent)
+    strings_ = parent->strings_;
+}
+
+void BindingEnv::Flatten(const BindingEnv* env) {
+  assert(values_.empty() && bindings_.empty() && rules_.empty());
+  if (!strings_ && env)
+    strings_ = env->strings_;
+  // Go from the innermost scope out, keeping the first value for a name.
+  for (; env; env = env->parent_) {
+    values_.insert(env->values_.begin(), env->values_.end());
+    for (Bindings::const_iterator b = env->bindings_.begin();
+         b != env->bindings_.end(); ++b) {
+      values_.insert(make_pair(b->first.AsString(), b->second.AsString()));
+    }
+    rules_.insert(env->rules_.begin(), env->rules_.end());
+  }
+  Freeze();
 }
 
 void BindingEnv::AddRule(const Rule* rule) {
@@ -69,7 +156,10 @@ bool Rule::IsReservedBinding(const string& var) {
       var == "description" ||
       var == "deps" ||
       var == "generator" ||
+      var == "hash_inputs" ||
+      var == "no_cache" ||
       var == "pool" ||
+      var == "pool_weight" ||
       var == "restat" ||
       var == "rspfile" ||
       var == "rspfile_content" ||
@@ -83,28 +173,42 @@ const map<string, const Rule*>& BindingEnv::GetRules() const {
 string BindingEnv::LookupWithFallback(const string& var,
                                       const EvalString* eval,
                                       Env* env) {
-  map<string, string>::iterator i = bindings_.find(var);
-  if (i != bindings_.end())
-    return i->second;
+  string result;
+  AppendWithFallback(var, eval, env, &result);
+  return result;
+}
 
-  if (eval)
-    return eval->Evaluate(env);
+void BindingEnv::AppendWithFallback(const string& var,
+                                    const EvalString* eval, Env* env,
+                                    string* result) {
+  StringPiece value;
+  if (Find(var, &value)) {
+    result->append(value.str_, value.len_);
+    return;
+  }
 
-  if (parent_)
-    return parent_->LookupVariable(var);
+  if (eval) {
+    eval->Evaluate(env, result);
+    return;
+  }
 
-  return "";
+  if (parent_)
+    parent_->AppendVariable(var, result);
 }
 
 string EvalString::Evaluate(Env* env) const {
   string result;
+  Evaluate(env, &result);
+  return result;
+}
+
+void EvalString::Evaluate(Env* env, string* result) const {
   for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
     if (i->second == RAW)
-      result.append(i->first);
+      result->append(i->first);
     else
-      result.append(env->LookupVariable(i->first));
+      env->AppendVariable(i->first, result);
   }
-  return result;
 }
 
 void EvalString::AddText(StringPiece text) {
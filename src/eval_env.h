@@ -23,11 +23,19 @@ using namespace std;
 #include "string_piece.h"
 
 struct Rule;
+struct StringPool;
 
 /// An interface for a scope for variable (e.g. "$foo") lookups.
 struct Env {
   virtual ~Env() {}
   virtual string LookupVariable(const string& var) = 0;
+
+  /// Append the value of |var| to |*result|, as EvalString::Evaluate() does
+  /// for each variable it refers to.  Envs that can do so without making a
+  /// string of the value first override this.
+  virtual void AppendVariable(const string& var, string* result) {
+    result->append(LookupVariable(var));
+  }
 };
 
 /// A tokenized string that contains variable references.
@@ -37,6 +45,9 @@ struct EvalString {
   ///         environment @a env.
   string Evaluate(Env* env) const;
 
+  /// Like Evaluate(), but append the evaluated string to |*result|.
+  void Evaluate(Env* env, string* result) const;
+
   /// @return The string with variables not expanded.
   string Unparse() const;
 
@@ -51,6 +62,9 @@ struct EvalString {
   string Serialize() const;
 
 private:
+  // Allow the manifest cache to save the tokens.
+  friend struct ManifestCache;
+
   enum TokenType { RAW, SPECIAL };
   typedef vector<pair<string, TokenType> > TokenList;
   TokenList parsed_;
@@ -70,6 +84,7 @@ struct Rule {
 
  private:
   // Allow the parsers to reach into this object and fill out its fields.
+  friend struct ManifestCache;
   friend struct ManifestParser;
 
   string name_;
@@ -80,18 +95,37 @@ struct Rule {
 /// An Env which contains a mapping of variables to values
 /// as well as a pointer to a parent scope.
 struct BindingEnv : public Env {
-  BindingEnv() : parent_(NULL) {}
-  explicit BindingEnv(BindingEnv* parent) : parent_(parent) {}
+  BindingEnv() : parent_(NULL), strings_(NULL) {}
+  explicit BindingEnv(BindingEnv* parent)
+      : parent_(parent), strings_(parent ? parent->strings_ : NULL) {}
 
-  virtual ~BindingEnv() {}
   virtual string LookupVariable(const string& var);
+  virtual void AppendVariable(const string& var, string* result);
 
   void AddRule(const Rule* rule);
   const Rule* LookupRule(const string& rule_name);
   const Rule* LookupRuleCurrentScope(const string& rule_name);
   const map<string, const Rule*>& GetRules() const;
 
-  void AddBinding(const string& key, const string& val);
+  void AddBinding(StringPiece key, StringPiece val);
+
+  /// Let this scope, and the scopes created with it as their parent, keep
+  /// the names and values of their bindings in |strings| once frozen, so
+  /// that scopes binding the same values share them.
+  void set_string_pool(StringPool* strings) { strings_ = strings; }
+
+  /// Mark the bindings of this scope as done, as those of an edge are once
+  /// it is parsed, and move them into the string pool, if there is one.
+  /// Only frozen scopes use the pool: a file's scope may bind a name any
+  /// number of times, and the pool would keep every value.
+  void Freeze();
+
+  /// Fill this scope, which must be empty, with every binding and rule
+  /// visible from |env|, so that lookups here give the same answers
+  /// without reading |env| or its parents again, and freeze it.
+  void Flatten(const BindingEnv* env);
+
+  void set_parent(BindingEnv* parent);
 
   /// This is tricky.  Edges want lookup scope to go in this order:
   /// 1) value set on edge itself (edge_->env_)
@@ -101,10 +135,30 @@ struct BindingEnv : public Env {
   string LookupWithFallback(const string& var, const EvalString* eval,
                             Env* env);
 
+  /// Like LookupWithFallback(), but append the value to |*result|.
+  void AppendWithFallback(const string& var, const EvalString* eval, Env* env,
+                          string* result);
+
 private:
-  map<string, string> bindings_;
+  // Allow the manifest cache to save the scope.
+  friend struct ManifestCache;
+
+  /// Set |*value| to the value of |var| in this scope itself, if it has one.
+  bool Find(const string& var, StringPiece* value) const;
+
+  /// The bindings of a scope that isn't frozen, as copies, so that a value
+  /// that is replaced is freed.
+  typedef map<string, string> Values;
+  Values values_;
+  /// The bindings of a frozen scope, sorted by name.  A flat vector of
+  /// pooled strings rather than a map of copies, as there is one for every
+  /// edge with bindings of its own.
+  typedef vector<pair<StringPiece, StringPiece> > Bindings;
+  Bindings bindings_;
   map<string, const Rule*> rules_;
   BindingEnv* parent_;
+  /// See set_string_pool().
+  StringPool* strings_;
 };
 
 #endif  // NINJA_EVAL_ENV_H_
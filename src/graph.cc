@@ -15,6 +15,7 @@
 #include "graph.h"
 
 #include <algorithm>
+#include <set>
 #include <assert.h>
 #include <stdio.h>
 
@@ -25,7 +26,9 @@
 #include "disk_interface.h"
 #include "manifest_parser.h"
 #include "metrics.h"
+#include "sha256.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 
 bool Node::Stat(DiskInterface* disk_interface, string* err) {
@@ -33,10 +36,90 @@ bool Node::Stat(DiskInterface* disk_interface, string* err) {
 }
 
 bool DependencyScan::RecomputeDirty(Node* node, string* err) {
+  StatReachableNodes(node);
   vector<Node*> stack;
   return RecomputeDirty(node, &stack, err);
 }
 
+namespace {
+
+/// Placeholder mtime for nodes queued for a batched stat, so that each node
+/// is queued only once.  Never visible outside of StatReachableNodes().
+const TimeStamp kStatPending = -2;
+
+}  // namespace
+
+void DependencyScan::StatReachableNodes(Node* node) {
+  vector<bool> visited;
+  vector<Node*> nodes;
+  CollectNodeToStat(node, &visited, &nodes);
+  if (nodes.empty())
+    return;
+
+  METRIC_RECORD("stat reachable nodes");
+  TRACE_RECORD("stat reachable nodes");
+  vector<string> paths(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i)
+    paths[i] = nodes[i]->path();
+  vector<TimeStamp> mtimes;
+  disk_interface_->StatMany(paths, &mtimes);
+  // Failed stats are left at -1 ("unknown") and are retried, and reported,
+  // by the dirty walk.
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    Node* node = nodes[i];
+    node->UpdateMtime(mtimes[i]);
+    // The dirty walk takes leaf nodes whose status is known as visited, so
+    // do its work for them here.
+    if (!node->in_edge() && node->status_known()) {
+      if (!node->exists())
+        EXPLAIN("%s has no in-edge and is missing", node->path().c_str());
+      node->set_dirty(!node->exists());
+    }
+  }
+}
+
+void DependencyScan::CollectNodeToStat(Node* node, vector<bool>* visited,
+                                       vector<Node*>* nodes) {
+  if (Edge* in_edge = node->in_edge()) {
+    CollectNodesToStat(in_edge, visited, nodes);
+  } else if (!node->status_known()) {
+    node->UpdateMtime(kStatPending);
+    nodes->push_back(node);
+  }
+}
+
+void DependencyScan::CollectNodesToStat(Edge* edge, vector<bool>* visited,
+                                        vector<Node*>* nodes) {
+  // Edges the dirty walk has already seen have their nodes stat()ed.
+  if (edge->mark_ != Edge::VisitNone)
+    return;
+  if (edge->id_ >= visited->size())
+    visited->resize(edge->id_ + 1, false);
+  if ((*visited)[edge->id_])
+    return;
+  (*visited)[edge->id_] = true;
+
+  for (vector<Node*>::iterator o = edge->outputs_.begin();
+       o != edge->outputs_.end(); ++o) {
+    if (!(*o)->status_known()) {
+      (*o)->UpdateMtime(kStatPending);
+      nodes->push_back(*o);
+    }
+  }
+
+  if (DepsLog* deps_log = dep_loader_.deps_log()) {
+    if (DepsLog::Deps* deps = deps_log->GetDeps(edge->outputs_[0])) {
+      for (int i = 0; i < deps->node_count; ++i)
+        CollectNodeToStat(deps->nodes[i], visited, nodes);
+    }
+  }
+
+  for (vector<Node*>::iterator i = edge->inputs_.begin();
+       i != edge->inputs_.end(); ++i) {
+    CollectNodeToStat(*i, visited, nodes);
+  }
+}
+
 bool DependencyScan::RecomputeDirty(Node* node, vector<Node*>* stack,
                                     string* err) {
   Edge* edge = node->in_edge();
@@ -212,10 +295,9 @@ bool DependencyScan::VerifyDAG(Node* node, vector<Node*>* stack, string* err) {
 
 bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
                                            bool* outputs_dirty, string* err) {
-  string command = edge->EvaluateCommand(/*incl_rsp_file=*/true);
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
-    if (RecomputeOutputDirty(edge, most_recent_input, command, *o)) {
+    if (RecomputeOutputDirty(edge, most_recent_input, *o)) {
       *outputs_dirty = true;
       return true;
     }
@@ -225,7 +307,6 @@ bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
 
 bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
                                           const Node* most_recent_input,
-                                          const string& command,
                                           Node* output) {
   if (edge->is_phony()) {
     // Phony edges don't write any output.  Outputs are only dirty if
@@ -239,6 +320,9 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
   }
 
   BuildLog::LogEntry* entry = 0;
+  // Whether newer inputs were found to have the contents the output was
+  // built from.
+  bool contents_unchanged = false;
 
   // Dirty if we're missing the output.
   if (!output->exists()) {
@@ -261,7 +345,9 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
       used_restat = true;
     }
 
-    if (output_mtime < most_recent_input->mtime()) {
+    if (output_mtime < most_recent_input->mtime() &&
+        !(contents_unchanged =
+              InputContentsUnchanged(edge, output))) {
       EXPLAIN("%soutput %s older than most recent input %s "
               "(%" PRId64 " vs %" PRId64 ")",
               used_restat ? "restat of " : "", output->path().c_str(),
@@ -275,14 +361,16 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
     bool generator = edge->GetBindingBool("generator");
     if (entry || (entry = build_log()->LookupByOutput(output->path()))) {
       if (!generator &&
-          BuildLog::LogEntry::HashCommand(command) != entry->command_hash) {
+          edge->command_hash() != entry->command_hash) {
         // May also be dirty due to the command changing since the last build.
         // But if this is a generator rule, the command changing does not make us
         // dirty.
         EXPLAIN("command line changed for %s", output->path().c_str());
         return true;
       }
-      if (most_recent_input && entry->mtime < most_recent_input->mtime()) {
+      if (most_recent_input && entry->mtime < most_recent_input->mtime() &&
+          !contents_unchanged &&
+          !InputContentsUnchanged(edge, output)) {
         // May also be dirty due to the mtime in the log being older than the
         // mtime of the most recent input.  This can occur even when the mtime
         // on disk is newer if a previous run wrote to the output file but
@@ -302,6 +390,158 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
   return false;
 }
 
+bool DependencyScan::InputContentsUnchanged(const Edge* edge,
+                                            const Node* output) {
+  if (!build_log() || !edge->GetBindingBool("hash_inputs"))
+    return false;
+  BuildLog::LogEntry* entry = build_log()->LookupByOutput(output->path());
+  if (!entry || !entry->input_hash ||
+      entry->command_hash != edge->command_hash())
+    return false;
+
+  uint64_t hash;
+  string err;
+  if (!HashInputs(edge, vector<Node*>(), &hash, NULL, &err)) {
+    EXPLAIN("can't hash inputs of %s: %s", output->path().c_str(),
+            err.c_str());
+    return false;
+  }
+  if (hash != entry->input_hash)
+    return false;
+  EXPLAIN("inputs of %s are newer, but their contents are unchanged",
+          output->path().c_str());
+  return true;
+}
+
+namespace {
+
+/// Add the non-order-only inputs in [|begin|, |end|) to |inputs|, with
+/// the inputs of phony edges in place of their outputs, since those have
+/// no contents of their own.
+void CollectHashedInputs(vector<Node*>::const_iterator begin,
+                         vector<Node*>::const_iterator end,
+                         set<Node*>* inputs) {
+  for (vector<Node*>::const_iterator i = begin; i != end; ++i) {
+    Edge* in_edge = (*i)->in_edge();
+    if (in_edge && in_edge->is_phony() && !in_edge->inputs_.empty()) {
+      if (inputs->insert(*i).second) {
+        CollectHashedInputs(in_edge->inputs_.begin(),
+                            in_edge->inputs_.end() - in_edge->order_only_deps_,
+                            inputs);
+      }
+      continue;
+    }
+    inputs->insert(*i);
+  }
+}
+
+bool ComparePaths(const Node* a, const Node* b) {
+  return a->path() < b->path();
+}
+
+/// The inputs HashInputs() hashes, sorted by path, so that the hash doesn't
+/// depend on their order.
+vector<Node*> HashedInputs(const Edge* edge, const vector<Node*>& deps) {
+  set<Node*> inputs;
+  CollectHashedInputs(edge->inputs_.begin(),
+                      edge->inputs_.end() - edge->order_only_deps_, &inputs);
+  CollectHashedInputs(deps.begin(), deps.end(), &inputs);
+
+  vector<Node*> sorted;
+  for (set<Node*>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+    Edge* in_edge = (*i)->in_edge();
+    if (!in_edge || !in_edge->is_phony() || in_edge->inputs_.empty())
+      sorted.push_back(*i);
+  }
+  sort(sorted.begin(), sorted.end(), ComparePaths);
+  return sorted;
+}
+
+/// Add the input at |path| whose contents have |digest| to |hashes|,
+/// which hashes to the hash of all of them.
+void AppendInputHash(const string& path, const string& digest,
+                     string* hashes) {
+  hashes->append(path);
+  hashes->push_back('\0');
+  hashes->push_back((char)digest.size());
+  hashes->append(digest);
+}
+
+uint64_t HashInputHashes(const string& hashes) {
+  uint64_t hash = BuildLog::LogEntry::HashCommand(hashes);
+  // 0 means that there is no hash.
+  return hash ? hash : 1;
+}
+
+}  // anonymous namespace
+
+bool DependencyScan::HashInputs(const Edge* edge, const vector<Node*>& deps,
+                                uint64_t* hash, TimeStamp* newest,
+                                string* err) {
+  METRIC_RECORD("hash inputs");
+  TRACE_RECORD("hash inputs");
+  vector<Node*> inputs = HashedInputs(edge, deps);
+  string hashes;
+  if (newest) {
+    vector<string> paths;
+    for (vector<Node*>::iterator i = inputs.begin(); i != inputs.end(); ++i)
+      paths.push_back((*i)->path());
+    if (!AppendPathHashes(paths, &hashes, newest, err))
+      return false;
+    *hash = HashInputHashes(hashes);
+    return true;
+  }
+
+  for (vector<Node*>::iterator i = inputs.begin(); i != inputs.end(); ++i) {
+    if (!(*i)->StatIfNecessary(disk_interface_, err))
+      return false;
+    string digest;
+    if (!build_log()->HashContent((*i)->path(), (*i)->mtime(),
+                                  disk_interface_, &digest, err))
+      return false;
+    AppendInputHash((*i)->path(), digest, &hashes);
+  }
+  *hash = HashInputHashes(hashes);
+  return true;
+}
+
+void DependencyScan::InputPaths(const Edge* edge, const vector<Node*>& deps,
+                                vector<string>* paths) const {
+  vector<Node*> inputs = HashedInputs(edge, deps);
+  paths->clear();
+  for (vector<Node*>::iterator i = inputs.begin(); i != inputs.end(); ++i)
+    paths->push_back((*i)->path());
+}
+
+bool DependencyScan::HashPaths(const vector<string>& paths, string* digest,
+                               TimeStamp* newest, string* err) {
+  string hashes;
+  if (!AppendPathHashes(paths, &hashes, newest, err))
+    return false;
+  *digest = Sha256::Hash(hashes);
+  return true;
+}
+
+bool DependencyScan::AppendPathHashes(const vector<string>& paths,
+                                      string* hashes, TimeStamp* newest,
+                                      string* err) {
+  if (newest)
+    *newest = 0;
+  for (vector<string>::const_iterator i = paths.begin(); i != paths.end();
+       ++i) {
+    TimeStamp mtime = disk_interface_->Stat(*i, err);
+    if (mtime == -1)
+      return false;
+    if (newest && mtime > *newest)
+      *newest = mtime;
+    string digest;
+    if (!build_log()->HashContent(*i, mtime, disk_interface_, &digest, err))
+      return false;
+    AppendInputHash(*i, digest, hashes);
+  }
+  return true;
+}
+
 bool DependencyScan::LoadDyndeps(Node* node, string* err) const {
   return dyndep_loader_.LoadDyndeps(node, err);
 }
@@ -327,10 +567,12 @@ struct EdgeEnv : public Env {
   EdgeEnv(const Edge* const edge, const EscapeKind escape)
       : edge_(edge), escape_in_out_(escape), recursive_(false) {}
   virtual string LookupVariable(const string& var);
+  virtual void AppendVariable(const string& var, string* result);
 
-  /// Given a span of Nodes, construct a list of paths suitable for a command
-  /// line.
-  std::string MakePathList(const Node* const* span, size_t size, char sep) const;
+  /// Given a span of Nodes, append a list of their paths suitable for a
+  /// command line to |*result|.
+  void AppendPathList(const Node* const* span, size_t size, char sep,
+                      string* result) const;
 
  private:
   vector<string> lookups_;
@@ -340,18 +582,26 @@ struct EdgeEnv : public Env {
 };
 
 string EdgeEnv::LookupVariable(const string& var) {
+  string result;
+  AppendVariable(var, &result);
+  return result;
+}
+
+void EdgeEnv::AppendVariable(const string& var, string* result) {
   if (var == "in" || var == "in_newline") {
     int explicit_deps_count = edge_->inputs_.size() - edge_->implicit_deps_ -
       edge_->order_only_deps_;
 #if __cplusplus >= 201103L
-    return MakePathList(edge_->inputs_.data(), explicit_deps_count,
+    AppendPathList(edge_->inputs_.data(), explicit_deps_count,
 #else
-    return MakePathList(&edge_->inputs_[0], explicit_deps_count,
+    AppendPathList(&edge_->inputs_[0], explicit_deps_count,
 #endif
-                        var == "in" ? ' ' : '\n');
+                   var == "in" ? ' ' : '\n', result);
+    return;
   } else if (var == "out") {
     int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
-    return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
+    AppendPathList(&edge_->outputs_[0], explicit_outs_count, ' ', result);
+    return;
   }
 
   if (recursive_) {
@@ -373,39 +623,83 @@ string EdgeEnv::LookupVariable(const string& var) {
   // In practice, variables defined on rules never use another rule variable.
   // For performance, only start checking for cycles after the first lookup.
   recursive_ = true;
-  return edge_->env_->LookupWithFallback(var, eval, this);
+  edge_->env_->AppendWithFallback(var, eval, this, result);
 }
 
-std::string EdgeEnv::MakePathList(const Node* const* const span,
-                                  const size_t size, const char sep) const {
-  string result;
+void EdgeEnv::AppendPathList(const Node* const* const span, const size_t size,
+                             const char sep, string* result) const {
+  // Grow |*result| once for a long list, allowing for the separators but
+  // not for escaping, which few paths need.
+  size_t needed = result->size() + size;
+  for (const Node* const* i = span; i != span + size; ++i)
+    needed += (*i)->path().size();
+  if (needed > result->capacity())
+    result->reserve(max(needed, 2 * result->capacity()));
+
   for (const Node* const* i = span; i != span + size; ++i) {
-    if (!result.empty())
-      result.push_back(sep);
-    const string& path = (*i)->PathDecanonicalized();
+    if (i != span)
+      result->push_back(sep);
+#ifdef _WIN32
+    string path = (*i)->PathDecanonicalized();
+#else
+    // Only Windows paths get decanonicalized, so don't copy the others.
+    const string& path = (*i)->path();
+#endif
     if (escape_in_out_ == kShellEscape) {
 #ifdef _WIN32
-      GetWin32EscapedString(path, &result);
+      GetWin32EscapedString(path, result);
 #else
-      GetShellEscapedString(path, &result);
+      GetShellEscapedString(path, result);
 #endif
     } else {
-      result.append(path);
+      result->append(path);
     }
   }
-  return result;
 }
 
 std::string Edge::EvaluateCommand(const bool incl_rsp_file) const {
-  string command = GetBinding("command");
+  string command;
   if (incl_rsp_file) {
-    string rspfile_content = GetBinding("rspfile_content");
-    if (!rspfile_content.empty())
-      command += ";rspfile=" + rspfile_content;
+    EvaluateCommandAndRspfile(&command);
+  } else {
+    EdgeEnv env(this, EdgeEnv::kShellEscape);
+    env.AppendVariable("command", &command);
   }
   return command;
 }
 
+size_t Edge::EvaluateCommandAndRspfile(string* command,
+                                       size_t* command_end) const {
+  EdgeEnv env(this, EdgeEnv::kShellEscape);
+  env.AppendVariable("command", command);
+  const char kRspfile[] = ";rspfile=";
+  size_t size = command->size();
+  if (command_end)
+    *command_end = size;
+  command->append(kRspfile);
+  EdgeEnv rspfile_env(this, EdgeEnv::kShellEscape);
+  rspfile_env.AppendVariable("rspfile_content", command);
+  if (command->size() == size + sizeof(kRspfile) - 1) {
+    command->resize(size);
+    return size;
+  }
+  return size + sizeof(kRspfile) - 1;
+}
+
+uint64_t Edge::command_hash() const {
+  if (!command_hash_valid_)
+    return command_hash(EvaluateCommand(true));
+  return command_hash_;
+}
+
+uint64_t Edge::command_hash(const string& command) const {
+  if (!command_hash_valid_) {
+    command_hash_ = BuildLog::LogEntry::HashCommand(command);
+    command_hash_valid_ = true;
+  }
+  return command_hash_;
+}
+
 std::string Edge::GetBinding(const std::string& key) const {
   EdgeEnv env(this, EdgeEnv::kShellEscape);
   return env.LookupVariable(key);
@@ -526,6 +820,7 @@ struct matches {
 bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
                                     string* err) {
   METRIC_RECORD("depfile load");
+  TRACE_RECORD("depfile load");
   // Read depfile content.  Treat a missing depfile as empty.
   string content;
   switch (disk_interface_->ReadFile(path, &content, err)) {
@@ -639,6 +934,7 @@ vector<Node*>::iterator ImplicitDepLoader::PreallocateSpace(Edge* edge,
   edge->inputs_.insert(edge->inputs_.end() - edge->order_only_deps_,
                        (size_t)count, 0);
   edge->implicit_deps_ += count;
+  edge->discovered_deps_ += count;
   return edge->inputs_.end() - edge->order_only_deps_ - count;
 }
 
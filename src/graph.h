@@ -15,6 +15,7 @@
 #ifndef NINJA_GRAPH_H_
 #define NINJA_GRAPH_H_
 
+#include <queue>
 #include <string>
 #include <vector>
 using namespace std;
@@ -66,6 +67,12 @@ struct Node {
     mtime_ = 0;
   }
 
+  /// Record the result of a stat() done on this node's behalf, for example
+  /// by DiskInterface::StatMany().
+  void UpdateMtime(TimeStamp mtime) {
+    mtime_ = mtime;
+  }
+
   bool exists() const {
     return mtime_ != 0;
   }
@@ -100,6 +107,8 @@ struct Node {
 
   const vector<Edge*>& out_edges() const { return out_edges_; }
   void AddOutEdge(Edge* edge) { out_edges_.push_back(edge); }
+  /// Undo the most recent AddOutEdge().
+  void PopOutEdge() { out_edges_.pop_back(); }
 
   void Dump(const char* prefix="") const;
 
@@ -146,7 +155,9 @@ struct Edge {
 
   Edge() : rule_(NULL), pool_(NULL), dyndep_(NULL), env_(NULL),
            mark_(VisitNone), outputs_ready_(false), deps_loaded_(false),
-           deps_missing_(false), implicit_deps_(0), order_only_deps_(0),
+           deps_missing_(false), command_hash_valid_(false), weight_(1),
+           critical_path_weight_(-1), id_(0),
+           implicit_deps_(0), order_only_deps_(0), discovered_deps_(0),
            implicit_outs_(0) {}
 
   /// Return true if all inputs' in-edges are ready.
@@ -157,6 +168,22 @@ struct Edge {
   /// full contents of a response file (if applicable)
   std::string EvaluateCommand(bool incl_rsp_file = false) const;
 
+  /// Append EvaluateCommand(true) to |*command|, and return where the
+  /// content of the response file starts in it, so that the one string
+  /// can serve to write the response file and to run the command too.
+  /// If given, |*command_end| is set to where the command itself ends.
+  size_t EvaluateCommandAndRspfile(string* command,
+                                   size_t* command_end = NULL) const;
+
+  /// The hash of EvaluateCommand(true), as the build log records it.  It
+  /// is computed the first time it is needed and then kept, since neither
+  /// the bindings of an edge nor its explicit inputs and outputs change
+  /// once the manifest is loaded.
+  uint64_t command_hash() const;
+  /// Like command_hash(), but computed from |command|, EvaluateCommand(true)
+  /// already at hand, if it isn't known yet.
+  uint64_t command_hash(const string& command) const;
+
   /// Returns the shell-escaped value of |key|.
   std::string GetBinding(const string& key) const;
   bool GetBindingBool(const string& key) const;
@@ -181,10 +208,31 @@ struct Edge {
   bool deps_loaded_;
   bool deps_missing_;
 
+  /// See command_hash().
+  mutable bool command_hash_valid_;
+  mutable uint64_t command_hash_;
+
+  /// How many of the slots of its pool the edge takes while it runs, from
+  /// its "pool_weight" binding.
+  int weight_;
+
+  /// The estimated cost of the longest path from this edge to any of the
+  /// targets requested from the Plan, including the cost of this edge
+  /// itself.  -1 if it has not been computed.  See Plan::ComputeCriticalPath.
+  int64_t critical_path_weight_;
+
+  /// A dense integer id for the edge, assigned by State::AddEdge and used
+  /// by the Plan to keep per-edge state in flat arrays.
+  size_t id_;
+
   const Rule& rule() const { return *rule_; }
   Pool* pool() const { return pool_; }
-  int weight() const { return 1; }
+  int weight() const { return weight_; }
   bool outputs_ready() const { return outputs_ready_; }
+  int64_t critical_path_weight() const { return critical_path_weight_; }
+  void set_critical_path_weight(int64_t weight) {
+    critical_path_weight_ = weight;
+  }
 
   // There are three types of inputs.
   // 1) explicit deps, which show up as $in on the command line;
@@ -196,6 +244,9 @@ struct Edge {
   // #2 and #3 when we need to access the various subsets.
   int implicit_deps_;
   int order_only_deps_;
+  /// How many of the implicit deps, at the end of that subset, were loaded
+  /// from a depfile or the deps log rather than from the manifest.
+  int discovered_deps_;
   bool is_implicit(size_t index) {
     return index >= inputs_.size() - order_only_deps_ - implicit_deps_ &&
         !is_order_only(index);
@@ -219,6 +270,21 @@ struct Edge {
   bool maybe_phonycycle_diagnostic() const;
 };
 
+/// Orders edges so that the edge with the longest critical path (i.e. the
+/// one that most delays the end of the build) compares greatest.
+struct EdgePriorityLess {
+  bool operator()(const Edge* a, const Edge* b) const {
+    if (a->critical_path_weight() != b->critical_path_weight())
+      return a->critical_path_weight() < b->critical_path_weight();
+    return a->id_ > b->id_;
+  }
+};
+
+/// A queue of ready edges, highest critical path weight first.
+struct EdgePriorityQueue
+    : public priority_queue<Edge*, vector<Edge*>, EdgePriorityLess> {
+  void clear() { c.clear(); }
+};
 
 /// ImplicitDepLoader loads implicit dependencies, as referenced via the
 /// "depfile" attribute in build files.
@@ -297,6 +363,25 @@ struct DependencyScan {
     return dep_loader_.deps_log();
   }
 
+  /// Set |*hash| to a hash of the contents of the inputs of |edge| that can
+  /// make it dirty, with those of phony edges in their place, and of |deps|.
+  /// If |newest| is given, the inputs are stat()ed again, and it is set to
+  /// the mtime of the newest; if not, their mtimes must be known.  Returns
+  /// false if an input can't be read.
+  bool HashInputs(const Edge* edge, const vector<Node*>& deps,
+                  uint64_t* hash, TimeStamp* newest, string* err);
+
+  /// Set |*paths| to the paths of the inputs HashInputs() hashes, sorted.
+  void InputPaths(const Edge* edge, const vector<Node*>& deps,
+                  vector<string>* paths) const;
+
+  /// Set |*digest| to the SHA-256 digest of the paths and contents of the
+  /// inputs at |paths|, as set by InputPaths(), which are stat()ed again.
+  /// Unlike the hash of HashInputs(), no other set of inputs can be made
+  /// to have the same digest.  |newest| may be NULL.
+  bool HashPaths(const vector<string>& paths, string* digest,
+                 TimeStamp* newest, string* err);
+
   /// Load a dyndep file from the given node's path and update the
   /// build graph with the new information.  One overload accepts
   /// a caller-owned 'DyndepFile' object in which to store the
@@ -306,12 +391,35 @@ struct DependencyScan {
 
  private:
   bool RecomputeDirty(Node* node, vector<Node*>* stack, string* err);
+
+  /// Append the paths and content digests of the inputs at |paths|, which
+  /// are stat()ed again, to |hashes|, for HashInputs() and HashPaths().
+  bool AppendPathHashes(const vector<string>& paths, string* hashes,
+                        TimeStamp* newest, string* err);
   bool VerifyDAG(Node* node, vector<Node*>* stack, string* err);
 
+  /// stat() all the nodes that RecomputeDirty() is going to need for
+  /// |node| in one DiskInterface::StatMany() batch, so that the walk
+  /// itself rarely has to wait on the disk.
+  void StatReachableNodes(Node* node);
+
+  /// Append the outputs and inputs of |edge| and of the not yet visited
+  /// edges it depends on, including implicit inputs recorded in the deps
+  /// log, to |nodes| if their status is not known yet.
+  void CollectNodesToStat(Edge* edge, vector<bool>* visited,
+                          vector<Node*>* nodes);
+  void CollectNodeToStat(Node* node, vector<bool>* visited,
+                         vector<Node*>* nodes);
+
   /// Recompute whether a given single output should be marked dirty.
   /// Returns true if so.
   bool RecomputeOutputDirty(const Edge* edge, const Node* most_recent_input,
-                            const string& command, Node* output);
+                            Node* output);
+
+  /// Whether |edge| has "hash_inputs" set, and the contents of its inputs
+  /// are those |output| was last built from, so that newer inputs don't
+  /// make it dirty.
+  bool InputContentsUnchanged(const Edge* edge, const Node* output);
 
   BuildLog* build_log_;
   DiskInterface* disk_interface_;
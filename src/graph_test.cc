@@ -14,6 +14,7 @@
 
 #include "graph.h"
 #include "build.h"
+#include "build_log.h"
 
 #include "test.h"
 
@@ -40,6 +41,35 @@ TEST_F(GraphTest, MissingImplicit) {
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
+TEST_F(GraphTest, StatReachableNodesInOneBatch) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat mid | implicit\n"
+"build mid: cat in\n"));
+  fs_.Create("in", "");
+  fs_.Create("mid", "");
+  fs_.Create("out", "");
+
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  ASSERT_EQ("", err);
+
+  ASSERT_EQ(4u, fs_.files_batch_statted_.size());
+  EXPECT_EQ("out", fs_.files_batch_statted_[0]);
+  EXPECT_EQ("mid", fs_.files_batch_statted_[1]);
+  EXPECT_EQ("in", fs_.files_batch_statted_[2]);
+  EXPECT_EQ("implicit", fs_.files_batch_statted_[3]);
+
+  // The missing leaf found by the batch still makes its dependents dirty.
+  EXPECT_TRUE(GetNode("implicit")->dirty());
+  EXPECT_FALSE(GetNode("mid")->dirty());
+  EXPECT_TRUE(GetNode("out")->dirty());
+
+  // Nodes that are already known are not stat()ed again.
+  fs_.files_batch_statted_.clear();
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &err));
+  EXPECT_EQ(0u, fs_.files_batch_statted_.size());
+}
+
 TEST_F(GraphTest, ModifiedImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat in | implicit\n"));
@@ -77,6 +107,50 @@ TEST_F(GraphTest, FunkyMakefilePath) {
   EXPECT_TRUE(GetNode("out.o")->dirty());
 }
 
+TEST_F(GraphTest, ResetKeepingMtimesDropsDiscoveredDeps) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule catdep\n"
+"  depfile = $out.d\n"
+"  command = cat $in > $out\n"
+"build out.o: catdep foo.cc | manifest.h || order\n"));
+  fs_.Create("foo.cc",  "");
+  fs_.Create("manifest.h",  "");
+  fs_.Create("order",  "");
+  fs_.Create("implicit.h", "");
+  fs_.Create("out.o.d", "out.o: implicit.h\n");
+  fs_.Create("out.o", "");
+
+  string err;
+  Edge* edge = GetNode("out.o")->in_edge();
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), &err));
+    ASSERT_EQ("", err);
+    EXPECT_FALSE(GetNode("out.o")->dirty());
+    ASSERT_EQ(4u, edge->inputs_.size());
+    EXPECT_EQ("implicit.h", edge->inputs_[2]->path());
+    EXPECT_EQ(2, edge->implicit_deps_);
+    EXPECT_EQ(1u, GetNode("implicit.h")->out_edges().size());
+
+    state_.ResetKeepingMtimes();
+    EXPECT_TRUE(GetNode("implicit.h")->status_known());
+    ASSERT_EQ(3u, edge->inputs_.size());
+    EXPECT_EQ("manifest.h", edge->inputs_[1]->path());
+    EXPECT_EQ("order", edge->inputs_[2]->path());
+    EXPECT_EQ(1, edge->implicit_deps_);
+    EXPECT_EQ(0u, GetNode("implicit.h")->out_edges().size());
+  }
+
+  // Leaves keep their dirty state, as the scan won't look at them again.
+  fs_.RemoveFile("foo.cc");
+  GetNode("foo.cc")->ResetState();
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("out.o")->dirty());
+  state_.ResetKeepingMtimes();
+  EXPECT_TRUE(GetNode("foo.cc")->dirty());
+  EXPECT_FALSE(GetNode("out.o")->dirty());
+}
+
 TEST_F(GraphTest, ExplicitImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
@@ -305,6 +379,49 @@ TEST_F(GraphTest, DepfileOverrideParent) {
   EXPECT_EQ("depfile is y", edge->GetBinding("command"));
 }
 
+// Check that the command hash covers the response file contents, and that
+// the command is only evaluated for it once.
+TEST_F(GraphTest, CommandHash) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule r\n"
+"  command = r $in > $out\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in_newline\n"
+"build out: r in1 in2 | in3\n"
+"build out2: cat in1\n"));
+  Edge* edge = GetNode("out")->in_edge();
+  EXPECT_EQ("r in1 in2 > out;rspfile=in1\nin2", edge->EvaluateCommand(true));
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand(edge->EvaluateCommand(true)),
+            edge->command_hash());
+
+  // Without response file contents, nothing is added to the command.
+  Edge* edge2 = GetNode("out2")->in_edge();
+  EXPECT_EQ("cat in1 > out2", edge2->EvaluateCommand(true));
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand("cat in1 > out2"),
+            edge2->command_hash());
+
+  // The one expansion also gives the response file contents.
+  string command;
+  size_t command_end;
+  size_t content = edge->EvaluateCommandAndRspfile(&command, &command_end);
+  EXPECT_EQ(edge->EvaluateCommand(true), command);
+  EXPECT_EQ("in1\nin2", command.substr(content));
+  EXPECT_EQ(edge->EvaluateCommand(), command.substr(0, command_end));
+  command.clear();
+  content = edge2->EvaluateCommandAndRspfile(&command, &command_end);
+  EXPECT_EQ("cat in1 > out2", command);
+  EXPECT_EQ(command.size(), content);
+  EXPECT_EQ(command.size(), command_end);
+
+  // Inputs discovered later are implicit and don't change the command.
+  edge->inputs_.insert(edge->inputs_.end() - edge->order_only_deps_,
+                       GetNode("in4"));
+  ++edge->implicit_deps_;
+  EXPECT_EQ("r in1 in2 > out;rspfile=in1\nin2", edge->EvaluateCommand(true));
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand(edge->EvaluateCommand(true)),
+            edge->command_hash());
+}
+
 // Verify that building a nested phony rule prints "no work to do"
 TEST_F(GraphTest, NestedPhonyPrintsDone) {
   AssertParse(&state_,
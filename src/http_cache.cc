@@ -0,0 +1,451 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "http_cache.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "trace.h"
+#include "util.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // macOS sets SO_NOSIGPIPE instead.
+#endif
+
+namespace {
+
+/// How long to wait for the server to reply or accept data.
+const int kTimeoutSeconds = 30;
+
+bool EqualsIgnoringCase(const string& a, const char* b) {
+  if (a.size() != strlen(b))
+    return false;
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i]))
+      return false;
+  }
+  return true;
+}
+
+/// connect() |fd| to |addr|, giving up after kTimeoutSeconds rather than
+/// the minutes the system may wait for a host that doesn't answer.  Sets
+/// errno on failure.
+bool ConnectWithTimeout(int fd, const sockaddr* addr, socklen_t addr_len) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return false;
+  if (connect(fd, addr, addr_len) < 0) {
+    if (errno != EINPROGRESS)
+      return false;
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    int64_t deadline = GetTimeMillis() + kTimeoutSeconds * 1000;
+    for (;;) {
+      int64_t timeout = deadline - GetTimeMillis();
+      int ret = timeout > 0 ? poll(&pfd, 1, (int)timeout) : 0;
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret < 0)
+        return false;
+      if (ret == 0) {
+        errno = ETIMEDOUT;
+        return false;
+      }
+      break;
+    }
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0)
+      return false;
+    if (error != 0) {
+      errno = error;
+      return false;
+    }
+  }
+  // Requests and responses are sent and read with timeouts of their own.
+  return fcntl(fd, F_SETFL, flags) == 0;
+}
+
+}  // anonymous namespace
+
+bool HttpConnection::Connect(string* err) {
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* addrs;
+  int error = getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addrs);
+  if (error != 0) {
+    *err = host_ + ": " + gai_strerror(error);
+    return false;
+  }
+  for (addrinfo* a = addrs; a; a = a->ai_next) {
+    fd_ = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+    if (fd_ < 0)
+      continue;
+    if (ConnectWithTimeout(fd_, a->ai_addr, a->ai_addrlen))
+      break;
+    *err = host_ + ":" + port_ + ": " + strerror(errno);
+    close(fd_);
+    fd_ = -1;
+  }
+  freeaddrinfo(addrs);
+  if (fd_ < 0)
+    return false;
+
+  SetCloseOnExec(fd_);
+  timeval timeout = { kTimeoutSeconds, 0 };
+  setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  // Requests are sent whole, so don't hold back their last segment.
+  int one = 1;
+  setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+  setsockopt(fd_, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+  return true;
+}
+
+void HttpConnection::Close() {
+  if (fd_ >= 0)
+    close(fd_);
+  fd_ = -1;
+  buffer_.clear();
+}
+
+bool HttpConnection::Send(const string& data, string* err) {
+  for (size_t sent = 0; sent < data.size(); ) {
+    ssize_t n = send(fd_, data.data() + sent, data.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      *err = string("send: ") + strerror(errno);
+      return false;
+    }
+    sent += n;
+  }
+  return true;
+}
+
+bool HttpConnection::Fill(size_t size, string* err) {
+  char buf[64 << 10];
+  while (buffer_.size() < size) {
+    ssize_t n = recv(fd_, buf, sizeof(buf), 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0) {
+      *err = n < 0 ? string("recv: ") + strerror(errno)
+                   : "connection closed by server";
+      return false;
+    }
+    buffer_.append(buf, n);
+  }
+  return true;
+}
+
+bool HttpConnection::ReadLine(string* line, string* err) {
+  size_t end;
+  while ((end = buffer_.find("\r\n")) == string::npos) {
+    if (!Fill(buffer_.size() + 1, err))
+      return false;
+  }
+  line->assign(buffer_, 0, end);
+  buffer_.erase(0, end + 2);
+  return true;
+}
+
+bool HttpConnection::ReadResponse(bool head, int* status, string* response,
+                                  string* err) {
+  string line;
+  if (!ReadLine(&line, err))
+    return false;
+  if (line.compare(0, 5, "HTTP/") != 0 || line.find(' ') == string::npos) {
+    *err = "bad response from server: " + line;
+    return false;
+  }
+  *status = atoi(line.c_str() + line.find(' ') + 1);
+  bool keep_alive = line.compare(0, 8, "HTTP/1.0") != 0;
+
+  long long content_length = -1;
+  bool chunked = false;
+  for (;;) {
+    if (!ReadLine(&line, err))
+      return false;
+    if (line.empty())
+      break;
+    size_t colon = line.find(':');
+    if (colon == string::npos)
+      continue;
+    string name = line.substr(0, colon);
+    size_t value_start = line.find_first_not_of(" \t", colon + 1);
+    string value = value_start == string::npos ? "" : line.substr(value_start);
+    if (EqualsIgnoringCase(name, "Content-Length"))
+      content_length = atoll(value.c_str());
+    else if (EqualsIgnoringCase(name, "Transfer-Encoding"))
+      chunked = EqualsIgnoringCase(value, "chunked");
+    else if (EqualsIgnoringCase(name, "Connection"))
+      keep_alive = EqualsIgnoringCase(value, "keep-alive");
+  }
+
+  response->clear();
+  // Responses to HEAD, and those without a body, have no body whatever
+  // their headers say.
+  if (head || *status == 204 || *status == 304 || *status / 100 == 1) {
+  } else if (chunked) {
+    for (;;) {
+      if (!ReadLine(&line, err))
+        return false;
+      size_t size = strtoul(line.c_str(), NULL, 16);
+      if (size == 0)
+        break;
+      if (!Fill(size + 2, err))
+        return false;
+      response->append(buffer_, 0, size);
+      buffer_.erase(0, size + 2);
+    }
+    // Skip the trailer.
+    do {
+      if (!ReadLine(&line, err))
+        return false;
+    } while (!line.empty());
+  } else if (content_length >= 0) {
+    if (!Fill((size_t)content_length, err))
+      return false;
+    response->assign(buffer_, 0, (size_t)content_length);
+    buffer_.erase(0, (size_t)content_length);
+  } else {
+    // The body ends when the server closes the connection.
+    string fill_err;
+    while (Fill(buffer_.size() + 1, &fill_err)) {}
+    response->swap(buffer_);
+    keep_alive = false;
+  }
+
+  if (!keep_alive)
+    Close();
+  return true;
+}
+
+bool HttpConnection::Request(const string& method, const string& path,
+                             const string& body, int* status,
+                             string* response, string* err) {
+  string host = host_.find(':') == string::npos ? host_ : "[" + host_ + "]";
+  string request = method + " " + path + " HTTP/1.1\r\n"
+      "Host: " + host + ":" + port_ + "\r\n";
+  if (method == "PUT") {
+    char length[32];
+    snprintf(length, sizeof(length), "%lu", (unsigned long)body.size());
+    request += string("Content-Length: ") + length + "\r\n";
+  }
+  request += "\r\n";
+  if (method == "PUT")
+    request += body;
+
+  // The server may have closed a connection that was kept open, in which
+  // case it is opened again.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    bool reused = fd_ >= 0;
+    if (!reused && !Connect(err))
+      return false;
+    if (Send(request, err) &&
+        ReadResponse(method == "HEAD", status, response, err))
+      return true;
+    Close();
+    if (!reused)
+      return false;
+  }
+  return false;
+}
+
+HttpBackend* HttpBackend::Open(const string& url, string* err) {
+  if (url.compare(0, 7, "http://") != 0) {
+    *err = "not an http:// URL: '" + url + "'";
+    return NULL;
+  }
+  size_t host_start = 7;
+  size_t path_start = url.find('/', host_start);
+  if (path_start == string::npos)
+    path_start = url.size();
+  string host = url.substr(host_start, path_start - host_start);
+  string port = "80";
+  // A port follows the last colon, unless that is inside an IPv6 address
+  // in brackets.
+  size_t colon = host.rfind(':');
+  if (colon != string::npos && host.find(']', colon) == string::npos) {
+    port = host.substr(colon + 1);
+    host.resize(colon);
+  }
+  if (host.size() > 2 && host[0] == '[' && host[host.size() - 1] == ']')
+    host = host.substr(1, host.size() - 2);
+  if (host.empty() || port.empty()) {
+    *err = "bad action cache URL '" + url + "'";
+    return NULL;
+  }
+  string path = url.substr(path_start);
+  if (path.empty() || path[path.size() - 1] != '/')
+    path.push_back('/');
+  return new HttpBackend(host, port, path);
+}
+
+HttpBackend::HttpBackend(const string& host, const string& port,
+                         const string& path)
+    : path_(path), connection_(host, port), unreachable_(false),
+      write_connection_(host, port), write_error_reported_(false)
+#if __cplusplus >= 201103L
+      , pending_bytes_(0), writing_(false), done_(false)
+#endif
+      {}
+
+HttpBackend::~HttpBackend() {
+#if __cplusplus >= 201103L
+  {
+    lock_guard<mutex> lock(mutex_);
+    done_ = true;
+  }
+  work_.notify_all();
+  if (thread_.joinable())
+    thread_.join();
+#endif
+}
+
+FileReader::Status HttpBackend::Get(const string& key, string* data,
+                                    string* err) {
+  METRIC_RECORD("http cache get");
+  TRACE_RECORD("http cache get");
+  if (unreachable_)
+    return FileReader::NotFound;
+  int status;
+  if (!connection_.Request("GET", path_ + key, "", &status, data, err)) {
+    // Say so once, and then build without the cache.
+#if __cplusplus >= 201103L
+    lock_guard<mutex> lock(mutex_);
+#endif
+    unreachable_ = true;
+    return FileReader::OtherError;
+  }
+  if (status == 200)
+    return FileReader::Okay;
+  if (status == 404)
+    return FileReader::NotFound;
+  char code[16];
+  snprintf(code, sizeof(code), "%d", status);
+  *err = "HTTP status " + string(code) + " reading " + key;
+  return FileReader::OtherError;
+}
+
+bool HttpBackend::Write(HttpConnection* connection, const Entry& entry,
+                        string* err) {
+  int status;
+  string response;
+  if (!entry.replace) {
+    if (!connection->Request("HEAD", path_ + entry.key, "", &status,
+                             &response, err))
+      return false;
+    if (status == 200)
+      return true;
+  }
+  if (!connection->Request("PUT", path_ + entry.key, entry.data, &status,
+                           &response, err))
+    return false;
+  if (status / 100 != 2) {
+    char code[16];
+    snprintf(code, sizeof(code), "%d", status);
+    *err = "HTTP status " + string(code) + " writing " + entry.key;
+    return false;
+  }
+  return true;
+}
+
+bool HttpBackend::Put(const string& key, const string& data, bool replace,
+                      string* err) {
+#if __cplusplus >= 201103L
+  unique_lock<mutex> lock(mutex_);
+  if (unreachable_ || !write_error_.empty())
+    return true;
+  // Don't hold on to more than so much while the server catches up.
+  while (pending_bytes_ > kMaxPendingBytes)
+    written_.wait(lock);
+  pending_.push_back(Entry(key, data, replace));
+  pending_bytes_ += data.size();
+  if (!thread_.joinable())
+    thread_ = thread(&HttpBackend::Work, this);
+  work_.notify_one();
+  return true;
+#else
+  if (unreachable_ || !write_error_.empty())
+    return true;
+  Write(&write_connection_, Entry(key, data, replace), &write_error_);
+  return true;
+#endif
+}
+
+bool HttpBackend::Flush(string* err) {
+#if __cplusplus >= 201103L
+  unique_lock<mutex> lock(mutex_);
+  while (!pending_.empty() || writing_)
+    written_.wait(lock);
+#endif
+  if (write_error_.empty() || write_error_reported_)
+    return true;
+  // Say so once.
+  write_error_reported_ = true;
+  *err = write_error_;
+  return false;
+}
+
+#if __cplusplus >= 201103L
+void HttpBackend::Work() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    while (pending_.empty() && !done_)
+      work_.wait(lock);
+    if (pending_.empty())
+      return;
+    Entry entry = pending_.front();
+    pending_.pop_front();
+    writing_ = true;
+    lock.unlock();
+    string err;
+    bool written = Write(&write_connection_, entry, &err);
+    lock.lock();
+    writing_ = false;
+    pending_bytes_ -= entry.data.size();
+    if (!written && write_error_.empty()) {
+      // Give up on writing: the server is likely down or full.
+      write_error_ = err;
+      for (deque<Entry>::iterator e = pending_.begin(); e != pending_.end();
+           ++e) {
+        pending_bytes_ -= e->data.size();
+      }
+      pending_.clear();
+    }
+    written_.notify_all();
+  }
+}
+#endif
@@ -0,0 +1,132 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_HTTP_CACHE_H_
+#define NINJA_HTTP_CACHE_H_
+
+#include <string>
+using namespace std;
+
+#if __cplusplus >= 201103L
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "action_cache.h"
+
+/// A connection to an HTTP/1.1 server, kept open between requests.
+struct HttpConnection {
+  HttpConnection(const string& host, const string& port)
+      : host_(host), port_(port), fd_(-1) {}
+  ~HttpConnection() { Close(); }
+
+  /// Send a request for |path| with |body|, which is only sent with PUT,
+  /// and read the response into |status| and |response|.  Returns false
+  /// if the server can't be reached or doesn't speak HTTP.
+  bool Request(const string& method, const string& path, const string& body,
+               int* status, string* response, string* err);
+
+ private:
+  bool Connect(string* err);
+  void Close();
+  bool Send(const string& data, string* err);
+  /// Read until |buffer_| has |size| bytes.
+  bool Fill(size_t size, string* err);
+  /// Read until |buffer_| has a line, and move it to |line|.
+  bool ReadLine(string* line, string* err);
+  bool ReadResponse(bool head, int* status, string* response, string* err);
+
+  string host_;
+  string port_;
+  int fd_;
+  /// Bytes read from |fd_| that haven't been used yet.
+  string buffer_;
+};
+
+/// An ActionCache::Backend keeping entries on an HTTP server, at its URL
+/// followed by their key.  Entries are read with GET and written with PUT,
+/// and contents the server has already are found with HEAD.  Entries are
+/// written by another thread, so that the build doesn't wait for them.
+struct HttpBackend : public ActionCache::Backend {
+  /// Returns NULL if |url| isn't an http:// URL.
+  static HttpBackend* Open(const string& url, string* err);
+  virtual ~HttpBackend();
+
+  virtual FileReader::Status Get(const string& key, string* data,
+                                 string* err);
+  virtual bool Put(const string& key, const string& data, bool replace,
+                   string* err);
+  virtual bool Flush(string* err);
+
+  /// The most bytes waiting to be written before Put() waits too.
+  static const size_t kMaxPendingBytes = 256 << 20;
+
+ private:
+  HttpBackend(const string& host, const string& port, const string& path);
+
+  /// An entry waiting to be written.
+  struct Entry {
+    Entry(const string& key, const string& data, bool replace)
+        : key(key), data(data), replace(replace) {}
+    string key;
+    string data;
+    bool replace;
+  };
+
+  /// Write |entry| with |connection|.
+  bool Write(HttpConnection* connection, const Entry& entry, string* err);
+
+#if __cplusplus >= 201103L
+  /// Thread body: write entries until there are none left and the backend
+  /// is being destroyed.
+  void Work();
+#endif
+
+  /// The path of the URL, which keys are appended to.
+  string path_;
+  /// The connection reads use.
+  HttpConnection connection_;
+  /// Set once the server couldn't be reached, after which nothing is read
+  /// or written.  Guarded by |mutex_|, as Put() may be called from another
+  /// thread.
+  bool unreachable_;
+
+  /// The connection writes use, which is only used by the writing thread.
+  HttpConnection write_connection_;
+  /// The first error writing an entry, after which nothing is written.
+  string write_error_;
+  /// Whether Flush() returned |write_error_| already.
+  bool write_error_reported_;
+#if __cplusplus >= 201103L
+  mutex mutex_;
+  /// Signalled when an entry is queued, and when the thread should exit.
+  condition_variable work_;
+  /// Signalled when an entry is written.
+  condition_variable written_;
+  deque<Entry> pending_;
+  size_t pending_bytes_;
+  /// Whether the thread is writing an entry it took from |pending_|.
+  bool writing_;
+  bool done_;
+  thread thread_;
+#endif
+
+  // Not copyable.
+  HttpBackend(const HttpBackend&);
+  void operator=(const HttpBackend&);
+};
+
+#endif  // NINJA_HTTP_CACHE_H_
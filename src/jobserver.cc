@@ -0,0 +1,260 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#include <algorithm>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+namespace {
+
+/// The most job slots Serve() starts a jobserver with.  Its tokens are
+/// written to a pipe before anything reads them, so they must fit.
+const int kMaxSlots = 4096;
+
+/// The error for a number of job slots out of the range Serve() takes.
+string SlotsError() {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "job slots must be from 1 to %d", kMaxSlots);
+  return buf;
+}
+
+/// Add the jobserver |auth| with |slots| job slots to |makeflags|, before
+/// the variable definitions that follow "--".
+string AddJobserver(const string& makeflags, int slots, const string& auth) {
+  char jobs[32];
+  snprintf(jobs, sizeof(jobs), "-j%d", slots);
+  string flags = " " + makeflags;
+  size_t vars = flags.find(" -- ");
+  if (vars == string::npos)
+    vars = flags.size();
+  flags.insert(vars, string(" ") + jobs + " --jobserver-auth=" + auth);
+  return flags.substr(flags.find_first_not_of(' '));
+}
+
+}  // namespace
+
+bool Jobserver::FindAuth(const string& makeflags, string* auth) {
+  static const char* const kPrefixes[] = {
+    "--jobserver-auth=", "--jobserver-fds="
+  };
+  bool found = false;
+  size_t end = 0;
+  for (;;) {
+    size_t start = makeflags.find_first_not_of(" \t", end);
+    if (start == string::npos)
+      break;
+    end = makeflags.find_first_of(" \t", start);
+    if (end == string::npos)
+      end = makeflags.size();
+    string word = makeflags.substr(start, end - start);
+    // Variable definitions follow.
+    if (word == "--")
+      break;
+    for (size_t i = 0; i < sizeof(kPrefixes) / sizeof(kPrefixes[0]); ++i) {
+      size_t length = strlen(kPrefixes[i]);
+      if (word.compare(0, length, kPrefixes[i]) == 0) {
+        *auth = word.substr(length);
+        found = true;
+      }
+    }
+  }
+  return found && !auth->empty();
+}
+
+Jobserver* Jobserver::Connect(string* err) {
+  const char* makeflags = getenv("MAKEFLAGS");
+  string auth;
+  if (!makeflags || !FindAuth(makeflags, &auth))
+    return NULL;
+  return Open(auth, err);
+}
+
+void Jobserver::Release() {
+  if (tokens_.empty())
+    return;
+#ifdef _WIN32
+  ReleaseSemaphore(semaphore_, 1, NULL);
+#else
+  char token = tokens_[tokens_.size() - 1];
+  while (write(write_fd_, &token, 1) < 0 && errno == EINTR) {}
+#endif
+  tokens_.resize(tokens_.size() - 1);
+}
+
+#ifdef _WIN32
+
+Jobserver::Jobserver() : semaphore_(NULL) {}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+  if (semaphore_)
+    CloseHandle(semaphore_);
+}
+
+Jobserver* Jobserver::Open(const string& auth, string* err) {
+  HANDLE semaphore = OpenSemaphoreA(SEMAPHORE_MODIFY_STATE | SYNCHRONIZE,
+                                    FALSE, auth.c_str());
+  if (!semaphore) {
+    *err = "jobserver semaphore '" + auth + "': " + GetLastErrorString();
+    return NULL;
+  }
+  Jobserver* jobserver = new Jobserver;
+  jobserver->semaphore_ = semaphore;
+  return jobserver;
+}
+
+Jobserver* Jobserver::Serve(int slots, string* err) {
+  if (slots < 1 || slots > kMaxSlots) {
+    *err = SlotsError();
+    return NULL;
+  }
+  char name[64];
+  snprintf(name, sizeof(name), "ninja_jobserver_%lu",
+           (unsigned long)GetCurrentProcessId());
+  // The handle is kept open for as long as we run, so that the semaphore
+  // outlives the clients that open it by name.
+  if (!CreateSemaphoreA(NULL, slots - 1, max(slots - 1, 1), name)) {
+    *err = string("CreateSemaphore: ") + GetLastErrorString();
+    return NULL;
+  }
+  const char* makeflags = getenv("MAKEFLAGS");
+  string value = AddJobserver(makeflags ? makeflags : "", slots, name);
+  _putenv(("MAKEFLAGS=" + value).c_str());
+  return Open(name, err);
+}
+
+bool Jobserver::Acquire() {
+  if (WaitForSingleObject(semaphore_, 0) != WAIT_OBJECT_0)
+    return false;
+  tokens_.push_back('+');
+  return true;
+}
+
+#else  // !_WIN32
+
+Jobserver::Jobserver()
+    : read_fd_(-1), write_fd_(-1), shared_read_fd_(false) {}
+
+Jobserver::~Jobserver() {
+  while (!tokens_.empty())
+    Release();
+  if (!shared_read_fd_)
+    close(read_fd_);
+}
+
+Jobserver* Jobserver::Open(const string& auth, string* err) {
+  Jobserver* jobserver = new Jobserver;
+  if (auth.compare(0, 5, "fifo:") == 0) {
+    string path = auth.substr(5);
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK);
+    if (fd < 0) {
+      *err = "jobserver fifo " + path + ": " + strerror(errno);
+      delete jobserver;
+      return NULL;
+    }
+    SetCloseOnExec(fd);
+    jobserver->read_fd_ = jobserver->write_fd_ = fd;
+    return jobserver;
+  }
+
+  int read_fd, write_fd;
+  char extra;
+  if (sscanf(auth.c_str(), "%d,%d%c", &read_fd, &write_fd, &extra) != 2) {
+    *err = "unknown jobserver '" + auth + "'";
+    delete jobserver;
+    return NULL;
+  }
+  if (read_fd < 0 || write_fd < 0 || fcntl(read_fd, F_GETFD) < 0 ||
+      fcntl(write_fd, F_GETFD) < 0) {
+    *err = "the jobserver pipe is closed; prefix the command that runs "
+           "ninja with '+' in its makefile";
+    delete jobserver;
+    return NULL;
+  }
+  jobserver->write_fd_ = write_fd;
+  jobserver->read_fd_ = -1;
+#ifdef __linux__
+  // Open the pipe again, which gives us a file description of our own that
+  // can be non-blocking without affecting the other clients.
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", read_fd);
+  jobserver->read_fd_ = open(path, O_RDONLY | O_NONBLOCK);
+  if (jobserver->read_fd_ >= 0)
+    SetCloseOnExec(jobserver->read_fd_);
+#endif
+  if (jobserver->read_fd_ < 0) {
+    jobserver->read_fd_ = read_fd;
+    jobserver->shared_read_fd_ = true;
+  }
+  return jobserver;
+}
+
+Jobserver* Jobserver::Serve(int slots, string* err) {
+  if (slots < 1 || slots > kMaxSlots) {
+    *err = SlotsError();
+    return NULL;
+  }
+  // The pipe is inherited by the commands we run, so it isn't
+  // close-on-exec.
+  int fds[2];
+  if (pipe(fds) < 0) {
+    *err = string("pipe: ") + strerror(errno);
+    return NULL;
+  }
+  string tokens(slots - 1, '+');
+  if (write(fds[1], tokens.data(), tokens.size()) != (ssize_t)tokens.size()) {
+    *err = string("write: ") + strerror(errno);
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+  char auth[32];
+  snprintf(auth, sizeof(auth), "%d,%d", fds[0], fds[1]);
+  const char* makeflags = getenv("MAKEFLAGS");
+  setenv("MAKEFLAGS",
+         AddJobserver(makeflags ? makeflags : "", slots, auth).c_str(), 1);
+  return Open(auth, err);
+}
+
+bool Jobserver::Acquire() {
+  // Another client may take the token between poll() and read(), in which
+  // case read() waits for the next one.  That only happens on systems where
+  // the pipe can't be opened again.
+  if (shared_read_fd_) {
+    pollfd pfd = { read_fd_, POLLIN, 0 };
+    if (poll(&pfd, 1, 0) != 1)
+      return false;
+  }
+  char token;
+  if (read(read_fd_, &token, 1) != 1)
+    return false;
+  tokens_.push_back(token);
+  return true;
+}
+
+#endif  // _WIN32
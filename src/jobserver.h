@@ -0,0 +1,90 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_JOBSERVER_H_
+#define NINJA_JOBSERVER_H_
+
+#include <string>
+using namespace std;
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/// A client of a GNU make jobserver, which shares a number of job slots
+/// between the processes of a build.  Every process has one slot of its
+/// own, and takes a token from the jobserver for each further job it runs
+/// at the same time, giving it back when the job finishes.
+///
+/// The jobserver is named in MAKEFLAGS by --jobserver-auth (or the older
+/// --jobserver-fds): a pair of pipe file descriptors "R,W", a fifo
+/// "fifo:PATH", or on Windows the name of a semaphore.
+struct Jobserver {
+  /// Connect to the jobserver named in the MAKEFLAGS environment variable.
+  /// Returns NULL if there is none, or if it can't be used, in which case
+  /// |err| is set; make closes the pipe for commands it doesn't think run
+  /// make, which is the usual reason.
+  static Jobserver* Connect(string* err);
+
+  /// Start a jobserver with |slots| job slots, one of them ours, and add
+  /// it to MAKEFLAGS so that the commands we run share them.  Returns a
+  /// client of it, or NULL with |err| set if there are too many slots to
+  /// start one, as with -j0.
+  static Jobserver* Serve(int slots, string* err);
+
+  /// Find the last jobserver named in |makeflags| and set |auth| to its
+  /// name.  Returns false if there is none.
+  static bool FindAuth(const string& makeflags, string* auth);
+
+  /// Gives back the tokens that were taken.
+  ~Jobserver();
+
+  /// Take a token if one is free, without waiting for one.
+  bool Acquire();
+
+  /// Give back a token taken by Acquire().
+  void Release();
+
+  /// The number of tokens taken and not given back.
+  size_t tokens() const { return tokens_.size(); }
+
+#ifndef _WIN32
+  /// Becomes readable when a token may be free.
+  int read_fd() const { return read_fd_; }
+#endif
+
+ private:
+  Jobserver();
+
+  /// Connect to the jobserver named |auth|.
+  static Jobserver* Open(const string& auth, string* err);
+
+#ifdef _WIN32
+  HANDLE semaphore_;
+#else
+  int read_fd_;
+  int write_fd_;
+  /// Whether |read_fd_| is shared with other processes, so that it can't
+  /// be made non-blocking and must be polled before reading.
+  bool shared_read_fd_;
+#endif
+  /// The tokens taken, which are given back as they were.
+  string tokens_;
+
+  // Not copyable.
+  Jobserver(const Jobserver&);
+  void operator=(const Jobserver&);
+};
+
+#endif  // NINJA_JOBSERVER_H_
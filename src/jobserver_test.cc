@@ -0,0 +1,154 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "jobserver.h"
+
+#ifndef _WIN32
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include "test.h"
+
+TEST(Jobserver, FindAuth) {
+  string auth;
+  EXPECT_FALSE(Jobserver::FindAuth("", &auth));
+  EXPECT_FALSE(Jobserver::FindAuth("-j8 -k", &auth));
+
+  EXPECT_TRUE(Jobserver::FindAuth("-j8 --jobserver-auth=3,4", &auth));
+  EXPECT_EQ("3,4", auth);
+  EXPECT_TRUE(Jobserver::FindAuth("s -j --jobserver-fds=5,6 -k", &auth));
+  EXPECT_EQ("5,6", auth);
+  EXPECT_TRUE(Jobserver::FindAuth("-j4 --jobserver-auth=fifo:/tmp/GMfifo1",
+                                  &auth));
+  EXPECT_EQ("fifo:/tmp/GMfifo1", auth);
+
+  // The last one counts.
+  EXPECT_TRUE(Jobserver::FindAuth(
+      "--jobserver-fds=3,4 -j --jobserver-auth=7,8", &auth));
+  EXPECT_EQ("7,8", auth);
+
+  // Variable definitions aren't flags.
+  EXPECT_FALSE(Jobserver::FindAuth(" -- X=--jobserver-auth=3,4", &auth));
+}
+
+#ifndef _WIN32
+
+namespace {
+
+struct JobserverTest : public testing::Test {
+  virtual void SetUp() {
+    const char* makeflags = getenv("MAKEFLAGS");
+    had_makeflags_ = makeflags != NULL;
+    if (makeflags)
+      makeflags_ = makeflags;
+  }
+
+  virtual void TearDown() {
+    if (had_makeflags_)
+      setenv("MAKEFLAGS", makeflags_.c_str(), 1);
+    else
+      unsetenv("MAKEFLAGS");
+  }
+
+  bool had_makeflags_;
+  string makeflags_;
+};
+
+TEST_F(JobserverTest, Pipe) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  ASSERT_EQ(2, write(fds[1], "ab", 2));
+  char makeflags[64];
+  snprintf(makeflags, sizeof(makeflags), "-j3 --jobserver-auth=%d,%d",
+           fds[0], fds[1]);
+  setenv("MAKEFLAGS", makeflags, 1);
+
+  string err;
+  Jobserver* jobserver = Jobserver::Connect(&err);
+  ASSERT_TRUE(jobserver);
+  EXPECT_EQ("", err);
+  EXPECT_TRUE(jobserver->Acquire());
+  EXPECT_TRUE(jobserver->Acquire());
+  // Acquire() doesn't wait for a token.
+  EXPECT_FALSE(jobserver->Acquire());
+  EXPECT_EQ(2u, jobserver->tokens());
+
+  jobserver->Release();
+  EXPECT_EQ(1u, jobserver->tokens());
+  // The tokens taken are given back as they were.
+  delete jobserver;
+  char tokens[3] = {};
+  ASSERT_EQ(2, read(fds[0], tokens, 2));
+  EXPECT_EQ("ba", string(tokens));
+
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(JobserverTest, Closed) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  close(fds[0]);
+  close(fds[1]);
+  char makeflags[64];
+  snprintf(makeflags, sizeof(makeflags), "-j3 --jobserver-auth=%d,%d",
+           fds[0], fds[1]);
+  setenv("MAKEFLAGS", makeflags, 1);
+
+  string err;
+  EXPECT_FALSE(Jobserver::Connect(&err));
+  EXPECT_NE("", err);
+}
+
+TEST_F(JobserverTest, Serve) {
+  setenv("MAKEFLAGS", "k -- X=1", 1);
+  string err;
+  Jobserver* jobserver = Jobserver::Serve(3, &err);
+  ASSERT_TRUE(jobserver);
+  EXPECT_EQ("", err);
+
+  string makeflags = getenv("MAKEFLAGS");
+  EXPECT_EQ(0u, makeflags.find("k -j3 --jobserver-auth="));
+  EXPECT_EQ(makeflags.size() - 7, makeflags.find(" -- X=1"));
+
+  // One of the slots is ours, and commands can take the others.
+  Jobserver* client = Jobserver::Connect(&err);
+  ASSERT_TRUE(client);
+  EXPECT_TRUE(jobserver->Acquire());
+  EXPECT_TRUE(client->Acquire());
+  EXPECT_FALSE(client->Acquire());
+  client->Release();
+  EXPECT_TRUE(jobserver->Acquire());
+  EXPECT_FALSE(jobserver->Acquire());
+
+  delete client;
+  delete jobserver;
+}
+
+TEST_F(JobserverTest, ServeTooManySlots) {
+  // -j0 asks for as many slots as an int holds.
+  string err;
+  EXPECT_FALSE(Jobserver::Serve(INT_MAX, &err));
+  EXPECT_EQ("job slots must be from 1 to 4096", err);
+  err.clear();
+  EXPECT_FALSE(Jobserver::Serve(0, &err));
+  EXPECT_NE("", err);
+}
+
+}  // anonymous namespace
+
+#endif  // !_WIN32
@@ -0,0 +1,520 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "disk_interface.h"
+#include "graph.h"
+#include "mapped_file.h"
+#include "metrics.h"
+#include "state.h"
+#include "trace.h"
+#include "util.h"
+#include "version.h"
+
+namespace {
+
+const char kFileSignature[] = "# ninja manifest cache\n";
+const uint32_t kCurrentVersion = 2;
+
+/// Writes the cache, remembering whether any write failed.
+struct CacheWriter {
+  explicit CacheWriter(FILE* f) : f_(f), ok_(true) {}
+
+  void WriteInt(uint32_t value) { Write(&value, 4); }
+  void WriteInt64(uint64_t value) { Write(&value, 8); }
+  void WriteString(StringPiece s) {
+    WriteInt((uint32_t)s.len_);
+    Write(s.str_, s.len_);
+  }
+  void Write(const void* data, size_t size) {
+    if (size && fwrite(data, size, 1, f_) < 1)
+      ok_ = false;
+  }
+
+  FILE* f_;
+  bool ok_;
+};
+
+/// Reads the cache in place, without reading past its end.  Once a read
+/// fails, ok() is false and all further reads return zeros.
+struct CacheReader {
+  CacheReader(const char* data, size_t size)
+      : pos_(data), end_(data + size), ok_(true) {}
+
+  uint32_t ReadInt() {
+    uint32_t value = 0;
+    Read(&value, 4);
+    return value;
+  }
+  uint64_t ReadInt64() {
+    uint64_t value = 0;
+    Read(&value, 8);
+    return value;
+  }
+  StringPiece ReadString() {
+    uint32_t len = ReadInt();
+    if (!ok_ || (size_t)(end_ - pos_) < len) {
+      ok_ = false;
+      return StringPiece();
+    }
+    StringPiece s(pos_, len);
+    pos_ += len;
+    return s;
+  }
+  /// Read an index into a table with |size| entries.
+  uint32_t ReadIndex(size_t size) {
+    uint32_t index = ReadInt();
+    if (index >= size)
+      ok_ = false;
+    return ok_ ? index : 0;
+  }
+  /// Read the number of items that follow, each of which takes at least
+  /// |item_size| bytes, so that a corrupt count doesn't make the caller
+  /// reserve too much.
+  uint32_t ReadCount(size_t item_size) {
+    uint32_t count = ReadInt();
+    if ((size_t)(end_ - pos_) / item_size < count)
+      ok_ = false;
+    return ok_ ? count : 0;
+  }
+  void Read(void* data, size_t size) {
+    if (!ok_ || (size_t)(end_ - pos_) < size) {
+      ok_ = false;
+      return;
+    }
+    memcpy(data, pos_, size);
+    pos_ += size;
+  }
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return pos_ == end_; }
+
+ private:
+  const char* pos_;
+  const char* end_;
+  bool ok_;
+};
+
+/// Assigns dense ids to objects in the order they are first seen.
+template<typename T>
+struct Numbering {
+  uint32_t Id(const T* item) {
+    pair<typename map<const T*, uint32_t>::iterator, bool> i =
+        ids_.insert(make_pair(item, (uint32_t)items_.size()));
+    if (i.second)
+      items_.push_back(item);
+    return i.first->second;
+  }
+
+  vector<const T*> items_;
+  map<const T*, uint32_t> ids_;
+};
+
+LoadStatus Corrupt(string* err) {
+  *err = "manifest cache is corrupt";
+  return LOAD_ERROR;
+}
+
+}  // anonymous namespace
+
+LoadStatus ManifestCache::Load(const string& path,
+                               DiskInterface* disk_interface, State* state,
+                               string* err) {
+  METRIC_RECORD(".ninja_manifest_cache load");
+  TRACE_RECORD(".ninja_manifest_cache load");
+  inputs_.clear();
+  warnings_.clear();
+  MappedFile file;
+  int ret = file.Open(path, err);
+  if (ret == -ENOENT) {
+    err->clear();
+    return LOAD_NOT_FOUND;
+  }
+  if (ret < 0)
+    return LOAD_ERROR;
+  CacheReader reader(file.data(), file.size());
+
+  // A cache from another version of ninja, or for another manifest, is
+  // simply replaced.
+  char signature[sizeof(kFileSignature) - 1];
+  reader.Read(signature, sizeof(signature));
+  if (!reader.ok() || memcmp(signature, kFileSignature, sizeof(signature)) ||
+      reader.ReadInt() != kCurrentVersion ||
+      reader.ReadString() != kNinjaVersion ||
+      reader.ReadString() != manifest_ ||
+      reader.ReadInt() != (uint32_t)options_.dupe_edge_action_ ||
+      reader.ReadInt() != (uint32_t)options_.phony_cycle_action_) {
+    return LOAD_NOT_FOUND;
+  }
+
+  uint32_t input_count = reader.ReadCount(12);
+  for (uint32_t i = 0; i < input_count; ++i) {
+    StringPiece input_path = reader.ReadString();
+    TimeStamp mtime = (TimeStamp)reader.ReadInt64();
+    if (!reader.ok())
+      return Corrupt(err);
+    inputs_.push_back(Input(input_path.AsString(), mtime));
+  }
+  for (vector<Input>::iterator i = inputs_.begin(); i != inputs_.end(); ++i) {
+    string stat_err;
+    if (disk_interface->Stat(i->path_, &stat_err) != i->mtime_) {
+      inputs_.clear();
+      return LOAD_NOT_FOUND;
+    }
+  }
+
+  uint32_t warning_count = reader.ReadCount(4);
+  for (uint32_t i = 0; i < warning_count; ++i) {
+    StringPiece warning = reader.ReadString();
+    if (!reader.ok())
+      return Corrupt(err);
+    warnings_.push_back(warning.AsString());
+  }
+
+  vector<Pool*> pools;
+  pools.push_back(&State::kDefaultPool);
+  pools.push_back(&State::kConsolePool);
+  uint32_t pool_count = reader.ReadCount(8);
+  for (uint32_t i = 0; i < pool_count; ++i) {
+    string name = reader.ReadString().AsString();
+    uint32_t depth = reader.ReadInt();
+    if (!reader.ok() || state->LookupPool(name) != NULL)
+      return Corrupt(err);
+    Pool* pool = new Pool(name, depth);
+    state->AddPool(pool);
+    pools.push_back(pool);
+  }
+
+  vector<const Rule*> rules;
+  rules.push_back(&State::kPhonyRule);
+  uint32_t rule_count = reader.ReadCount(8);
+  for (uint32_t i = 0; i < rule_count; ++i) {
+    Rule* rule = new Rule(reader.ReadString().AsString());
+    rules.push_back(rule);
+    uint32_t binding_count = reader.ReadCount(8);
+    for (uint32_t j = 0; j < binding_count; ++j) {
+      EvalString* value = &rule->bindings_[reader.ReadString().AsString()];
+      uint32_t token_count = reader.ReadCount(8);
+      value->parsed_.resize(token_count);
+      for (uint32_t k = 0; k < token_count; ++k) {
+        uint32_t type = reader.ReadInt();
+        value->parsed_[k].first = reader.ReadString().AsString();
+        value->parsed_[k].second =
+            type ? EvalString::SPECIAL : EvalString::RAW;
+      }
+    }
+    if (!reader.ok())
+      return Corrupt(err);
+  }
+
+  // The first scope is the State's own.
+  vector<BindingEnv*> scopes;
+  uint32_t scope_count = reader.ReadCount(12);
+  for (uint32_t i = 0; i < scope_count; ++i) {
+    uint32_t parent = reader.ReadIndex(i + 1);
+    if (!reader.ok())
+      return Corrupt(err);
+    BindingEnv* env = &state->bindings_;
+    if (i > 0) {
+      env = new BindingEnv(parent ? scopes[parent - 1] : NULL);
+      env->set_string_pool(&state->string_pool_);
+    }
+    scopes.push_back(env);
+    uint32_t binding_count = reader.ReadCount(8);
+    for (uint32_t j = 0; j < binding_count; ++j) {
+      StringPiece key = reader.ReadString();
+      env->AddBinding(key, reader.ReadString());
+    }
+    // Nothing is parsed into the other scopes any more.
+    if (i > 0)
+      env->Freeze();
+    uint32_t scope_rule_count = reader.ReadCount(4);
+    for (uint32_t j = 0; j < scope_rule_count; ++j) {
+      const Rule* rule = rules[reader.ReadIndex(rules.size())];
+      env->rules_[rule->name()] = rule;
+    }
+    if (!reader.ok())
+      return Corrupt(err);
+  }
+  if (scopes.empty())
+    return Corrupt(err);
+
+  vector<Node*> nodes;
+  uint32_t node_count = reader.ReadCount(12);
+  nodes.reserve(node_count);
+  for (uint32_t i = 0; i < node_count; ++i) {
+    StringPiece node_path = reader.ReadString();
+    uint64_t slash_bits = reader.ReadInt64();
+    if (!reader.ok())
+      return Corrupt(err);
+    nodes.push_back(state->GetNode(node_path, slash_bits));
+  }
+
+  uint32_t edge_count = reader.ReadCount(40);
+  state->edges_.reserve(edge_count);
+  for (uint32_t i = 0; i < edge_count; ++i) {
+    const Rule* rule = rules[reader.ReadIndex(rules.size())];
+    Pool* pool = pools[reader.ReadIndex(pools.size())];
+    BindingEnv* env = scopes[reader.ReadIndex(scopes.size())];
+    uint32_t dyndep = reader.ReadIndex(nodes.size() + 1);
+    int implicit_deps = (int)reader.ReadInt();
+    int order_only_deps = (int)reader.ReadInt();
+    int implicit_outs = (int)reader.ReadInt();
+    int weight = (int)reader.ReadInt();
+    if (!reader.ok() || weight <= 0)
+      return Corrupt(err);
+
+    Edge* edge = state->AddEdge(rule);
+    edge->pool_ = pool;
+    edge->weight_ = weight;
+    edge->env_ = env;
+    uint32_t out_count = reader.ReadCount(4);
+    edge->outputs_.reserve(out_count);
+    for (uint32_t j = 0; j < out_count; ++j) {
+      uint32_t id = reader.ReadIndex(nodes.size());
+      if (!reader.ok())
+        return Corrupt(err);
+      Node* node = nodes[id];
+      edge->outputs_.push_back(node);
+      node->set_in_edge(edge);
+    }
+    uint32_t in_count = reader.ReadCount(4);
+    edge->inputs_.reserve(in_count);
+    for (uint32_t j = 0; j < in_count; ++j) {
+      uint32_t id = reader.ReadIndex(nodes.size());
+      if (!reader.ok())
+        return Corrupt(err);
+      Node* node = nodes[id];
+      edge->inputs_.push_back(node);
+      node->AddOutEdge(edge);
+    }
+    if (implicit_deps < 0 || order_only_deps < 0 ||
+        (size_t)implicit_deps + order_only_deps > in_count ||
+        implicit_outs < 0 || (size_t)implicit_outs > out_count) {
+      return Corrupt(err);
+    }
+    edge->implicit_deps_ = implicit_deps;
+    edge->order_only_deps_ = order_only_deps;
+    edge->implicit_outs_ = implicit_outs;
+    if (dyndep) {
+      edge->dyndep_ = nodes[dyndep - 1];
+      edge->dyndep_->set_dyndep_pending(true);
+    }
+  }
+
+  uint32_t default_count = reader.ReadCount(4);
+  for (uint32_t i = 0; i < default_count; ++i) {
+    uint32_t id = reader.ReadIndex(nodes.size());
+    if (!reader.ok())
+      return Corrupt(err);
+    Node* node = nodes[id];
+    state->defaults_.push_back(node);
+  }
+
+  if (!reader.ok() || !reader.at_end())
+    return Corrupt(err);
+  return LOAD_SUCCESS;
+}
+
+bool ManifestCache::Write(const string& path, const State& state,
+                          string* err) {
+  METRIC_RECORD(".ninja_manifest_cache write");
+  TRACE_RECORD(".ninja_manifest_cache write");
+
+  // Number everything the edges refer to, in the order they refer to it.
+  Numbering<Pool> pools;
+  pools.Id(&State::kDefaultPool);
+  pools.Id(&State::kConsolePool);
+  for (map<string, Pool*>::const_iterator i = state.pools_.begin();
+       i != state.pools_.end(); ++i) {
+    pools.Id(i->second);
+  }
+  Numbering<Rule> rules;
+  rules.Id(&State::kPhonyRule);
+  Numbering<BindingEnv> scopes;
+  scopes.Id(&state.bindings_);
+  for (map<string, const Rule*>::const_iterator r =
+           state.bindings_.rules_.begin();
+       r != state.bindings_.rules_.end(); ++r) {
+    rules.Id(r->second);
+  }
+  Numbering<Node> nodes;
+  vector<const BindingEnv*> new_scopes;
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const Edge* edge = *e;
+    // A scope comes after its parent, and its rules come with it.
+    new_scopes.clear();
+    for (const BindingEnv* env = edge->env_;
+         env && scopes.ids_.count(env) == 0; env = env->parent_) {
+      new_scopes.push_back(env);
+    }
+    for (vector<const BindingEnv*>::reverse_iterator i = new_scopes.rbegin();
+         i != new_scopes.rend(); ++i) {
+      scopes.Id(*i);
+      for (map<string, const Rule*>::const_iterator r = (*i)->rules_.begin();
+           r != (*i)->rules_.end(); ++r) {
+        rules.Id(r->second);
+      }
+    }
+    rules.Id(edge->rule_);
+    pools.Id(edge->pool_);
+    for (vector<Node*>::const_iterator n = edge->outputs_.begin();
+         n != edge->outputs_.end(); ++n) {
+      nodes.Id(*n);
+    }
+    for (vector<Node*>::const_iterator n = edge->inputs_.begin();
+         n != edge->inputs_.end(); ++n) {
+      nodes.Id(*n);
+    }
+    if (edge->dyndep_)
+      nodes.Id(edge->dyndep_);
+  }
+  for (vector<Node*>::const_iterator n = state.defaults_.begin();
+       n != state.defaults_.end(); ++n) {
+    nodes.Id(*n);
+  }
+
+  string temp_path = path + ".tmp";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+  CacheWriter writer(f);
+
+  writer.Write(kFileSignature, sizeof(kFileSignature) - 1);
+  writer.WriteInt(kCurrentVersion);
+  writer.WriteString(kNinjaVersion);
+  writer.WriteString(manifest_);
+  writer.WriteInt(options_.dupe_edge_action_);
+  writer.WriteInt(options_.phony_cycle_action_);
+  writer.WriteInt(inputs_.size());
+  for (vector<Input>::const_iterator i = inputs_.begin(); i != inputs_.end();
+       ++i) {
+    writer.WriteString(i->path_);
+    writer.WriteInt64(i->mtime_);
+  }
+  writer.WriteInt(warnings_.size());
+  for (vector<string>::const_iterator w = warnings_.begin();
+       w != warnings_.end(); ++w) {
+    writer.WriteString(*w);
+  }
+
+  // The built-in pools and rules are already in every State.
+  writer.WriteInt(pools.items_.size() - 2);
+  for (size_t i = 2; i < pools.items_.size(); ++i) {
+    writer.WriteString(pools.items_[i]->name());
+    writer.WriteInt(pools.items_[i]->depth());
+  }
+  writer.WriteInt(rules.items_.size() - 1);
+  for (size_t i = 1; i < rules.items_.size(); ++i) {
+    const Rule* rule = rules.items_[i];
+    writer.WriteString(rule->name());
+    writer.WriteInt(rule->bindings_.size());
+    for (Rule::Bindings::const_iterator b = rule->bindings_.begin();
+         b != rule->bindings_.end(); ++b) {
+      writer.WriteString(b->first);
+      writer.WriteInt(b->second.parsed_.size());
+      for (EvalString::TokenList::const_iterator t =
+               b->second.parsed_.begin();
+           t != b->second.parsed_.end(); ++t) {
+        writer.WriteInt(t->second == EvalString::SPECIAL);
+        writer.WriteString(t->first);
+      }
+    }
+  }
+
+  writer.WriteInt(scopes.items_.size());
+  for (size_t i = 0; i < scopes.items_.size(); ++i) {
+    const BindingEnv* env = scopes.items_[i];
+    writer.WriteInt(env->parent_ && i > 0 ? scopes.ids_[env->parent_] + 1
+                                          : 0);
+    writer.WriteInt(env->values_.size() + env->bindings_.size());
+    for (BindingEnv::Values::const_iterator v = env->values_.begin();
+         v != env->values_.end(); ++v) {
+      writer.WriteString(v->first);
+      writer.WriteString(v->second);
+    }
+    for (BindingEnv::Bindings::const_iterator b = env->bindings_.begin();
+         b != env->bindings_.end(); ++b) {
+      writer.WriteString(b->first);
+      writer.WriteString(b->second);
+    }
+    writer.WriteInt(env->rules_.size());
+    for (map<string, const Rule*>::const_iterator r = env->rules_.begin();
+         r != env->rules_.end(); ++r) {
+      writer.WriteInt(rules.ids_[r->second]);
+    }
+  }
+
+  writer.WriteInt(nodes.items_.size());
+  for (size_t i = 0; i < nodes.items_.size(); ++i) {
+    writer.WriteString(nodes.items_[i]->path());
+    writer.WriteInt64(nodes.items_[i]->slash_bits());
+  }
+
+  writer.WriteInt(state.edges_.size());
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const Edge* edge = *e;
+    writer.WriteInt(rules.ids_[edge->rule_]);
+    writer.WriteInt(pools.ids_[edge->pool_]);
+    writer.WriteInt(scopes.ids_[edge->env_]);
+    writer.WriteInt(edge->dyndep_ ? nodes.ids_[edge->dyndep_] + 1 : 0);
+    writer.WriteInt(edge->implicit_deps_);
+    writer.WriteInt(edge->order_only_deps_);
+    writer.WriteInt(edge->implicit_outs_);
+    writer.WriteInt(edge->weight_);
+    writer.WriteInt(edge->outputs_.size());
+    for (vector<Node*>::const_iterator n = edge->outputs_.begin();
+         n != edge->outputs_.end(); ++n) {
+      writer.WriteInt(nodes.ids_[*n]);
+    }
+    writer.WriteInt(edge->inputs_.size());
+    for (vector<Node*>::const_iterator n = edge->inputs_.begin();
+         n != edge->inputs_.end(); ++n) {
+      writer.WriteInt(nodes.ids_[*n]);
+    }
+  }
+
+  writer.WriteInt(state.defaults_.size());
+  for (vector<Node*>::const_iterator n = state.defaults_.begin();
+       n != state.defaults_.end(); ++n) {
+    writer.WriteInt(nodes.ids_[*n]);
+  }
+
+  if (!writer.ok_ || fclose(f) != 0) {
+    *err = strerror(errno);
+    if (!writer.ok_)
+      fclose(f);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  unlink(path.c_str());
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  return true;
+}
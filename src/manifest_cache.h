@@ -0,0 +1,77 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MANIFEST_CACHE_H_
+#define NINJA_MANIFEST_CACHE_H_
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "load_status.h"
+#include "manifest_parser.h"
+#include "timestamp.h"
+
+struct DiskInterface;
+struct State;
+
+/// The State that a manifest was loaded into, saved in binary form, so that
+/// later runs can load it without lexing the manifest, evaluating its paths
+/// and bindings or canonicalizing paths again.  It is only used while none
+/// of the files the manifest was read from have changed since.
+///
+/// The file has a version header, the name of the manifest and the options
+/// it was parsed with, the path and mtime of each file read, and the
+/// warnings printed while parsing.  Then
+/// follow the pools, the rules with their unevaluated bindings, the scopes
+/// with their evaluated bindings, the nodes, the edges and the defaults.
+/// Rules, scopes and nodes are referred to by their index in the file.
+/// All integers are 4 bytes, except for mtimes and slash bits which are 8;
+/// strings are a length followed by the bytes.
+struct ManifestCache {
+  ManifestCache(const string& manifest, const ManifestParserOptions& options)
+      : manifest_(manifest), options_(options) {}
+
+  /// A file the manifest was read from, with its mtime from before it was
+  /// read.
+  struct Input {
+    Input(const string& path, TimeStamp mtime) : path_(path), mtime_(mtime) {}
+    string path_;
+    TimeStamp mtime_;
+  };
+
+  /// Load the cache at |path| into |state|, which must be newly constructed,
+  /// and fill in |inputs_| and |warnings_|.  Returns LOAD_NOT_FOUND without touching |state|
+  /// if there is no cache, or it is for another manifest, other options or
+  /// another version of ninja, or any of its inputs changed.  Returns
+  /// LOAD_ERROR if the cache is corrupt, in which case |state| may have been
+  /// partly filled in.
+  LoadStatus Load(const string& path, DiskInterface* disk_interface,
+                  State* state, string* err);
+
+  /// Save |state|, which was loaded by reading |inputs_|, to |path|.
+  bool Write(const string& path, const State& state, string* err);
+
+  vector<Input> inputs_;
+
+  /// The warnings the manifest was parsed with, to print again whenever the
+  /// cache is loaded.
+  vector<string> warnings_;
+
+ private:
+  string manifest_;
+  ManifestParserOptions options_;
+};
+
+#endif  // NINJA_MANIFEST_CACHE_H_
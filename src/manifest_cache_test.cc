@@ -0,0 +1,211 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_cache.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "graph.h"
+#include "state.h"
+#include "util.h"
+#include "test.h"
+
+namespace {
+
+const char kTestFilename[] = "ManifestCacheTest-tempfile";
+
+struct ManifestCacheTest : public testing::Test {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+    fs_.Create("build.ninja",
+"pool link\n"
+"  depth = 2\n"
+"rule cat\n"
+"  command = cat $in > $out $flags\n"
+"  pool = link\n"
+"flags = -outer\n"
+"build out1 | out1.d: cat in1 | in2 || in3\n"
+"  flags = -edge\n"
+"  pool_weight = 2\n"
+"build dd: phony\n"
+"build out2: cat in1 dd\n"
+"  dyndep = dd\n"
+"subninja sub.ninja\n"
+"default out1\n");
+    fs_.Create("sub.ninja",
+"rule cat\n"
+"  command = subcat $in > $out $flags\n"
+"  pool = console\n"
+"build out3: cat out1\n");
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  /// Parse the manifest, and save it to the cache.
+  void ParseAndWrite(const ManifestParserOptions& options) {
+    ManifestParser parser(&state_, &fs_, options);
+    string err;
+    ASSERT_TRUE(parser.Load("build.ninja", &err));
+    ASSERT_EQ("", err);
+
+    ManifestCache cache("build.ninja", options);
+    for (vector<string>::iterator i = fs_.files_read_.begin();
+         i != fs_.files_read_.end(); ++i) {
+      cache.inputs_.push_back(ManifestCache::Input(*i, fs_.Stat(*i, &err)));
+    }
+    EXPECT_TRUE(cache.Write(kTestFilename, state_, &err));
+    ASSERT_EQ("", err);
+  }
+
+  State state_;
+  VirtualFileSystem fs_;
+};
+
+TEST_F(ManifestCacheTest, RoundTrip) {
+  ASSERT_NO_FATAL_FAILURE(ParseAndWrite(ManifestParserOptions()));
+
+  State state;
+  ManifestCache cache("build.ninja", ManifestParserOptions());
+  string err;
+  EXPECT_EQ(LOAD_SUCCESS, cache.Load(kTestFilename, &fs_, &state, &err));
+  ASSERT_EQ("", err);
+  VerifyGraph(state);
+
+  ASSERT_EQ(2u, cache.inputs_.size());
+  EXPECT_EQ("build.ninja", cache.inputs_[0].path_);
+  EXPECT_EQ("sub.ninja", cache.inputs_[1].path_);
+
+  ASSERT_EQ(state_.edges_.size(), state.edges_.size());
+  for (size_t i = 0; i < state.edges_.size(); ++i) {
+    Edge* expected = state_.edges_[i];
+    Edge* edge = state.edges_[i];
+    EXPECT_EQ(expected->EvaluateCommand(), edge->EvaluateCommand());
+    EXPECT_EQ(expected->pool()->name(), edge->pool()->name());
+    EXPECT_EQ(expected->inputs_.size(), edge->inputs_.size());
+    EXPECT_EQ(expected->outputs_.size(), edge->outputs_.size());
+    EXPECT_EQ(expected->implicit_deps_, edge->implicit_deps_);
+    EXPECT_EQ(expected->order_only_deps_, edge->order_only_deps_);
+    EXPECT_EQ(expected->implicit_outs_, edge->implicit_outs_);
+    EXPECT_EQ(expected->weight(), edge->weight());
+  }
+  EXPECT_EQ("cat in1 > out1 -edge",
+            state.edges_[0]->EvaluateCommand());
+  EXPECT_EQ("subcat out1 > out3 -outer", state.edges_[3]->EvaluateCommand());
+  EXPECT_EQ(&State::kConsolePool, state.edges_[3]->pool());
+  EXPECT_EQ(2, state.edges_[0]->weight());
+  EXPECT_TRUE(state.edges_[1]->is_phony());
+  EXPECT_EQ(2, state.LookupPool("link")->depth());
+
+  Node* dd = state.LookupNode("dd");
+  ASSERT_TRUE(dd);
+  EXPECT_EQ(dd, state.edges_[2]->dyndep_);
+  EXPECT_TRUE(dd->dyndep_pending());
+  EXPECT_EQ(state.edges_[0], state.LookupNode("out1.d")->in_edge());
+  ASSERT_EQ(1u, state.defaults_.size());
+  EXPECT_EQ("out1", state.defaults_[0]->path());
+
+  EXPECT_EQ("-outer", state.bindings_.LookupVariable("flags"));
+  EXPECT_EQ(2u, state.bindings_.GetRules().size());
+  EXPECT_TRUE(state.bindings_.LookupRule("cat"));
+}
+
+TEST_F(ManifestCacheTest, Warnings) {
+  ManifestParser parser(&state_, &fs_);
+  string err;
+  ASSERT_TRUE(parser.Load("build.ninja", &err));
+  ManifestCache cache("build.ninja", ManifestParserOptions());
+  cache.inputs_.push_back(
+      ManifestCache::Input("build.ninja", fs_.Stat("build.ninja", &err)));
+  cache.warnings_.push_back("multiple rules generate out1");
+  cache.warnings_.push_back("phony target 'dd' names itself as an input");
+  ASSERT_TRUE(cache.Write(kTestFilename, state_, &err));
+
+  State state;
+  ManifestCache loaded("build.ninja", ManifestParserOptions());
+  EXPECT_EQ(LOAD_SUCCESS, loaded.Load(kTestFilename, &fs_, &state, &err));
+  EXPECT_EQ("", err);
+  EXPECT_EQ(cache.warnings_, loaded.warnings_);
+}
+
+TEST_F(ManifestCacheTest, Stale) {
+  ASSERT_NO_FATAL_FAILURE(ParseAndWrite(ManifestParserOptions()));
+
+  fs_.Tick();
+  fs_.Create("sub.ninja", "");
+  State state;
+  ManifestCache cache("build.ninja", ManifestParserOptions());
+  string err;
+  EXPECT_EQ(LOAD_NOT_FOUND, cache.Load(kTestFilename, &fs_, &state, &err));
+  EXPECT_EQ("", err);
+  EXPECT_TRUE(state.edges_.empty());
+  EXPECT_TRUE(state.paths_.empty());
+}
+
+TEST_F(ManifestCacheTest, OtherManifestOrOptions) {
+  ASSERT_NO_FATAL_FAILURE(ParseAndWrite(ManifestParserOptions()));
+
+  State state;
+  string err;
+  ManifestCache other_manifest("other.ninja", ManifestParserOptions());
+  EXPECT_EQ(LOAD_NOT_FOUND,
+            other_manifest.Load(kTestFilename, &fs_, &state, &err));
+
+  ManifestParserOptions options;
+  options.phony_cycle_action_ = kPhonyCycleActionError;
+  ManifestCache other_options("build.ninja", options);
+  EXPECT_EQ(LOAD_NOT_FOUND,
+            other_options.Load(kTestFilename, &fs_, &state, &err));
+  EXPECT_TRUE(state.edges_.empty());
+}
+
+TEST_F(ManifestCacheTest, Missing) {
+  State state;
+  ManifestCache cache("build.ninja", ManifestParserOptions());
+  string err;
+  EXPECT_EQ(LOAD_NOT_FOUND, cache.Load(kTestFilename, &fs_, &state, &err));
+  EXPECT_EQ("", err);
+}
+
+TEST_F(ManifestCacheTest, Truncated) {
+  ASSERT_NO_FATAL_FAILURE(ParseAndWrite(ManifestParserOptions()));
+
+  // A cache cut short anywhere must not load; once its inputs have been
+  // checked, the State may be half loaded, so that must be reported.
+  string contents;
+  string err;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+  for (size_t size = contents.size(); size-- > 0; ) {
+    unlink(kTestFilename);
+    FILE* f = fopen(kTestFilename, "wb");
+    ASSERT_TRUE(f);
+    if (size)
+      ASSERT_EQ(1u, fwrite(contents.data(), size, 1, f));
+    fclose(f);
+
+    State state;
+    ManifestCache cache("build.ninja", ManifestParserOptions());
+    LoadStatus status = cache.Load(kTestFilename, &fs_, &state, &err);
+    EXPECT_NE(LOAD_SUCCESS, status);
+    if (size == contents.size() - 1) {
+      EXPECT_EQ(LOAD_ERROR, status);
+      EXPECT_EQ("manifest cache is corrupt", err);
+    }
+  }
+}
+
+}  // anonymous namespace
@@ -14,24 +14,301 @@
 
 #include "manifest_parser.h"
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <list>
 #include <vector>
 
+#if __cplusplus >= 201103L
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#endif
+
+#include "disk_interface.h"
 #include "graph.h"
 #include "state.h"
 #include "util.h"
 #include "version.h"
 
+namespace {
+
+/// A pool declaration, with where to report it if the name is taken.
+struct PendingPool {
+  PendingPool(const string& name, const Lexer& lexer)
+      : name_(name), depth_(-1), lexer_(lexer) {}
+  string name_;
+  /// -1 if the declaration is incomplete; its error follows.
+  int depth_;
+  Lexer lexer_;
+};
+
+/// A default target, with where to report it if it doesn't exist.
+struct PendingDefault {
+  PendingDefault(const string& path, const Lexer& lexer)
+      : path_(path), lexer_(lexer) {}
+  string path_;
+  Lexer lexer_;
+};
+
+}  // namespace
+
+/// A build statement with its paths evaluated, but not yet turned into an
+/// Edge and Nodes.
+struct ManifestParser::PendingEdge {
+  PendingEdge() : rule_(NULL), env_(NULL), pool_weight_(1), num_outs_(0),
+                  implicit_outs_(0), implicit_(0), order_only_(0),
+                  truncated_(false), dyndep_from_rule_(false) {}
+
+  const Rule* rule_;
+  BindingEnv* env_;
+  /// Where to report errors that depend on other statements.
+  Lexer lexer_;
+  string pool_;
+  int pool_weight_;
+  /// The outputs, followed by the inputs.
+  vector<string> paths_;
+  vector<uint64_t> slash_bits_;
+  size_t num_outs_;
+  int implicit_outs_;
+  int implicit_;
+  int order_only_;
+  /// Set if an output failed to evaluate.  The error follows.
+  bool truncated_;
+  /// Set if an input failed to evaluate.  That is only reported if the
+  /// edge keeps any of its outputs.
+  string in_error_;
+  string dyndep_;
+  /// The rule's dyndep binding may refer to $in and $out, so it can only
+  /// be evaluated once the duplicate outputs have been dropped.
+  bool dyndep_from_rule_;
+};
+
+/// A manifest file and the files it includes, parsed into statements.
+struct ManifestParser::File {
+  enum Kind {
+    kPool,
+    kEdge,
+    kDefault,
+    kSubninja,
+    kRequiredVersion,
+    kError,
+  };
+
+  /// A statement, as an index into the vector for its kind.
+  struct Statement {
+    Statement(Kind kind, size_t index) : kind_(kind), index_(index) {}
+    Kind kind_;
+    size_t index_;
+  };
+
+  enum Status {
+    kQueued,
+    kParsing,
+    kParsed,
+  };
+
+  File() : scope_(NULL), parent_scope_(NULL), snapshot_(NULL),
+           status_(kQueued) {}
+
+  ~File() {
+    // Edges keep pointing at the scope, so give it back its real parent
+    // before the snapshot goes away.
+    if (parent_scope_)
+      scope_->set_parent(parent_scope_);
+    for (size_t i = 0; i < subninjas_.size(); ++i)
+      delete subninjas_[i];
+    for (size_t i = 0; i < snapshots_.size(); ++i)
+      delete snapshots_[i];
+  }
+
+  void Add(Kind kind, size_t index) {
+    statements_.push_back(Statement(kind, index));
+  }
+
+  /// Parsing stopped at an error.
+  void Fail(const string& err) {
+    error_ = err;
+    Add(kError, 0);
+  }
+
+  /// For a subninja file, its path and the subninja statement.
+  string path_;
+  Lexer parent_lexer_;
+
+  /// The scope of this file.  A subninja file's scope has a snapshot of
+  /// the enclosing scope as its parent while it is parsed, because the
+  /// enclosing file is being parsed at the same time.
+  BindingEnv* scope_;
+  BindingEnv* parent_scope_;
+
+  /// The snapshot of |scope_| to give the next subninja file, unless the
+  /// scope has changed since.
+  BindingEnv* snapshot_;
+  vector<BindingEnv*> snapshots_;
+
+  /// The names and contents of this file and of the files it includes,
+  /// which lexers point into.
+  list<string> strings_;
+
+  vector<Statement> statements_;
+  vector<PendingPool> pools_;
+  vector<PendingEdge> edges_;
+  vector<PendingDefault> defaults_;
+  vector<File*> subninjas_;
+  vector<string> versions_;
+  string error_;
+
+  /// Only accessed by the Queue, and with its lock held.
+  Status status_;
+
+ private:
+  // Not copyable.
+  File(const File&);
+  void operator=(const File&);
+};
+
+/// Subninja files waiting to be parsed, and the threads parsing them.
+struct ManifestParser::Queue {
+  Queue(ManifestParser* parser, int threads)
+      : parser_(parser), max_threads_(threads)
+#if __cplusplus >= 201103L
+      , done_(false)
+#endif
+      {}
+  ~Queue();
+
+  /// Make |file| available to other threads for parsing.
+  void Push(File* file);
+
+  /// Return once |file| is parsed, parsing it on this thread if no other
+  /// thread has started on it.
+  void Wait(File* file);
+
+ private:
+#if __cplusplus >= 201103L
+  /// Thread body: parse queued files until the queue is destroyed.
+  void Work();
+#endif
+
+  ManifestParser* parser_;
+  int max_threads_;
+#if __cplusplus >= 201103L
+  mutex mutex_;
+  /// Signalled when a file is queued, and when the threads should exit.
+  condition_variable work_;
+  /// Signalled when a file has been parsed.
+  condition_variable parsed_;
+  deque<File*> pending_;
+  vector<thread> threads_;
+  bool done_;
+#endif
+};
+
+ManifestParser::Queue::~Queue() {
+#if __cplusplus >= 201103L
+  vector<thread> threads;
+  {
+    lock_guard<mutex> lock(mutex_);
+    done_ = true;
+    threads.swap(threads_);
+  }
+  work_.notify_all();
+  for (size_t i = 0; i < threads.size(); ++i)
+    threads[i].join();
+#endif
+}
+
+void ManifestParser::Queue::Push(File* file) {
+#if __cplusplus >= 201103L
+  // Without helpers, Wait() parses every file when it gets to it.
+  if (max_threads_ <= 1)
+    return;
+  lock_guard<mutex> lock(mutex_);
+  if (done_)
+    return;
+  pending_.push_back(file);
+  // The thread applying the statements parses files too, when it has to
+  // wait for one that nobody has started on.
+  if ((int)threads_.size() < max_threads_ - 1)
+    threads_.push_back(thread(&Queue::Work, this));
+  work_.notify_one();
+#endif
+}
+
+void ManifestParser::Queue::Wait(File* file) {
+#if __cplusplus >= 201103L
+  unique_lock<mutex> lock(mutex_);
+  if (file->status_ == File::kQueued) {
+    deque<File*>::iterator i = find(pending_.begin(), pending_.end(), file);
+    if (i != pending_.end())
+      pending_.erase(i);
+    file->status_ = File::kParsing;
+    lock.unlock();
+    parser_->ParseSubninja(file);
+    lock.lock();
+    file->status_ = File::kParsed;
+    return;
+  }
+  while (file->status_ != File::kParsed)
+    parsed_.wait(lock);
+#else
+  parser_->ParseSubninja(file);
+#endif
+}
+
+#if __cplusplus >= 201103L
+void ManifestParser::Queue::Work() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    while (pending_.empty() && !done_)
+      work_.wait(lock);
+    if (done_)
+      return;
+    File* file = pending_.front();
+    pending_.pop_front();
+    file->status_ = File::kParsing;
+    lock.unlock();
+    parser_->ParseSubninja(file);
+    lock.lock();
+    file->status_ = File::kParsed;
+    parsed_.notify_all();
+  }
+}
+#endif
+
 ManifestParser::ManifestParser(State* state, FileReader* file_reader,
                                ManifestParserOptions options)
     : Parser(state, file_reader),
-      options_(options), quiet_(false) {
+      options_(options), quiet_(false), file_(NULL), queue_(NULL) {
   env_ = &state->bindings_;
 }
 
 bool ManifestParser::Parse(const string& filename, const string& input,
                            string* err) {
+  File file;
+  file.scope_ = env_;
+  // Declared after |file|, so that its threads are done before the files
+  // they might still be parsing are deleted.
+  Queue queue(this, options_.parse_threads_);
+  file_ = &file;
+  queue_ = &queue;
+
+  string parse_err;
+  if (!ParseStatements(filename, input, &parse_err))
+    file.Fail(parse_err);
+  bool success = Apply(&file, err);
+
+  file_ = NULL;
+  queue_ = NULL;
+  return success;
+}
+
+bool ManifestParser::ParseStatements(const string& filename,
+                                     const string& input, string* err) {
   lexer_.Start(filename, input);
 
   for (;;) {
@@ -60,11 +337,14 @@ bool ManifestParser::Parse(const string& filename, const string& input,
       if (!ParseLet(&name, &let_value, err))
         return false;
       string value = let_value.Evaluate(env_);
-      // Check ninja_required_version immediately so we can exit
-      // before encountering any syntactic surprises.
-      if (name == "ninja_required_version")
-        CheckNinjaVersion(value);
+      // Check ninja_required_version before any of the statements after
+      // it, so we can exit before encountering any syntactic surprises.
+      if (name == "ninja_required_version") {
+        file_->versions_.push_back(value);
+        file_->Add(File::kRequiredVersion, file_->versions_.size() - 1);
+      }
       env_->AddBinding(name, value);
+      file_->snapshot_ = NULL;
       break;
     }
     case Lexer::INCLUDE:
@@ -99,8 +379,10 @@ bool ManifestParser::ParsePool(string* err) {
   if (!ExpectToken(Lexer::NEWLINE, err))
     return false;
 
-  if (state_->LookupPool(name) != NULL)
-    return lexer_.Error("duplicate pool '" + name + "'", err);
+  // Whether the name is taken is only known once the statements before
+  // this one have been applied.
+  file_->pools_.push_back(PendingPool(name, lexer_));
+  file_->Add(File::kPool, file_->pools_.size() - 1);
 
   int depth = -1;
 
@@ -123,7 +405,7 @@ bool ManifestParser::ParsePool(string* err) {
   if (depth < 0)
     return lexer_.Error("expected 'depth =' line", err);
 
-  state_->AddPool(new Pool(name, depth));
+  file_->pools_.back().depth_ = depth;
   return true;
 }
 
@@ -166,6 +448,7 @@ bool ManifestParser::ParseRule(string* err) {
     return lexer_.Error("expected 'command =' line", err);
 
   env_->AddRule(rule);
+  file_->snapshot_ = NULL;
   return true;
 }
 
@@ -192,8 +475,8 @@ bool ManifestParser::ParseDefault(string* err) {
     uint64_t slash_bits;  // Unused because this only does lookup.
     if (!CanonicalizePath(&path, &slash_bits, &path_err))
       return lexer_.Error(path_err, err);
-    if (!state_->AddDefault(path, &path_err))
-      return lexer_.Error(path_err, err);
+    file_->defaults_.push_back(PendingDefault(path, lexer_));
+    file_->Add(File::kDefault, file_->defaults_.size() - 1);
 
     eval.Clear();
     if (!lexer_.ReadPath(&eval, err))
@@ -303,42 +586,230 @@ bool ManifestParser::ParseEdge(string* err) {
     env->AddBinding(key, val.Evaluate(env_));
     has_indent_token = lexer_.PeekToken(Lexer::INDENT);
   }
-
-  Edge* edge = state_->AddEdge(rule);
-  edge->env_ = env;
-
-  string pool_name = edge->GetBinding("pool");
-  if (!pool_name.empty()) {
-    Pool* pool = state_->LookupPool(pool_name);
-    if (pool == NULL)
-      return lexer_.Error("unknown pool name '" + pool_name + "'", err);
-    edge->pool_ = pool;
+  if (env != env_)
+    env->Freeze();
+
+  // Evaluate the bindings that don't depend on the edge's nodes now,
+  // while the scope is as it is at this statement.
+  Edge stand_in;
+  stand_in.rule_ = rule;
+  stand_in.env_ = env;
+  int pool_weight = 1;
+  string weight = stand_in.GetBinding("pool_weight");
+  if (!weight.empty()) {
+    char* end;
+    long value = strtol(weight.c_str(), &end, 10);
+    if (*end != 0 || value <= 0 || value > INT_MAX)
+      return lexer_.Error("invalid pool_weight '" + weight + "'", err);
+    pool_weight = value;
   }
 
-  edge->outputs_.reserve(outs.size());
-  for (size_t i = 0, e = outs.size(); i != e; ++i) {
+  file_->edges_.push_back(PendingEdge());
+  file_->Add(File::kEdge, file_->edges_.size() - 1);
+  PendingEdge* edge = &file_->edges_.back();
+  edge->rule_ = rule;
+  edge->env_ = env;
+  edge->lexer_ = lexer_;
+  edge->pool_ = stand_in.GetBinding("pool");
+  edge->pool_weight_ = pool_weight;
+  edge->dyndep_from_rule_ = rule->GetBinding("dyndep") != NULL;
+  if (!edge->dyndep_from_rule_)
+    edge->dyndep_ = stand_in.GetUnescapedDyndep();
+
+  edge->paths_.reserve(outs.size() + ins.size());
+  edge->slash_bits_.reserve(outs.size() + ins.size());
+  for (size_t i = 0; i < outs.size(); ++i) {
     string path = outs[i].Evaluate(env);
     string path_err;
     uint64_t slash_bits;
-    if (!CanonicalizePath(&path, &slash_bits, &path_err))
+    if (!CanonicalizePath(&path, &slash_bits, &path_err)) {
+      edge->num_outs_ = edge->paths_.size();
+      edge->truncated_ = true;
       return lexer_.Error(path_err, err);
-    if (!state_->AddOut(edge, path, slash_bits)) {
+    }
+    edge->paths_.push_back(path);
+    edge->slash_bits_.push_back(slash_bits);
+  }
+  edge->num_outs_ = outs.size();
+  edge->implicit_outs_ = implicit_outs;
+
+  for (vector<EvalString>::iterator i = ins.begin(); i != ins.end(); ++i) {
+    string path = i->Evaluate(env);
+    string path_err;
+    uint64_t slash_bits;
+    if (!CanonicalizePath(&path, &slash_bits, &path_err)) {
+      lexer_.Error(path_err, &edge->in_error_);
+      break;
+    }
+    edge->paths_.push_back(path);
+    edge->slash_bits_.push_back(slash_bits);
+  }
+  edge->implicit_ = implicit;
+  edge->order_only_ = order_only;
+  return true;
+}
+
+bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
+  EvalString eval;
+  if (!lexer_.ReadPath(&eval, err))
+    return false;
+  string path = eval.Evaluate(env_);
+
+  if (new_scope) {
+    File* file = new File;
+    file->path_ = path;
+    file->parent_lexer_ = lexer_;
+    file->scope_ = new BindingEnv(Snapshot());
+    file->parent_scope_ = env_;
+    file_->subninjas_.push_back(file);
+    file_->Add(File::kSubninja, file_->subninjas_.size() - 1);
+    queue_->Push(file);
+  } else {
+    file_->strings_.push_back(path);
+    const string& filename = file_->strings_.back();
+    const string* contents;
+    if (!LoadFile(filename, &lexer_, &contents, err))
+      return false;
+    ManifestParser subparser(state_, file_reader_, options_);
+    subparser.env_ = env_;
+    subparser.file_ = file_;
+    subparser.queue_ = queue_;
+    if (!subparser.ParseStatements(filename, *contents, err))
+      return false;
+  }
+
+  if (!ExpectToken(Lexer::NEWLINE, err))
+    return false;
+
+  return true;
+}
+
+bool ManifestParser::LoadFile(const string& path, Lexer* parent,
+                              const string** contents, string* err) {
+  file_->strings_.push_back(string());
+  string* buffer = &file_->strings_.back();
+  string read_err;
+  if (file_reader_->ReadFile(path, buffer, &read_err) != FileReader::Okay) {
+    *err = "loading '" + path + "': " + read_err;
+    parent->Error(string(*err), err);
+    return false;
+  }
+  // The lexer needs a nul byte at the end of its input; see Parser::Load().
+  buffer->resize(buffer->size() + 1);
+  *contents = buffer;
+  return true;
+}
+
+BindingEnv* ManifestParser::Snapshot() {
+  if (!file_->snapshot_) {
+    file_->snapshot_ = new BindingEnv;
+    file_->snapshot_->Flatten(env_);
+    file_->snapshots_.push_back(file_->snapshot_);
+  }
+  return file_->snapshot_;
+}
+
+void ManifestParser::ParseSubninja(File* file) {
+  ManifestParser parser(state_, file_reader_, options_);
+  parser.env_ = file->scope_;
+  parser.file_ = file;
+  parser.queue_ = queue_;
+  const string* contents;
+  string err;
+  if (!parser.LoadFile(file->path_, &file->parent_lexer_, &contents, &err) ||
+      !parser.ParseStatements(file->path_, *contents, &err)) {
+    file->Fail(err);
+  }
+}
+
+bool ManifestParser::Apply(File* file, string* err) {
+  for (vector<File::Statement>::iterator i = file->statements_.begin();
+       i != file->statements_.end(); ++i) {
+    switch (i->kind_) {
+    case File::kPool: {
+      PendingPool* pool = &file->pools_[i->index_];
+      if (state_->LookupPool(pool->name_) != NULL)
+        return pool->lexer_.Error("duplicate pool '" + pool->name_ + "'", err);
+      if (pool->depth_ >= 0)
+        state_->AddPool(new Pool(pool->name_, pool->depth_));
+      break;
+    }
+    case File::kEdge:
+      if (!ApplyEdge(&file->edges_[i->index_], err))
+        return false;
+      break;
+    case File::kDefault: {
+      PendingDefault* target = &file->defaults_[i->index_];
+      string path_err;
+      if (!state_->AddDefault(target->path_, &path_err))
+        return target->lexer_.Error(path_err, err);
+      break;
+    }
+    case File::kSubninja: {
+      File* subninja = file->subninjas_[i->index_];
+      queue_->Wait(subninja);
+      if (!Apply(subninja, err))
+        return false;
+      // Nothing refers to the parsed statements any more.
+      delete subninja;
+      file->subninjas_[i->index_] = NULL;
+      break;
+    }
+    case File::kRequiredVersion:
+      CheckNinjaVersion(file->versions_[i->index_]);
+      break;
+    case File::kError:
+      *err = file->error_;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ManifestParser::ApplyEdge(PendingEdge* pending, string* err) {
+  Edge* edge = state_->AddEdge(pending->rule_);
+  edge->env_ = pending->env_;
+
+  if (!pending->pool_.empty()) {
+    Pool* pool = state_->LookupPool(pending->pool_);
+    if (pool == NULL) {
+      return pending->lexer_.Error("unknown pool name '" + pending->pool_ +
+                                   "'", err);
+    }
+    edge->pool_ = pool;
+  }
+  edge->weight_ = pending->pool_weight_;
+  if (edge->pool_->depth() != 0 && edge->weight_ > edge->pool_->depth()) {
+    char weight[64];
+    snprintf(weight, sizeof(weight), "pool_weight %d exceeds the depth %d",
+             edge->weight_, edge->pool_->depth());
+    return pending->lexer_.Error(string(weight) + " of pool '" +
+                                 edge->pool_->name() + "'", err);
+  }
+
+  int implicit_outs = pending->implicit_outs_;
+  edge->outputs_.reserve(pending->num_outs_);
+  for (size_t i = 0, e = pending->num_outs_; i != e; ++i) {
+    const string& path = pending->paths_[i];
+    if (!state_->AddOut(edge, path, pending->slash_bits_[i])) {
       if (options_.dupe_edge_action_ == kDupeEdgeActionError) {
-        lexer_.Error("multiple rules generate " + path + " [-w dupbuild=err]",
-                     err);
+        pending->lexer_.Error("multiple rules generate " + path +
+                              " [-w dupbuild=err]", err);
         return false;
       } else {
         if (!quiet_) {
-          Warning("multiple rules generate %s. "
-                  "builds involving this target will not be correct; "
-                  "continuing anyway [-w dupbuild=warn]",
-                  path.c_str());
+          warnings_.push_back("multiple rules generate " + path + ". "
+                              "builds involving this target will not be "
+                              "correct; continuing anyway [-w dupbuild=warn]");
+          Warning("%s", warnings_.back().c_str());
         }
         if (e - i <= static_cast<size_t>(implicit_outs))
           --implicit_outs;
       }
     }
   }
+  if (pending->truncated_)
+    return true;  // The error that stopped the parse comes next.
   if (edge->outputs_.empty()) {
     // All outputs of the edge are already created by other edges. Don't add
     // this edge.  Do this check before input nodes are connected to the edge.
@@ -348,17 +819,15 @@ bool ManifestParser::ParseEdge(string* err) {
   }
   edge->implicit_outs_ = implicit_outs;
 
-  edge->inputs_.reserve(ins.size());
-  for (vector<EvalString>::iterator i = ins.begin(); i != ins.end(); ++i) {
-    string path = i->Evaluate(env);
-    string path_err;
-    uint64_t slash_bits;
-    if (!CanonicalizePath(&path, &slash_bits, &path_err))
-      return lexer_.Error(path_err, err);
-    state_->AddIn(edge, path, slash_bits);
+  edge->inputs_.reserve(pending->paths_.size() - pending->num_outs_);
+  for (size_t i = pending->num_outs_; i < pending->paths_.size(); ++i)
+    state_->AddIn(edge, pending->paths_[i], pending->slash_bits_[i]);
+  if (!pending->in_error_.empty()) {
+    *err = pending->in_error_;
+    return false;
   }
-  edge->implicit_deps_ = implicit;
-  edge->order_only_deps_ = order_only;
+  edge->implicit_deps_ = pending->implicit_;
+  edge->order_only_deps_ = pending->order_only_;
 
   if (options_.phony_cycle_action_ == kPhonyCycleActionWarn &&
       edge->maybe_phonycycle_diagnostic()) {
@@ -372,9 +841,9 @@ bool ManifestParser::ParseEdge(string* err) {
     if (new_end != edge->inputs_.end()) {
       edge->inputs_.erase(new_end, edge->inputs_.end());
       if (!quiet_) {
-        Warning("phony target '%s' names itself as an input; "
-                "ignoring [-w phonycycle=warn]",
-                out->path().c_str());
+        warnings_.push_back("phony target '" + out->path() + "' names itself "
+                            "as an input; ignoring [-w phonycycle=warn]");
+        Warning("%s", warnings_.back().c_str());
       }
     }
   }
@@ -382,7 +851,8 @@ bool ManifestParser::ParseEdge(string* err) {
   // Lookup, validate, and save any dyndep binding.  It will be used later
   // to load generated dependency information dynamically, but it must
   // be one of our manifest-specified inputs.
-  string dyndep = edge->GetUnescapedDyndep();
+  string dyndep = pending->dyndep_from_rule_ ? edge->GetUnescapedDyndep()
+                                             : pending->dyndep_;
   if (!dyndep.empty()) {
     uint64_t slash_bits;
     if (!CanonicalizePath(&dyndep, &slash_bits, err))
@@ -392,31 +862,10 @@ bool ManifestParser::ParseEdge(string* err) {
     vector<Node*>::iterator dgi =
       std::find(edge->inputs_.begin(), edge->inputs_.end(), edge->dyndep_);
     if (dgi == edge->inputs_.end()) {
-      return lexer_.Error("dyndep '" + dyndep + "' is not an input", err);
+      return pending->lexer_.Error("dyndep '" + dyndep + "' is not an input",
+                                   err);
     }
   }
 
   return true;
 }
-
-bool ManifestParser::ParseFileInclude(bool new_scope, string* err) {
-  EvalString eval;
-  if (!lexer_.ReadPath(&eval, err))
-    return false;
-  string path = eval.Evaluate(env_);
-
-  ManifestParser subparser(state_, file_reader_, options_);
-  if (new_scope) {
-    subparser.env_ = new BindingEnv(env_);
-  } else {
-    subparser.env_ = env_;
-  }
-
-  if (!subparser.Load(path, err, &lexer_))
-    return false;
-
-  if (!ExpectToken(Lexer::NEWLINE, err))
-    return false;
-
-  return true;
-}
@@ -15,6 +15,10 @@
 #ifndef NINJA_MANIFEST_PARSER_H_
 #define NINJA_MANIFEST_PARSER_H_
 
+#include <string>
+#include <vector>
+using namespace std;
+
 #include "parser.h"
 
 struct BindingEnv;
@@ -33,12 +37,22 @@ enum PhonyCycleAction {
 struct ManifestParserOptions {
   ManifestParserOptions()
       : dupe_edge_action_(kDupeEdgeActionWarn),
-        phony_cycle_action_(kPhonyCycleActionWarn) {}
+        phony_cycle_action_(kPhonyCycleActionWarn),
+        parse_threads_(1) {}
   DupeEdgeAction dupe_edge_action_;
   PhonyCycleAction phony_cycle_action_;
+  /// How many threads may parse subninja files at once.  More than one
+  /// requires a FileReader that can be called from several threads.
+  int parse_threads_;
 };
 
 /// Parses .ninja files.
+///
+/// Each file is first parsed into a list of statements with all their
+/// paths evaluated, without touching the State; then the statements are
+/// added to the State in manifest order.  A subninja file has a scope of
+/// its own, so it can be parsed on another thread while the statements
+/// before it are being added.
 struct ManifestParser : public Parser {
   ManifestParser(State* state, FileReader* file_reader,
                  ManifestParserOptions options = ManifestParserOptions());
@@ -49,10 +63,21 @@ struct ManifestParser : public Parser {
     return Parse("input", input, err);
   }
 
+  /// The warnings printed while parsing, in order.
+  vector<string> warnings_;
+
 private:
-  /// Parse a file, given its contents as a string.
+  struct File;
+  struct PendingEdge;
+  struct Queue;
+
+  /// Parse a file, given its contents as a string, and add it to the State.
   bool Parse(const string& filename, const string& input, string* err);
 
+  /// Parse the statements of a file into |file_|.
+  bool ParseStatements(const string& filename, const string& input,
+                       string* err);
+
   /// Parse various statement types.
   bool ParsePool(string* err);
   bool ParseRule(string* err);
@@ -63,9 +88,25 @@ private:
   /// Parse either a 'subninja' or 'include' line.
   bool ParseFileInclude(bool new_scope, string* err);
 
+  /// Read |path| into |file_|, reporting errors at |parent|.
+  bool LoadFile(const string& path, Lexer* parent,
+                const string** contents, string* err);
+
+  /// A scope that gives the same answers as |env_| does now.
+  BindingEnv* Snapshot();
+
+  /// Parse a queued subninja file.  Called on any thread.
+  void ParseSubninja(File* file);
+
+  /// Add the statements parsed into |file| to the State.
+  bool Apply(File* file, string* err);
+  bool ApplyEdge(PendingEdge* pending, string* err);
+
   BindingEnv* env_;
   ManifestParserOptions options_;
   bool quiet_;
+  File* file_;
+  Queue* queue_;
 };
 
 #endif  // NINJA_MANIFEST_PARSER_H_
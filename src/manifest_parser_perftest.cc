@@ -27,6 +27,7 @@
 #include <direct.h>
 #else
 #include <getopt.h>
+#include <sys/resource.h>
 #include <unistd.h>
 #endif
 
@@ -37,13 +38,18 @@
 #include "state.h"
 #include "util.h"
 
-bool WriteFakeManifests(const string& dir, string* err) {
+bool WriteFakeManifests(const string& dir, int targets, bool edge_variables,
+                        string* err) {
   RealDiskInterface disk_interface;
   TimeStamp mtime = disk_interface.Stat(dir + "/build.ninja", err);
   if (mtime != 0)  // 0 means that the file doesn't exist yet.
     return mtime != -1;
 
-  string command = "python misc/write_fake_manifests.py " + dir;
+  // Each target is written to a subninja file of its own.
+  char targets_flag[32];
+  snprintf(targets_flag, sizeof(targets_flag), "--targets %d ", targets);
+  string command = "python misc/write_fake_manifests.py " +
+      string(targets_flag) + (edge_variables ? "--edge-variables " : "") + dir;
   printf("Creating manifest data..."); fflush(stdout);
   int exit_code = system(command.c_str());
   printf("done.\n");
@@ -52,11 +58,13 @@ bool WriteFakeManifests(const string& dir, string* err) {
   return exit_code == 0;
 }
 
-int LoadManifests(bool measure_command_evaluation) {
+int LoadManifests(bool measure_command_evaluation, int parse_threads) {
   string err;
   RealDiskInterface disk_interface;
   State state;
-  ManifestParser parser(&state, &disk_interface);
+  ManifestParserOptions options;
+  options.parse_threads_ = parse_threads;
+  ManifestParser parser(&state, &disk_interface, options);
   if (!parser.Load("build.ninja", &err)) {
     fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
     exit(1);
@@ -73,39 +81,65 @@ int LoadManifests(bool measure_command_evaluation) {
 
 int main(int argc, char* argv[]) {
   bool measure_command_evaluation = true;
+  int parse_threads = GetProcessorCount();
+  int targets = 1500;
+  bool edge_variables = false;
   int opt;
-  while ((opt = getopt(argc, argv, const_cast<char*>("fh"))) != -1) {
+  while ((opt = getopt(argc, argv, const_cast<char*>("efj:t:h"))) != -1) {
     switch (opt) {
+    case 'e':
+      edge_variables = true;
+      break;
     case 'f':
       measure_command_evaluation = false;
       break;
+    case 'j':
+      parse_threads = atoi(optarg);
+      break;
+    case 't':
+      targets = atoi(optarg);
+      break;
     case 'h':
     default:
       printf("usage: manifest_parser_perftest\n"
 "\n"
 "options:\n"
+"  -e     set the compile flags on each edge rather than once per file\n"
 "  -f     only measure manifest load time, not command evaluation time\n"
-             );
+"  -j N   parse subninja files on N threads [default=%d]\n"
+"  -t N   generate N targets, each in its own subninja file [default=1500]\n",
+             GetProcessorCount());
     return 1;
     }
   }
+  if (parse_threads < 1 || targets < 1)
+    Fatal("-j and -t need a positive number");
 
-  const char kManifestDir[] = "build/manifest_perftest";
+  // Keep the data for each size around, so that runs can be compared.
+  string manifest_dir = "build/manifest_perftest";
+  if (targets != 1500) {
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "_%d", targets);
+    manifest_dir += suffix;
+  }
+  if (edge_variables)
+    manifest_dir += "_edge_variables";
 
   string err;
-  if (!WriteFakeManifests(kManifestDir, &err)) {
+  if (!WriteFakeManifests(manifest_dir, targets, edge_variables, &err)) {
     fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
     return 1;
   }
 
-  if (chdir(kManifestDir) < 0)
+  if (chdir(manifest_dir.c_str()) < 0)
     Fatal("chdir: %s", strerror(errno));
 
   const int kNumRepetitions = 5;
   vector<int> times;
   for (int i = 0; i < kNumRepetitions; ++i) {
     int64_t start = GetTimeMillis();
-    int optimization_guard = LoadManifests(measure_command_evaluation);
+    int optimization_guard = LoadManifests(measure_command_evaluation,
+                                           parse_threads);
     int delta = (int)(GetTimeMillis() - start);
     printf("%dms (hash: %x)\n", delta, optimization_guard);
     times.push_back(delta);
@@ -115,4 +149,10 @@ int main(int argc, char* argv[]) {
   int max = *max_element(times.begin(), times.end());
   float total = accumulate(times.begin(), times.end(), 0.0f);
   printf("min %dms  max %dms  avg %.1fms\n", min, max, total / times.size());
+#ifndef _WIN32
+  // The memory that -e saves by sharing binding strings shows up here.
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    printf("peak RSS %ldMB\n", (long)usage.ru_maxrss / 1024);
+#endif
 }
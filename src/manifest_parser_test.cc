@@ -17,6 +17,10 @@
 #include <map>
 #include <vector>
 
+#if __cplusplus >= 201103L
+#include <mutex>
+#endif
+
 #include "graph.h"
 #include "state.h"
 #include "test.h"
@@ -70,6 +74,51 @@ TEST_F(ParserTest, RuleAttributes) {
 ));
 }
 
+TEST_F(ParserTest, PoolWeight) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(
+"pool heavy\n"
+"  depth = 8\n"
+"rule link\n"
+"  command = link\n"
+"  pool = heavy\n"
+"  pool_weight = 4\n"
+"build a: link in\n"
+"build b: link in\n"
+"  pool_weight = 8\n"
+"build c: link in\n"
+"  pool_weight =\n"));
+
+  EXPECT_EQ(4, state.LookupNode("a")->in_edge()->weight());
+  EXPECT_EQ(8, state.LookupNode("b")->in_edge()->weight());
+  EXPECT_EQ(1, state.LookupNode("c")->in_edge()->weight());
+
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("rule run\n"
+                                  "  command = run\n"
+                                  "build out: run in\n"
+                                  "  pool_weight = 0\n", &err));
+    EXPECT_EQ("input:5: invalid pool_weight '0'\n", err);
+  }
+
+  {
+    State local_state;
+    ManifestParser parser(&local_state, NULL);
+    string err;
+    EXPECT_FALSE(parser.ParseTest("pool heavy\n"
+                                  "  depth = 2\n"
+                                  "rule run\n"
+                                  "  command = run\n"
+                                  "  pool = heavy\n"
+                                  "  pool_weight = 3\n"
+                                  "build out: run in\n", &err));
+    EXPECT_EQ("input:8: pool_weight 3 exceeds the depth 2 of pool 'heavy'\n",
+              err);
+  }
+}
+
 TEST_F(ParserTest, IgnoreIndentedComments) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
 "  #indented comment\n"
@@ -923,6 +972,86 @@ TEST_F(ParserTest, DuplicateRuleInDifferentSubninjasWithInclude) {
                                 "build y : cat\n", &err));
 }
 
+#if __cplusplus >= 201103L
+/// Lets several parser threads share a VirtualFileSystem.
+struct LockedFileReader : public FileReader {
+  explicit LockedFileReader(FileReader* reader) : reader_(reader) {}
+  virtual Status ReadFile(const string& path, string* contents, string* err) {
+    lock_guard<mutex> lock(mutex_);
+    return reader_->ReadFile(path, contents, err);
+  }
+  FileReader* reader_;
+  mutex mutex_;
+};
+
+TEST_F(ParserTest, ParallelSubNinjas) {
+  // Statements from subninja files parsed on other threads still go into
+  // the State in manifest order, with the same scoping as before.
+  string manifest =
+"rule cat\n"
+"  command = cat $in > $out $var\n";
+  for (int i = 0; i < 20; ++i) {
+    char name[32];
+    snprintf(name, sizeof(name), "sub%d.ninja", i);
+    fs_.Create(name,
+      "rule cat\n"
+      "  command = sub $out $var\n"
+      "build shared out" + string(name) + ": cat in\n"
+      "subninja nested.ninja\n");
+    manifest += "subninja " + string(name) + "\n";
+  }
+  fs_.Create("nested.ninja", "build nested: cat\n");
+  manifest += "var = late\n"
+              "build last: cat\n"
+              "default last\n";
+
+  LockedFileReader reader(&fs_);
+  ManifestParserOptions parser_opts;
+  parser_opts.parse_threads_ = 4;
+  ManifestParser parser(&state, &reader, parser_opts);
+  string err;
+  EXPECT_TRUE(parser.ParseTest(manifest, &err));
+  EXPECT_EQ("", err);
+  VerifyGraph(state);
+
+  // One edge per subninja file and one for "nested", which only the first
+  // file gets to build, plus "last".
+  ASSERT_EQ(22u, state.edges_.size());
+  EXPECT_EQ("sub shared outsub0.ninja late",
+            state.edges_[0]->EvaluateCommand());
+  EXPECT_EQ(state.edges_[0], state.LookupNode("shared")->in_edge());
+  EXPECT_EQ("sub nested late", state.edges_[1]->EvaluateCommand());
+  EXPECT_EQ("sub outsub1.ninja late", state.edges_[2]->EvaluateCommand());
+  EXPECT_EQ("cat  > last late", state.edges_[21]->EvaluateCommand());
+  ASSERT_EQ(1u, state.defaults_.size());
+  EXPECT_EQ("last", state.defaults_[0]->path());
+}
+
+TEST_F(ParserTest, ParallelSubNinjaErrorOrder) {
+  // The first error in manifest order is reported, however the threads
+  // were scheduled.
+  fs_.Create("a.ninja", "build a: cat\n");
+  fs_.Create("b.ninja", "build\n");
+  fs_.Create("c.ninja", "build c: nosuchrule\n");
+  LockedFileReader reader(&fs_);
+  ManifestParserOptions parser_opts;
+  parser_opts.parse_threads_ = 4;
+  ManifestParser parser(&state, &reader, parser_opts);
+  string err;
+  EXPECT_FALSE(parser.ParseTest("rule cat\n"
+                                "  command = cat\n"
+                                "subninja a.ninja\n"
+                                "subninja b.ninja\n"
+                                "subninja c.ninja\n"
+                                "subninja missing.ninja\n", &err));
+  EXPECT_EQ("b.ninja:1: expected path\n"
+            "build\n"
+            "     ^ near here"
+            , err);
+  EXPECT_TRUE(state.LookupNode("a"));
+}
+#endif
+
 TEST_F(ParserTest, Include) {
   fs_.Create("include.ninja", "var = inner\n");
   ASSERT_NO_FATAL_FAILURE(AssertParse(
@@ -0,0 +1,84 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "mapped_file.h"
+
+#include <errno.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "util.h"
+
+int MappedFile::Open(const string& path, string* err) {
+  Close();
+#ifdef _WIN32
+  int ret = ReadFile(path, &contents_, err);
+  if (ret < 0)
+    return ret;
+  data_ = contents_.data();
+  size_ = contents_.size();
+  return 0;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    int error = errno;
+    err->assign(strerror(error));
+    return -error;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int error = errno;
+    err->assign(strerror(error));
+    close(fd);
+    return -error;
+  }
+
+  // mmap() refuses empty mappings; an empty file needs no data anyway.
+  if (st.st_size > 0) {
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      err->assign(strerror(error));
+      close(fd);
+      return -error;
+    }
+#ifdef MADV_SEQUENTIAL
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+#endif
+    data_ = static_cast<const char*>(data);
+    size_ = st.st_size;
+  }
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return 0;
+#endif
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+  contents_.clear();
+#else
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+#endif
+  data_ = NULL;
+  size_ = 0;
+}
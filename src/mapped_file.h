@@ -0,0 +1,52 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MAPPED_FILE_H_
+#define NINJA_MAPPED_FILE_H_
+
+#include <stddef.h>
+
+#include <string>
+using namespace std;
+
+/// The contents of a whole file, for reading.  On POSIX systems the file is
+/// mapped into memory, so that no time is spent copying it and pages that
+/// are never looked at are never read; elsewhere it is read into a buffer.
+/// The data is only valid until Close(), and should not be relied upon if
+/// the file is modified meanwhile.
+struct MappedFile {
+  MappedFile() : data_(NULL), size_(0) {}
+  ~MappedFile() { Close(); }
+
+  /// Open |path| for reading.
+  /// Returns -errno and fills in \a err on error, like ReadFile().
+  int Open(const string& path, string* err);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+#ifdef _WIN32
+  string contents_;
+#endif
+
+  // Not copyable.
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+};
+
+#endif  // NINJA_MAPPED_FILE_H_
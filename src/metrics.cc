@@ -125,3 +125,7 @@ int64_t GetTimeMillis() {
   return TimerToMicros(HighResTimer()) / 1000;
 }
 
+int64_t GetTimeMicros() {
+  return TimerToMicros(HighResTimer());
+}
+
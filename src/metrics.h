@@ -62,6 +62,9 @@ private:
 /// Epoch varies between platforms; only useful for measuring elapsed time.
 int64_t GetTimeMillis();
 
+/// Like GetTimeMillis(), in microseconds.
+int64_t GetTimeMicros();
+
 /// A simple stopwatch which returns the time
 /// in seconds since Restart() was called.
 struct Stopwatch {
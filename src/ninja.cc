@@ -17,8 +17,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <cstdlib>
 
+#if __cplusplus >= 201103L
+#include <mutex>
+#endif
+
 #ifdef _WIN32
 #include "getopt.h"
 #include <direct.h>
@@ -34,18 +39,28 @@
 #include "browse.h"
 #include "build.h"
 #include "build_log.h"
+#include "cgroup.h"
 #include "deps_log.h"
 #include "clean.h"
 #include "debug_flags.h"
 #include "disk_interface.h"
 #include "graph.h"
 #include "graphviz.h"
+#include "jobserver.h"
+#include "manifest_cache.h"
 #include "manifest_parser.h"
 #include "metrics.h"
 #include "state.h"
+#include "trace.h"
 #include "util.h"
 #include "version.h"
 
+#ifdef __linux__
+#include <poll.h>
+#include <signal.h>
+#include "serve.h"
+#endif
+
 #ifdef _MSC_VER
 // Defined in msvc_helper_main-win32.cc.
 int MSVCHelperMain(int argc, char** argv);
@@ -58,6 +73,9 @@ namespace {
 
 struct Tool;
 
+/// Where the State loaded from the manifest is saved between runs.
+const char kManifestCachePath[] = ".ninja_manifest_cache";
+
 /// Command-line options.
 struct Options {
   /// Build file to load.
@@ -74,19 +92,59 @@ struct Options {
 
   /// Whether phony cycles should warn or print an error.
   bool phony_cycle_should_err;
+
+  /// Whether -j was passed.
+  bool parallelism_set;
+
+  /// Whether to start a jobserver for the commands we run.
+  bool jobserver;
+
+  /// File to write a trace of the build to, or NULL.
+  const char* trace_file;
+};
+
+/// A FileReader that remembers the paths of the files it read, and their
+/// mtimes from before they were read.  The manifest parser may call it
+/// from several threads at once.
+struct RecordingFileReader : public FileReader {
+  explicit RecordingFileReader(DiskInterface* disk_interface)
+      : disk_interface_(disk_interface) {}
+
+  virtual Status ReadFile(const string& path, string* contents, string* err) {
+    // A file that changes after this is older than it, and is read again
+    // next time rather than taken from the manifest cache.
+    TimeStamp mtime = disk_interface_->Stat(path, err);
+    {
+#if __cplusplus >= 201103L
+      lock_guard<mutex> lock(mutex_);
+#endif
+      files_.push_back(path);
+      mtimes_.push_back(mtime);
+    }
+    return disk_interface_->ReadFile(path, contents, err);
+  }
+
+  DiskInterface* disk_interface_;
+  vector<string> files_;
+  vector<TimeStamp> mtimes_;
+#if __cplusplus >= 201103L
+  mutex mutex_;
+#endif
 };
 
 /// The Ninja main() loads up a series of data structures; various tools need
 /// to poke into these, so store them as fields on an object.
 struct NinjaMain : public BuildLogUser {
   NinjaMain(const char* ninja_command, const BuildConfig& config) :
-      ninja_command_(ninja_command), config_(config) {}
+      ninja_command_(ninja_command), config_(config),
+      manifest_reader_(&disk_interface_) {}
 
   /// Command line used to run Ninja.
   const char* ninja_command_;
 
-  /// Build configuration set from flags (e.g. parallelism).
-  const BuildConfig& config_;
+  /// Build configuration set from flags (e.g. parallelism).  "-t serve"
+  /// changes it for each build it runs.
+  BuildConfig config_;
 
   /// Loaded state (rules, nodes).
   State state_;
@@ -94,6 +152,9 @@ struct NinjaMain : public BuildLogUser {
   /// Functions for accesssing the disk.
   RealDiskInterface disk_interface_;
 
+  /// Reads the manifest, remembering which files it is made of.
+  RecordingFileReader manifest_reader_;
+
   /// The build directory, used for storing the build log etc.
   string build_dir_;
 
@@ -122,10 +183,37 @@ struct NinjaMain : public BuildLogUser {
   int ToolClean(const Options* options, int argc, char* argv[]);
   int ToolCleanDead(const Options* options, int argc, char* argv[]);
   int ToolCompilationDatabase(const Options* options, int argc, char* argv[]);
+  int ToolCosts(const Options* options, int argc, char* argv[]);
   int ToolRecompact(const Options* options, int argc, char* argv[]);
   int ToolRestat(const Options* options, int argc, char* argv[]);
+  int ToolTextLog(const Options* options, int argc, char* argv[]);
   int ToolUrtle(const Options* options, int argc, char** argv);
   int ToolRules(const Options* options, int argc, char* argv[]);
+#ifdef __linux__
+  int ToolServe(const Options* options, int argc, char* argv[]);
+
+  /// Run the build a "-t serve" client asked for, stopping it if
+  /// |client_fd|, its connection, becomes readable.
+  /// @return an exit code, or kServeDeclined if the client should build by
+  /// itself.  Sets |*restart| if the server needs to reload its state.
+  int ServeBuild(const char* input_file, const ServeRequest& request,
+                 int client_fd, bool* restart);
+#endif
+
+  /// Load the State from the manifest cache, if it is up to date, and print
+  /// the warnings the manifest was parsed with.
+  /// @return LOAD_ERROR if the cache is corrupt, in which case the State
+  /// may be half loaded.
+  LoadStatus LoadManifestCache(const char* input_file,
+                               const ManifestParserOptions& options,
+                               string* err);
+
+  /// Parse the manifest, and save the State to the manifest cache if
+  /// |write_cache| is set.
+  /// @return false on error.
+  bool ParseManifest(const char* input_file,
+                     const ManifestParserOptions& options, bool write_cache,
+                     string* err);
 
   /// Open the build log.
   /// @return LOAD_ERROR on error.
@@ -207,6 +295,11 @@ void Usage(const BuildConfig& config) {
 "options:\n"
 "  --version      print ninja version (\"%s\")\n"
 "  -v, --verbose  show all command lines while building\n"
+"  --jobserver    share the -j job slots with the commands run, through a\n"
+"                 GNU make jobserver\n"
+"  --trace FILE   write a timeline of the build to FILE, for chrome://tracing\n"
+"  --pressure N   run fewer jobs while tasks stall waiting for CPU, memory or\n"
+"                 I/O more than N%% of the time (Linux 4.20 and later)\n"
 "\n"
 "  -C DIR   change to DIR before doing anything else\n"
 "  -f FILE  specify input build file [default=build.ninja]\n"
@@ -214,6 +307,9 @@ void Usage(const BuildConfig& config) {
 "  -j N     run N jobs in parallel (0 means infinity) [default=%d on this system]\n"
 "  -k N     keep going until N jobs fail (0 means infinity) [default=1]\n"
 "  -l N     do not start new jobs if the load average is greater than N\n"
+"  -m N     do not start new jobs if the jobs running may then need more than\n"
+"           N MB of memory, going by their last run (0 means no limit)\n"
+"           [default=the memory available]\n"
 "  -n       dry run (don't run commands but act like they succeeded)\n"
 "\n"
 "  -d MODE  enable debugging (use '-d list' to list modes)\n"
@@ -236,9 +332,56 @@ int GuessParallelism() {
   }
 }
 
+LoadStatus NinjaMain::LoadManifestCache(const char* input_file,
+                                        const ManifestParserOptions& options,
+                                        string* err) {
+  ManifestCache cache(input_file, options);
+  LoadStatus status = cache.Load(kManifestCachePath, &disk_interface_,
+                                 &state_, err);
+  if (status == LOAD_SUCCESS) {
+    for (vector<ManifestCache::Input>::iterator i = cache.inputs_.begin();
+         i != cache.inputs_.end(); ++i) {
+      manifest_reader_.files_.push_back(i->path_);
+      manifest_reader_.mtimes_.push_back(i->mtime_);
+    }
+    // The parse that wrote the cache printed these; print them every time.
+    for (vector<string>::iterator w = cache.warnings_.begin();
+         w != cache.warnings_.end(); ++w) {
+      Warning("%s", w->c_str());
+    }
+  }
+  return status;
+}
+
+bool NinjaMain::ParseManifest(const char* input_file,
+                              const ManifestParserOptions& options,
+                              bool write_cache, string* err) {
+  TRACE_RECORD("manifest parse");
+  ManifestParser parser(&state_, &manifest_reader_, options);
+  if (!parser.Load(input_file, err))
+    return false;
+  if (!write_cache)
+    return true;
+
+  ManifestCache cache(input_file, options);
+  cache.warnings_ = parser.warnings_;
+  for (size_t i = 0; i < manifest_reader_.files_.size(); ++i) {
+    // Without an mtime, there is no telling whether the cache is current.
+    if (manifest_reader_.mtimes_[i] <= 0)
+      return true;
+    cache.inputs_.push_back(ManifestCache::Input(manifest_reader_.files_[i],
+                                                 manifest_reader_.mtimes_[i]));
+  }
+  string cache_err;
+  if (!cache.Write(kManifestCachePath, state_, &cache_err))
+    EXPLAIN("writing %s: %s", kManifestCachePath, cache_err.c_str());
+  return true;
+}
+
 /// Rebuild the build manifest, if necessary.
 /// Returns true if the manifest was rebuilt.
 bool NinjaMain::RebuildManifest(const char* input_file, string* err) {
+  TRACE_RECORD("rebuild manifest");
   string path = input_file;
   uint64_t slash_bits;  // Unused because this path is only used for lookup.
   if (!CanonicalizePath(&path, &slash_bits, err))
@@ -847,6 +990,156 @@ int NinjaMain::ToolCompilationDatabase(const Options* options, int argc,
   return 0;
 }
 
+namespace {
+
+/// What one edge, or all edges of a rule, cost in their last run.
+struct Cost {
+  Cost() : edges(0), cpu(0), wall(0), max_rss(0), blocks(0) {}
+
+  void Add(const BuildLog::LogEntry& entry) {
+    ++edges;
+    cpu += (int64_t)entry.usage.user_time + entry.usage.system_time;
+    wall += entry.end_time - entry.start_time;
+    max_rss = max(max_rss, entry.usage.max_rss);
+    blocks += (int64_t)entry.usage.blocks_in + entry.usage.blocks_out;
+  }
+
+  string name;
+  int edges;
+  /// CPU and wall time, in milliseconds.
+  int64_t cpu;
+  int64_t wall;
+  /// In kilobytes.
+  uint32_t max_rss;
+  /// 512-byte blocks read and written.
+  int64_t blocks;
+};
+
+/// The order "-t costs -s" sorts by, most costly first.
+enum CostKey { COST_CPU, COST_RSS, COST_IO, COST_TIME };
+
+struct CostGreater {
+  explicit CostGreater(CostKey key) : key_(key) {}
+
+  bool operator()(const Cost& a, const Cost& b) const {
+    int64_t x = Value(a), y = Value(b);
+    if (x != y)
+      return x > y;
+    return a.name < b.name;
+  }
+
+  int64_t Value(const Cost& cost) const {
+    switch (key_) {
+    case COST_RSS: return cost.max_rss;
+    case COST_IO: return cost.blocks;
+    case COST_TIME: return cost.wall;
+    default: return cost.cpu;
+    }
+  }
+
+  CostKey key_;
+};
+
+void PrintCosts(const vector<Cost>& costs, const char* what, bool edges) {
+  printf("%9s %9s %9s %9s %s%s\n", "cpu s", "wall s", "rss MB", "io MB",
+         edges ? "" : "edges  ", what);
+  for (vector<Cost>::const_iterator i = costs.begin(); i != costs.end(); ++i) {
+    printf("%9.1f %9.1f %9.1f %9.1f ", i->cpu / 1e3, i->wall / 1e3,
+           i->max_rss / 1024.0, i->blocks / 2048.0);
+    if (!edges)
+      printf("%5d  ", i->edges);
+    printf("%s\n", i->name.c_str());
+  }
+}
+
+}  // anonymous namespace
+
+int NinjaMain::ToolCosts(const Options* options, int argc, char* argv[]) {
+  // The costs tool uses getopt, and expects argv[0] to contain the name of
+  // the tool, i.e. "costs".
+  argc++;
+  argv--;
+
+  CostKey key = COST_CPU;
+  int top = 20;
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("hs:n:"))) != -1) {
+    switch (opt) {
+    case 's':
+      if (strcmp(optarg, "cpu") == 0) {
+        key = COST_CPU;
+      } else if (strcmp(optarg, "rss") == 0) {
+        key = COST_RSS;
+      } else if (strcmp(optarg, "io") == 0) {
+        key = COST_IO;
+      } else if (strcmp(optarg, "time") == 0) {
+        key = COST_TIME;
+      } else {
+        Error("unknown sort key '%s'", optarg);
+        return 1;
+      }
+      break;
+    case 'n':
+      top = atoi(optarg);
+      break;
+    case 'h':
+    default:
+      printf("usage: ninja -t costs [options]\n"
+             "\n"
+             "options:\n"
+             "  -s KEY  sort by cpu (default), rss, io or time\n"
+             "  -n N    list the N most costly edges [default=20]\n"
+             "  -h      print this message\n"
+             );
+      return 1;
+    }
+  }
+
+  // Each edge in the manifest, by the cost of its last run.  All outputs
+  // of an edge share one run, so only the first one seen counts.
+  map<Edge*, Cost> edges;
+  const BuildLog::Entries& entries = build_log_.entries();
+  for (BuildLog::Entries::const_iterator i = entries.begin();
+       i != entries.end(); ++i) {
+    Node* node = state_.LookupNode(i->second->output);
+    if (!node || !node->in_edge())
+      continue;
+    Cost& cost = edges[node->in_edge()];
+    if (cost.edges)
+      continue;
+    cost.name = node->in_edge()->outputs_[0]->path();
+    cost.Add(*i->second);
+  }
+
+  map<string, Cost> rules;
+  vector<Cost> edge_costs;
+  for (map<Edge*, Cost>::iterator i = edges.begin(); i != edges.end(); ++i) {
+    Cost& rule = rules[i->first->rule().name()];
+    rule.name = i->first->rule().name();
+    rule.edges += 1;
+    rule.cpu += i->second.cpu;
+    rule.wall += i->second.wall;
+    rule.max_rss = max(rule.max_rss, i->second.max_rss);
+    rule.blocks += i->second.blocks;
+    edge_costs.push_back(i->second);
+  }
+  vector<Cost> rule_costs;
+  for (map<string, Cost>::iterator i = rules.begin(); i != rules.end(); ++i)
+    rule_costs.push_back(i->second);
+
+  CostGreater greater(key);
+  sort(rule_costs.begin(), rule_costs.end(), greater);
+  sort(edge_costs.begin(), edge_costs.end(), greater);
+  if (top >= 0 && edge_costs.size() > (size_t)top)
+    edge_costs.resize(top);
+
+  PrintCosts(rule_costs, "rule", false);
+  printf("\n");
+  PrintCosts(edge_costs, "edge", true);
+  return 0;
+}
+
 int NinjaMain::ToolRecompact(const Options* options, int argc, char* argv[]) {
   if (!EnsureBuildDirExists())
     return 1;
@@ -858,6 +1151,33 @@ int NinjaMain::ToolRecompact(const Options* options, int argc, char* argv[]) {
   return 0;
 }
 
+int NinjaMain::ToolTextLog(const Options* options, int argc, char* argv[]) {
+  if (!EnsureBuildDirExists())
+    return 1;
+
+  string log_path = ".ninja_log";
+  if (!build_dir_.empty())
+    log_path = build_dir_ + "/" + log_path;
+
+  string err;
+  const LoadStatus status = build_log_.Load(log_path, &err);
+  if (status == LOAD_ERROR) {
+    Error("loading build log %s: %s", log_path.c_str(), err.c_str());
+    return 1;
+  }
+  if (!err.empty()) {
+    // Hack: Load() can return a warning via err by returning LOAD_SUCCESS.
+    Warning("%s", err.c_str());
+    err.clear();
+  }
+
+  if (!build_log_.WriteText(stdout) || fflush(stdout) != 0) {
+    Error("writing build log: %s", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
 int NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
   // The restat tool uses getopt, and expects argv[0] to contain the name of the
   // tool, i.e. "restat"
@@ -916,6 +1236,222 @@ int NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
   return EXIT_SUCCESS;
 }
 
+#ifdef __linux__
+namespace {
+
+/// Keeps the server alive, and writes failing with EPIPE instead, when a
+/// client goes away during its build.  Being a handler rather than SIG_IGN,
+/// it is reset to the default for the commands the server runs.
+void IgnoreSignal(int) {}
+
+/// Replaces the environment with |env|, plus kServeEnvVar, for as long as
+/// it is in scope.  Commands are spawned with |environ|, so they see it too.
+struct ScopedEnvironment {
+  explicit ScopedEnvironment(const vector<string>& env)
+      : env_(env), saved_(environ) {
+    env_.push_back(string(kServeEnvVar) + "=1");
+    for (vector<string>::iterator e = env_.begin(); e != env_.end(); ++e)
+      vars_.push_back(const_cast<char*>(e->c_str()));
+    vars_.push_back(NULL);
+    environ = &vars_[0];
+  }
+  ~ScopedEnvironment() { environ = saved_; }
+
+ private:
+  vector<string> env_;
+  vector<char*> vars_;
+  char** saved_;
+};
+
+}  // anonymous namespace
+
+int NinjaMain::ToolServe(const Options* options, int argc, char* argv[]) {
+  if (argc != 0) {
+    printf("usage: ninja -t serve\n");
+    return 1;
+  }
+
+  NodeWatcher watcher(&state_);
+  ServeSocket socket;
+  string err;
+  if (!watcher.Init(&err) || !socket.Listen(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+
+  // Watch for changes to the manifest before looking at any nodes.
+  for (vector<string>::iterator f = manifest_reader_.files_.begin();
+       f != manifest_reader_.files_.end(); ++f) {
+    string path = *f;
+    uint64_t slash_bits;
+    if (CanonicalizePath(&path, &slash_bits, &err))
+      watcher.WatchFile(path);
+  }
+  // Changes to the logs by anyone else make our copies stale.
+  string log_dir = build_dir_.empty() ? "" : build_dir_ + "/";
+  string build_log_path = log_dir + ".ninja_log";
+  string deps_log_path = log_dir + ".ninja_deps";
+  uint64_t slash_bits;
+  if (CanonicalizePath(&build_log_path, &slash_bits, &err) &&
+      CanonicalizePath(&deps_log_path, &slash_bits, &err)) {
+    watcher.WatchFile(build_log_path);
+    watcher.WatchFile(deps_log_path);
+  }
+  watcher.WatchNodes();
+
+  // Edges with dyndep files change the graph in ways State cannot undo.
+  bool uses_dyndep = false;
+  for (vector<Edge*>::iterator e = state_.edges_.begin();
+       e != state_.edges_.end() && !uses_dyndep; ++e) {
+    uses_dyndep = (*e)->dyndep_ != NULL;
+  }
+
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = IgnoreSignal;
+  sigaction(SIGPIPE, &act, NULL);
+  setenv(kServeEnvVar, "1", 1);
+
+  printf("ninja: serving builds of '%s'\n", options->input_file);
+  fflush(stdout);
+
+  bool restart = false;
+  while (!restart) {
+    pollfd fds[2] = {
+      { socket.fd_, POLLIN, 0 },
+      { watcher.fd(), POLLIN, 0 },
+    };
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      Fatal("poll: %s", strerror(errno));
+    }
+
+    watcher.ProcessEvents();
+    if (!watcher.changed_files().empty())
+      break;
+
+    if (!(fds[0].revents & POLLIN))
+      continue;
+    ServeConnection conn;
+    if (!socket.Accept(&conn, &err)) {
+      if (!err.empty())
+        Warning("%s", err.c_str());
+      err.clear();
+      continue;
+    }
+    // The manifest was loaded with our -w flags, not the client's.
+    if (conn.request_.manifest != options->input_file ||
+        conn.request_.dupe_edges_should_err !=
+            options->dupe_edges_should_err ||
+        conn.request_.phony_cycle_should_err !=
+            options->phony_cycle_should_err) {
+      conn.Reply(kServeDeclined);
+      continue;
+    }
+
+    watcher.WatchNodes();
+
+    // Print to the client's terminal while building.
+    fflush(stdout);
+    fflush(stderr);
+    int saved_stdout = dup(1);
+    int saved_stderr = dup(2);
+    dup2(conn.stdout_fd_, 1);
+    dup2(conn.stderr_fd_, 2);
+
+    int exit_code = ServeBuild(options->input_file, conn.request_, conn.fd_,
+                               &restart);
+    if (uses_dyndep)
+      restart = true;
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_stdout, 1);
+    dup2(saved_stderr, 2);
+    close(saved_stdout);
+    close(saved_stderr);
+
+    // Our own writes to the logs don't make them stale, but a build that
+    // changed the manifest does.
+    watcher.ProcessEvents();
+    set<string> changed = watcher.changed_files();
+    changed.erase(build_log_path);
+    changed.erase(deps_log_path);
+    if (!changed.empty())
+      restart = true;
+    watcher.ClearChangedFiles();
+    conn.Reply(exit_code);
+  }
+
+  // Start over with a fresh process, so that everything is reloaded.
+  printf("ninja: manifest or logs changed; restarting\n");
+  fflush(stdout);
+  socket.Close();
+  vector<const char*> args;
+  args.push_back(ninja_command_);
+  args.push_back("-f");
+  args.push_back(options->input_file);
+  args.push_back("-w");
+  args.push_back(options->dupe_edges_should_err ? "dupbuild=err"
+                                                : "dupbuild=warn");
+  if (options->phony_cycle_should_err) {
+    args.push_back("-w");
+    args.push_back("phonycycle=err");
+  }
+  args.push_back("-t");
+  args.push_back("serve");
+  args.push_back(NULL);
+  execv("/proc/self/exe", const_cast<char**>(&args[0]));
+  Fatal("execv: %s", strerror(errno));
+  return 1;
+}
+
+int NinjaMain::ServeBuild(const char* input_file, const ServeRequest& request,
+                          int client_fd, bool* restart) {
+  config_.parallelism = request.parallelism;
+  config_.failures_allowed = request.failures_allowed;
+  config_.max_load_average = request.max_load_average;
+  config_.max_pressure = request.max_pressure;
+  config_.max_memory = request.max_memory;
+  config_.verbosity = (BuildConfig::Verbosity)request.verbosity;
+  config_.dry_run = request.dry_run;
+  config_.action_cache = request.action_cache;
+  // Stop the build, as a local one would stop on SIGHUP, if the client goes
+  // away or is interrupted.
+  config_.hangup_fd = client_fd;
+  g_explaining = request.explaining;
+  g_keep_depfile = request.keep_depfile;
+  g_keep_rsp = request.keep_rsp;
+
+  // Run commands, and read NINJA_STATUS and the like, in the client's
+  // environment.
+  ScopedEnvironment env(request.env);
+
+  // Nodes whose files changed were forgotten by the NodeWatcher; keep the
+  // mtimes of the rest.
+  state_.ResetKeepingMtimes();
+
+  string err;
+  if (RebuildManifest(input_file, &err)) {
+    // The manifest changed under us; let the client load it.
+    *restart = true;
+    return kServeDeclined;
+  } else if (!err.empty()) {
+    Error("rebuilding '%s': %s", input_file, err.c_str());
+    return 1;
+  }
+
+  vector<char*> targets;
+  for (vector<string>::const_iterator t = request.targets.begin();
+       t != request.targets.end(); ++t) {
+    targets.push_back(const_cast<char*>(t->c_str()));
+  }
+  targets.push_back(NULL);
+  return RunBuild(request.targets.size(), &targets[0]);
+}
+#endif  // __linux__
+
 int NinjaMain::ToolUrtle(const Options* options, int argc, char** argv) {
   // RLE encoded.
   const char* urtle =
@@ -966,12 +1502,20 @@ const Tool* ChooseTool(const string& tool_name) {
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolTargets },
     { "compdb",  "dump JSON compilation database to stdout",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolCompilationDatabase },
+    { "costs",  "rank rules and edges by the resources their last run used",
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolCosts },
     { "recompact",  "recompacts ninja-internal data structures",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolRecompact },
     { "restat",  "restats all outputs in the build log",
       Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolRestat },
     { "rules",  "list all rules",
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolRules },
+    { "textlog",  "print the build log in the text format of older versions",
+      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolTextLog },
+#if defined(__linux__)
+    { "serve",  "keep state in memory and run builds for ninja clients (EXPERIMENTAL)",
+      Tool::RUN_AFTER_LOGS, &NinjaMain::ToolServe },
+#endif
     { "cleandead",  "clean built files that are no longer produced by the manifest",
       Tool::RUN_AFTER_LOGS, &NinjaMain::ToolCleanDead },
     { "urtle", NULL,
@@ -1018,6 +1562,7 @@ bool DebugEnable(const string& name) {
 #ifdef _WIN32
 "  nostatcache  don't batch stat() calls per directory and cache them\n"
 #endif
+"  nomanifestcache  don't load or write .ninja_manifest_cache\n"
 "multiple modes can be enabled via -d FOO -d BAR\n");
     return false;
   } else if (name == "stats") {
@@ -1035,11 +1580,14 @@ bool DebugEnable(const string& name) {
   } else if (name == "nostatcache") {
     g_experimental_statcache = false;
     return true;
+  } else if (name == "nomanifestcache") {
+    g_manifest_cache = false;
+    return true;
   } else {
     const char* suggestion =
         SpellcheckString(name.c_str(),
                          "stats", "explain", "keepdepfile", "keeprsp",
-                         "nostatcache", NULL);
+                         "nostatcache", "nomanifestcache", NULL);
     if (suggestion) {
       Error("unknown debug setting '%s', did you mean '%s'?",
             name.c_str(), suggestion);
@@ -1173,6 +1721,27 @@ void NinjaMain::DumpMetrics() {
   int buckets = (int)state_.paths_.bucket_count();
   printf("path->node hash load %.2f (%d entries / %d buckets)\n",
          count / (double) buckets, count, buckets);
+  printf("binding strings %d (%d kB)\n", (int)state_.string_pool_.size(),
+         (int)(state_.string_pool_.bytes() / 1024));
+
+  CgroupLimits cgroup = CgroupLimits::Read();
+  printf("cgroup cpu quota ");
+  if (cgroup.cpu_quota > 0)
+    printf("%.2f", cgroup.cpu_quota);
+  else
+    printf("none");
+  printf(", cpuset ");
+  if (cgroup.cpuset_cpus > 0)
+    printf("%d cpus", cgroup.cpuset_cpus);
+  else
+    printf("none");
+  printf(", memory limit ");
+  if (cgroup.memory_limit >= 0)
+    printf("%" PRId64 " MB (%" PRId64 " MB used)", cgroup.memory_limit / 1024,
+           cgroup.memory_usage / 1024);
+  else
+    printf("none");
+  printf("\n");
 }
 
 bool NinjaMain::EnsureBuildDirExists() {
@@ -1258,17 +1827,20 @@ int ReadFlags(int* argc, char*** argv,
               Options* options, BuildConfig* config) {
   config->parallelism = GuessParallelism();
 
-  enum { OPT_VERSION = 1 };
+  enum { OPT_VERSION = 1, OPT_JOBSERVER, OPT_TRACE, OPT_PRESSURE };
   const option kLongOptions[] = {
     { "help", no_argument, NULL, 'h' },
     { "version", no_argument, NULL, OPT_VERSION },
+    { "jobserver", no_argument, NULL, OPT_JOBSERVER },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "pressure", required_argument, NULL, OPT_PRESSURE },
     { "verbose", no_argument, NULL, 'v' },
     { NULL, 0, NULL, 0 }
   };
 
   int opt;
   while (!options->tool &&
-         (opt = getopt_long(*argc, *argv, "d:f:j:k:l:nt:vw:C:h", kLongOptions,
+         (opt = getopt_long(*argc, *argv, "d:f:j:k:l:m:nt:vw:C:h", kLongOptions,
                             NULL)) != -1) {
     switch (opt) {
       case 'd':
@@ -1287,6 +1859,7 @@ int ReadFlags(int* argc, char*** argv,
         // We want to run N jobs in parallel. For N = 0, INT_MAX
         // is close enough to infinite for most sane builds.
         config->parallelism = value > 0 ? value : INT_MAX;
+        options->parallelism_set = true;
         break;
       }
       case 'k': {
@@ -1309,6 +1882,14 @@ int ReadFlags(int* argc, char*** argv,
         config->max_load_average = value;
         break;
       }
+      case 'm': {
+        char* end;
+        long long value = strtoll(optarg, &end, 10);
+        if (end == optarg || *end != 0 || value < 0)
+          Fatal("-m parameter not a number of megabytes; did you mean -m 0?");
+        config->max_memory = value * 1024;
+        break;
+      }
       case 'n':
         config->dry_run = true;
         break;
@@ -1330,6 +1911,20 @@ int ReadFlags(int* argc, char*** argv,
       case OPT_VERSION:
         printf("%s\n", kNinjaVersion);
         return 0;
+      case OPT_JOBSERVER:
+        options->jobserver = true;
+        break;
+      case OPT_TRACE:
+        options->trace_file = optarg;
+        break;
+      case OPT_PRESSURE: {
+        char* end;
+        double value = strtod(optarg, &end);
+        if (end == optarg || *end != 0)
+          Fatal("--pressure parameter not numeric");
+        config->max_pressure = value;
+        break;
+      }
       case 'h':
       default:
         Usage(*config);
@@ -1342,6 +1937,12 @@ int ReadFlags(int* argc, char*** argv,
   return -1;
 }
 
+/// Finish the trace when exiting.
+void CloseTrace() {
+  delete g_trace;
+  g_trace = NULL;
+}
+
 NORETURN void real_main(int argc, char** argv) {
   // Use exit() instead of return in this function to avoid potentially
   // expensive cleanup when destructing NinjaMain.
@@ -1357,6 +1958,9 @@ NORETURN void real_main(int argc, char** argv) {
   if (exit_code >= 0)
     exit(exit_code);
 
+  if (const char* action_cache = getenv("NINJA_ACTION_CACHE"))
+    config.action_cache = action_cache;
+
   if (options.working_dir) {
     // The formatting of this string, complete with funny quotes, is
     // so Emacs can properly identify that the cwd has changed for
@@ -1370,6 +1974,62 @@ NORETURN void real_main(int argc, char** argv) {
     }
   }
 
+  if (options.trace_file) {
+    string err;
+    g_trace = Trace::Open(options.trace_file, &err);
+    if (!g_trace)
+      Fatal("opening trace file '%s': %s", options.trace_file, err.c_str());
+    atexit(CloseTrace);
+  }
+
+  // The metrics that -d stats prints aren't updated atomically.
+  if (!g_metrics)
+    config.deps_threads = GetProcessorCount();
+
+  if (!options.tool && !config.dry_run) {
+    // Share job slots with the make that runs us, or else with the commands
+    // we run if asked to.  Under make, -j only caps the number of jobs.
+    string err;
+    config.jobserver = Jobserver::Connect(&err);
+    if (config.jobserver) {
+      if (!options.parallelism_set)
+        config.parallelism = INT_MAX;
+    } else if (!err.empty()) {
+      Warning("jobserver: %s", err.c_str());
+    } else if (options.jobserver) {
+      config.jobserver = Jobserver::Serve(config.parallelism, &err);
+      if (!err.empty())
+        Fatal("jobserver: %s", err.c_str());
+    }
+  }
+
+#ifdef __linux__
+  if (!options.tool && !config.jobserver && !g_trace && !g_metrics) {
+    // Let a "-t serve" server running in this directory do the build.
+    ServeRequest request;
+    request.manifest = options.input_file;
+    request.parallelism = config.parallelism;
+    request.failures_allowed = config.failures_allowed;
+    request.max_load_average = config.max_load_average;
+    request.max_pressure = config.max_pressure;
+    request.max_memory = config.max_memory;
+    request.verbosity = config.verbosity;
+    request.dry_run = config.dry_run;
+    request.explaining = g_explaining;
+    request.keep_depfile = g_keep_depfile;
+    request.keep_rsp = g_keep_rsp;
+    request.dupe_edges_should_err = options.dupe_edges_should_err;
+    request.phony_cycle_should_err = options.phony_cycle_should_err;
+    request.action_cache = config.action_cache;
+    for (char** e = environ; *e; ++e)
+      request.env.push_back(*e);
+    request.targets.assign(argv, argv + argc);
+    int result;
+    if (ForwardToServer(request, &result))
+      exit(result);
+  }
+#endif
+
   if (options.tool && options.tool->when == Tool::RUN_AFTER_FLAGS) {
     // None of the RUN_AFTER_FLAGS actually use a NinjaMain, but it's needed
     // by other tools.
@@ -1379,6 +2039,7 @@ NORETURN void real_main(int argc, char** argv) {
 
   // Limit number of rebuilds, to prevent infinite loops.
   const int kCycleLimit = 100;
+  bool use_manifest_cache = g_manifest_cache;
   for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
     NinjaMain ninja(ninja_command, config);
 
@@ -1389,9 +2050,22 @@ NORETURN void real_main(int argc, char** argv) {
     if (options.phony_cycle_should_err) {
       parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
     }
-    ManifestParser parser(&ninja.state_, &ninja.disk_interface_, parser_opts);
+    // The metrics that -d stats prints aren't updated atomically.
+    if (!g_metrics)
+      parser_opts.parse_threads_ = GetProcessorCount();
     string err;
-    if (!parser.Load(options.input_file, &err)) {
+    LoadStatus status = LOAD_NOT_FOUND;
+    if (use_manifest_cache)
+      status = ninja.LoadManifestCache(options.input_file, parser_opts, &err);
+    if (status == LOAD_ERROR) {
+      // The State may be half loaded, so parse into a fresh one.
+      Warning("%s; parsing '%s' instead", err.c_str(), options.input_file);
+      use_manifest_cache = false;
+      continue;
+    }
+    if (status == LOAD_NOT_FOUND &&
+        !ninja.ParseManifest(options.input_file, parser_opts,
+                             g_manifest_cache && !options.tool, &err)) {
       Error("%s", err.c_str());
       exit(1);
     }
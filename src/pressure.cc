@@ -0,0 +1,128 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pressure.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "cgroup.h"
+#include "metrics.h"
+
+namespace {
+
+const char* const kResources[] = { "cpu", "memory", "io" };
+
+}  // anonymous namespace
+
+PressureMonitor* PressureMonitor::Open() {
+  // The root cgroup has no pressure files of its own, and older kernels
+  // have none for any cgroup, so fall back to those of the system.
+  string dir = CgroupV2Dir();
+  if (!dir.empty()) {
+    PressureMonitor* monitor = new PressureMonitor(dir + "/");
+    if (monitor->ReadTotals(monitor->totals_))
+      return monitor;
+    delete monitor;
+  }
+  PressureMonitor* monitor = new PressureMonitor("/proc/pressure/");
+  if (monitor->ReadTotals(monitor->totals_))
+    return monitor;
+  delete monitor;
+  return NULL;
+}
+
+PressureMonitor::PressureMonitor(const string& dir) : time_(GetTimeMicros()) {
+  bool cgroup = dir.compare(0, 6, "/proc/") != 0;
+  for (int i = 0; i < 3; ++i) {
+    files_[i] = dir + kResources[i] + (cgroup ? ".pressure" : "");
+    totals_[i] = 0;
+  }
+}
+
+double PressureMonitor::Sample() {
+  uint64_t totals[3];
+  if (!ReadTotals(totals))
+    return -1;
+  int64_t now = GetTimeMicros();
+  double pressure = 0;
+  if (now > time_) {
+    for (int i = 0; i < 3; ++i) {
+      double stalled = (double)(totals[i] - totals_[i]);
+      pressure = max(pressure, 100.0 * stalled / (now - time_));
+    }
+  }
+  memcpy(totals_, totals, sizeof(totals_));
+  time_ = now;
+  return min(pressure, 100.0);
+}
+
+bool PressureMonitor::ReadTotals(uint64_t totals[3]) const {
+  for (int i = 0; i < 3; ++i) {
+    string contents, err;
+    if (ReadFile(files_[i], &contents, &err) < 0 ||
+        !ParseSomeTotal(contents, &totals[i]))
+      return false;
+  }
+  return true;
+}
+
+// static
+bool PressureMonitor::ParseSomeTotal(const string& contents,
+                                     uint64_t* total) {
+  // "some avg10=0.00 avg60=0.00 avg300=0.00 total=12345"
+  if (contents.compare(0, 5, "some ") != 0)
+    return false;
+  size_t end = contents.find('\n');
+  size_t field = contents.find(" total=");
+  if (field == string::npos || field > end)
+    return false;
+  const char* start = contents.c_str() + field + 7;
+  char* parsed;
+  *total = strtoull(start, &parsed, 10);
+  return parsed != start;
+}
+
+PressureThrottle::PressureThrottle(PressureMonitor* monitor, int parallelism,
+                                   double max_pressure)
+    : monitor_(monitor), parallelism_(parallelism),
+      max_pressure_(max_pressure), limit_(parallelism),
+      last_sample_(GetTimeMicros()) {}
+
+PressureThrottle::~PressureThrottle() {
+  delete monitor_;
+}
+
+int PressureThrottle::Limit(int running) {
+  int64_t now = GetTimeMicros();
+  if (monitor_ && now - last_sample_ >= kSampleInterval) {
+    Update(monitor_->Sample(), running);
+    last_sample_ = now;
+  }
+  return limit_;
+}
+
+void PressureThrottle::Update(double pressure, int running) {
+  if (pressure < 0)
+    return;
+  if (pressure > max_pressure_) {
+    // Back off from what was running rather than from a limit that may
+    // not have been reached.
+    limit_ = max(1, min(limit_, running) * 3 / 4);
+  } else if (pressure < max_pressure_ / 2 && limit_ < parallelism_) {
+    ++limit_;
+  }
+}
@@ -0,0 +1,93 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_PRESSURE_H_
+#define NINJA_PRESSURE_H_
+
+#include <string>
+using namespace std;
+
+#include "util.h"  // For int64_t.
+
+/// Measures how much of the time tasks stall waiting for CPU, memory or
+/// I/O, from the pressure stall information (PSI) of Linux 4.20 and later.
+/// That is the information of ninja's own cgroup when the cgroup v2
+/// hierarchy has it, so that other containers on a shared host don't
+/// count, and that of the whole system otherwise.
+struct PressureMonitor {
+  /// Returns NULL if there is no pressure stall information.
+  static PressureMonitor* Open();
+
+  /// Returns the percentage of the time since the previous sample, or
+  /// since Open(), during which some tasks stalled on the resource they
+  /// stalled on the most.  Returns -1 if the information can't be read.
+  double Sample();
+
+  /// Set |*total| to the total stall time, in microseconds, on the "some"
+  /// line of the contents of a pressure file.  Returns false if there is
+  /// none.
+  static bool ParseSomeTotal(const string& contents, uint64_t* total);
+
+ private:
+  explicit PressureMonitor(const string& dir);
+
+  /// Read the stall time totals of the files.  Returns false on error.
+  bool ReadTotals(uint64_t totals[3]) const;
+
+  /// The pressure files of CPU, memory and I/O.
+  string files_[3];
+  /// Their totals and the time, in microseconds, as of the last sample.
+  uint64_t totals_[3];
+  int64_t time_;
+};
+
+/// Adjusts how many commands may run at once so that the pressure measured
+/// by a PressureMonitor stays under a limit.  Like TCP congestion control,
+/// it takes off a quarter of the commands running when the pressure is
+/// over the limit, and allows one more at a time once it is well under.
+struct PressureThrottle {
+  /// Let up to |parallelism| commands run while the pressure measured by
+  /// |monitor|, which may be NULL, stays under |max_pressure| percent.
+  /// Takes ownership of |monitor|.
+  PressureThrottle(PressureMonitor* monitor, int parallelism,
+                   double max_pressure);
+  ~PressureThrottle();
+
+  /// The pressure is sampled at most this often, in microseconds.
+  static const int64_t kSampleInterval = 250000;
+
+  /// How many commands may run, now that |running| are, sampling the
+  /// pressure first if the last sample is old enough.
+  int Limit(int running);
+
+  /// Adjust the limit to a sample of |pressure|, taken while |running|
+  /// commands were running.
+  void Update(double pressure, int running);
+
+  int limit() const { return limit_; }
+
+ private:
+  PressureMonitor* monitor_;
+  int parallelism_;
+  double max_pressure_;
+  int limit_;
+  /// When the pressure was last sampled.
+  int64_t last_sample_;
+
+  // Not copyable.
+  PressureThrottle(const PressureThrottle&);
+  void operator=(const PressureThrottle&);
+};
+
+#endif  // NINJA_PRESSURE_H_
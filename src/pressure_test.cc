@@ -0,0 +1,74 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "pressure.h"
+
+#include "test.h"
+
+TEST(PressureMonitor, ParseSomeTotal) {
+  uint64_t total = 0;
+  EXPECT_TRUE(PressureMonitor::ParseSomeTotal(
+      "some avg10=1.50 avg60=0.20 avg300=0.05 total=248381953\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=42\n", &total));
+  EXPECT_EQ(248381953u, total);
+
+  // Only the "some" line counts.
+  EXPECT_FALSE(PressureMonitor::ParseSomeTotal(
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=42\n", &total));
+  EXPECT_FALSE(PressureMonitor::ParseSomeTotal(
+      "some avg10=0.00 avg60=0.00 avg300=0.00\n"
+      "full avg10=0.00 avg60=0.00 avg300=0.00 total=42\n", &total));
+  EXPECT_FALSE(PressureMonitor::ParseSomeTotal("", &total));
+}
+
+TEST(PressureThrottle, Update) {
+  PressureThrottle throttle(NULL, 16, 10.0);
+  EXPECT_EQ(16, throttle.limit());
+
+  // A quarter of what runs is taken off while the pressure is too high.
+  throttle.Update(40.0, 16);
+  EXPECT_EQ(12, throttle.limit());
+  throttle.Update(40.0, 12);
+  EXPECT_EQ(9, throttle.limit());
+  // Backing off starts from what runs, when fewer commands run than the
+  // limit allows.
+  throttle.Update(40.0, 4);
+  EXPECT_EQ(3, throttle.limit());
+  throttle.Update(40.0, 1);
+  EXPECT_EQ(1, throttle.limit());
+  throttle.Update(40.0, 1);
+  EXPECT_EQ(1, throttle.limit());
+
+  // Between half the limit and the limit, nothing changes.
+  throttle.Update(8.0, 1);
+  EXPECT_EQ(1, throttle.limit());
+
+  // Well under the limit, one more command at a time may run, up to the
+  // parallelism.
+  for (int i = 2; i <= 16; ++i) {
+    throttle.Update(1.0, i - 1);
+    EXPECT_EQ(i, throttle.limit());
+  }
+  throttle.Update(0.0, 16);
+  EXPECT_EQ(16, throttle.limit());
+
+  // Failed samples are ignored.
+  throttle.Update(-1, 16);
+  EXPECT_EQ(16, throttle.limit());
+}
+
+TEST(PressureThrottle, NoMonitor) {
+  PressureThrottle throttle(NULL, 4, 10.0);
+  EXPECT_EQ(4, throttle.Limit(4));
+}
@@ -0,0 +1,38 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_RESOURCE_USAGE_H_
+#define NINJA_RESOURCE_USAGE_H_
+
+#include "util.h"  // For uint32_t.
+
+/// The resources a command used, as reported by the system when it exited.
+/// Except on Windows, that includes the processes it waited for.  Fields
+/// the system doesn't report are zero.
+struct ResourceUsage {
+  ResourceUsage()
+      : user_time(0), system_time(0), max_rss(0), blocks_in(0),
+        blocks_out(0) {}
+
+  /// CPU time spent in user mode and in the kernel, in milliseconds.
+  uint32_t user_time;
+  uint32_t system_time;
+  /// The peak resident set size of its largest process, in kilobytes.
+  uint32_t max_rss;
+  /// 512-byte blocks read and written through the file system.
+  uint32_t blocks_in;
+  uint32_t blocks_out;
+};
+
+#endif  // NINJA_RESOURCE_USAGE_H_
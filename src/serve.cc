@@ -0,0 +1,559 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "serve.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "state.h"
+#include "util.h"
+
+const char kServeSocketName[] = ".ninja_serve";
+const char kServeEnvVar[] = "NINJA_SERVE_BUILD";
+
+namespace {
+
+/// Identifies the request format, so that clients and servers of different
+/// ninja versions do not misunderstand each other.
+const char kServeProtocol[] = "ninja-serve-2";
+
+string DirName(const string& path) {
+  string::size_type slash_pos = path.find_last_of('/');
+  if (slash_pos == string::npos)
+    return string();
+  while (slash_pos > 0 && path[slash_pos - 1] == '/')
+    --slash_pos;
+  return path.substr(0, slash_pos ? slash_pos : 1);
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    size -= written;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, char* data, size_t size) {
+  while (size > 0) {
+    ssize_t len = read(fd, data, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    data += len;
+    size -= len;
+  }
+  return true;
+}
+
+/// The signal that interrupted the client while it waited for the server,
+/// or 0.
+volatile sig_atomic_t g_client_interrupted;
+
+void SetClientInterrupted(int signum) {
+  g_client_interrupted = signum;
+}
+
+/// Wait for the server to reply on |fd|.  Interruptions in the meantime are
+/// passed on by closing our end for writing: the server stops the build,
+/// just as a local one would stop, and still replies.
+bool WaitForReply(int fd, int32_t* reply) {
+  sigset_t set, old_mask;
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGHUP);
+  sigprocmask(SIG_BLOCK, &set, &old_mask);
+  struct sigaction act, old_int_act, old_term_act, old_hup_act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = SetClientInterrupted;
+  sigaction(SIGINT, &act, &old_int_act);
+  sigaction(SIGTERM, &act, &old_term_act);
+  sigaction(SIGHUP, &act, &old_hup_act);
+
+  g_client_interrupted = 0;
+  bool shut_down = false;
+  bool ok;
+  for (;;) {
+    pollfd pfd = { fd, POLLIN, 0 };
+    int ret = ppoll(&pfd, 1, NULL, &old_mask);
+    if (ret < 0 && errno != EINTR) {
+      ok = false;
+      break;
+    }
+    if (g_client_interrupted && !shut_down) {
+      shutdown(fd, SHUT_WR);
+      shut_down = true;
+    }
+    if (ret > 0) {
+      ok = ReadAll(fd, (char*)reply, sizeof(*reply));
+      break;
+    }
+  }
+
+  sigaction(SIGINT, &old_int_act, NULL);
+  sigaction(SIGTERM, &old_term_act, NULL);
+  sigaction(SIGHUP, &old_hup_act, NULL);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+  return ok;
+}
+
+void SocketAddress(sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strncpy(addr->sun_path, kServeSocketName, sizeof(addr->sun_path) - 1);
+}
+
+}  // anonymous namespace
+
+// ServeRequest ----------------------------------------------------------------
+
+void ServeRequest::Serialize(string* data) const {
+  char buf[64];
+  data->assign(kServeProtocol, sizeof(kServeProtocol));
+  data->append(manifest.c_str(), manifest.size() + 1);
+  snprintf(buf, sizeof(buf), "%d", parallelism);
+  data->append(buf, strlen(buf) + 1);
+  snprintf(buf, sizeof(buf), "%d", failures_allowed);
+  data->append(buf, strlen(buf) + 1);
+  snprintf(buf, sizeof(buf), "%.17g", max_load_average);
+  data->append(buf, strlen(buf) + 1);
+  snprintf(buf, sizeof(buf), "%.17g", max_pressure);
+  data->append(buf, strlen(buf) + 1);
+  snprintf(buf, sizeof(buf), "%lld", (long long)max_memory);
+  data->append(buf, strlen(buf) + 1);
+  snprintf(buf, sizeof(buf), "%d", verbosity);
+  data->append(buf, strlen(buf) + 1);
+  data->append(dry_run ? "1" : "0", 2);
+  data->append(explaining ? "1" : "0", 2);
+  data->append(keep_depfile ? "1" : "0", 2);
+  data->append(keep_rsp ? "1" : "0", 2);
+  data->append(dupe_edges_should_err ? "1" : "0", 2);
+  data->append(phony_cycle_should_err ? "1" : "0", 2);
+  data->append(action_cache.c_str(), action_cache.size() + 1);
+  snprintf(buf, sizeof(buf), "%d", (int)env.size());
+  data->append(buf, strlen(buf) + 1);
+  for (vector<string>::const_iterator e = env.begin(); e != env.end(); ++e)
+    data->append(e->c_str(), e->size() + 1);
+  for (vector<string>::const_iterator t = targets.begin();
+       t != targets.end(); ++t) {
+    data->append(t->c_str(), t->size() + 1);
+  }
+}
+
+bool ServeRequest::Parse(const string& data) {
+  vector<string> fields;
+  string::size_type start = 0;
+  while (start < data.size()) {
+    string::size_type end = data.find('\0', start);
+    if (end == string::npos)
+      return false;
+    fields.push_back(data.substr(start, end - start));
+    start = end + 1;
+  }
+  const size_t kFixedFields = 16;
+  if (fields.size() < kFixedFields || fields[0] != kServeProtocol)
+    return false;
+  int env_count = atoi(fields[15].c_str());
+  if (env_count < 0 || fields.size() - kFixedFields < (size_t)env_count)
+    return false;
+  manifest = fields[1];
+  parallelism = atoi(fields[2].c_str());
+  failures_allowed = atoi(fields[3].c_str());
+  max_load_average = strtod(fields[4].c_str(), NULL);
+  max_pressure = strtod(fields[5].c_str(), NULL);
+  max_memory = strtoll(fields[6].c_str(), NULL, 10);
+  verbosity = atoi(fields[7].c_str());
+  dry_run = fields[8] == "1";
+  explaining = fields[9] == "1";
+  keep_depfile = fields[10] == "1";
+  keep_rsp = fields[11] == "1";
+  dupe_edges_should_err = fields[12] == "1";
+  phony_cycle_should_err = fields[13] == "1";
+  action_cache = fields[14];
+  env.assign(fields.begin() + kFixedFields,
+             fields.begin() + kFixedFields + env_count);
+  targets.assign(fields.begin() + kFixedFields + env_count, fields.end());
+  return true;
+}
+
+// Client ----------------------------------------------------------------------
+
+bool ForwardToServer(const ServeRequest& request, int* exit_code) {
+  // Don't wait for a server that is busy running the build we're part of.
+  if (getenv(kServeEnvVar))
+    return false;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  sockaddr_un addr;
+  SocketAddress(&addr);
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return false;
+  }
+
+  string data;
+  request.Serialize(&data);
+  uint32_t size = data.size();
+
+  // Send the size of the request along with our stdout and stderr, then the
+  // request itself.
+  int fds[2] = { 1, 2 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  // The server only starts on a request it read in full, so until then we
+  // may still build by ourselves.
+  if (sendmsg(fd, &msg, 0) != sizeof(size) ||
+      !WriteAll(fd, data.data(), data.size())) {
+    Warning("lost connection to ninja server; building locally");
+    close(fd);
+    return false;
+  }
+  int32_t reply;
+  if (!WaitForReply(fd, &reply)) {
+    Error("lost connection to ninja server");
+    close(fd);
+    *exit_code = 1;
+    return true;
+  }
+  close(fd);
+
+  if (reply == kServeDeclined)
+    return false;
+  *exit_code = reply;
+  return true;
+}
+
+// Server ----------------------------------------------------------------------
+
+ServeConnection::~ServeConnection() {
+  if (fd_ >= 0)
+    close(fd_);
+  if (stdout_fd_ >= 0)
+    close(stdout_fd_);
+  if (stderr_fd_ >= 0)
+    close(stderr_fd_);
+}
+
+void ServeConnection::Reply(int exit_code) {
+  int32_t reply = exit_code;
+  // If the client went away there's no one to tell.
+  WriteAll(fd_, (const char*)&reply, sizeof(reply));
+}
+
+ServeSocket::~ServeSocket() {
+  Close();
+}
+
+bool ServeSocket::Listen(string* err) {
+  sockaddr_un addr;
+  SocketAddress(&addr);
+
+  // A socket that nobody accepts connections on is left over from a server
+  // that died; anything else means a server is running.
+  int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (probe < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return false;
+  }
+  bool running = connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+  close(probe);
+  if (running) {
+    *err = "a ninja server is already running in this directory";
+    return false;
+  }
+  unlink(kServeSocketName);
+
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0) {
+    *err = string("socket: ") + strerror(errno);
+    return false;
+  }
+  // Only the user running the server may connect to it, as it runs
+  // commands on their behalf.
+  mode_t old_umask = umask(0177);
+  int bound = bind(fd_, (sockaddr*)&addr, sizeof(addr));
+  umask(old_umask);
+  if (bound < 0 || listen(fd_, 16) < 0) {
+    *err = string(kServeSocketName) + ": " + strerror(errno);
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+void ServeSocket::Close() {
+  if (fd_ < 0)
+    return;
+  close(fd_);
+  fd_ = -1;
+  unlink(kServeSocketName);
+}
+
+bool ServeSocket::Accept(ServeConnection* conn, string* err) {
+  conn->fd_ = accept4(fd_, NULL, NULL, SOCK_CLOEXEC);
+  if (conn->fd_ < 0) {
+    *err = string("accept: ") + strerror(errno);
+    return false;
+  }
+  ucred peer;
+  socklen_t peer_len = sizeof(peer);
+  if (getsockopt(conn->fd_, SOL_SOCKET, SO_PEERCRED, &peer, &peer_len) < 0) {
+    *err = string("getsockopt: ") + strerror(errno);
+    return false;
+  }
+  if (peer.uid != geteuid()) {
+    *err = "refusing a connection from another user";
+    return false;
+  }
+  // Clients send their request right away; one that doesn't mustn't keep
+  // the server from accepting others.
+  timeval timeout = { request_timeout_, 0 };
+  if (setsockopt(conn->fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                 sizeof(timeout)) < 0) {
+    *err = string("setsockopt: ") + strerror(errno);
+    return false;
+  }
+
+  uint32_t size;
+  int fds[2];
+  char control[CMSG_SPACE(sizeof(fds))];
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len;
+  do {
+    len = recvmsg(conn->fd_, &msg, MSG_CMSG_CLOEXEC);
+  } while (len < 0 && errno == EINTR);
+  if (len == 0)
+    return false;  // Not a client, e.g. another server probing the socket.
+  if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    *err = "timed out waiting for a request";
+    return false;
+  }
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  if (len != sizeof(size) || !cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    *err = "malformed request";
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  conn->stdout_fd_ = fds[0];
+  conn->stderr_fd_ = fds[1];
+
+  string data(size, '\0');
+  errno = 0;
+  if (!ReadAll(conn->fd_, &data[0], size)) {
+    *err = errno == EAGAIN || errno == EWOULDBLOCK
+        ? "timed out waiting for a request" : "malformed request";
+    return false;
+  }
+  if (!conn->request_.Parse(data)) {
+    *err = "malformed request";
+    return false;
+  }
+  return true;
+}
+
+// NodeWatcher -----------------------------------------------------------------
+
+NodeWatcher::~NodeWatcher() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool NodeWatcher::Init(string* err) {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    *err = string("inotify_init1: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+void NodeWatcher::WatchFile(const string& path) {
+  bool added;
+  WatchDir(DirName(path), &added);
+  files_.insert(path);
+}
+
+int NodeWatcher::AddWatch(const string& dir, uint32_t mask) {
+  return inotify_add_watch(fd_, dir.c_str(), mask);
+}
+
+bool NodeWatcher::WatchDir(const string& dir, bool* added) {
+  *added = false;
+  if (dir_watches_.find(dir) != dir_watches_.end())
+    return true;
+  const uint32_t kMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+                         IN_MODIFY | IN_MOVED_FROM | IN_MOVED_TO |
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  int wd = AddWatch(dir.empty() ? "." : dir, kMask);
+  if (wd < 0) {
+    if (errno == ENOSPC) {
+      static bool warned = false;
+      if (!warned)
+        Warning("inotify watch limit reached; some files will be stat()ed "
+                "on every build (see fs.inotify.max_user_watches)");
+      warned = true;
+    }
+    return false;
+  }
+  dir_watches_[dir] = wd;
+  watch_dirs_[wd].push_back(dir);
+  *added = true;
+  return true;
+}
+
+void NodeWatcher::WatchNodes() {
+  if (state_->paths_.size() == nodes_seen_) {
+    // Only retry the nodes that weren't watched last time.
+    vector<Node*> unwatched;
+    unwatched.swap(unwatched_);
+    for (vector<Node*>::iterator n = unwatched.begin();
+         n != unwatched.end(); ++n) {
+      bool added;
+      if (!WatchDir(DirName((*n)->path()), &added))
+        unwatched_.push_back(*n);
+      // The file may have changed before the watch was added.
+      (*n)->ResetState();
+    }
+    return;
+  }
+
+  unwatched_.clear();
+  set<string> added_dirs;
+  for (State::Paths::iterator i = state_->paths_.begin();
+       i != state_->paths_.end(); ++i) {
+    Node* node = i->second;
+    string dir = DirName(node->path());
+    bool added;
+    if (!WatchDir(dir, &added)) {
+      unwatched_.push_back(node);
+      node->ResetState();
+      continue;
+    }
+    // Nodes stat()ed before their directory was watched may be stale.
+    if (added)
+      added_dirs.insert(dir);
+    if (added_dirs.count(dir))
+      node->ResetState();
+  }
+  nodes_seen_ = state_->paths_.size();
+}
+
+void NodeWatcher::ProcessEvents() {
+  char buf[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+  for (;;) {
+    ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    for (char* p = buf; p < buf + len; ) {
+      const inotify_event* event = (const inotify_event*)p;
+      p += sizeof(inotify_event) + event->len;
+      HandleEvent(*event);
+    }
+  }
+}
+
+void NodeWatcher::HandleEvent(const inotify_event& event) {
+  if (event.mask & IN_Q_OVERFLOW) {
+    ForgetAll();
+    return;
+  }
+  map<int, vector<string> >::iterator w = watch_dirs_.find(event.wd);
+  if (w == watch_dirs_.end())
+    return;
+  const vector<string> dirs = w->second;
+
+  if (event.mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+    // The directory is gone, or no longer at its path.  Stop watching it
+    // and look at all nodes again in WatchNodes().
+    if (!(event.mask & IN_IGNORED))
+      inotify_rm_watch(fd_, event.wd);
+    watch_dirs_.erase(w);
+    nodes_seen_ = 0;
+    for (vector<string>::const_iterator d = dirs.begin(); d != dirs.end();
+         ++d) {
+      dir_watches_.erase(*d);
+      PathChanged(*d);
+    }
+    return;
+  }
+
+  for (vector<string>::const_iterator d = dirs.begin(); d != dirs.end();
+       ++d) {
+    // A change to an entry also changes the directory itself.
+    PathChanged(*d);
+    if (event.len > 0)
+      PathChanged(d->empty() ? event.name : *d + "/" + event.name);
+  }
+}
+
+void NodeWatcher::PathChanged(const string& path) {
+  if (Node* node = state_->LookupNode(path))
+    node->ResetState();
+  if (files_.count(path))
+    changed_files_.insert(path);
+}
+
+void NodeWatcher::ForgetAll() {
+  for (State::Paths::iterator i = state_->paths_.begin();
+       i != state_->paths_.end(); ++i) {
+    i->second->ResetState();
+  }
+}
@@ -0,0 +1,194 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SERVE_H_
+#define NINJA_SERVE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "util.h"  // For int64_t.
+
+struct Node;
+struct State;
+struct inotify_event;
+
+// Support for "ninja -t serve": a long-running process that keeps the
+// loaded State, the logs and the mtimes of nodes in memory between builds,
+// and runs builds on behalf of ninja clients started in the same directory.
+// Linux only, as it relies on inotify.
+
+/// The Unix socket a server listens on, relative to its working directory.
+extern const char kServeSocketName[];
+
+/// Environment variable set for the commands a server runs, so that a ninja
+/// started by one of them does not forward its build to the busy server.
+extern const char kServeEnvVar[];
+
+/// Exit code a server replies with when the client should build by itself,
+/// for example because the manifest changed.
+const int kServeDeclined = -1;
+
+/// A build request, forwarded from a client to a server.
+struct ServeRequest {
+  ServeRequest() : parallelism(1), failures_allowed(1),
+                   max_load_average(-0.0f), max_pressure(-0.0f),
+                   max_memory(-1), verbosity(0), dry_run(false),
+                   explaining(false), keep_depfile(false), keep_rsp(false),
+                   dupe_edges_should_err(false),
+                   phony_cycle_should_err(false) {}
+
+  /// Serialize the request into |data|.
+  void Serialize(string* data) const;
+  /// Parse a request produced by Serialize().  Returns false on error.
+  bool Parse(const string& data);
+
+  string manifest;
+  int parallelism;
+  int failures_allowed;
+  double max_load_average;
+  double max_pressure;
+  int64_t max_memory;
+  int verbosity;
+  bool dry_run;
+  /// The client's -d explain, -d keepdepfile and -d keeprsp.
+  bool explaining;
+  bool keep_depfile;
+  bool keep_rsp;
+  /// The client's -w dupbuild and -w phonycycle, which the server declines
+  /// to build for unless it loaded the manifest with the same.
+  bool dupe_edges_should_err;
+  bool phony_cycle_should_err;
+  string action_cache;
+  /// The client's environment, as "NAME=value" strings, for the commands
+  /// the server runs.
+  vector<string> env;
+  vector<string> targets;
+};
+
+/// Forward |request| to a server running in the current directory, along
+/// with our stdout and stderr for it to print to, and wait for the build to
+/// finish.  SIGINT, SIGTERM and SIGHUP meanwhile make the server stop the
+/// build, which still replies once it cleaned up.  Returns false if there
+/// is no server or it declined the request, in which case the caller should
+/// build by itself.  Once the request was sent, a lost connection is
+/// reported as a failed build instead, since the server may still be
+/// running commands.
+bool ForwardToServer(const ServeRequest& request, int* exit_code);
+
+/// A client connection accepted by a ServeSocket.
+struct ServeConnection {
+  ServeConnection() : fd_(-1), stdout_fd_(-1), stderr_fd_(-1) {}
+  ~ServeConnection();
+
+  /// Send the exit code of the build to the client.
+  void Reply(int exit_code);
+
+  int fd_;
+  /// The client's stdout and stderr.
+  int stdout_fd_;
+  int stderr_fd_;
+  ServeRequest request_;
+};
+
+/// The socket a server listens on.
+struct ServeSocket {
+  ServeSocket() : fd_(-1), request_timeout_(5) {}
+  ~ServeSocket();
+
+  /// Start listening on kServeSocketName, which only the user may connect
+  /// to.  Fails if another server is already listening there.
+  bool Listen(string* err);
+
+  /// Stop listening and remove the socket.
+  void Close();
+
+  /// Accept a connection and read its request.  Returns false, filling
+  /// |err| unless the peer just hung up, if there is no valid request
+  /// within |request_timeout_| or the peer is another user.
+  /// The client sends nothing more, so the connection becomes readable
+  /// once it hangs up or is interrupted.
+  bool Accept(ServeConnection* conn, string* err);
+
+  int fd_;
+  /// How many seconds Accept() waits for a request.
+  int request_timeout_;
+};
+
+/// Watches the directories that contain the nodes of a State with inotify
+/// and forgets the mtimes of nodes whose files change, so that the mtimes
+/// stay valid from one build to the next without stat()ing everything.
+struct NodeWatcher {
+  explicit NodeWatcher(State* state)
+      : state_(state), fd_(-1), nodes_seen_(0) {}
+  virtual ~NodeWatcher();
+
+  bool Init(string* err);
+
+  /// A file descriptor that is readable when events are pending.
+  int fd() const { return fd_; }
+
+  /// Also report changes to |path|, which need not be a node, in
+  /// changed_files().
+  void WatchFile(const string& path);
+
+  /// Watch the directories of nodes added since the last call.  Nodes
+  /// whose directory cannot be watched, for example because it does not
+  /// exist yet, have their mtime forgotten on every call.
+  void WatchNodes();
+
+  /// Read all pending events and forget the mtimes of the affected nodes.
+  void ProcessEvents();
+
+  /// Forget the mtimes of the nodes affected by |event|.
+  void HandleEvent(const inotify_event& event);
+
+  /// Files passed to WatchFile() that changed since the last call to
+  /// ClearChangedFiles().
+  const set<string>& changed_files() const { return changed_files_; }
+  void ClearChangedFiles() { changed_files_.clear(); }
+
+ protected:
+  /// Add an inotify watch with |mask| for |dir|, as inotify_add_watch().
+  virtual int AddWatch(const string& dir, uint32_t mask);
+
+ private:
+  /// Start watching |dir|, if it is not watched yet.  Sets |*added| if a
+  /// new watch was added.  Returns false if |dir| cannot be watched.
+  bool WatchDir(const string& dir, bool* added);
+
+  /// Handle a change to |path|.
+  void PathChanged(const string& path);
+
+  /// Forget the mtimes of all nodes, e.g. when events were lost.
+  void ForgetAll();
+
+  State* state_;
+  int fd_;
+  /// Watched directories, by path and by watch descriptor.  Different paths
+  /// to the same directory share a watch descriptor.
+  map<string, int> dir_watches_;
+  map<int, vector<string> > watch_dirs_;
+  /// Nodes whose directory is not watched.
+  vector<Node*> unwatched_;
+  /// The number of nodes in |state_| when they were last all looked at.
+  size_t nodes_seen_;
+  set<string> files_;
+  set<string> changed_files_;
+};
+
+#endif  // NINJA_SERVE_H_
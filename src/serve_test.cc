@@ -0,0 +1,284 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "serve.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "graph.h"
+#include "state.h"
+#include "test.h"
+
+namespace {
+
+TEST(ServeRequestTest, RoundTrip) {
+  ServeRequest request;
+  request.manifest = "sub/build.ninja";
+  request.parallelism = 12;
+  request.failures_allowed = 0;
+  request.max_load_average = 3.5;
+  request.max_pressure = 0.25;
+  request.max_memory = 1LL << 40;
+  request.verbosity = 2;
+  request.dry_run = true;
+  request.explaining = true;
+  request.keep_rsp = true;
+  request.phony_cycle_should_err = true;
+  request.action_cache = "http://cache:8080/";
+  request.env.push_back("PATH=/usr/bin");
+  request.env.push_back("EMPTY=");
+  request.targets.push_back("all");
+  request.targets.push_back("with space");
+
+  string data;
+  request.Serialize(&data);
+  ServeRequest parsed;
+  ASSERT_TRUE(parsed.Parse(data));
+  EXPECT_EQ("sub/build.ninja", parsed.manifest);
+  EXPECT_EQ(12, parsed.parallelism);
+  EXPECT_EQ(0, parsed.failures_allowed);
+  EXPECT_EQ(3.5, parsed.max_load_average);
+  EXPECT_EQ(0.25, parsed.max_pressure);
+  EXPECT_EQ(1LL << 40, parsed.max_memory);
+  EXPECT_EQ(2, parsed.verbosity);
+  EXPECT_TRUE(parsed.dry_run);
+  EXPECT_TRUE(parsed.explaining);
+  EXPECT_FALSE(parsed.keep_depfile);
+  EXPECT_TRUE(parsed.keep_rsp);
+  EXPECT_FALSE(parsed.dupe_edges_should_err);
+  EXPECT_TRUE(parsed.phony_cycle_should_err);
+  EXPECT_EQ("http://cache:8080/", parsed.action_cache);
+  ASSERT_EQ(2u, parsed.env.size());
+  EXPECT_EQ("PATH=/usr/bin", parsed.env[0]);
+  EXPECT_EQ("EMPTY=", parsed.env[1]);
+  ASSERT_EQ(2u, parsed.targets.size());
+  EXPECT_EQ("all", parsed.targets[0]);
+  EXPECT_EQ("with space", parsed.targets[1]);
+}
+
+TEST(ServeRequestTest, RoundTripDefaults) {
+  ServeRequest request;
+  string data;
+  request.Serialize(&data);
+  ServeRequest parsed;
+  parsed.parallelism = 5;
+  parsed.targets.push_back("stale");
+  ASSERT_TRUE(parsed.Parse(data));
+  EXPECT_EQ("", parsed.manifest);
+  EXPECT_EQ(1, parsed.parallelism);
+  EXPECT_EQ(-1, parsed.max_memory);
+  EXPECT_FALSE(parsed.dry_run);
+  EXPECT_EQ(0u, parsed.env.size());
+  EXPECT_EQ(0u, parsed.targets.size());
+}
+
+TEST(ServeRequestTest, Malformed) {
+  ServeRequest request;
+  request.targets.push_back("all");
+  string data;
+  request.Serialize(&data);
+
+  ServeRequest parsed;
+  EXPECT_FALSE(parsed.Parse(""));
+  // A field without its terminator.
+  EXPECT_FALSE(parsed.Parse(data.substr(0, data.size() - 1)));
+  // Too few fields.
+  EXPECT_FALSE(parsed.Parse(data.substr(0, data.find('\0') + 1)));
+  // Another version of the protocol.
+  string other = data;
+  other[other.find('\0') - 1] ^= 1;
+  EXPECT_FALSE(parsed.Parse(other));
+  // Fewer environment variables than announced.
+  request.env.push_back("A=1");
+  request.env.push_back("B=2");
+  request.Serialize(&other);
+  string vars("A=1\0B=2", 8);
+  other.erase(other.find(vars), vars.size());
+  EXPECT_FALSE(parsed.Parse(other));
+  EXPECT_TRUE(parsed.Parse(data));
+}
+
+TEST(ServeSocketTest, Private) {
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("Ninja-ServeSocketTest");
+  ServeSocket socket;
+  string err;
+  ASSERT_TRUE(socket.Listen(&err));
+  ASSERT_EQ("", err);
+  struct stat st;
+  ASSERT_EQ(0, stat(kServeSocketName, &st));
+  EXPECT_EQ(0600, (st.st_mode & 0777));
+  socket.Close();
+  temp_dir.Cleanup();
+}
+
+TEST(ServeSocketTest, SilentClient) {
+  // A client that connects and sends nothing is dropped.
+  ScopedTempDir temp_dir;
+  temp_dir.CreateAndEnter("Ninja-ServeSocketTest");
+  ServeSocket socket;
+  socket.request_timeout_ = 1;
+  string err;
+  ASSERT_TRUE(socket.Listen(&err));
+  int client = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, kServeSocketName);
+  ASSERT_EQ(0, connect(client, (sockaddr*)&addr, sizeof(addr)));
+
+  ServeConnection conn;
+  EXPECT_FALSE(socket.Accept(&conn, &err));
+  EXPECT_EQ("timed out waiting for a request", err);
+  close(client);
+  socket.Close();
+  temp_dir.Cleanup();
+}
+
+struct NodeWatcherTest : public testing::Test {
+  virtual void SetUp() {
+    temp_dir_.CreateAndEnter("Ninja-NodeWatcherTest");
+    ASSERT_TRUE(disk_interface_.MakeDirs("dir/in"));
+    ASSERT_TRUE(disk_interface_.WriteFile("dir/in", ""));
+    ASSERT_TRUE(disk_interface_.WriteFile("other", ""));
+    in_ = state_.GetNode("dir/in", 0);
+    other_ = state_.GetNode("other", 0);
+  }
+
+  virtual void TearDown() {
+    temp_dir_.Cleanup();
+  }
+
+  /// Stat all nodes, as a build would.
+  void StatNodes() {
+    string err;
+    ASSERT_TRUE(in_->Stat(&disk_interface_, &err));
+    ASSERT_TRUE(other_->Stat(&disk_interface_, &err));
+    ASSERT_EQ("", err);
+  }
+
+  ScopedTempDir temp_dir_;
+  RealDiskInterface disk_interface_;
+  State state_;
+  Node* in_;
+  Node* other_;
+};
+
+/// A NodeWatcher that can't add any watch, as when the inotify watch limit
+/// is reached.
+struct LimitedNodeWatcher : public NodeWatcher {
+  explicit LimitedNodeWatcher(State* state) : NodeWatcher(state) {}
+
+  virtual int AddWatch(const string& dir, uint32_t mask) {
+    errno = ENOSPC;
+    return -1;
+  }
+};
+
+TEST_F(NodeWatcherTest, ForgetsChangedNodes) {
+  NodeWatcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  watcher.WatchNodes();
+  StatNodes();
+
+  watcher.ProcessEvents();
+  EXPECT_TRUE(in_->status_known());
+  EXPECT_TRUE(other_->status_known());
+
+  ASSERT_TRUE(disk_interface_.WriteFile("dir/in", "changed"));
+  watcher.ProcessEvents();
+  EXPECT_FALSE(in_->status_known());
+  EXPECT_TRUE(other_->status_known());
+}
+
+TEST_F(NodeWatcherTest, NewNodes) {
+  NodeWatcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  watcher.WatchNodes();
+  StatNodes();
+
+  // A node in a directory that wasn't watched yet may have been stat()ed
+  // before the watch was added.
+  ASSERT_TRUE(disk_interface_.MakeDirs("new/out"));
+  Node* out = state_.GetNode("new/out", 0);
+  ASSERT_TRUE(out->Stat(&disk_interface_, &err));
+  watcher.WatchNodes();
+  EXPECT_FALSE(out->status_known());
+  EXPECT_TRUE(in_->status_known());
+
+  ASSERT_TRUE(out->Stat(&disk_interface_, &err));
+  ASSERT_TRUE(disk_interface_.WriteFile("new/out", ""));
+  watcher.ProcessEvents();
+  EXPECT_FALSE(out->status_known());
+}
+
+TEST_F(NodeWatcherTest, QueueOverflow) {
+  NodeWatcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  watcher.WatchNodes();
+  StatNodes();
+
+  // When events were lost, any node may have changed.
+  inotify_event event;
+  memset(&event, 0, sizeof(event));
+  event.wd = -1;
+  event.mask = IN_Q_OVERFLOW;
+  watcher.HandleEvent(event);
+  EXPECT_FALSE(in_->status_known());
+  EXPECT_FALSE(other_->status_known());
+}
+
+TEST_F(NodeWatcherTest, WatchLimit) {
+  LimitedNodeWatcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  StatNodes();
+
+  // Nodes that can't be watched are stat()ed again on every build.
+  watcher.WatchNodes();
+  EXPECT_FALSE(in_->status_known());
+  EXPECT_FALSE(other_->status_known());
+  StatNodes();
+  watcher.WatchNodes();
+  EXPECT_FALSE(in_->status_known());
+  EXPECT_FALSE(other_->status_known());
+}
+
+TEST_F(NodeWatcherTest, ChangedFiles) {
+  NodeWatcher watcher(&state_);
+  string err;
+  ASSERT_TRUE(watcher.Init(&err));
+  watcher.WatchFile("build.ninja");
+  watcher.WatchNodes();
+  EXPECT_TRUE(watcher.changed_files().empty());
+
+  ASSERT_TRUE(disk_interface_.WriteFile("build.ninja", ""));
+  ASSERT_TRUE(disk_interface_.WriteFile("other", "changed"));
+  watcher.ProcessEvents();
+  ASSERT_EQ(1u, watcher.changed_files().size());
+  EXPECT_EQ("build.ninja", *watcher.changed_files().begin());
+  watcher.ClearChangedFiles();
+  EXPECT_TRUE(watcher.changed_files().empty());
+}
+
+}  // anonymous namespace
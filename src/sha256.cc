@@ -0,0 +1,155 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sha256.h"
+
+#include <string.h>
+
+// As specified in FIPS 180-4.
+
+namespace {
+
+const uint32_t kRoundConstants[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+  0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+  0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+  0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+  0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+  0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t RotateRight(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+}  // anonymous namespace
+
+Sha256::Sha256() : size_(0) {
+  state_[0] = 0x6a09e667;
+  state_[1] = 0xbb67ae85;
+  state_[2] = 0x3c6ef372;
+  state_[3] = 0xa54ff53a;
+  state_[4] = 0x510e527f;
+  state_[5] = 0x9b05688c;
+  state_[6] = 0x1f83d9ab;
+  state_[7] = 0x5be0cd19;
+}
+
+void Sha256::Update(const void* data, size_t size) {
+  const unsigned char* p = (const unsigned char*)data;
+  size_t buffered = size_ % 64;
+  size_ += size;
+  if (buffered) {
+    size_t fill = 64 - buffered;
+    if (size < fill) {
+      memcpy(buffer_ + buffered, p, size);
+      return;
+    }
+    memcpy(buffer_ + buffered, p, fill);
+    Transform(buffer_);
+    p += fill;
+    size -= fill;
+  }
+  for (; size >= 64; p += 64, size -= 64)
+    Transform(p);
+  memcpy(buffer_, p, size);
+}
+
+string Sha256::Digest() {
+  // Pad with a 1 bit, then 0 bits up to 8 bytes short of a block, then the
+  // size in bits, big-endian.
+  uint64_t bits = size_ * 8;
+  unsigned char padding[72] = { 0x80 };
+  size_t padding_size = 64 + 56 - size_ % 64;
+  if (padding_size > 64)
+    padding_size -= 64;
+  for (int i = 0; i < 8; ++i)
+    padding[padding_size + i] = (unsigned char)(bits >> (56 - 8 * i));
+  Update(padding, padding_size + 8);
+
+  string digest(kDigestSize, '\0');
+  for (int i = 0; i < 8; ++i) {
+    digest[4 * i] = (char)(state_[i] >> 24);
+    digest[4 * i + 1] = (char)(state_[i] >> 16);
+    digest[4 * i + 2] = (char)(state_[i] >> 8);
+    digest[4 * i + 3] = (char)state_[i];
+  }
+  return digest;
+}
+
+// static
+string Sha256::Hash(StringPiece data) {
+  Sha256 sha;
+  sha.Update(data.str_, data.len_);
+  return sha.Digest();
+}
+
+// static
+string Sha256::Hex(const string& digest) {
+  string hex;
+  hex.reserve(digest.size() * 2);
+  for (size_t i = 0; i < digest.size(); ++i) {
+    unsigned char c = (unsigned char)digest[i];
+    hex.push_back("0123456789abcdef"[c >> 4]);
+    hex.push_back("0123456789abcdef"[c & 0xf]);
+  }
+  return hex;
+}
+
+void Sha256::Transform(const unsigned char* block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; ++i) {
+    w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+        ((uint32_t)block[4 * i + 2] << 8) | (uint32_t)block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; ++i) {
+    uint32_t s0 = RotateRight(w[i - 15], 7) ^ RotateRight(w[i - 15], 18) ^
+        (w[i - 15] >> 3);
+    uint32_t s1 = RotateRight(w[i - 2], 17) ^ RotateRight(w[i - 2], 19) ^
+        (w[i - 2] >> 10);
+    w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+
+  uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+  uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+  for (int i = 0; i < 64; ++i) {
+    uint32_t s1 = RotateRight(e, 6) ^ RotateRight(e, 11) ^ RotateRight(e, 25);
+    uint32_t ch = (e & f) ^ (~e & g);
+    uint32_t t1 = h + s1 + ch + kRoundConstants[i] + w[i];
+    uint32_t s0 = RotateRight(a, 2) ^ RotateRight(a, 13) ^ RotateRight(a, 22);
+    uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+    uint32_t t2 = s0 + maj;
+    h = g;
+    g = f;
+    f = e;
+    e = d + t1;
+    d = c;
+    c = b;
+    b = a;
+    a = t1 + t2;
+  }
+  state_[0] += a;
+  state_[1] += b;
+  state_[2] += c;
+  state_[3] += d;
+  state_[4] += e;
+  state_[5] += f;
+  state_[6] += g;
+  state_[7] += h;
+}
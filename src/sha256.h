@@ -0,0 +1,58 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SHA256_H_
+#define NINJA_SHA256_H_
+
+#include <stddef.h>
+
+#include <string>
+using namespace std;
+
+#include "string_piece.h"
+#include "util.h"  // For uint64_t.
+
+/// The SHA-256 digest of some data, for naming contents where a clash of
+/// names could be forced on purpose, as in a cache that others write to.
+struct Sha256 {
+  /// The size of a digest in bytes.
+  static const size_t kDigestSize = 32;
+
+  Sha256();
+
+  /// Add |size| bytes at |data| to what is digested.
+  void Update(const void* data, size_t size);
+
+  /// Return the digest of what was added, as kDigestSize raw bytes.  No
+  /// more can be added afterwards.
+  string Digest();
+
+  /// Return the digest of |data|.
+  static string Hash(StringPiece data);
+
+  /// Return |digest| as lowercase hex.
+  static string Hex(const string& digest);
+
+ private:
+  /// Digest the 64-byte block at |block| into |state_|.
+  void Transform(const unsigned char* block);
+
+  uint32_t state_[8];
+  /// The number of bytes added so far.
+  uint64_t size_;
+  /// The bytes added since the last full block.
+  unsigned char buffer_[64];
+};
+
+#endif  // NINJA_SHA256_H_
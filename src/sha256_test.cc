@@ -0,0 +1,57 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sha256.h"
+
+#include "test.h"
+
+namespace {
+
+// The examples of FIPS 180-4.
+TEST(Sha256Test, Examples) {
+  EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+            Sha256::Hex(Sha256::Hash("")));
+  EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+            Sha256::Hex(Sha256::Hash("abc")));
+  EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+            Sha256::Hex(Sha256::Hash(
+                "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq")));
+}
+
+TEST(Sha256Test, Million) {
+  Sha256 sha;
+  string a(1000, 'a');
+  for (int i = 0; i < 1000; ++i)
+    sha.Update(a.data(), a.size());
+  EXPECT_EQ("cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+            Sha256::Hex(sha.Digest()));
+}
+
+TEST(Sha256Test, Pieces) {
+  // However the data is split, and wherever the padding falls.
+  string data;
+  for (int i = 0; i < 200; ++i)
+    data.push_back((char)i);
+  for (size_t size = 0; size <= data.size(); size += 7) {
+    for (size_t split = 0; split <= size; split += 5) {
+      Sha256 sha;
+      sha.Update(data.data(), split);
+      sha.Update(data.data() + split, size - split);
+      EXPECT_EQ(Sha256::Hash(StringPiece(data.data(), size)), sha.Digest());
+    }
+  }
+  EXPECT_EQ(Sha256::kDigestSize, Sha256::Hash(data).size());
+}
+
+}  // anonymous namespace
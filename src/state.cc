@@ -38,17 +38,18 @@ void Pool::DelayEdge(Edge* edge) {
   delayed_.insert(edge);
 }
 
-void Pool::RetrieveReadyEdges(set<Edge*>* ready_queue) {
+void Pool::RetrieveReadyEdges(EdgePriorityQueue* ready_queue) {
   DelayedEdges::iterator it = delayed_.begin();
   while (it != delayed_.end()) {
     Edge* edge = *it;
+    // Lighter edges behind one that doesn't fit would take the slots it is
+    // waiting for, and could keep it waiting for as long as they come.
     if (current_use_ + edge->weight() > depth_)
       break;
-    ready_queue->insert(edge);
+    ready_queue->push(edge);
     EdgeScheduled(*edge);
-    ++it;
+    delayed_.erase(it++);
   }
-  delayed_.erase(delayed_.begin(), it);
 }
 
 void Pool::Dump() const {
@@ -62,11 +63,12 @@ void Pool::Dump() const {
 }
 
 // static
-bool Pool::WeightedEdgeCmp(const Edge* a, const Edge* b) {
+bool Pool::DelayedEdgeCmp(const Edge* a, const Edge* b) {
   if (!a) return b;
   if (!b) return false;
-  int weight_diff = a->weight() - b->weight();
-  return ((weight_diff < 0) || (weight_diff == 0 && a < b));
+  if (a->critical_path_weight() != b->critical_path_weight())
+    return a->critical_path_weight() > b->critical_path_weight();
+  return a->id_ < b->id_;
 }
 
 Pool State::kDefaultPool("", 0);
@@ -74,6 +76,7 @@ Pool State::kConsolePool("console", 1);
 const Rule State::kPhonyRule("phony");
 
 State::State() {
+  bindings_.set_string_pool(&string_pool_);
   bindings_.AddRule(&kPhonyRule);
   AddPool(&kDefaultPool);
   AddPool(&kConsolePool);
@@ -96,6 +99,7 @@ Edge* State::AddEdge(const Rule* rule) {
   edge->rule_ = rule;
   edge->pool_ = &State::kDefaultPool;
   edge->env_ = &bindings_;
+  edge->id_ = edges_.size();
   edges_.push_back(edge);
   return edge;
 }
@@ -191,6 +195,35 @@ void State::Reset() {
   }
 }
 
+void State::ResetKeepingMtimes() {
+  for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
+    Node* node = i->second;
+    // DependencyScan does not revisit leaf nodes whose status is known.
+    node->set_dirty(!node->in_edge() && node->status_known() &&
+                    !node->exists());
+  }
+  for (vector<Edge*>::iterator e = edges_.begin(); e != edges_.end(); ++e) {
+    Edge* edge = *e;
+    edge->outputs_ready_ = false;
+    edge->deps_loaded_ = false;
+    edge->mark_ = Edge::VisitNone;
+    if (edge->discovered_deps_ == 0)
+      continue;
+    // Discovered deps are loaded after the whole manifest, so they are the
+    // last out edges of their nodes.  All of them are going away, so it
+    // does not matter which edge each popped one belonged to.
+    vector<Node*>::iterator end = edge->inputs_.end() - edge->order_only_deps_;
+    vector<Node*>::iterator begin = end - edge->discovered_deps_;
+    for (vector<Node*>::iterator i = begin; i != end; ++i) {
+      if (*i)  // NULL if loading a depfile failed halfway.
+        (*i)->PopOutEdge();
+    }
+    edge->inputs_.erase(begin, end);
+    edge->implicit_deps_ -= edge->discovered_deps_;
+    edge->discovered_deps_ = 0;
+  }
+}
+
 void State::Dump() {
   for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
     Node* node = i->second;
@@ -23,9 +23,11 @@ using namespace std;
 
 #include "eval_env.h"
 #include "hash_map.h"
+#include "string_pool.h"
 #include "util.h"
 
 struct Edge;
+struct EdgePriorityQueue;
 struct Node;
 struct Rule;
 
@@ -39,7 +41,7 @@ struct Rule;
 /// completes).
 struct Pool {
   Pool(const string& name, int depth)
-    : name_(name), current_use_(0), depth_(depth), delayed_(&WeightedEdgeCmp) {}
+    : name_(name), current_use_(0), depth_(depth), delayed_(&DelayedEdgeCmp) {}
 
   // A depth of 0 is infinite
   bool is_valid() const { return depth_ >= 0; }
@@ -61,8 +63,11 @@ struct Pool {
   /// adds the given edge to this Pool to be delayed.
   void DelayEdge(Edge* edge);
 
-  /// Pool will add zero or more edges to the ready_queue
-  void RetrieveReadyEdges(set<Edge*>* ready_queue);
+  /// Pool will add zero or more edges to the ready_queue: the most critical
+  /// delayed edges, as long as their weight fits in what is left of its
+  /// depth.  Less critical edges wait behind one that doesn't fit yet, so
+  /// that the slots it needs are freed for it.
+  void RetrieveReadyEdges(EdgePriorityQueue* ready_queue);
 
   /// Dump the Pool and its edges (useful for debugging).
   void Dump() const;
@@ -75,7 +80,8 @@ struct Pool {
   int current_use_;
   int depth_;
 
-  static bool WeightedEdgeCmp(const Edge* a, const Edge* b);
+  /// Orders the delayed edges most critical first.
+  static bool DelayedEdgeCmp(const Edge* a, const Edge* b);
 
   typedef set<Edge*,bool(*)(const Edge*, const Edge*)> DelayedEdges;
   DelayedEdges delayed_;
@@ -106,6 +112,13 @@ struct State {
   /// state where we haven't yet examined the disk for dirty state.
   void Reset();
 
+  /// Like Reset(), but keep the mtimes of nodes, for callers that track
+  /// which files changed since they were stat()ed and forget those nodes'
+  /// mtimes themselves.  Also drops the implicit dependencies loaded from
+  /// depfiles and the deps log, so that the next scan loads them afresh.
+  /// Must not be used once dyndep files have been loaded.
+  void ResetKeepingMtimes();
+
   /// Dump the nodes and Pools (useful for debugging).
   void Dump();
 
@@ -124,6 +137,9 @@ struct State {
   /// All the edges of the graph.
   vector<Edge*> edges_;
 
+  /// Holds the names and values of the bindings of frozen scopes, such as
+  /// those of edges, once each.
+  StringPool string_pool_;
   BindingEnv bindings_;
   vector<Node*> defaults_;
 };
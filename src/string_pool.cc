@@ -0,0 +1,60 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "string_pool.h"
+
+#include <string.h>
+
+StringPiece StringPool::Intern(StringPiece str) {
+  // The low bits of the hash pick a bucket within the shard, so use the
+  // high ones here.
+  Shard* shard = &shards_[MurmurHash2(str.str_, str.len_) >> (32 - kShardBits)];
+#if __cplusplus >= 201103L
+  lock_guard<mutex> lock(shard->mutex_);
+#endif
+  Shard::Strings::iterator i = shard->strings_.find(str);
+  if (i != shard->strings_.end())
+    return i->second;
+  char* copy = shard->arena_.AllocArray<char>(str.len_);
+  if (str.len_)
+    memcpy(copy, str.str_, str.len_);
+  StringPiece pooled(copy, str.len_);
+  shard->strings_.insert(Shard::Strings::value_type(pooled, pooled));
+  shard->bytes_ += str.len_;
+  return pooled;
+}
+
+size_t StringPool::size() const {
+  size_t size = 0;
+  for (int i = 0; i < 1 << kShardBits; ++i) {
+    const Shard& shard = shards_[i];
+#if __cplusplus >= 201103L
+    lock_guard<mutex> lock(shard.mutex_);
+#endif
+    size += shard.strings_.size();
+  }
+  return size;
+}
+
+size_t StringPool::bytes() const {
+  size_t bytes = 0;
+  for (int i = 0; i < 1 << kShardBits; ++i) {
+    const Shard& shard = shards_[i];
+#if __cplusplus >= 201103L
+    lock_guard<mutex> lock(shard.mutex_);
+#endif
+    bytes += shard.bytes_;
+  }
+  return bytes;
+}
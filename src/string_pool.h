@@ -0,0 +1,66 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_STRING_POOL_H_
+#define NINJA_STRING_POOL_H_
+
+#if __cplusplus >= 201103L
+#include <mutex>
+#endif
+
+#include "arena.h"
+#include "hash_map.h"
+#include "string_piece.h"
+
+/// Keeps a single copy of each distinct string it is given, so that the
+/// scopes binding variables to the same long values, as generators often
+/// do for the flags of every edge, share that copy.
+struct StringPool {
+  StringPool() {}
+
+  /// Return the pooled copy of |str|, which stays valid for as long as the
+  /// pool does.  Safe to call from several threads at once.
+  StringPiece Intern(StringPiece str);
+
+  /// The number of distinct strings in the pool.
+  size_t size() const;
+
+  /// The total length of the distinct strings in the pool.
+  size_t bytes() const;
+
+ private:
+  /// The strings whose hash picks one shard, with a lock of their own, so
+  /// that threads parsing different files seldom wait for each other.
+  struct Shard {
+    Shard() : bytes_(0) {}
+
+    /// Maps each pooled string to itself.
+    typedef ExternalStringHashMap<StringPiece>::Type Strings;
+    Strings strings_;
+    size_t bytes_;
+    Arena arena_;
+#if __cplusplus >= 201103L
+    mutable mutex mutex_;
+#endif
+  };
+
+  static const int kShardBits = 4;
+  Shard shards_[1 << kShardBits];
+
+  // Not copyable.
+  StringPool(const StringPool&);
+  void operator=(const StringPool&);
+};
+
+#endif  // NINJA_STRING_POOL_H_
@@ -0,0 +1,97 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "string_pool.h"
+
+#include "eval_env.h"
+#include "test.h"
+
+TEST(StringPool, Intern) {
+  StringPool pool;
+  string flags = "-Wall -O2";
+  StringPiece a = pool.Intern(flags);
+  EXPECT_EQ("-Wall -O2", a.AsString());
+  EXPECT_NE(flags.data(), a.str_);
+
+  // The same contents give the same copy, wherever they come from.
+  StringPiece b = pool.Intern(string("-Wall -O2"));
+  EXPECT_EQ(a.str_, b.str_);
+
+  StringPiece empty = pool.Intern("");
+  EXPECT_EQ(0u, empty.len_);
+  EXPECT_EQ(empty.str_, pool.Intern(StringPiece()).str_);
+
+  EXPECT_EQ(2u, pool.size());
+  EXPECT_EQ(9u, pool.bytes());
+}
+
+TEST(StringPool, SharedByScopes) {
+  StringPool pool;
+  BindingEnv root;
+  root.set_string_pool(&pool);
+  root.AddBinding("cflags", "-O2");
+
+  // Scopes made under the root share its pool once frozen.
+  BindingEnv edge1(&root), edge2(&root);
+  edge1.AddBinding("defines", "-DFOO -DBAR");
+  edge2.AddBinding("defines", "-DFOO -DBAR");
+  edge2.AddBinding("cflags", "-O0");
+  EXPECT_EQ(0u, pool.size());
+  edge1.Freeze();
+  edge2.Freeze();
+  EXPECT_EQ(4u, pool.size());
+
+  EXPECT_EQ("-O2", edge1.LookupVariable("cflags"));
+  EXPECT_EQ("-O0", edge2.LookupVariable("cflags"));
+  EXPECT_EQ("-DFOO -DBAR", edge2.LookupVariable("defines"));
+  EXPECT_EQ("", root.LookupVariable("defines"));
+
+  // Rebinding replaces the value, frozen or not.
+  edge1.AddBinding("defines", "-DBAZ");
+  EXPECT_EQ("-DBAZ", edge1.LookupVariable("defines"));
+  edge1.AddBinding("cflags", "-Os");
+  EXPECT_EQ("-Os", edge1.LookupVariable("cflags"));
+  EXPECT_EQ("-DBAZ", edge1.LookupVariable("defines"));
+  EXPECT_EQ(6u, pool.size());
+
+  // A scope without a pool keeps its own copies.
+  string value = "x";
+  {
+    BindingEnv alone;
+    alone.AddBinding("v", value);
+    alone.Freeze();
+    value = "y";
+    EXPECT_EQ("x", alone.LookupVariable("v"));
+  }
+  EXPECT_EQ(6u, pool.size());
+}
+
+TEST(StringPool, Reassigned) {
+  // The values a scope that isn't frozen binds a name to in turn aren't
+  // all kept, as they are when each goes into the pool.
+  StringPool pool;
+  BindingEnv root;
+  root.set_string_pool(&pool);
+  for (int i = 0; i < 100; ++i)
+    root.AddBinding("flags", root.LookupVariable("flags") + " -Ifoo");
+  EXPECT_EQ(0u, pool.size());
+  EXPECT_EQ(600u, root.LookupVariable("flags").size());
+
+  // A snapshot of it is frozen, and pools only the last value.
+  BindingEnv snapshot;
+  snapshot.Flatten(&root);
+  EXPECT_EQ(2u, pool.size());
+  EXPECT_EQ(605u, pool.bytes());
+  EXPECT_EQ(root.LookupVariable("flags"), snapshot.LookupVariable("flags"));
+}
@@ -22,20 +22,109 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
 #include <spawn.h>
 
+#ifdef USE_EPOLL
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#endif
+
 extern char** environ;
 
 #include "util.h"
 
+// wait4() reports the resources a child used, but not everywhere.
+#if !defined(_AIX) && !defined(__OS400__) && !defined(__sun)
+#define USE_WAIT4
+#endif
+
+namespace {
+
+/// Like waitpid(), also filling |usage| once |pid| is reaped.
+pid_t WaitForChild(pid_t pid, int* status, int options,
+                   ResourceUsage* usage) {
+#ifdef USE_WAIT4
+  rusage ru;
+  pid_t ret = wait4(pid, status, options, &ru);
+  if (ret == pid) {
+    usage->user_time = ru.ru_utime.tv_sec * 1000 + ru.ru_utime.tv_usec / 1000;
+    usage->system_time =
+        ru.ru_stime.tv_sec * 1000 + ru.ru_stime.tv_usec / 1000;
+#ifdef __APPLE__
+    usage->max_rss = ru.ru_maxrss / 1024;  // In bytes.
+#else
+    usage->max_rss = ru.ru_maxrss;
+#endif
+    usage->blocks_in = ru.ru_inblock;
+    usage->blocks_out = ru.ru_oublock;
+  }
+  return ret;
+#else
+  return waitpid(pid, status, options);
+#endif
+}
+
+}  // anonymous namespace
+
+#ifdef USE_EPOLL
+namespace {
+
+/// Set in the epoll data of a pidfd, to tell it from the Subprocess's pipe.
+const uintptr_t kPidfdTag = 1;
+
+/// The epoll data of the descriptor passed to WatchHangup().
+const uintptr_t kHangupData = 0;
+
+/// The epoll data of the descriptor passed to WatchReadable().  Like
+/// kHangupData, it can't be the address of a Subprocess.
+const uintptr_t kReadableData = 2;
+
+/// Descriptors kept free for everything other than subprocesses.
+const size_t kSpareFds = 64;
+
+void EpollAdd(int epoll_fd, int fd, uintptr_t data) {
+  epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.u64 = data;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+    Fatal("epoll_ctl: %s", strerror(errno));
+}
+
+/// Close |*fd|, first taking it out of the epoll set: a copy of it that is
+/// still open somewhere would otherwise keep it there.
+void EpollClose(int epoll_fd, int* fd) {
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, *fd, NULL);
+  close(*fd);
+  *fd = -1;
+}
+
+}  // anonymous namespace
+#endif  // USE_EPOLL
+
 Subprocess::Subprocess(bool use_console) : fd_(-1), pid_(-1),
+#ifdef USE_EPOLL
+                                           pidfd_(-1), reaped_(false),
+                                           status_(0), epoll_fd_(-1),
+                                           running_index_(0),
+#endif
                                            use_console_(use_console) {
 }
 
 Subprocess::~Subprocess() {
+#ifdef USE_EPOLL
+  if (fd_ >= 0)
+    EpollClose(epoll_fd_, &fd_);
+  if (pidfd_ >= 0)
+    EpollClose(epoll_fd_, &pidfd_);
+#else
   if (fd_ >= 0)
     close(fd_);
+#endif
   // Reap child if forgotten.
   if (pid_ != -1)
     Finish();
@@ -46,12 +135,12 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
   if (pipe(output_pipe) < 0)
     Fatal("pipe: %s", strerror(errno));
   fd_ = output_pipe[0];
-#if !defined(USE_PPOLL)
-  // If available, we use ppoll in DoWork(); otherwise we use pselect
-  // and so must avoid overly-large FDs.
+#if !defined(USE_PPOLL) && !defined(USE_EPOLL)
+  // If available, we use epoll or ppoll in DoWork(); otherwise we use
+  // pselect and so must avoid overly-large FDs.
   if (fd_ >= static_cast<int>(FD_SETSIZE))
     Fatal("pipe: %s", strerror(EMFILE));
-#endif  // !USE_PPOLL
+#endif  // !USE_PPOLL && !USE_EPOLL
   SetCloseOnExec(fd_);
 
   posix_spawn_file_actions_t action;
@@ -124,6 +213,20 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
     Fatal("posix_spawn_file_actions_destroy: %s", strerror(err));
 
   close(output_pipe[1]);
+
+#ifdef USE_EPOLL
+  epoll_fd_ = set->epoll_fd_;
+  EpollAdd(epoll_fd_, fd_, reinterpret_cast<uintptr_t>(this));
+#ifdef SYS_pidfd_open
+  if ((set->running_.size() + 1) * 2 + kSpareFds < set->fd_limit_) {
+    pidfd_ = syscall(SYS_pidfd_open, pid_, 0);
+    if (pidfd_ >= 0) {
+      EpollAdd(epoll_fd_, pidfd_,
+               reinterpret_cast<uintptr_t>(this) | kPidfdTag);
+    }
+  }
+#endif
+#endif
   return true;
 }
 
@@ -135,16 +238,37 @@ void Subprocess::OnPipeReady() {
   } else {
     if (len < 0)
       Fatal("read: %s", strerror(errno));
+#ifdef USE_EPOLL
+    EpollClose(epoll_fd_, &fd_);
+#else
     close(fd_);
     fd_ = -1;
+#endif
   }
 }
 
+#ifdef USE_EPOLL
+void Subprocess::OnExit() {
+  pid_t ret = WaitForChild(pid_, &status_, WNOHANG, &usage_);
+  if (ret < 0)
+    Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  // If it somehow wasn't ready, Finish() waits for it.
+  reaped_ = ret == pid_;
+  EpollClose(epoll_fd_, &pidfd_);
+}
+#endif
+
 ExitStatus Subprocess::Finish() {
   assert(pid_ != -1);
   int status;
-  if (waitpid(pid_, &status, 0) < 0)
+#ifdef USE_EPOLL
+  if (reaped_) {
+    status = status_;
+  } else
+#endif
+  if (WaitForChild(pid_, &status, 0, &usage_) < 0) {
     Fatal("waitpid(%d): %s", pid_, strerror(errno));
+  }
   pid_ = -1;
 
   if (WIFEXITED(status)) {
@@ -160,7 +284,13 @@ ExitStatus Subprocess::Finish() {
 }
 
 bool Subprocess::Done() const {
+#ifdef USE_EPOLL
+  // With a pidfd, wait for the child to exit too, so that Finish() doesn't
+  // block on a child that closed its output early.
+  return fd_ == -1 && pidfd_ == -1;
+#else
   return fd_ == -1;
+#endif
 }
 
 const string& Subprocess::GetOutput() const {
@@ -188,7 +318,7 @@ void SubprocessSet::HandlePendingInterruption() {
     interrupted_ = SIGHUP;
 }
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet() : hangup_fd_(-1), readable_fd_(-1) {
   sigset_t set;
   sigemptyset(&set);
   sigaddset(&set, SIGINT);
@@ -206,6 +336,16 @@ SubprocessSet::SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigaction(SIGHUP, &act, &old_hup_act_) < 0)
     Fatal("sigaction: %s", strerror(errno));
+
+#ifdef USE_EPOLL
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    Fatal("epoll_create1: %s", strerror(errno));
+  rlimit rlim;
+  fd_limit_ = 0;
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == 0)
+    fd_limit_ = rlim.rlim_cur;
+#endif
 }
 
 SubprocessSet::~SubprocessSet() {
@@ -219,6 +359,9 @@ SubprocessSet::~SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigprocmask(SIG_SETMASK, &old_mask_, 0) < 0)
     Fatal("sigprocmask: %s", strerror(errno));
+#ifdef USE_EPOLL
+  close(epoll_fd_);
+#endif
 }
 
 Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
@@ -227,11 +370,75 @@ Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
     delete subprocess;
     return 0;
   }
+#ifdef USE_EPOLL
+  subprocess->running_index_ = running_.size();
+#endif
   running_.push_back(subprocess);
   return subprocess;
 }
 
-#ifdef USE_PPOLL
+void SubprocessSet::WatchHangup(int fd) {
+  hangup_fd_ = fd;
+#ifdef USE_EPOLL
+  EpollAdd(epoll_fd_, fd, kHangupData);
+#endif
+}
+
+void SubprocessSet::WatchReadable(int fd) {
+#ifdef USE_EPOLL
+  if (readable_fd_ >= 0)
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, readable_fd_, NULL);
+  if (fd >= 0)
+    EpollAdd(epoll_fd_, fd, kReadableData);
+#endif
+  readable_fd_ = fd;
+}
+
+#if defined(USE_EPOLL)
+bool SubprocessSet::DoWork() {
+  epoll_event events[64];
+  interrupted_ = 0;
+  int ret = epoll_pwait(epoll_fd_, events, sizeof(events) / sizeof(events[0]),
+                        -1, &old_mask_);
+  if (ret == -1) {
+    if (errno != EINTR) {
+      perror("ninja: epoll_pwait");
+      return false;
+    }
+    return IsInterrupted();
+  }
+
+  HandlePendingInterruption();
+  if (IsInterrupted())
+    return true;
+
+  for (int i = 0; i < ret; ++i) {
+    uintptr_t data = events[i].data.u64;
+    if (data == kHangupData) {
+      interrupted_ = SIGHUP;
+      return true;
+    }
+    if (data == kReadableData)
+      continue;
+    Subprocess* subproc = reinterpret_cast<Subprocess*>(data & ~kPidfdTag);
+    if (data & kPidfdTag)
+      subproc->OnExit();
+    else
+      subproc->OnPipeReady();
+    if (subproc->Done()) {
+      finished_.push(subproc);
+      // Move the last running subprocess into its place.
+      Subprocess* last = running_.back();
+      running_[subproc->running_index_] = last;
+      last->running_index_ = subproc->running_index_;
+      running_.pop_back();
+    }
+  }
+
+  return IsInterrupted();
+}
+
+#elif defined(USE_PPOLL)
 bool SubprocessSet::DoWork() {
   vector<pollfd> fds;
   nfds_t nfds = 0;
@@ -245,6 +452,16 @@ bool SubprocessSet::DoWork() {
     fds.push_back(pfd);
     ++nfds;
   }
+  if (readable_fd_ >= 0) {
+    pollfd pfd = { readable_fd_, POLLIN, 0 };
+    fds.push_back(pfd);
+    ++nfds;
+  }
+  if (hangup_fd_ >= 0) {
+    pollfd pfd = { hangup_fd_, POLLIN, 0 };
+    fds.push_back(pfd);
+    ++nfds;
+  }
 
   interrupted_ = 0;
   int ret = ppoll(&fds.front(), nfds, NULL, &old_mask_);
@@ -257,6 +474,8 @@ bool SubprocessSet::DoWork() {
   }
 
   HandlePendingInterruption();
+  if (hangup_fd_ >= 0 && fds.back().revents)
+    interrupted_ = SIGHUP;
   if (IsInterrupted())
     return true;
 
@@ -281,7 +500,7 @@ bool SubprocessSet::DoWork() {
   return IsInterrupted();
 }
 
-#else  // !defined(USE_PPOLL)
+#else  // !defined(USE_EPOLL) && !defined(USE_PPOLL)
 bool SubprocessSet::DoWork() {
   fd_set set;
   int nfds = 0;
@@ -296,6 +515,16 @@ bool SubprocessSet::DoWork() {
         nfds = fd+1;
     }
   }
+  if (hangup_fd_ >= 0) {
+    FD_SET(hangup_fd_, &set);
+    if (nfds < hangup_fd_ + 1)
+      nfds = hangup_fd_ + 1;
+  }
+  if (readable_fd_ >= 0) {
+    FD_SET(readable_fd_, &set);
+    if (nfds < readable_fd_ + 1)
+      nfds = readable_fd_ + 1;
+  }
 
   interrupted_ = 0;
   int ret = pselect(nfds, &set, 0, 0, 0, &old_mask_);
@@ -308,6 +537,8 @@ bool SubprocessSet::DoWork() {
   }
 
   HandlePendingInterruption();
+  if (hangup_fd_ >= 0 && FD_ISSET(hangup_fd_, &set))
+    interrupted_ = SIGHUP;
   if (IsInterrupted())
     return true;
 
@@ -327,7 +558,7 @@ bool SubprocessSet::DoWork() {
 
   return IsInterrupted();
 }
-#endif  // !defined(USE_PPOLL)
+#endif  // !defined(USE_EPOLL) && !defined(USE_PPOLL)
 
 Subprocess* SubprocessSet::NextFinished() {
   if (finished_.empty())
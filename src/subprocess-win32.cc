@@ -16,11 +16,45 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <psapi.h>
 
 #include <algorithm>
 
 #include "util.h"
 
+namespace {
+
+/// Convert a FILETIME span, in 100ns units, to milliseconds.
+uint32_t FileTimeToMillis(const FILETIME& time) {
+  return (uint32_t)((((uint64_t)time.dwHighDateTime << 32) |
+                     time.dwLowDateTime) / 10000);
+}
+
+/// Fill |usage| with the resources the process |child| used.
+void GetChildUsage(HANDLE child, ResourceUsage* usage) {
+  FILETIME creation, exit, kernel, user;
+  if (GetProcessTimes(child, &creation, &exit, &kernel, &user)) {
+    usage->user_time = FileTimeToMillis(user);
+    usage->system_time = FileTimeToMillis(kernel);
+  }
+  IO_COUNTERS io;
+  if (GetProcessIoCounters(child, &io)) {
+    usage->blocks_in = (uint32_t)(io.ReadTransferCount / 512);
+    usage->blocks_out = (uint32_t)(io.WriteTransferCount / 512);
+  }
+  // Looked up at run time, as it moved from psapi.dll to kernel32.dll.
+  typedef BOOL (WINAPI *GetProcessMemoryInfoFunc)(
+      HANDLE, PROCESS_MEMORY_COUNTERS*, DWORD);
+  static GetProcessMemoryInfoFunc get_memory_info =
+      (GetProcessMemoryInfoFunc)GetProcAddress(
+          GetModuleHandleA("kernel32.dll"), "K32GetProcessMemoryInfo");
+  PROCESS_MEMORY_COUNTERS memory;
+  if (get_memory_info && get_memory_info(child, &memory, sizeof(memory)))
+    usage->max_rss = (uint32_t)(memory.PeakWorkingSetSize / 1024);
+}
+
+}  // anonymous namespace
+
 Subprocess::Subprocess(bool use_console) : child_(NULL) , overlapped_(),
                                            is_reading_(false),
                                            use_console_(use_console) {
@@ -184,6 +218,7 @@ ExitStatus Subprocess::Finish() {
 
   DWORD exit_code = 0;
   GetExitCodeProcess(child_, &exit_code);
+  GetChildUsage(child_, &usage_);
 
   CloseHandle(child_);
   child_ = NULL;
@@ -203,7 +238,7 @@ const string& Subprocess::GetOutput() const {
 
 HANDLE SubprocessSet::ioport_;
 
-SubprocessSet::SubprocessSet() {
+SubprocessSet::SubprocessSet() : timeout_(INFINITE) {
   ioport_ = ::CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
   if (!ioport_)
     Win32Fatal("CreateIoCompletionPort");
@@ -247,7 +282,9 @@ bool SubprocessSet::DoWork() {
   OVERLAPPED* overlapped;
 
   if (!GetQueuedCompletionStatus(ioport_, &bytes_read, (PULONG_PTR)&subproc,
-                                 &overlapped, INFINITE)) {
+                                 &overlapped, timeout_)) {
+    if (!overlapped && GetLastError() == WAIT_TIMEOUT)
+      return false;
     if (GetLastError() != ERROR_BROKEN_PIPE)
       Win32Fatal("GetQueuedCompletionStatus");
   }
@@ -35,6 +35,7 @@ using namespace std;
 #endif
 
 #include "exit_status.h"
+#include "resource_usage.h"
 
 /// Subprocess wraps a single async subprocess.  It is entirely
 /// passive: it expects the caller to notify it when its fds are ready
@@ -51,12 +52,20 @@ struct Subprocess {
 
   const string& GetOutput() const;
 
+  /// The resources the process used, once Finish() reaped it.
+  const ResourceUsage& GetResourceUsage() const { return usage_; }
+
  private:
   Subprocess(bool use_console);
   bool Start(struct SubprocessSet* set, const string& command);
   void OnPipeReady();
+#ifdef USE_EPOLL
+  /// Reap the child, which |pidfd_| says has exited.
+  void OnExit();
+#endif
 
   string buf_;
+  ResourceUsage usage_;
 
 #ifdef _WIN32
   /// Set up pipe_ as the parent-side pipe of the subprocess; return the
@@ -71,13 +80,28 @@ struct Subprocess {
 #else
   int fd_;
   pid_t pid_;
+#ifdef USE_EPOLL
+  /// Becomes readable when the child exits, so that it is reaped then
+  /// rather than in Finish().  -1 if the kernel has no pidfds, if we were
+  /// short of file descriptors, or once the child has been reaped.
+  int pidfd_;
+  /// Whether the child has been reaped, and its wait status if so.
+  bool reaped_;
+  int status_;
+  /// The epoll set of the SubprocessSet that started us.
+  int epoll_fd_;
+  /// Where we are in the running_ of that SubprocessSet, so that we're
+  /// removed from it without searching.
+  size_t running_index_;
+#endif
 #endif
   bool use_console_;
 
   friend struct SubprocessSet;
 };
 
-/// SubprocessSet runs a ppoll/pselect() loop around a set of Subprocesses.
+/// SubprocessSet runs an epoll/ppoll/pselect() loop around a set of
+/// Subprocesses.
 /// DoWork() waits for any state change in subprocesses; finished_
 /// is a queue of subprocesses as they finish.
 struct SubprocessSet {
@@ -89,12 +113,29 @@ struct SubprocessSet {
   Subprocess* NextFinished();
   void Clear();
 
+#ifdef _WIN32
+  /// Have DoWork() return after |timeout| milliseconds even if no
+  /// subprocess changed state.  INFINITE, the default, waits without limit.
+  void SetTimeout(DWORD timeout) { timeout_ = timeout; }
+#else
+  /// Interrupt DoWork() as SIGHUP would once |fd| becomes readable, such as
+  /// a connection whose peer hung up.  Not owned.
+  void WatchHangup(int fd);
+
+  /// Have DoWork() also return once |fd| becomes readable, such as the
+  /// pipe of a jobserver that has a token free, until this is called again
+  /// with -1.  Not owned.
+  void WatchReadable(int fd);
+#endif
+
   vector<Subprocess*> running_;
   queue<Subprocess*> finished_;
 
 #ifdef _WIN32
   static BOOL WINAPI NotifyInterrupted(DWORD dwCtrlType);
   static HANDLE ioport_;
+  /// See SetTimeout().
+  DWORD timeout_;
 #else
   static void SetInterruptedFlag(int signum);
   static void HandlePendingInterruption();
@@ -108,6 +149,18 @@ struct SubprocessSet {
   struct sigaction old_term_act_;
   struct sigaction old_hup_act_;
   sigset_t old_mask_;
+  /// See WatchHangup(); -1 if there is none.
+  int hangup_fd_;
+  /// See WatchReadable(); -1 if there is none.
+  int readable_fd_;
+#ifdef USE_EPOLL
+  /// Has the pipe and pidfd of each running Subprocess registered, so that
+  /// DoWork() only looks at those that are ready.
+  int epoll_fd_;
+  /// The limit on open file descriptors.  Pidfds are only opened while
+  /// they are well clear of it, so that they never make a pipe() fail.
+  size_t fd_limit_;
+#endif
 #endif
 };
 
@@ -144,6 +144,37 @@ TEST_F(SubprocessTest, InterruptParentWithSigHup) {
   ASSERT_FALSE("We should have been interrupted");
 }
 
+TEST_F(SubprocessTest, InterruptByHangup) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  subprocs_.WatchHangup(fds[0]);
+  Subprocess* subproc = subprocs_.Add("sleep 5");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  close(fds[1]);
+
+  bool interrupted = subprocs_.DoWork();
+  subprocs_.Clear();
+  close(fds[0]);
+  EXPECT_TRUE(interrupted);
+}
+
+TEST_F(SubprocessTest, WatchReadable) {
+  int fds[2];
+  ASSERT_EQ(0, pipe(fds));
+  subprocs_.WatchReadable(fds[0]);
+  Subprocess* subproc = subprocs_.Add("sleep 5");
+  ASSERT_NE((Subprocess *) 0, subproc);
+  ASSERT_EQ(1, write(fds[1], "+", 1));
+
+  // DoWork() returns though nothing finished.
+  EXPECT_FALSE(subprocs_.DoWork());
+  EXPECT_FALSE(subproc->Done());
+  subprocs_.WatchReadable(-1);
+  subprocs_.Clear();
+  close(fds[0]);
+  close(fds[1]);
+}
+
 TEST_F(SubprocessTest, Console) {
   // Skip test if we don't have the console ourselves.
   if (isatty(0) && isatty(1) && isatty(2)) {
@@ -161,6 +192,30 @@ TEST_F(SubprocessTest, Console) {
 
 #endif
 
+#ifndef _WIN32
+// The child may exit while something it started still holds its output
+// open, or close its output and keep running.  Either way the Subprocess
+// is only done, and its exit status known, once both have happened.
+TEST_F(SubprocessTest, ExitAndOutputCloseApart) {
+  const char* kCommands[2] = {
+    "echo hi; (sleep 0.2) & exit 3",
+    "echo hi; exec >&- 2>&-; sleep 0.2; exit 3",
+  };
+  for (int i = 0; i < 2; ++i) {
+    Subprocess* subproc = subprocs_.Add(kCommands[i]);
+    ASSERT_NE((Subprocess *) 0, subproc);
+
+    while (!subproc->Done()) {
+      subprocs_.DoWork();
+    }
+    EXPECT_EQ(ExitFailure, subproc->Finish());
+    EXPECT_EQ("hi\n", subproc->GetOutput());
+    ASSERT_EQ(subproc, subprocs_.NextFinished());
+    delete subproc;
+  }
+}
+#endif
+
 TEST_F(SubprocessTest, SetWithSingle) {
   Subprocess* subproc = subprocs_.Add(kSimpleCommand);
   ASSERT_NE((Subprocess *) 0, subproc);
@@ -214,7 +269,7 @@ TEST_F(SubprocessTest, SetWithMulti) {
   }
 }
 
-#if defined(USE_PPOLL)
+#if defined(USE_PPOLL) || defined(USE_EPOLL)
 TEST_F(SubprocessTest, SetWithLots) {
   // Arbitrary big number; needs to be over 1024 to confirm we're no longer
   // hostage to pselect.
@@ -165,11 +165,34 @@ TimeStamp VirtualFileSystem::Stat(const string& path, string* err) const {
   return 0;
 }
 
+void VirtualFileSystem::StatMany(const vector<string>& paths,
+                                 vector<TimeStamp>* mtimes) const {
+  files_batch_statted_.insert(files_batch_statted_.end(),
+                              paths.begin(), paths.end());
+  DiskInterface::StatMany(paths, mtimes);
+}
+
 bool VirtualFileSystem::WriteFile(const string& path, const string& contents) {
   Create(path, contents);
   return true;
 }
 
+bool VirtualFileSystem::WriteFileIfChanged(const string& path,
+                                           StringPiece contents) {
+  FileMap::iterator i = files_.find(path);
+  if (i != files_.end() && StringPiece(i->second.contents) == contents)
+    return true;
+  return WriteFile(path, contents.AsString());
+}
+
+bool VirtualFileSystem::Touch(const string& path) {
+  FileMap::iterator i = files_.find(path);
+  if (i == files_.end())
+    return false;
+  i->second.mtime = now_;
+  return true;
+}
+
 bool VirtualFileSystem::MakeDir(const string& path) {
   directories_made_.push_back(path);
   return true;  // success
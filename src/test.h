@@ -145,7 +145,11 @@ struct VirtualFileSystem : public DiskInterface {
 
   // DiskInterface
   virtual TimeStamp Stat(const string& path, string* err) const;
+  virtual void StatMany(const vector<string>& paths,
+                        vector<TimeStamp>* mtimes) const;
   virtual bool WriteFile(const string& path, const string& contents);
+  virtual bool WriteFileIfChanged(const string& path, StringPiece contents);
+  virtual bool Touch(const string& path);
   virtual bool MakeDir(const string& path);
   virtual Status ReadFile(const string& path, string* contents, string* err);
   virtual int RemoveFile(const string& path);
@@ -159,6 +163,7 @@ struct VirtualFileSystem : public DiskInterface {
 
   vector<string> directories_made_;
   vector<string> files_read_;
+  mutable vector<string> files_batch_statted_;
   typedef map<string, Entry> FileMap;
   FileMap files_;
   set<string> files_removed_;
@@ -0,0 +1,128 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "metrics.h"
+
+Trace* g_trace = NULL;
+
+namespace {
+
+/// Append |str| to |out| as a JSON string.
+void AppendJSONString(const string& str, string* out) {
+  out->push_back('"');
+  for (size_t i = 0; i < str.size(); ++i) {
+    unsigned char c = str[i];
+    if (c == '"' || c == '\\') {
+      out->push_back('\\');
+      out->push_back(c);
+    } else if (c < 0x20) {
+      char escape[8];
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+      out->append(escape);
+    } else {
+      out->push_back(c);
+    }
+  }
+  out->push_back('"');
+}
+
+}  // anonymous namespace
+
+Trace* Trace::Open(const string& path, string* err) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file) {
+    *err = strerror(errno);
+    return NULL;
+  }
+  Trace* trace = new Trace(file);
+  fprintf(file, "[\n");
+  trace->NameLane(0);
+  return trace;
+}
+
+Trace::Trace(FILE* file)
+    : file_(file), start_(GetTimeMicros()), written_(false) {}
+
+Trace::~Trace() {
+  fprintf(file_, "\n]\n");
+  fclose(file_);
+}
+
+void Trace::AddPhase(const char* name, int64_t start) {
+  WriteEvent(name, "ninja", 0, start, GetTimeMicros());
+}
+
+void Trace::JobStarted(const void* job) {
+  Job started = { GetTimeMicros(), 0 };
+  while (started.lane < busy_lanes_.size() && busy_lanes_[started.lane])
+    ++started.lane;
+  if (started.lane == busy_lanes_.size()) {
+    busy_lanes_.push_back(false);
+    NameLane(started.lane + 1);
+  }
+  busy_lanes_[started.lane] = true;
+  jobs_[job] = started;
+}
+
+void Trace::JobFinished(const void* job, const string& name,
+                        const string& category) {
+  map<const void*, Job>::iterator i = jobs_.find(job);
+  if (i == jobs_.end())
+    return;
+  WriteEvent(name, category, i->second.lane + 1, i->second.start,
+             GetTimeMicros());
+  busy_lanes_[i->second.lane] = false;
+  jobs_.erase(i);
+}
+
+void Trace::WriteEvent(const string& name, const string& category,
+                       size_t lane, int64_t start, int64_t end) {
+  string event = "{\"name\":";
+  AppendJSONString(name, &event);
+  event += ",\"cat\":";
+  AppendJSONString(category, &event);
+  fprintf(file_, "%s%s,\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":0,"
+          "\"tid\":%u}", written_ ? ",\n" : "", event.c_str(),
+          (long long)(start - start_), (long long)(end - start),
+          (unsigned)lane);
+  written_ = true;
+}
+
+void Trace::NameLane(size_t lane) {
+  char name[32];
+  if (lane == 0)
+    snprintf(name, sizeof(name), "ninja");
+  else
+    snprintf(name, sizeof(name), "job slot %u", (unsigned)lane);
+  fprintf(file_, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,"
+          "\"tid\":%u,\"args\":{\"name\":\"%s\"}},\n"
+          "{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":0,"
+          "\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+          written_ ? ",\n" : "", (unsigned)lane, name, (unsigned)lane,
+          (unsigned)lane);
+  written_ = true;
+}
+
+ScopedTrace::ScopedTrace(const char* name)
+    : name_(name), start_(g_trace ? GetTimeMicros() : -1) {}
+
+ScopedTrace::~ScopedTrace() {
+  if (g_trace && start_ >= 0)
+    g_trace->AddPhase(name_, start_);
+}
@@ -0,0 +1,100 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_TRACE_H_
+#define NINJA_TRACE_H_
+
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "util.h"  // For int64_t.
+
+/// Writes a timeline of what ninja did to a file, in the Chrome trace event
+/// format that chrome://tracing and https://ui.perfetto.dev show.  Phases
+/// of ninja itself, such as loading the logs, are on the "ninja" lane,
+/// nested as they ran; each command is on the lane of the job slot it ran
+/// in.  To trace a phase, see TRACE_RECORD below.  Only the main thread
+/// may record events.
+struct Trace {
+  /// Start a trace at |path|.  Returns NULL on error.
+  static Trace* Open(const string& path, string* err);
+
+  /// Finish the trace and close its file.
+  ~Trace();
+
+  /// Record the phase |name|, which started at |start|, as returned by
+  /// GetTimeMicros(), and ended now.
+  void AddPhase(const char* name, int64_t start);
+
+  /// Record that |job| started, on the first job slot lane that is free.
+  void JobStarted(const void* job);
+
+  /// Record that |job| finished, naming it |name| in |category|.
+  void JobFinished(const void* job, const string& name,
+                   const string& category);
+
+ private:
+  Trace(FILE* file);
+
+  /// Write an event on |lane|, where 0 is ninja's and job slots follow.
+  void WriteEvent(const string& name, const string& category, size_t lane,
+                  int64_t start, int64_t end);
+
+  /// Write the name of |lane|.
+  void NameLane(size_t lane);
+
+  FILE* file_;
+  /// When the trace started, which events are timed from.
+  int64_t start_;
+  /// Whether an event was written, so that the next one needs a comma.
+  bool written_;
+
+  /// A job that is running.
+  struct Job {
+    int64_t start;
+    size_t lane;
+  };
+  map<const void*, Job> jobs_;
+  /// Whether the lane of each job slot has a job on it.
+  vector<bool> busy_lanes_;
+
+  // Not copyable.
+  Trace(const Trace&);
+  void operator=(const Trace&);
+};
+
+/// A scoped object for recording a phase across the body of a function.
+/// Used by the TRACE_RECORD macro.
+struct ScopedTrace {
+  explicit ScopedTrace(const char* name);
+  ~ScopedTrace();
+
+ private:
+  const char* name_;
+  /// When the phase started, or -1 if there is no trace.
+  int64_t start_;
+};
+
+/// Use TRACE_RECORD("foobar") at the top of a function to have each call
+/// of it recorded as a phase in the trace, if there is one.
+#define TRACE_RECORD(name) ScopedTrace trace_h_scoped(name);
+
+/// The trace events are recorded to, or NULL.
+extern Trace* g_trace;
+
+#endif  // NINJA_TRACE_H_
@@ -0,0 +1,119 @@
+// Copyright 2020 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "util.h"
+#include "test.h"
+
+namespace {
+
+const char kTestFilename[] = "TraceTest-tempfile";
+
+struct TraceTest : public testing::Test {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  /// Finish |trace| and return what it wrote.
+  string Finish(Trace* trace) {
+    delete trace;
+    string contents, err;
+    EXPECT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+    return contents;
+  }
+};
+
+/// The number of times |needle| is in |haystack|.
+int Count(const string& haystack, const string& needle) {
+  int count = 0;
+  for (size_t i = haystack.find(needle); i != string::npos;
+       i = haystack.find(needle, i + 1))
+    ++count;
+  return count;
+}
+
+TEST_F(TraceTest, Phases) {
+  string err;
+  g_trace = Trace::Open(kTestFilename, &err);
+  ASSERT_TRUE(g_trace);
+  {
+    TRACE_RECORD("outer");
+    {
+      TRACE_RECORD("inner \"quoted\"");
+    }
+  }
+  Trace* trace = g_trace;
+  g_trace = NULL;
+  {
+    // Nothing is recorded without a trace.
+    TRACE_RECORD("untraced");
+  }
+  string contents = Finish(trace);
+
+  EXPECT_EQ(0u, contents.find("[\n"));
+  EXPECT_EQ(contents.size() - 3, contents.rfind("\n]\n"));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+      "\"args\":{\"name\":\"ninja\"}}"));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"outer\",\"cat\":\"ninja\",\"ph\":\"X\""));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"inner \\\"quoted\\\"\",\"cat\":\"ninja\",\"ph\":\"X\""));
+  EXPECT_EQ(string::npos, contents.find("untraced"));
+}
+
+TEST_F(TraceTest, JobLanes) {
+  string err;
+  Trace* trace = Trace::Open(kTestFilename, &err);
+  ASSERT_TRUE(trace);
+  int a, b, c;
+  trace->JobStarted(&a);
+  trace->JobStarted(&b);
+  trace->JobFinished(&a, "a", "cc");
+  // The first lane is free again.
+  trace->JobStarted(&c);
+  trace->JobFinished(&b, "b", "cc");
+  trace->JobFinished(&c, "c", "link");
+  string contents = Finish(trace);
+
+  // Two jobs ran at once, so there are two lanes.
+  EXPECT_EQ(1, Count(contents, "\"job slot 1\""));
+  EXPECT_EQ(1, Count(contents, "\"job slot 2\""));
+  EXPECT_EQ(0, Count(contents, "\"job slot 3\""));
+  EXPECT_NE(string::npos, contents.find(
+      "{\"name\":\"a\",\"cat\":\"cc\",\"ph\":\"X\""));
+  EXPECT_EQ(string::npos, contents.find("\"tid\":3"));
+
+  // c took the lane a left.
+  size_t a_event = contents.find("{\"name\":\"a\"");
+  size_t b_event = contents.find("{\"name\":\"b\"");
+  size_t c_event = contents.find("{\"name\":\"c\",\"cat\":\"link\"");
+  EXPECT_EQ(contents.find("\"tid\":1}", a_event),
+            contents.find("\"tid\":", a_event));
+  EXPECT_EQ(contents.find("\"tid\":2}", b_event),
+            contents.find("\"tid\":", b_event));
+  EXPECT_EQ(contents.find("\"tid\":1}", c_event),
+            contents.find("\"tid\":", c_event));
+}
+
+}  // anonymous namespace
@@ -38,6 +38,7 @@
 #include <sys/time.h>
 #endif
 
+#include <algorithm>
 #include <vector>
 
 #if defined(__APPLE__) || defined(__FreeBSD__)
@@ -51,6 +52,7 @@
 #include <sys/sysinfo.h>
 #endif
 
+#include "cgroup.h"
 #include "edit_distance.h"
 #include "metrics.h"
 
@@ -487,12 +489,22 @@ int GetProcessorCount() {
   // The number of exposed processors might not represent the actual number of
   // processors threads can run on. This happens when a CPU set limitation is
   // active, see https://github.com/ninja-build/ninja/issues/1278
+  int count = sysconf(_SC_NPROCESSORS_ONLN);
   cpu_set_t set;
   if (sched_getaffinity(getpid(), sizeof(set), &set) == 0) {
-    return CPU_COUNT(&set);
+    count = CPU_COUNT(&set);
   }
+#else
+  int count = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+#ifdef __linux__
+  // In a container, the CPU quota of its cgroup may let it use fewer CPUs
+  // than it can see.
+  int cgroup_cpus = CgroupLimits::Read().cpus();
+  if (cgroup_cpus > 0 && cgroup_cpus < count)
+    count = cgroup_cpus;
 #endif
-  return sysconf(_SC_NPROCESSORS_ONLN);
+  return count;
 #endif
 }
 
@@ -595,6 +607,52 @@ double GetLoadAverage() {
 }
 #endif // _WIN32
 
+#if defined(_WIN32) || defined(__CYGWIN__)
+int64_t GetAvailableMemory(const CgroupMemory* cgroup) {
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status))
+    return -1;
+  return status.ullAvailPhys / 1024;
+}
+#elif defined(__linux__)
+int64_t GetAvailableMemory(const CgroupMemory* cgroup) {
+  if (!cgroup) {
+    CgroupMemory found;
+    return GetAvailableMemory(&found);
+  }
+
+  FILE* meminfo = fopen("/proc/meminfo", "r");
+  if (!meminfo)
+    return -1;
+  // MemAvailable, unlike MemFree, counts the page cache that can be
+  // dropped.  Kernels before 3.14 don't have it.
+  int64_t available = -1;
+  char line[256];
+  while (fgets(line, sizeof(line), meminfo)) {
+    long long kb;
+    if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) {
+      available = kb;
+      break;
+    }
+  }
+  fclose(meminfo);
+
+  // MemAvailable is that of the whole system, but the memory limit of the
+  // cgroup of a container is usually lower.
+  if (cgroup->limit() >= 0) {
+    int64_t left = max(cgroup->limit() - cgroup->ReadUsage(), (int64_t)0);
+    if (available < 0 || left < available)
+      available = left;
+  }
+  return available;
+}
+#else
+int64_t GetAvailableMemory(const CgroupMemory* cgroup) {
+  return -1;
+}
+#endif
+
 string ElideMiddle(const string& str, size_t width) {
   switch (width) {
       case 0: return "";
@@ -97,6 +97,13 @@ int GetProcessorCount();
 /// on error.
 double GetLoadAverage();
 
+struct CgroupMemory;
+
+/// @return the memory, in kilobytes, that can be used without swapping, or
+/// a negative value if it is not known.  Passing the @a cgroup memory of
+/// the process, found once, saves finding it again on each call.
+int64_t GetAvailableMemory(const CgroupMemory* cgroup = NULL);
+
 /// Elide the given string @a str with '...' in the middle if the length
 /// exceeds @a width.
 string ElideMiddle(const string& str, size_t width);